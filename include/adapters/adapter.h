@@ -25,6 +25,47 @@ namespace RedisCluster
         {
             return REDIS_ERR;
         }
+    
+        typedef void (TimerCallback)( void *data );
+        
+        // Starts a one-shot timer calling the callback from the event loop after the timeout.
+        // Returns the timer for stopTimer, or NULL if the adapter has no timers.
+        virtual void* startTimer( long /* milliseconds */, TimerCallback *, void * /* data */ )
+        {
+            return NULL;
+        }
+        
+        // Stops a timer which has not fired yet.
+        virtual void stopTimer( void * /* timer */ )
+        {
+        }
+        
+        typedef void (ReadCallback)( void *data );
+        
+        // Calls the callback from the event loop whenever the descriptor is readable, i.e. to
+        // wake the loop from other threads. Returns the watch for unwatchFd, or NULL if
+        // the adapter can't watch descriptors.
+        virtual void* watchFd( int /* fd */, ReadCallback *, void * /* data */ )
+        {
+            return NULL;
+        }
+        
+        // Stops watching, the descriptor is not closed.
+        virtual void unwatchFd( void * /* watch */ )
+        {
+        }
+        
+        // Runs the event loop in the calling thread until stop. Returns false if the adapter
+        // doesn't run its loop, then the loop is run by the owner of the event library.
+        virtual bool run()
+        {
+            return false;
+        }
+        
+        // Makes run return, called on the loop thread.
+        virtual void stop()
+        {
+        }
     };  // class Adapter
 }  // namespace RedisCluster
 
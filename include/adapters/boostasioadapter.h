@@ -39,7 +39,123 @@ namespace RedisCluster
             return REDIS_OK;
         }
 
+        virtual void* startTimer( long milliseconds, TimerCallback *callback, void *data )
+        {
+            Timer *timer = new Timer( io_service_, callback, data );
+            timer->timer.expires_from_now( boost::posix_time::milliseconds( milliseconds ) );
+            timer->timer.async_wait( [timer]( const boost::system::error_code & ) {
+                if( !timer->stopped )
+                    timer->callback( timer->data );
+                delete timer;
+            } );
+            return timer;
+        }
+
+        // the handler of a stopped timer is still called, it frees the timer
+        virtual void stopTimer( void *timer )
+        {
+            Timer *t = static_cast<Timer*>( timer );
+            t->stopped = true;
+            t->timer.cancel();
+        }
+
+        // the descriptor is watched by a stream descriptor which gives it back when the watch
+        // is freed, so it is not closed by asio
+        virtual void* watchFd( int fd, ReadCallback *callback, void *data )
+        {
+            Watch *watch = new Watch( io_service_, callback, data );
+            boost::system::error_code ec;
+            watch->descriptor.assign( fd, ec );
+            if( ec )
+            {
+                delete watch;
+                return NULL;
+            }
+            wait( watch );
+            return watch;
+        }
+
+        // the handler of a stopped watch is still called if it is waiting, it frees the watch
+        virtual void unwatchFd( void *watch )
+        {
+            Watch *w = static_cast<Watch*>( watch );
+            if( !w->waiting )
+            {
+                delete w;
+                return;
+            }
+            w->stopped = true;
+            boost::system::error_code ec;
+            w->descriptor.cancel( ec );
+        }
+
+        virtual bool run()
+        {
+            io_service_.reset();
+            io_service_.run();
+            return true;
+        }
+
+        virtual void stop()
+        {
+            io_service_.stop();
+        }
+
     private:
+        struct Timer
+        {
+            Timer( boost::asio::io_service &ios, TimerCallback *cb, void *d ) :
+            timer( ios ), callback( cb ), data( d ), stopped( false ) {}
+
+            boost::asio::deadline_timer timer;
+            TimerCallback *callback;
+            void *data;
+            bool stopped;
+        };
+
+        struct Watch
+        {
+            Watch( boost::asio::io_service &ios, ReadCallback *cb, void *d ) :
+            descriptor( ios ), callback( cb ), data( d ), waiting( false ), stopped( false ) {}
+
+            ~Watch()
+            {
+                if( descriptor.is_open() )
+                    descriptor.release();
+            }
+
+            boost::asio::posix::stream_descriptor descriptor;
+            ReadCallback *callback;
+            void *data;
+            // handler is pending or running
+            bool waiting;
+            bool stopped;
+        };
+
+        static void wait( Watch *watch )
+        {
+            watch->waiting = true;
+            watch->descriptor.async_read_some( boost::asio::null_buffers(),
+                [watch]( const boost::system::error_code &ec, size_t ) {
+                    if( watch->stopped )
+                    {
+                        delete watch;
+                        return;
+                    }
+                    if( ec )
+                    {
+                        watch->waiting = false;
+                        return;
+                    }
+                    watch->callback( watch->data );
+                    // the callback may unwatch
+                    if( watch->stopped )
+                        delete watch;
+                    else
+                        wait( watch );
+                } );
+        }
+
         boost::asio::io_service & io_service_;
 
         typedef boost::shared_ptr<redisBoostClient> ClientSptr;
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __libredisCluster_adapters_epolladapter_h__
+#define __libredisCluster_adapters_epolladapter_h__
+
+#include <chrono>  // for steady_clock
+#include <new>  // for nothrow
+#include <vector>  // for vector
+#include <stdint.h>
+#include <sys/epoll.h>  // for epoll_wait()
+#include <sys/ioctl.h>  // for FIONREAD
+#include <unistd.h>  // for close()
+
+#include "adapter.h"  // for Adapter
+#include "../clusterexception.h"  // for ConnectionFailedException
+
+extern "C"
+{
+#include <hiredis/async.h>  // for redisAsyncHandleRead()
+}
+
+namespace RedisCluster
+{
+    // Adapter running its own event loop on epoll (Linux only), for threads doing redis I/O
+    // only. Every socket is registered once in edge-triggered mode, so hiredis asking for read
+    // and write events costs no system call. Writes asked for during a loop iteration are done
+    // at its end, so commands sent by callbacks and tasks go out in one write per connection.
+    // Timeouts and backoff delays are kept in a hashed timer wheel with millisecond ticks.
+    //
+    //   EpollAdapter adapter;
+    //   Cluster<redisAsyncContext>::ptr_t cluster_p = AsyncHiredisCommand<>::createCluster( "127.0.0.1", 7000, adapter );
+    //   AsyncHiredisCommand<>::Command( cluster_p, "FOO", callback, "GET %s", "FOO" );
+    //   adapter.run();
+    //   delete cluster_p;
+    class EpollAdapter : public Adapter
+    {
+        EpollAdapter(const EpollAdapter&) = delete;
+        EpollAdapter& operator=(const EpollAdapter&) = delete;
+
+    public:
+        EpollAdapter() :
+        epfd_( epoll_create1( EPOLL_CLOEXEC ) ),
+        live_( 0 ),
+        stopped_( false ),
+        ready_( NULL ),
+        garbage_( NULL ),
+        timers_( 0 ),
+        tick_( 0 ),
+        wheel_( WheelSize, static_cast<Timer*>( NULL ) ),
+        due_( NULL ),
+        start_( Clock::now() )
+        {
+            if( epfd_ < 0 )
+                throw ConnectionFailedException( nullptr );
+        }
+
+        // contexts must be freed and watches stopped before, timers not fired are dropped
+        virtual ~EpollAdapter()
+        {
+            for( size_t i = 0; i < wheel_.size(); ++i )
+                freeTimers( wheel_[i] );
+            freeTimers( due_ );
+            collect();
+            while( ready_ != NULL )
+            {
+                Handle *h = ready_;
+                ready_ = h->nextReady;
+                if( h->closed )
+                    delete h;
+            }
+            ::close( epfd_ );
+        }
+
+    public:
+        virtual int attachContext( redisAsyncContext &ac ) override
+        {
+            if( ac.ev.data != NULL )
+                return REDIS_ERR;
+            Handle *h = open( ac.c.fd, EPOLLIN | EPOLLOUT | EPOLLET );
+            if( h == NULL )
+                return REDIS_ERR;
+            h->ac = &ac;
+
+            ac.ev.addRead = addRead;
+            ac.ev.delRead = delRead;
+            ac.ev.addWrite = addWrite;
+            ac.ev.delWrite = delWrite;
+            ac.ev.cleanup = cleanup;
+#if HIREDIS_MAJOR >= 1
+            ac.ev.scheduleTimer = scheduleTimer;
+#endif
+            ac.ev.data = h;
+            return REDIS_OK;
+        }
+
+        virtual void* startTimer( long milliseconds, TimerCallback *callback, void *data ) override
+        {
+            Timer *timer = new (std::nothrow) Timer;
+            if( timer == NULL )
+                return NULL;
+            timer->callback = callback;
+            timer->data = data;
+            // ticks up to the current one are expired already
+            uint64_t expires = now() + static_cast<uint64_t>( milliseconds > 0 ? milliseconds : 0 );
+            timer->expires = expires > tick_ ? expires : tick_ + 1;
+            link( wheel_[ timer->expires % WheelSize ], timer );
+            ++timers_;
+            return timer;
+        }
+
+        virtual void stopTimer( void *timer ) override
+        {
+            Timer *t = static_cast<Timer*>( timer );
+            unlink( t );
+            --timers_;
+            delete t;
+        }
+
+        // Watches are edge-triggered like sockets, so the callback must read
+        // the descriptor until it would block
+        virtual void* watchFd( int fd, ReadCallback *callback, void *data ) override
+        {
+            Handle *h = open( fd, EPOLLIN | EPOLLET );
+            if( h == NULL )
+                return NULL;
+            h->callback = callback;
+            h->data = data;
+            return h;
+        }
+
+        virtual void unwatchFd( void *watch ) override
+        {
+            close( static_cast<Handle*>( watch ) );
+        }
+
+        // Runs the loop until stop, or until there are no contexts, watches and timers left,
+        // like event_base_dispatch
+        virtual bool run() override
+        {
+            stopped_ = false;
+            while( !stopped_ && ( live_ > 0 || timers_ > 0 || ready_ != NULL ) )
+                runOnce( -1 );
+            return true;
+        }
+
+        virtual void stop() override
+        {
+            stopped_ = true;
+        }
+
+        // One iteration of the loop: waits for events up to the timeout (negative waits for
+        // the next timer, or forever) and handles them, then does the writes asked for
+        // and fires the timers due. For threads running their own loops
+        void runOnce( int milliseconds )
+        {
+            int timeout = ready_ != NULL ? 0 : nextTimeout( milliseconds );
+            int count = epoll_wait( epfd_, events_, MaxEvents, timeout );
+            for( int i = 0; i < count; ++i )
+            {
+                Handle *h = static_cast<Handle*>( events_[i].data.ptr );
+                if( !h->closed )
+                    dispatch( h, events_[i].events );
+            }
+            flush();
+            expire();
+            collect();
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        static const size_t WheelSize = 1024;
+        static const int MaxEvents = 256;
+
+        // registered socket of a context or watched descriptor
+        struct Handle
+        {
+            Handle( EpollAdapter *a, int f ) :
+            owner( a ), fd( f ), ac( NULL ), callback( NULL ), data( NULL ), timer( NULL ),
+            reading( false ), writing( false ), queued( false ), closed( false ),
+            nextReady( NULL ), nextGarbage( NULL ) {}
+
+            EpollAdapter *owner;
+            int fd;
+            redisAsyncContext *ac;
+            // set for watches
+            ReadCallback *callback;
+            void *data;
+            // timeout of the context
+            void *timer;
+            bool reading;
+            bool writing;
+            // in the ready list, freed by flush when closed meanwhile
+            bool queued;
+            bool closed;
+            Handle *nextReady;
+            Handle *nextGarbage;
+        };
+
+        struct Timer
+        {
+            Timer *prev;
+            Timer *next;
+            // head of the list the timer is in
+            Timer **list;
+            uint64_t expires;
+            TimerCallback *callback;
+            void *data;
+        };
+
+        Handle* open( int fd, uint32_t events )
+        {
+            Handle *h = new (std::nothrow) Handle( this, fd );
+            if( h == NULL )
+                return NULL;
+            struct epoll_event ev;
+            ev.events = events;
+            ev.data.ptr = h;
+            if( epoll_ctl( epfd_, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+            {
+                delete h;
+                return NULL;
+            }
+            ++live_;
+            return h;
+        }
+
+        // handle may still be in the events of this iteration, so it is freed at its end
+        void close( Handle *h )
+        {
+            if( h->timer != NULL )
+                stopTimer( h->timer );
+            h->timer = NULL;
+            struct epoll_event ev;
+            epoll_ctl( epfd_, EPOLL_CTL_DEL, h->fd, &ev );
+            h->closed = true;
+            h->ac = NULL;
+            --live_;
+            if( !h->queued )
+            {
+                h->nextGarbage = garbage_;
+                garbage_ = h;
+            }
+        }
+
+        // edge comes once, so the socket is read while it has data
+        static bool pending( int fd )
+        {
+            int bytes = 0;
+            return ioctl( fd, FIONREAD, &bytes ) == 0 && bytes > 0;
+        }
+
+        static void read( Handle *h )
+        {
+            do
+            {
+                redisAsyncHandleRead( h->ac );
+            }
+            while( !h->closed && h->reading && pending( h->fd ) );
+        }
+
+        static void dispatch( Handle *h, uint32_t events )
+        {
+            if( h->callback != NULL )
+            {
+                if( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) )
+                    h->callback( h->data );
+                return;
+            }
+            if( ( events & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) && h->writing )
+                redisAsyncHandleWrite( h->ac );
+            if( !h->closed && ( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) && h->reading )
+                read( h );
+        }
+
+        void queue( Handle *h )
+        {
+            if( h->queued )
+                return;
+            h->queued = true;
+            h->nextReady = ready_;
+            ready_ = h;
+        }
+
+        // a writable socket gives no edge when hiredis asks for writes, so the writes
+        // are done here. Contexts are queued again by callbacks sending commands
+        void flush()
+        {
+            Handle *h = ready_;
+            ready_ = NULL;
+            while( h != NULL )
+            {
+                Handle *next = h->nextReady;
+                h->queued = false;
+                if( h->closed )
+                {
+                    delete h;
+                }
+                else
+                {
+                    if( h->writing )
+                        redisAsyncHandleWrite( h->ac );
+                    if( !h->closed && h->reading && pending( h->fd ) )
+                        read( h );
+                }
+                h = next;
+            }
+        }
+
+        void collect()
+        {
+            while( garbage_ != NULL )
+            {
+                Handle *h = garbage_;
+                garbage_ = h->nextGarbage;
+                delete h;
+            }
+        }
+
+        inline uint64_t now() const
+        {
+            return static_cast<uint64_t>( std::chrono::duration_cast<std::chrono::milliseconds>(
+                Clock::now() - start_ ).count() );
+        }
+
+        static void link( Timer *&head, Timer *t )
+        {
+            t->list = &head;
+            t->prev = NULL;
+            t->next = head;
+            if( head != NULL )
+                head->prev = t;
+            head = t;
+        }
+
+        static void unlink( Timer *t )
+        {
+            if( t->prev != NULL )
+                t->prev->next = t->next;
+            else
+                *t->list = t->next;
+            if( t->next != NULL )
+                t->next->prev = t->prev;
+        }
+
+        static void freeTimers( Timer *t )
+        {
+            while( t != NULL )
+            {
+                Timer *next = t->next;
+                delete t;
+                t = next;
+            }
+        }
+
+        // wait until the tick of the nearest slot with timers, they may be due
+        // only in a later turn of the wheel, then the loop just waits again
+        int nextTimeout( int milliseconds ) const
+        {
+            if( timers_ == 0 )
+                return milliseconds;
+            uint64_t current = now();
+            for( uint64_t t = tick_ + 1; t <= tick_ + WheelSize; ++t )
+            {
+                if( wheel_[ t % WheelSize ] != NULL )
+                {
+                    int wait = t > current ? static_cast<int>( t - current ) : 0;
+                    return milliseconds >= 0 && milliseconds < wait ? milliseconds : wait;
+                }
+            }
+            return milliseconds;
+        }
+
+        // Timers due are moved out of the wheel first, so callbacks may start and stop any
+        // timers. After a long iteration every slot is checked once
+        void expire()
+        {
+            uint64_t current = now();
+            if( current <= tick_ )
+                return;
+            uint64_t from = current - tick_ > WheelSize ? current - WheelSize : tick_;
+            tick_ = current;
+            for( uint64_t t = from + 1; t <= current; ++t )
+            {
+                Timer *timer = wheel_[ t % WheelSize ];
+                while( timer != NULL )
+                {
+                    Timer *next = timer->next;
+                    if( timer->expires <= current )
+                    {
+                        unlink( timer );
+                        link( due_, timer );
+                    }
+                    timer = next;
+                }
+            }
+            while( due_ != NULL )
+            {
+                Timer *timer = due_;
+                unlink( timer );
+                --timers_;
+                TimerCallback *callback = timer->callback;
+                void *data = timer->data;
+                delete timer;
+                callback( data );
+            }
+        }
+
+        static void addRead( void *privdata )
+        {
+            Handle *h = static_cast<Handle*>( privdata );
+            if( !h->reading )
+            {
+                h->reading = true;
+                // data which came before gave its edge already
+                h->owner->queue( h );
+            }
+        }
+
+        static void delRead( void *privdata )
+        {
+            static_cast<Handle*>( privdata )->reading = false;
+        }
+
+        static void addWrite( void *privdata )
+        {
+            Handle *h = static_cast<Handle*>( privdata );
+            if( !h->writing )
+            {
+                h->writing = true;
+                h->owner->queue( h );
+            }
+        }
+
+        static void delWrite( void *privdata )
+        {
+            static_cast<Handle*>( privdata )->writing = false;
+        }
+
+        static void cleanup( void *privdata )
+        {
+            Handle *h = static_cast<Handle*>( privdata );
+            h->owner->close( h );
+        }
+
+#if HIREDIS_MAJOR >= 1
+        static void scheduleTimer( void *privdata, struct timeval tv )
+        {
+            Handle *h = static_cast<Handle*>( privdata );
+            if( h->timer != NULL )
+                h->owner->stopTimer( h->timer );
+            h->timer = h->owner->startTimer( tv.tv_sec * 1000 + tv.tv_usec / 1000, timedOut, h );
+        }
+
+        static void timedOut( void *data )
+        {
+            Handle *h = static_cast<Handle*>( data );
+            h->timer = NULL;
+            redisAsyncHandleTimeout( h->ac );
+        }
+#endif
+
+        int epfd_;
+        // open contexts and watches
+        size_t live_;
+        bool stopped_;
+        // contexts with writes or reads to do at the end of the iteration
+        Handle *ready_;
+        // closed handles freed at the end of the iteration
+        Handle *garbage_;
+        struct epoll_event events_[MaxEvents];
+
+        size_t timers_;
+        // last tick timers are expired for
+        uint64_t tick_;
+        std::vector<Timer*> wheel_;
+        Timer *due_;
+        Clock::time_point start_;
+    };  // class EpollAdapter
+}  // namespace RedisCluster
+
+#endif  // __libredisCluster_adapters_epolladapter_h__
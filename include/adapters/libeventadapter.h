@@ -26,8 +26,82 @@ namespace RedisCluster
         {
             return redisLibeventAttach( &ac, &base_ );
         }
+        
+        virtual void* startTimer( long milliseconds, TimerCallback *callback, void *data ) override
+        {
+            Timer *timer = new Timer( callback, data );
+            timer->ev = evtimer_new( &base_, fire, timer );
+            struct timeval tv = { milliseconds / 1000, ( milliseconds % 1000 ) * 1000 };
+            if( timer->ev == NULL || evtimer_add( timer->ev, &tv ) != 0 )
+            {
+                stopTimer( timer );
+                return NULL;
+            }
+            return timer;
+        }
+        
+        virtual void stopTimer( void *timer ) override
+        {
+            Timer *t = static_cast<Timer*>( timer );
+            if( t->ev != NULL )
+                event_free( t->ev );
+            delete t;
+        }
+        
+        // watches use the same record as timers, but their events persist
+        virtual void* watchFd( int fd, ReadCallback *callback, void *data ) override
+        {
+            Timer *watch = new Timer( callback, data );
+            watch->ev = event_new( &base_, fd, EV_READ | EV_PERSIST, readable, watch );
+            if( watch->ev == NULL || event_add( watch->ev, NULL ) != 0 )
+            {
+                unwatchFd( watch );
+                return NULL;
+            }
+            return watch;
+        }
+        
+        virtual void unwatchFd( void *watch ) override
+        {
+            stopTimer( watch );
+        }
+        
+        virtual bool run() override
+        {
+            return event_base_dispatch( &base_ ) != -1;
+        }
+        
+        virtual void stop() override
+        {
+            event_base_loopbreak( &base_ );
+        }
     
     private:
+        struct Timer
+        {
+            Timer( TimerCallback *cb, void *d ) : ev( NULL ), callback( cb ), data( d ) {}
+            
+            struct event *ev;
+            TimerCallback *callback;
+            void *data;
+        };
+        
+        static void fire( evutil_socket_t, short, void *arg )
+        {
+            Timer *timer = static_cast<Timer*>( arg );
+            TimerCallback *callback = timer->callback;
+            void *data = timer->data;
+            event_free( timer->ev );
+            delete timer;
+            callback( data );
+        }
+        
+        static void readable( evutil_socket_t, short, void *arg )
+        {
+            Timer *watch = static_cast<Timer*>( arg );
+            watch->callback( watch->data );
+        }
+        
         struct event_base & base_;
     };  // class Adapter
 }  // namespace RedisCluster
@@ -25,7 +25,114 @@ namespace RedisCluster
             return redisLibuvAttach( &ac, loop_ );
         }
 
+        virtual void* startTimer( long milliseconds, TimerCallback *callback, void *data ) override
+        {
+            Timer *timer = new Timer;
+            timer->callback = callback;
+            timer->data = data;
+            if( uv_timer_init( loop_, &timer->handle ) != 0 )
+            {
+                delete timer;
+                return NULL;
+            }
+            timer->handle.data = timer;
+            if( uv_timer_start( &timer->handle, fire, milliseconds, 0 ) != 0 )
+            {
+                close( timer );
+                return NULL;
+            }
+            return timer;
+        }
+
+        virtual void stopTimer( void *timer ) override
+        {
+            Timer *t = static_cast<Timer*>( timer );
+            uv_timer_stop( &t->handle );
+            close( t );
+        }
+
+        virtual void* watchFd( int fd, ReadCallback *callback, void *data ) override
+        {
+            Watch *watch = new Watch;
+            watch->callback = callback;
+            watch->data = data;
+            if( uv_poll_init( loop_, &watch->handle, fd ) != 0 )
+            {
+                delete watch;
+                return NULL;
+            }
+            watch->handle.data = watch;
+            if( uv_poll_start( &watch->handle, UV_READABLE, readable ) != 0 )
+            {
+                uv_close( reinterpret_cast<uv_handle_t*>( &watch->handle ), freeWatch );
+                return NULL;
+            }
+            return watch;
+        }
+
+        virtual void unwatchFd( void *watch ) override
+        {
+            Watch *w = static_cast<Watch*>( watch );
+            uv_poll_stop( &w->handle );
+            uv_close( reinterpret_cast<uv_handle_t*>( &w->handle ), freeWatch );
+        }
+
+        virtual bool run() override
+        {
+            uv_run( loop_, UV_RUN_DEFAULT );
+            return true;
+        }
+
+        virtual void stop() override
+        {
+            uv_stop( loop_ );
+        }
+
     private:
+        struct Timer
+        {
+            uv_timer_t handle;
+            TimerCallback *callback;
+            void *data;
+        };
+
+        static void fire( uv_timer_t *handle )
+        {
+            Timer *timer = static_cast<Timer*>( handle->data );
+            close( timer );
+            timer->callback( timer->data );
+        }
+
+        // handles are freed by the loop after they are closed
+        static void close( Timer *timer )
+        {
+            uv_close( reinterpret_cast<uv_handle_t*>( &timer->handle ), freeTimer );
+        }
+
+        static void freeTimer( uv_handle_t *handle )
+        {
+            delete static_cast<Timer*>( handle->data );
+        }
+
+        struct Watch
+        {
+            uv_poll_t handle;
+            ReadCallback *callback;
+            void *data;
+        };
+
+        static void readable( uv_poll_t *handle, int status, int )
+        {
+            Watch *watch = static_cast<Watch*>( handle->data );
+            if( status == 0 )
+                watch->callback( watch->data );
+        }
+
+        static void freeWatch( uv_handle_t *handle )
+        {
+            delete static_cast<Watch*>( handle->data );
+        }
+
         uv_loop_t* loop_;
     };  // class Adapter
 }  // namespace RedisCluster
@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__asyncbatch__
+#define __libredisCluster__asyncbatch__
+
+#include <algorithm>
+#include <stdarg.h>
+#include <vector>
+
+#include "asynchirediscommand.h"
+
+namespace RedisCluster
+{
+    // Batch of async commands with per-command callbacks and one callback for the whole batch.
+    // Commands are formatted by add() and sent by execute() grouped by node, so the output
+    // buffer of every node grows once and gets all its commands in one write. Redirections
+    // are followed by the commands as usual, commands redirected by the replies read at once
+    // go to the new node together in the next write
+    //
+    //   AsyncBatch<> batch( cluster_p );
+    //   for( size_t i = 0; i < keys.size(); ++i )
+    //       batch.add( keys[i], cmd.format( "GET", keys[i] ), onValue );
+    //   batch.execute( []( size_t commands, size_t failed ) { ... } );
+    template < typename Cluster = Cluster<redisAsyncContext> >
+    class AsyncBatch
+    {
+        typedef redisAsyncContext Connection;
+        typedef AsyncHiredisCommand<Cluster> Command;
+
+        AsyncBatch(const AsyncBatch&) = delete;
+        AsyncBatch& operator=(const AsyncBatch&) = delete;
+
+    public:
+        typedef typename Command::RedisCallback RedisCallback;
+        // gets the number of commands and the number of commands finished without
+        // a reply or with an error reply, must not throw
+        typedef SmallFunction<void (size_t commands, size_t failed)> DoneCallback;
+
+        explicit AsyncBatch( typename Cluster::ptr_t cluster_p ) :
+        cluster_p_( cluster_p )
+        {
+            if( cluster_p == NULL )
+                throw InvalidArgument(nullptr);
+        }
+
+        // commands not executed are dropped without callbacks
+        ~AsyncBatch()
+        {
+            for( size_t i = 0; i < commands_.size(); ++i )
+                delete commands_[i];
+        }
+
+        // commands are returned for setting error callbacks
+        Command& add( const string &key, const RespCommand &cmd, const RedisCallback &redisCallback = RedisCallback() )
+        {
+            return append( new Command( cluster_p_, key, cmd, redisCallback ) );
+        }
+
+        // large arguments must stay valid until the callback of the command
+        Command& add( const string &key, const ScatterCommand &cmd, const RedisCallback &redisCallback = RedisCallback() )
+        {
+            return append( new Command( cluster_p_, key, cmd, redisCallback ) );
+        }
+
+        Command& add( const string &key, int argc, const char **argv, const size_t *argvlen,
+                     const RedisCallback &redisCallback = RedisCallback() )
+        {
+            return append( new Command( cluster_p_, key, argc, argv, argvlen, redisCallback ) );
+        }
+
+        Command& add( const string &key, const RedisCallback &redisCallback, const char *format, ... )
+        {
+            va_list ap;
+            va_start( ap, format );
+            Command *c = nullptr;
+            try
+            {
+                c = new Command( cluster_p_, key, format, ap, redisCallback );
+            }
+            catch( ... )
+            {
+                va_end( ap );
+                throw;
+            }
+            va_end( ap );
+            return append( c );
+        }
+
+        inline size_t size() const
+        {
+            return commands_.size();
+        }
+
+        // Sends all commands, the batch can be reused after that. Commands which can't be sent
+        // are finished as failed, the first error is returned. The done callback is called when
+        // all commands are finished, for a batch failed completely it is called before return
+        ErrorCode execute( const DoneCallback &done = DoneCallback() )
+        {
+            State *state = new State( done, commands_.size() );
+            std::vector<Command*> commands;
+            commands.swap( commands_ );
+            for( size_t i = 0; i < commands.size(); ++i )
+                commands[i]->setFinishCb( finished, state );
+
+            ErrorCode result = submit( cluster_p_, commands );
+            finished( state, true );
+            return result;
+        }
+
+        // Sends commands created by new grouped by node, i.e. sub-commands of other commands.
+        // Commands which can't be sent are finished as failed, the first error is returned
+        static ErrorCode submit( typename Cluster::ptr_t cluster_p, const std::vector<Command*> &commands )
+        {
+            std::vector<Target> targets;
+            targets.reserve( commands.size() );
+
+            ErrorCode result = SUCCESS;
+            for( size_t i = 0; i < commands.size(); ++i )
+            {
+                typename Cluster::SlotConnection con;
+                ErrorCode code = cluster_p->findConnection( commands[i]->slot_, con );
+                if( code == SUCCESS )
+                {
+                    Target target = { con.second, commands[i] };
+                    targets.push_back( target );
+                }
+                else
+                {
+                    // commands for a node being reconnected are held by the node
+                    if( code == NODE_NOT_FOUND )
+                        code = commands[i]->hold();
+                    if( code != SUCCESS )
+                        fail( commands[i], code, result );
+                }
+            }
+
+            // commands of a node go one after another, in the order they were added
+            std::stable_sort( targets.begin(), targets.end() );
+            for( size_t first = 0; first < targets.size(); )
+            {
+                size_t last = first;
+                size_t size = 0;
+                while( last < targets.size() && targets[last].con == targets[first].con )
+                    size += targets[last++].command->size();
+
+                Connection *con = targets[first].con;
+                sds obuf = sdsMakeRoomFor( con->c.obuf, size );
+                if( obuf != NULL )
+                    con->c.obuf = obuf;
+                for( ; first < last; ++first )
+                {
+                    // commands over the flow limits wait or fail one by one
+                    ErrorCode code = targets[first].command->send( con );
+                    if( code != SUCCESS )
+                        fail( targets[first].command, code, result );
+                }
+            }
+            return result;
+        }
+
+    private:
+        struct State
+        {
+            DoneCallback done;
+            size_t commands;
+            size_t failed;
+            // unfinished commands and one more for execute
+            size_t pending;
+
+            State( const DoneCallback &callback, size_t count ) :
+            done( callback ),
+            commands( count ),
+            failed( 0 ),
+            pending( count + 1 )
+            {
+            }
+        };
+
+        struct Target
+        {
+            Connection *con;
+            Command *command;
+
+            bool operator<( const Target &other ) const
+            {
+                return con < other.con;
+            }
+        };
+
+        Command& append( Command *c )
+        {
+            try
+            {
+                commands_.push_back( c );
+            }
+            catch( ... )
+            {
+                delete c;
+                throw;
+            }
+            return *c;
+        }
+
+        static void fail( Command *c, ErrorCode code, ErrorCode &result )
+        {
+            if( result == SUCCESS )
+                result = code;
+            c->handleError( code, HiredisProcess::FAILED );
+            delete c;
+        }
+
+        static void finished( void *data, bool succeeded )
+        {
+            State *state = static_cast<State*>( data );
+            if( !succeeded )
+                ++state->failed;
+            if( --state->pending != 0 )
+                return;
+            if( state->done )
+                state->done( state->commands, state->failed );
+            delete state;
+        }
+
+        typename Cluster::ptr_t cluster_p_;
+        std::vector<Command*> commands_;
+    };
+}
+
+#endif /* defined(__libredisCluster__asyncbatch__) */
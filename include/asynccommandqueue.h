@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __libredisCluster__asynccommandqueue__
+#define __libredisCluster__asynccommandqueue__
+
+#include <new>
+#include <string>
+
+#include "adapters/adapter.h"
+#include "asyncfuture.h"
+#include "asynchirediscommand.h"
+#include "loopqueue.h"
+#include "replyarena.h"
+#include "smallfunction.h"
+
+namespace RedisCluster
+{
+    using std::string;
+
+    // Queue of an event loop which any thread can send async commands through. Commands are
+    // formatted by the calling thread and pushed to a lock-free queue, the loop is woken through
+    // its adapter and sends all the commands queued so far in one go. Callbacks are called on
+    // the loop thread, or on the submitting thread when a reply queue is given: the reply is
+    // copied then and the callback is posted to that queue
+    //
+    //   AsyncCommandQueue<> commands( cluster_p, adapter );
+    //   ... in a worker thread
+    //   AsyncCommandQueue<>::ReplyQueue replies;
+    //   commands.Command( "FOO", cmd.format( "GET", "FOO" ), []( const redisReply &reply ) { ... }, NULL, &replies );
+    //   replies.wait( 100 );
+    //
+    // or with a future instead of the callback
+    //
+    //   AsyncFuture f = commands.FutureCommand( "FOO", cmd.format( "GET", "FOO" ) );
+    //   const redisReply *reply = f.get();
+    template < typename Cluster = Cluster<redisAsyncContext> >
+    class AsyncCommandQueue
+    {
+        typedef AsyncHiredisCommand<Cluster> AsyncCommand;
+
+        AsyncCommandQueue(const AsyncCommandQueue&) = delete;
+        AsyncCommandQueue& operator=(const AsyncCommandQueue&) = delete;
+
+    public:
+        typedef typename AsyncCommand::RedisCallback RedisCallback;
+        typedef typename AsyncCommand::errorCodeCallbackFn errorCodeCallbackFn;
+        // task run by the loop with its cluster, must not throw
+        typedef SmallFunction<void (typename Cluster::ptr_t cluster_p)> Task;
+        // callbacks delivered to a submitting thread, run by its own loop or by its wait calls
+        typedef LoopQueue< SmallFunction<void ()> > ReplyQueue;
+
+        // adapter must be able to watch descriptors, the cluster is used by the loop only
+        AsyncCommandQueue( typename Cluster::ptr_t cluster_p, Adapter &adapter ) :
+        cluster_p_( cluster_p ),
+        closing_( false ),
+        queue_( adapter )
+        {
+        }
+
+        // commands still queued fail with DISCONNECTED, the loop must not run anymore
+        // and the cluster must still be there
+        ~AsyncCommandQueue()
+        {
+            closing_ = true;
+            queue_.drain();
+        }
+
+        // runs the task on the loop thread, called by any thread
+        void post( const Task &task )
+        {
+            typename Cluster::ptr_t cluster_p = cluster_p_;
+            queue_.post( LoopTask( [cluster_p, task]() { task( cluster_p ); } ) );
+        }
+
+        // Sends the command from the loop, called by any thread. Errors of sending and
+        // redirections go to the error code callback on the loop thread. With a reply queue
+        // the callback is called on the thread of the queue, which must outlive the command.
+        // Commands finished without a reply don't call it, like other async commands.
+        // Not for subscriptions
+        void Command( const string &key,
+                     const RespCommand &cmd,
+                     const RedisCallback &redisCallback = RedisCallback(),
+                     errorCodeCallbackFn *errorCb = NULL,
+                     ReplyQueue *replyTo = NULL )
+        {
+            submit( new AsyncCommand( cluster_p_, key, cmd, redisCallback ), errorCb, replyTo );
+        }
+
+        void Command( const string &key,
+                     int argc,
+                     const char **argv,
+                     const size_t *argvlen,
+                     const RedisCallback &redisCallback = RedisCallback(),
+                     errorCodeCallbackFn *errorCb = NULL,
+                     ReplyQueue *replyTo = NULL )
+        {
+            submit( new AsyncCommand( cluster_p_, key, argc, argv, argvlen, redisCallback ), errorCb, replyTo );
+        }
+
+        // Sends the command from the loop like Command, called by any thread. The future is
+        // ready when the command is finished, errors of sending make it ready with the error
+        AsyncFuture FutureCommand( const string &key, const RespCommand &cmd )
+        {
+            AsyncFuture future;
+            submit( AsyncFutureCommand<Cluster>::attach( future, [&]( const RedisCallback &cb )
+            {
+                return new AsyncCommand( cluster_p_, key, cmd, cb );
+            } ), NULL, NULL );
+            return future;
+        }
+
+        AsyncFuture FutureCommand( const string &key,
+                                  int argc,
+                                  const char **argv,
+                                  const size_t *argvlen )
+        {
+            AsyncFuture future;
+            submit( AsyncFutureCommand<Cluster>::attach( future, [&]( const RedisCallback &cb )
+            {
+                return new AsyncCommand( cluster_p_, key, argc, argv, argvlen, cb );
+            } ), NULL, NULL );
+            return future;
+        }
+
+        // Stops watching the queue, so the loop may return when its connections are closed,
+        // called on the loop thread. Commands taken later fail with DISCONNECTED
+        void close()
+        {
+            closing_ = true;
+            queue_.close();
+        }
+
+        // runs the tasks and sends the commands queued so far, called on the loop thread
+        // (or by the owner of a stopped loop)
+        inline size_t drain()
+        {
+            return queue_.drain();
+        }
+
+    private:
+        // tasks wrapping user tasks with the cluster are stored inline
+        typedef SmallFunction<void (), 10 * sizeof(void*)> LoopTask;
+
+        // reply copied by the loop for the callback on the submitting thread
+        struct Delivery
+        {
+            Delivery( const RedisCallback &cb, ReplyQueue *queue ) :
+            callback( cb ), replyTo( queue ), reply( nullptr ) {}
+
+            RedisCallback callback;
+            ReplyQueue *replyTo;
+            const redisReply *reply;
+            ReplyArena arena;
+        };
+
+        // hiredis frees the reply right after the callback, so it is copied for the other thread
+        static RedisCallback deliver( Delivery *d )
+        {
+            return RedisCallback( [d]( const redisReply &reply )
+            {
+                try
+                {
+                    d->reply = d->arena.copyReply( reply );
+                }
+                catch( const std::bad_alloc & )
+                {
+                    d->reply = nullptr;
+                }
+            } );
+        }
+
+        // called from the destructor of the command on the loop thread
+        static void finished( void *data, bool )
+        {
+            Delivery *d = static_cast<Delivery*>( data );
+            if( d->reply == nullptr )
+            {
+                delete d;
+                return;
+            }
+            try
+            {
+                d->replyTo->post( SmallFunction<void ()>( [d]() { d->callback( *d->reply ); delete d; } ) );
+            }
+            catch( ... )
+            {
+                delete d;
+            }
+        }
+
+        // queued commands are sent by the loop, so they are counted by its flow control
+        void submit( AsyncCommand *c, errorCodeCallbackFn *errorCb, ReplyQueue *replyTo )
+        {
+            c->setErrorCodeCb( errorCb );
+            try
+            {
+                if( replyTo != NULL && c->redisCallback_ )
+                {
+                    Delivery *d = new Delivery( c->redisCallback_, replyTo );
+                    c->redisCallback_ = deliver( d );
+                    c->setFinishCb( finished, d );
+                }
+                queue_.post( LoopTask( [this, c]() { send( c ); } ) );
+            }
+            catch( ... )
+            {
+                delete c;
+                throw;
+            }
+        }
+
+        void send( AsyncCommand *c )
+        {
+            ErrorCode code = closing_ ? DISCONNECTED : c->process();
+            if( code != SUCCESS )
+            {
+                c->handleError( code, HiredisProcess::FAILED );
+                delete c;
+            }
+        }
+
+        typename Cluster::ptr_t cluster_p_;
+        // set by the loop when the queue is closed
+        bool closing_;
+        LoopQueue<LoopTask> queue_;
+    };
+}
+
+#endif /* defined(__libredisCluster__asynccommandqueue__) */
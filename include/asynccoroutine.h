@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__asynccoroutine__
+#define __libredisCluster__asynccoroutine__
+
+// Coroutines need C++20, the header is empty for older standards
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "adapters/adapter.h"
+#include "asyncbatch.h"
+#include "asynchirediscommand.h"
+#include "blockpool.h"
+#include "replyarena.h"
+
+namespace RedisCluster
+{
+    // Reply of an awaited async command, owns the reply object. Empty if the command finished
+    // without a reply, error() tells why then
+    class AsyncReply
+    {
+        AsyncReply(const AsyncReply&) = delete;
+        AsyncReply& operator=(const AsyncReply&) = delete;
+
+    public:
+        AsyncReply() : reply_( nullptr ), arena_( nullptr ), error_( SUCCESS ) {}
+
+        AsyncReply( AsyncReply &&other ) noexcept :
+        reply_( other.reply_ ), arena_( other.arena_ ), error_( other.error_ )
+        {
+            other.reply_ = nullptr;
+            other.arena_ = nullptr;
+        }
+
+        AsyncReply& operator=( AsyncReply &&other ) noexcept
+        {
+            if( this != &other )
+            {
+                reset();
+                reply_ = other.reply_;
+                arena_ = other.arena_;
+                error_ = other.error_;
+                other.reply_ = nullptr;
+                other.arena_ = nullptr;
+            }
+            return *this;
+        }
+
+        ~AsyncReply()
+        {
+            reset();
+        }
+
+        explicit operator bool() const
+        {
+            return reply_ != nullptr;
+        }
+
+        const redisReply& operator*() const
+        {
+            return *reply_;
+        }
+
+        const redisReply* operator->() const
+        {
+            return reply_;
+        }
+
+        const redisReply* get() const
+        {
+            return reply_;
+        }
+
+        ErrorCode error() const
+        {
+            return error_;
+        }
+
+    private:
+        template<typename Cluster>
+        friend class AsyncAwait;
+
+        // Awaiting coroutines are resumed from the reply callback, before hiredis frees the reply.
+        // The arena of the reply freed meanwhile goes back to the reply, as hiredis reads
+        // the owner pointer from the arena itself
+        static const redisReply*& delivered()
+        {
+            static thread_local const redisReply *reply = nullptr;
+            return reply;
+        }
+
+        void reset()
+        {
+            if( arena_ != nullptr )
+            {
+                if( reply_ == delivered() )
+                    ReplyArena::attach( reply_, arena_ );
+                else
+                    delete arena_;
+            }
+            reply_ = nullptr;
+            arena_ = nullptr;
+        }
+
+        const redisReply *reply_;
+        ReplyArena *arena_;
+        ErrorCode error_;
+    };
+
+    // number of commands of an awaited batch and of the ones finished without
+    // a reply or with an error reply, error is the first error of sending
+    struct AsyncBatchResult
+    {
+        size_t commands;
+        size_t failed;
+        ErrorCode error;
+    };
+
+    template<typename T>
+    class AsyncTask;
+
+    namespace detail
+    {
+        // Frames of tasks are taken from the free list of the event loop thread, like commands.
+        // Frames larger than the block come from the heap
+        typedef BlockPool<1024> TaskFramePool;
+
+        class TaskPromiseBase
+        {
+        public:
+            TaskPromiseBase() : detached_( false ) {}
+
+            static void* operator new( size_t size )
+            {
+                return TaskFramePool::allocate( size );
+            }
+
+            static void operator delete( void *p, size_t size ) noexcept
+            {
+                TaskFramePool::release( p, size );
+            }
+
+            // task runs right away until its first co_await
+            std::suspend_never initial_suspend() noexcept
+            {
+                return std::suspend_never();
+            }
+
+            // finished task resumes the awaiting one, or frees itself if nobody holds it
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept
+                {
+                    return false;
+                }
+
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> h ) noexcept
+                {
+                    TaskPromiseBase &promise = h.promise();
+                    if( promise.continuation_ )
+                        return promise.continuation_;
+                    if( promise.detached_ )
+                        h.destroy();
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            FinalAwaiter final_suspend() noexcept
+            {
+                return FinalAwaiter();
+            }
+
+            // exceptions are rethrown to the awaiting task, the ones of
+            // tasks nobody awaits are lost
+            void unhandled_exception() noexcept
+            {
+                exception_ = std::current_exception();
+            }
+
+        protected:
+            template<typename T>
+            friend class RedisCluster::AsyncTask;
+
+            void rethrow()
+            {
+                if( exception_ )
+                    std::rethrow_exception( exception_ );
+            }
+
+            std::coroutine_handle<> continuation_;
+            std::exception_ptr exception_;
+            bool detached_;
+        };
+
+        template<typename T>
+        class TaskPromise : public TaskPromiseBase
+        {
+        public:
+            AsyncTask<T> get_return_object() noexcept;
+
+            template<typename V>
+            void return_value( V &&value )
+            {
+                value_ = std::forward<V>( value );
+            }
+
+            T result()
+            {
+                rethrow();
+                return std::move( *value_ );
+            }
+
+        private:
+            std::optional<T> value_;
+        };
+
+        template<>
+        class TaskPromise<void> : public TaskPromiseBase
+        {
+        public:
+            AsyncTask<void> get_return_object() noexcept;
+
+            void return_void() noexcept {}
+
+            void result()
+            {
+                rethrow();
+            }
+        };
+    }
+
+    // Coroutine of async commands. A task starts at once and runs until its first co_await,
+    // then it is resumed from the event loop by the reply. Other tasks may co_await it for the
+    // result, a task object dropped before the task is finished lets it run to the end alone
+    //
+    //   AsyncTask<> transfer( Cluster<redisAsyncContext>::ptr_t cluster_p, RespCommand &cmd )
+    //   {
+    //       AsyncReply r = co_await AsyncAwait<>::Command( cluster_p, "from", cmd.format( "GET", "from" ) );
+    //       if( r && r->type == REDIS_REPLY_STRING )
+    //           co_await AsyncAwait<>::Command( cluster_p, "to", cmd.format( "SET", "to", r->str ) );
+    //   }
+    template<typename T = void>
+    class AsyncTask
+    {
+        AsyncTask(const AsyncTask&) = delete;
+        AsyncTask& operator=(const AsyncTask&) = delete;
+
+    public:
+        typedef detail::TaskPromise<T> promise_type;
+        typedef std::coroutine_handle<promise_type> handle_type;
+
+        explicit AsyncTask( handle_type handle ) noexcept : handle_( handle ) {}
+
+        AsyncTask( AsyncTask &&other ) noexcept : handle_( other.handle_ )
+        {
+            other.handle_ = nullptr;
+        }
+
+        ~AsyncTask()
+        {
+            if( !handle_ )
+                return;
+            if( handle_.done() )
+                handle_.destroy();
+            else
+                handle_.promise().detached_ = true;
+        }
+
+        inline bool done() const
+        {
+            return !handle_ || handle_.done();
+        }
+
+        bool await_ready() const noexcept
+        {
+            return handle_.done();
+        }
+
+        void await_suspend( std::coroutine_handle<> awaiting ) noexcept
+        {
+            handle_.promise().continuation_ = awaiting;
+        }
+
+        T await_resume()
+        {
+            return handle_.promise().result();
+        }
+
+    private:
+        handle_type handle_;
+    };
+
+    namespace detail
+    {
+        template<typename T>
+        inline AsyncTask<T> TaskPromise<T>::get_return_object() noexcept
+        {
+            return AsyncTask<T>( AsyncTask<T>::handle_type::from_promise( *this ) );
+        }
+
+        inline AsyncTask<void> TaskPromise<void>::get_return_object() noexcept
+        {
+            return AsyncTask<void>( AsyncTask<void>::handle_type::from_promise( *this ) );
+        }
+    }
+
+    // Awaitable async commands, batches and delays for coroutines. Commands are created when
+    // the awaitable is made and sent when it is awaited, errors of sending finish the co_await
+    // at once. Coroutines are resumed from the callbacks of the event loop, a cluster must not
+    // be deleted by the coroutines it resumes. Subscriptions are not supported
+    template < typename Cluster = Cluster<redisAsyncContext> >
+    class AsyncAwait
+    {
+        typedef AsyncHiredisCommand<Cluster> AsyncCommand;
+
+        AsyncAwait() = delete;
+
+    public:
+
+        class CommandAwaiter
+        {
+            CommandAwaiter(const CommandAwaiter&) = delete;
+            CommandAwaiter& operator=(const CommandAwaiter&) = delete;
+
+        public:
+            explicit CommandAwaiter( AsyncCommand *command ) noexcept :
+            command_( command ), sent_( nullptr ), suspended_( false ), finished_( false ) {}
+
+            CommandAwaiter( CommandAwaiter &&other ) noexcept :
+            command_( other.command_ ), sent_( nullptr ), suspended_( false ), finished_( false )
+            {
+                other.command_ = nullptr;
+            }
+
+            // command not awaited is never sent
+            ~CommandAwaiter()
+            {
+                delete command_;
+            }
+
+            // idempotent commands are sent again after reconnect, see AsyncHiredisCommand::setIdempotent
+            CommandAwaiter& idempotent( bool value = true )
+            {
+                command_->setIdempotent( value );
+                return *this;
+            }
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend( std::coroutine_handle<> handle ) noexcept
+            {
+                handle_ = handle;
+                AsyncCommand *c = command_;
+                command_ = nullptr;
+                sent_ = c;
+                c->redisCallback_ = [this]( const redisReply &reply ) { keep( reply ); };
+                c->setFinishCb( finished, this );
+                ErrorCode code = c->process();
+                if( code != SUCCESS )
+                {
+                    c->handleError( code, HiredisProcess::FAILED );
+                    delete c;
+                }
+                // command failed to be sent is finished without suspending
+                suspended_ = !finished_;
+                return suspended_;
+            }
+
+            AsyncReply await_resume() noexcept
+            {
+                return std::move( reply_ );
+            }
+
+        private:
+            // replies of async commands are freed by hiredis after the callback,
+            // so the reply is taken with its arena
+            void keep( const redisReply &reply )
+            {
+                reply_.arena_ = ReplyArena::detach( &reply );
+                reply_.reply_ = &reply;
+            }
+
+            static void finished( void *data, bool )
+            {
+                CommandAwaiter *that = static_cast<CommandAwaiter*>( data );
+                // called from the destructor of the command, so the command is still there
+                that->reply_.error_ = that->sent_->error();
+                if( !that->reply_ && that->reply_.error_ == SUCCESS )
+                    that->reply_.error_ = DISCONNECTED;
+                that->sent_ = nullptr;
+                that->finished_ = true;
+                if( !that->suspended_ )
+                    return;
+                const redisReply *&delivered = AsyncReply::delivered();
+                const redisReply *previous = delivered;
+                delivered = that->reply_.reply_;
+                that->handle_.resume();
+                delivered = previous;
+            }
+
+            friend class AsyncAwait;
+
+            AsyncCommand *command_;
+            AsyncCommand *sent_;
+            std::coroutine_handle<> handle_;
+            AsyncReply reply_;
+            bool suspended_;
+            bool finished_;
+        };
+
+        class BatchAwaiter
+        {
+        public:
+            explicit BatchAwaiter( AsyncBatch<Cluster> &batch ) noexcept :
+            batch_( &batch ), suspended_( false ), finished_( false )
+            {
+                result_.commands = 0;
+                result_.failed = 0;
+                result_.error = SUCCESS;
+            }
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            bool await_suspend( std::coroutine_handle<> handle ) noexcept
+            {
+                handle_ = handle;
+                result_.error = batch_->execute( [this]( size_t commands, size_t failed ) {
+                    done( commands, failed );
+                } );
+                suspended_ = !finished_;
+                return suspended_;
+            }
+
+            AsyncBatchResult await_resume() const noexcept
+            {
+                return result_;
+            }
+
+        private:
+            void done( size_t commands, size_t failed )
+            {
+                result_.commands = commands;
+                result_.failed = failed;
+                finished_ = true;
+                if( suspended_ )
+                    handle_.resume();
+            }
+
+            AsyncBatch<Cluster> *batch_;
+            std::coroutine_handle<> handle_;
+            AsyncBatchResult result_;
+            bool suspended_;
+            bool finished_;
+        };
+
+        class DelayAwaiter
+        {
+        public:
+            DelayAwaiter( Adapter &adapter, long milliseconds ) noexcept :
+            adapter_( &adapter ), milliseconds_( milliseconds ), started_( false ) {}
+
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            // adapters without timers don't suspend
+            bool await_suspend( std::coroutine_handle<> handle ) noexcept
+            {
+                handle_ = handle;
+                started_ = adapter_->startTimer( milliseconds_, fired, this ) != NULL;
+                return started_;
+            }
+
+            // false if the adapter has no timers
+            bool await_resume() const noexcept
+            {
+                return started_;
+            }
+
+        private:
+            static void fired( void *data )
+            {
+                static_cast<DelayAwaiter*>( data )->handle_.resume();
+            }
+
+            Adapter *adapter_;
+            long milliseconds_;
+            std::coroutine_handle<> handle_;
+            bool started_;
+        };
+
+        // co_await gives AsyncReply
+        static CommandAwaiter Command( typename Cluster::ptr_t cluster_p, const string &key, const RespCommand &cmd )
+        {
+            return CommandAwaiter( new AsyncCommand( cluster_p, key, cmd ) );
+        }
+
+        // large arguments must stay valid until the command is finished
+        static CommandAwaiter Command( typename Cluster::ptr_t cluster_p, const string &key, const ScatterCommand &cmd )
+        {
+            return CommandAwaiter( new AsyncCommand( cluster_p, key, cmd ) );
+        }
+
+        static CommandAwaiter Command( typename Cluster::ptr_t cluster_p, const string &key,
+                                      int argc, const char **argv, const size_t *argvlen )
+        {
+            return CommandAwaiter( new AsyncCommand( cluster_p, key, argc, argv, argvlen ) );
+        }
+
+        static CommandAwaiter Command( typename Cluster::ptr_t cluster_p, const string &key, const char *format, ... )
+        {
+            va_list ap;
+            va_start( ap, format );
+            AsyncCommand *c = nullptr;
+            try
+            {
+                c = new AsyncCommand( cluster_p, key, format, ap );
+            }
+            catch( ... )
+            {
+                va_end( ap );
+                throw;
+            }
+            va_end( ap );
+            return CommandAwaiter( c );
+        }
+
+        // co_await executes the batch and gives AsyncBatchResult when all its commands are finished
+        static BatchAwaiter Execute( AsyncBatch<Cluster> &batch ) noexcept
+        {
+            return BatchAwaiter( batch );
+        }
+
+        // co_await resumes the coroutine from the event loop after the delay,
+        // e.g. between retries
+        static DelayAwaiter Delay( Adapter &adapter, long milliseconds ) noexcept
+        {
+            return DelayAwaiter( adapter, milliseconds );
+        }
+    };
+}
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* defined(__libredisCluster__asynccoroutine__) */
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__asyncfuture__
+#define __libredisCluster__asyncfuture__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "asynchirediscommand.h"
+#include "clusterexception.h"
+#include "replyarena.h"
+#include "result.h"
+
+namespace RedisCluster
+{
+    template<typename Cluster>
+    class AsyncFutureCommand;
+
+    template<typename Cluster>
+    class AsyncCommandQueue;
+
+    // Result of an async command for threads other than the event loop thread. The loop thread
+    // completes the future with one atomic operation, a mutex is taken only when another thread
+    // is blocked in wait. The reply is copied, so it stays valid while the future lives
+    //
+    //   AsyncFuture f = AsyncFutureCommand<>::Command( cluster_p, "FOO", cmd.format( "GET", "FOO" ) );
+    //   ... in a worker thread
+    //   const redisReply *reply = f.get();
+    //   if( reply == nullptr )
+    //       cerr << errorMessage( f.error() ) << endl;
+    class AsyncFuture
+    {
+        AsyncFuture(const AsyncFuture&) = delete;
+        AsyncFuture& operator=(const AsyncFuture&) = delete;
+
+        template<typename Cluster>
+        friend class AsyncFutureCommand;
+
+        // shared by the future and the event loop, freed by the last of them
+        struct State
+        {
+            enum Flags
+            {
+                READY = 1,
+                // a thread is blocked in wait
+                WAITING = 2,
+                // the future is a part of a group
+                LINKED = 4
+            };
+
+            State( unsigned references ) :
+            flags( 0 ),
+            refs( references ),
+            pending( 1 ),
+            group( nullptr ),
+            reply( nullptr ),
+            error( SUCCESS ),
+            command( nullptr )
+            {
+            }
+
+            std::atomic<unsigned> flags;
+            std::atomic<unsigned> refs;
+            // futures of a group which are not ready, and one more while they are linked
+            std::atomic<size_t> pending;
+            // group the future is linked to, set before LINKED flag
+            State *group;
+            // reply and error are set before READY flag
+            const redisReply *reply;
+            ErrorCode error;
+            // command in flight, used by the event loop only
+            void *command;
+            std::mutex lock;
+            std::condition_variable ready;
+            ReplyArena arena;
+        };
+
+    public:
+        AsyncFuture() : state_( nullptr ) {}
+
+        AsyncFuture( AsyncFuture &&other ) noexcept : state_( other.state_ )
+        {
+            other.state_ = nullptr;
+        }
+
+        AsyncFuture& operator=( AsyncFuture &&other ) noexcept
+        {
+            if( this != &other )
+            {
+                if( state_ != nullptr )
+                    release( state_ );
+                state_ = other.state_;
+                other.state_ = nullptr;
+            }
+            return *this;
+        }
+
+        // future may be dropped before its command is finished
+        ~AsyncFuture()
+        {
+            if( state_ != nullptr )
+                release( state_ );
+        }
+
+        inline bool valid() const
+        {
+            return state_ != nullptr;
+        }
+
+        inline bool ready() const
+        {
+            return state_ == nullptr || ( state_->flags.load( std::memory_order_acquire ) & State::READY );
+        }
+
+        void wait() const
+        {
+            if( ready() )
+                return;
+            std::unique_lock<std::mutex> locker( state_->lock );
+            state_->flags.fetch_or( State::WAITING, std::memory_order_acq_rel );
+            while( !ready() )
+                state_->ready.wait( locker );
+        }
+
+        // false if the future is not ready after the timeout
+        bool waitFor( std::chrono::milliseconds timeout ) const
+        {
+            if( ready() )
+                return true;
+            std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+            std::unique_lock<std::mutex> locker( state_->lock );
+            state_->flags.fetch_or( State::WAITING, std::memory_order_acq_rel );
+            while( !ready() )
+            {
+                if( state_->ready.wait_until( locker, deadline ) == std::cv_status::timeout )
+                    return ready();
+            }
+            return true;
+        }
+
+        // waits for the command, the reply is NULL if the command finished without a reply
+        const redisReply* get() const
+        {
+            wait();
+            return state_ != nullptr ? state_->reply : nullptr;
+        }
+
+        // waits for the command, error of a command finished without a reply
+        ErrorCode error() const
+        {
+            wait();
+            return state_ != nullptr ? state_->error : INVALID_ARGUMENT;
+        }
+
+        // Future without a reply which is ready when all the futures are ready, so a thread
+        // waiting for many commands is woken up once. A future can be in one group only,
+        // futures are still used for their replies
+        static AsyncFuture whenAll( const std::vector<AsyncFuture> &futures )
+        {
+            for( size_t i = 0; i < futures.size(); ++i )
+            {
+                if( futures[i].state_ != nullptr &&
+                   ( futures[i].state_->flags.load( std::memory_order_acquire ) & State::LINKED ) )
+                    throw LogicError( nullptr, "future is already in a group" );
+            }
+
+            AsyncFuture all( 2 );
+            State *group = all.state_;
+            for( size_t i = 0; i < futures.size(); ++i )
+            {
+                State *s = futures[i].state_;
+                if( s == nullptr )
+                    continue;
+                group->refs.fetch_add( 1, std::memory_order_relaxed );
+                group->pending.fetch_add( 1, std::memory_order_relaxed );
+                s->group = group;
+                if( s->flags.fetch_or( State::LINKED, std::memory_order_acq_rel ) & State::READY )
+                    arrive( group );
+            }
+            arrive( group );
+            return all;
+        }
+
+    private:
+        explicit AsyncFuture( unsigned references ) : state_( new State( references ) ) {}
+
+        static void complete( State *s )
+        {
+            unsigned flags = s->flags.fetch_or( State::READY, std::memory_order_acq_rel );
+            if( flags & State::WAITING )
+            {
+                // waiter checks the flag under the lock, so it can't miss the notification
+                std::lock_guard<std::mutex> locker( s->lock );
+                s->ready.notify_all();
+            }
+            if( flags & State::LINKED )
+                arrive( s->group );
+            release( s );
+        }
+
+        static void arrive( State *group )
+        {
+            if( group->pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+                complete( group );
+            else
+                release( group );
+        }
+
+        static void release( State *s )
+        {
+            if( s->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+                delete s;
+        }
+
+        State *state_;
+    };
+
+    // Variants of AsyncHiredisCommand::Command returning futures. They are called on the event
+    // loop thread like other async commands, the futures may be waited for and freed by any
+    // thread. Errors of sending make ready futures with the error instead of exceptions.
+    // Other threads send commands with futures by AsyncCommandQueue::FutureCommand
+    template < typename Cluster = Cluster<redisAsyncContext> >
+    class AsyncFutureCommand
+    {
+        typedef AsyncHiredisCommand<Cluster> AsyncCommand;
+        typedef AsyncFuture::State State;
+
+        friend class AsyncCommandQueue<Cluster>;
+
+        AsyncFutureCommand() = delete;
+
+    public:
+
+        static AsyncFuture Command( typename Cluster::ptr_t cluster_p,
+                                   const string &key,
+                                   const RespCommand &cmd )
+        {
+            AsyncFuture future( 2 );
+            State *s = future.state_;
+            sent( s, AsyncCommand::TryCommand( cluster_p, key, cmd,
+                                         [s]( const redisReply &reply ) { keep( s, reply ); } ) );
+            return future;
+        }
+
+        static AsyncFuture Command( typename Cluster::ptr_t cluster_p,
+                                   const string &key,
+                                   int argc,
+                                   const char **argv,
+                                   const size_t *argvlen )
+        {
+            AsyncFuture future( 2 );
+            State *s = future.state_;
+            sent( s, AsyncCommand::TryCommand( cluster_p, key, argc, argv, argvlen,
+                                         [s]( const redisReply &reply ) { keep( s, reply ); } ) );
+            return future;
+        }
+
+    private:
+
+        // Command completing the future, created by the calling thread and sent later by the
+        // loop of AsyncCommandQueue. Make creates the command with the given callback
+        template<typename Make>
+        static AsyncCommand* attach( AsyncFuture &future, const Make &make )
+        {
+            AsyncFuture attached( 2 );
+            State *s = attached.state_;
+            AsyncCommand *c;
+            try
+            {
+                c = make( typename AsyncCommand::RedisCallback( [s]( const redisReply &reply ) { keep( s, reply ); } ) );
+            }
+            catch( ... )
+            {
+                // reference of the command which is not there
+                AsyncFuture::release( s );
+                throw;
+            }
+            s->command = c;
+            c->setFinishCb( finished, s );
+            future = std::move( attached );
+            return c;
+        }
+
+        static void sent( State *s, const Result<AsyncCommand*> &result )
+        {
+            if( !result )
+            {
+                s->error = result.error();
+                AsyncFuture::complete( s );
+                return;
+            }
+            s->command = result.value();
+            result.value()->setFinishCb( finished, s );
+        }
+
+        // hiredis frees the reply right after the callback, so it is copied for the future
+        static void keep( State *s, const redisReply &reply )
+        {
+            try
+            {
+                s->reply = s->arena.copyReply( reply );
+            }
+            catch( const std::bad_alloc & )
+            {
+                s->error = OUT_OF_MEMORY;
+            }
+        }
+
+        static void finished( void *data, bool )
+        {
+            State *s = static_cast<State*>( data );
+            if( s->reply == nullptr && s->error == SUCCESS )
+            {
+                // called from the destructor of the command, so the command is still there
+                ErrorCode code = static_cast<AsyncCommand*>( s->command )->error();
+                s->error = code != SUCCESS ? code : DISCONNECTED;
+            }
+            s->command = nullptr;
+            AsyncFuture::complete( s );
+        }
+    };
+}
+
+#endif /* defined(__libredisCluster__asyncfuture__) */
@@ -30,12 +30,25 @@
 #define __libredisCluster__asynchirediscommand__
 
 #include <assert.h>
-#include <functional>  // for function<>
+#include <chrono>
 #include <iostream>
+#include <map>
+#include <string.h>
+#include <strings.h>
 
 #include "adapters/adapter.h"  // for Adapter
+#include "blockpool.h"
 #include "cluster.h"
+#include "flowcontrol.h"
 #include "hiredisprocess.h"
+#include "reconnect.h"
+#include "replyarena.h"
+#include "replydecoder.h"
+#include "replystream.h"
+#include "respcommand.h"
+#include "respparser.h"
+#include "result.h"
+#include "smallfunction.h"
 
 extern "C"
 {
@@ -47,21 +60,116 @@ namespace RedisCluster
 {
     using std::string;
     
+    template<typename Cluster>
+    class AsyncBatch;
+    
+    template<typename Cluster>
+    class AsyncMultiKeyCommand;
+    
+    template<typename Cluster>
+    class AsyncAwait;
+    
+    template<typename Cluster>
+    class AsyncCommandQueue;
+    
     // Asynchronous command class. Use Adapter to adapt different event library.
     template < typename Cluster = Cluster<redisAsyncContext> >
     class AsyncHiredisCommand
     {
         typedef redisAsyncContext Connection;
+        enum CommandType
+        {
+            SDS,
+            FORMATTED_STRING,
+            SHORT,
+            COPIED,
+            SCATTERED
+        };
+        
+        // commands up to this size built by RespCommand are copied into the command object
+        static const size_t ShortCommandSize = 64;
 
-        struct ConnectContext {
+        // user data of a connection
+        typedef typename FlowControl<AsyncHiredisCommand>::Node FlowNode;
+        typedef std::chrono::steady_clock Clock;
+        
+        struct ConnectContext;
+        
+        // node connection being restored, commands for its slots are held on its flow node
+        struct Reconnect
+        {
+            ConnectContext *context;
+            FlowNode *node;
+            typename Cluster::SlotRange range;
+            string host;
+            int port;
+            unsigned attempt;
+            // timer of the next attempt, or NULL
+            void *timer;
+            // connection being established, or NULL
+            Connection *con;
+            // time of the next attempt for adapters without timers
+            Clock::time_point retryAt;
+        };
+        
+        typedef std::map<typename Cluster::SlotRange, Reconnect*, typename Cluster::SlotComparator> DownNodes;
+        
+        // user data of the cluster, flow control of its connections
+        struct ConnectContext : FlowControl<AsyncHiredisCommand> {
+            explicit ConnectContext( Adapter *a ) :
+            FlowControl<AsyncHiredisCommand>( sendQueued, failQueued ),
+            adapter( a ),
+            pcluster( nullptr ),
+            lifetime( 0 ),
+            reconnect( ReconnectPolicy::disabled() ),
+            random( static_cast<ReconnectPolicy::Random::result_type>(
+                Clock::now().time_since_epoch().count() ^ reinterpret_cast<size_t>( this ) ) )
+            {
+            }
+            
+            // nodes being reconnected are given up, connections of others
+            // are closed by the cluster already
+            ~ConnectContext()
+            {
+                while( !down.empty() )
+                {
+                    Reconnect *r = down.begin()->second;
+                    down.erase( down.begin() );
+                    if( r->timer != NULL )
+                        adapter->stopTimer( r->timer );
+                    if( r->con != NULL )
+                        redisAsyncFree( r->con );
+                    this->closeNode( r->node );
+                    delete r;
+                }
+            }
+            
+            Reconnect* reconnecting( FlowNode *node ) const
+            {
+                for( typename DownNodes::const_iterator it = down.begin(); it != down.end(); ++it )
+                {
+                    if( it->second->node == node )
+                        return it->second;
+                }
+                return NULL;
+            }
+            
             Adapter *adapter;
             typename Cluster::ptr_t pcluster;
             int lifetime;
+            ReconnectPolicy reconnect;
+            ReconnectPolicy::Random random;
+            DownNodes down;
         };
         
         AsyncHiredisCommand(const AsyncHiredisCommand&) = delete;
         AsyncHiredisCommand& operator=(const AsyncHiredisCommand&) = delete;
         
+        friend class AsyncBatch<Cluster>;
+        friend class AsyncMultiKeyCommand<Cluster>;
+        friend class AsyncAwait<Cluster>;
+        friend class AsyncCommandQueue<Cluster>;
+        
     public:
         
         enum Action
@@ -72,15 +180,25 @@ namespace RedisCluster
             RETRY
         };
         
-        typedef std::function<void (const redisReply& reply)> RedisCallback;
+        // lambdas capturing a few values are stored in the command object without allocation
+        typedef SmallFunction<void (const redisReply& reply)> RedisCallback;
         typedef Action (userErrorCallbackFn)( const AsyncHiredisCommand<Cluster> &,
                                                       const ClusterException &,
                                                       HiredisProcess::processState );
+        // error handler of the non-throwing API, gets error codes instead of exception objects
+        typedef Action (errorCodeCallbackFn)( const AsyncHiredisCommand<Cluster> &,
+                                              ErrorCode,
+                                              HiredisProcess::processState );
+        // called when the command is finished, right before it is deleted. Succeeded is set if
+        // the reply callback got a reply other than an error
+        typedef void (finishCallbackFn)( void *data, bool succeeded );
+        // called when the cluster becomes overloaded and when it recovers
+        typedef typename FlowControl<AsyncHiredisCommand>::overloadCallbackFn overloadCallbackFn;
         
         
         static inline AsyncHiredisCommand<Cluster>& Command(
             typename Cluster::ptr_t cluster_p,
-            string key,  // todo: const
+            const string &key,
             int argc,
             const char ** argv,
             const size_t *argvlen,
@@ -89,17 +207,18 @@ namespace RedisCluster
             // would be deleted in redis reply callback or in case of error
             AsyncHiredisCommand<Cluster> *c = new AsyncHiredisCommand<Cluster>(
                 cluster_p, key, argc, argv, argvlen, redisCallback );
-            if( c->process() != REDIS_OK )
+            ErrorCode code = c->process();
+            if( code != SUCCESS )
             {
                 delete c;
-                throw DisconnectedException();
+                ErrorCodes::raise( code );
             }
             return *c;
         }
         
         static inline AsyncHiredisCommand<Cluster>& Command(
             typename Cluster::ptr_t cluster_p,
-            string key,
+            const string &key,
             const RedisCallback& redisCallback,
             const char *format, ... )
         {
@@ -108,10 +227,11 @@ namespace RedisCluster
             // would be deleted in redis reply callback or in case of error
             AsyncHiredisCommand<Cluster> *c = new AsyncHiredisCommand<Cluster>(
                 cluster_p, key, format, ap, redisCallback );
-            if( c->process() != REDIS_OK )
+            ErrorCode code = c->process();
+            if( code != SUCCESS )
             {
                 delete c;
-                throw DisconnectedException();
+                ErrorCodes::raise( code );
             }
             va_end(ap);
             return *c;
@@ -119,21 +239,150 @@ namespace RedisCluster
         
         static inline AsyncHiredisCommand<Cluster>& Command(
             typename Cluster::ptr_t cluster_p,
-            string key,
+            const string &key,
             const char *format, va_list ap,
             const RedisCallback& redisCallback = RedisCallback())
         {
             // would be deleted in redis reply callback or in case of error
             AsyncHiredisCommand<Cluster> *c = new AsyncHiredisCommand<Cluster>(
                 cluster_p, key, format, ap, redisCallback );
-            if( c->process() != REDIS_OK )
+            ErrorCode code = c->process();
+            if( code != SUCCESS )
+            {
+                delete c;
+                ErrorCodes::raise( code );
+            }
+            return *c;
+        }
+
+        // command is already encoded by RespCommand builder
+        static inline AsyncHiredisCommand<Cluster>& Command(
+            typename Cluster::ptr_t cluster_p,
+            const string &key,
+            const RespCommand &cmd,
+            const RedisCallback& redisCallback = RedisCallback())
+        {
+            // would be deleted in redis reply callback or in case of error
+            AsyncHiredisCommand<Cluster> *c = new AsyncHiredisCommand<Cluster>(
+                cluster_p, key, cmd, redisCallback );
+            ErrorCode code = c->process();
+            if( code != SUCCESS )
             {
                 delete c;
-                throw DisconnectedException();
+                ErrorCodes::raise( code );
             }
             return *c;
         }
 
+        // large arguments of the command are not copied by the command object, they are copied
+        // only to the output buffer of the connection, so they must stay valid until the callback
+        static inline AsyncHiredisCommand<Cluster>& Command(
+            typename Cluster::ptr_t cluster_p,
+            const string &key,
+            const ScatterCommand &cmd,
+            const RedisCallback& redisCallback = RedisCallback())
+        {
+            // would be deleted in redis reply callback or in case of error
+            AsyncHiredisCommand<Cluster> *c = new AsyncHiredisCommand<Cluster>(
+                cluster_p, key, cmd, redisCallback );
+            ErrorCode code = c->process();
+            if( code != SUCCESS )
+            {
+                delete c;
+                ErrorCodes::raise( code );
+            }
+            return *c;
+        }
+
+        // reply is passed to the visitor element by element as hiredis parses it, so the reply
+        // tree is never built. Bulk strings come in one chunk each, because hiredis reader
+        // buffers the whole string. The callback gets an empty object of the reply type
+        // (or the error reply) when the reply is complete
+        static inline AsyncHiredisCommand<Cluster>& Command(
+            typename Cluster::ptr_t cluster_p,
+            const string &key,
+            const RespCommand &cmd,
+            ReplyVisitor &visitor,
+            const RedisCallback& redisCallback = RedisCallback())
+        {
+            // would be deleted in redis reply callback or in case of error
+            AsyncHiredisCommand<Cluster> *c = new AsyncHiredisCommand<Cluster>(
+                cluster_p, key, cmd, redisCallback );
+            c->visitor_ = &visitor;
+            ErrorCode code = c->process();
+            if( code != SUCCESS )
+            {
+                delete c;
+                ErrorCodes::raise( code );
+            }
+            return *c;
+        }
+
+        // Non-throwing versions of Command. The command is returned in Result, errors of sending
+        // are returned as error codes. Errors of redirections are passed to the error code
+        // callback (setErrorCodeCb) or to the user error callback
+        static inline Result<AsyncHiredisCommand<Cluster>*> TryCommand(
+            typename Cluster::ptr_t cluster_p,
+            const string &key,
+            int argc,
+            const char ** argv,
+            const size_t *argvlen,
+            const RedisCallback& redisCallback = RedisCallback()) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            AsyncHiredisCommand<Cluster> *c = nullptr;
+            try
+            {
+                c = new AsyncHiredisCommand<Cluster>( cluster_p, key, argc, argv, argvlen, redisCallback );
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+            return start( c );
+        }
+        
+        static inline Result<AsyncHiredisCommand<Cluster>*> TryCommand(
+            typename Cluster::ptr_t cluster_p,
+            const string &key,
+            const RespCommand &cmd,
+            const RedisCallback& redisCallback = RedisCallback()) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            AsyncHiredisCommand<Cluster> *c = nullptr;
+            try
+            {
+                c = new AsyncHiredisCommand<Cluster>( cluster_p, key, cmd, redisCallback );
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+            return start( c );
+        }
+        
+        static inline Result<AsyncHiredisCommand<Cluster>*> TryCommand(
+            typename Cluster::ptr_t cluster_p,
+            const string &key,
+            const ScatterCommand &cmd,
+            const RedisCallback& redisCallback = RedisCallback()) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            AsyncHiredisCommand<Cluster> *c = nullptr;
+            try
+            {
+                c = new AsyncHiredisCommand<Cluster>( cluster_p, key, cmd, redisCallback );
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+            return start( c );
+        }
+
         // Todo: Allow hosts
         static typename Cluster::ptr_t createCluster(
             const char* host,
@@ -151,9 +400,7 @@ namespace RedisCluster
             reply = static_cast<redisReply*>( redisCommand( con, Cluster::CmdInit() ) );
             HiredisProcess::checkCritical( reply, true );
             
-            ConnectContext *cc = new ConnectContext({ &adapter, nullptr, 0});
-            cluster = new Cluster(reply, connect, disconnect, (void*)cc, clusterDestructCB, static_cast<void*>(cc));
-            cc->pcluster = cluster;
+            cluster = createCluster( reply, adapter );
             
             freeReplyObject( reply );
             redisFree( con );
@@ -161,15 +408,79 @@ namespace RedisCluster
             return cluster;
         }
         
+        // cluster from a CLUSTER SLOTS reply owned by the caller, i.e. clusters of several
+        // event loops sharing one topology
+        static typename Cluster::ptr_t createCluster( redisReply *slots, Adapter& adapter )
+        {
+            ConnectContext *cc = new ConnectContext( &adapter );
+            typename Cluster::ptr_t cluster = new Cluster(slots, connect, disconnect, (void*)cc, clusterDestructCB, static_cast<void*>(cc));
+            cc->pcluster = cluster;
+            return cluster;
+        }
+        
+        // Limits of commands in flight (sent and not answered yet) of a cluster created by
+        // createCluster. Commands over the limits fail with OVERLOADED error, wait in the queue
+        // of their node or are sent anyway according to the policy. The overload callback
+        // tells the producer when to slow down and when to go on
+        static void setFlowLimits( typename Cluster::ptr_t cluster_p,
+                                  const FlowLimits &limits,
+                                  overloadCallbackFn *overloadCb = NULL,
+                                  void *data = NULL )
+        {
+            connectContext( cluster_p ).setLimits( limits, overloadCb, data );
+        }
+        
+        // commands and bytes in flight and queued commands of the cluster, e.g. for
+        // shedding the load before it comes to the cluster
+        static FlowStats flowStats( typename Cluster::ptr_t cluster_p )
+        {
+            return connectContext( cluster_p ).stats();
+        }
+        
+        // Node connections of a cluster created by createCluster are restored after they
+        // drop, with delays timed by the adapter. Adapters without timers retry when commands
+        // come for the node after the delay. Commands meanwhile are held and sent when the node
+        // is back, or fail if it is given up. Clusters don't reconnect by default
+        static void setReconnectPolicy( typename Cluster::ptr_t cluster_p, const ReconnectPolicy &policy )
+        {
+            connectContext( cluster_p ).reconnect = policy;
+        }
+        
         inline void setUserErrorCb( userErrorCallbackFn *userErrorCb )
         {
             userErrorCb_ = userErrorCb;
         }
         
+        // error code callback is used instead of the user error callback if both are set
+        inline void setErrorCodeCb( errorCodeCallbackFn *errorCodeCb )
+        {
+            errorCodeCb_ = errorCodeCb;
+        }
+        
+        // finish callback must not throw, it is called from the destructor of the command
+        inline void setFinishCb( finishCallbackFn *finishCb, void *data )
+        {
+            finishCb_ = finishCb;
+            finishData_ = data;
+        }
+        
+        // idempotent commands are sent again after reconnect if their connection drops
+        // before the reply, see ReconnectPolicy::replayIdempotent
+        inline void setIdempotent( bool idempotent )
+        {
+            idempotent_ = idempotent;
+        }
+        
+        // last error passed to the error callbacks, i.e. for finish callbacks
+        inline ErrorCode error() const
+        {
+            return error_;
+        }
+        
     protected:
         
         AsyncHiredisCommand( typename Cluster::ptr_t cluster_p,
-            string key,
+            const string &key,
             int argc,
             const char ** argv,
             const size_t *argvlen,
@@ -177,39 +488,178 @@ namespace RedisCluster
         cluster_p_( cluster_p ),
         redisCallback_( redisCallback ),
         userErrorCb_( NULL ),
+        errorCodeCb_( NULL ),
+        finishCb_( NULL ),
+        finishData_( NULL ),
+        succeeded_( false ),
+        idempotent_( false ),
+        error_( SUCCESS ),
         con_( {"",  NULL} ),
-        key_( key ) {
+        node_( NULL ),
+        slot_( SlotHash::SlotByKey( key.c_str(), key.length() ) ),
+        cmd_( nullptr ),
+        len_( 0 ),
+        type_( SDS ),
+        scatter_( nullptr ),
+        askingFailed_( false ),
+        visitor_( NULL ) {
             if(!cluster_p)
                 throw InvalidArgument(nullptr);
+            // formatted buffers of hiredis are owned by the command as they are
             sds buf = nullptr;
-            int len = redisFormatSdsCommandArgv(&buf, argc, argv, argvlen);
-            cmd_ = string(static_cast<char*>(buf), len);
-            sdsfree(buf);
+            len_ = redisFormatSdsCommandArgv(&buf, argc, argv, argvlen);
+            if( len_ < 0 )
+                throw InvalidArgument(nullptr);
+            cmd_ = buf;
         }
         
         AsyncHiredisCommand( typename Cluster::ptr_t cluster_p,
-            string key,
+            const string &key,
             const char *format, va_list ap,
             const RedisCallback& redisCallback = RedisCallback()) :
         cluster_p_( cluster_p ),
         redisCallback_( redisCallback ),
         userErrorCb_( NULL ),
+        errorCodeCb_( NULL ),
+        finishCb_( NULL ),
+        finishData_( NULL ),
+        succeeded_( false ),
+        idempotent_( false ),
+        error_( SUCCESS ),
         con_( {"", NULL} ),
-        key_( key ) {
+        node_( NULL ),
+        slot_( SlotHash::SlotByKey( key.c_str(), key.length() ) ),
+        cmd_( nullptr ),
+        len_( 0 ),
+        type_( FORMATTED_STRING ),
+        scatter_( nullptr ),
+        askingFailed_( false ),
+        visitor_( NULL ) {
             if(!cluster_p)
                 throw InvalidArgument(nullptr);
-            char * buf = nullptr;
-            int len = redisvFormatCommand(&buf, format, ap);
-            cmd_ = string(buf, len);
-            free(buf);
+            len_ = redisvFormatCommand(&cmd_, format, ap);
+            if( len_ < 0 )
+                throw InvalidArgument(nullptr);
+        }
+        
+        AsyncHiredisCommand( typename Cluster::ptr_t cluster_p,
+            const string &key,
+            const RespCommand &cmd,
+            const RedisCallback& redisCallback = RedisCallback()) :
+        cluster_p_( cluster_p ),
+        redisCallback_( redisCallback ),
+        userErrorCb_( NULL ),
+        errorCodeCb_( NULL ),
+        finishCb_( NULL ),
+        finishData_( NULL ),
+        succeeded_( false ),
+        idempotent_( false ),
+        error_( SUCCESS ),
+        con_( {"", NULL} ),
+        node_( NULL ),
+        slot_( SlotHash::SlotByKey( key.c_str(), key.length() ) ),
+        cmd_( nullptr ),
+        len_( 0 ),
+        type_( SHORT ),
+        scatter_( nullptr ),
+        askingFailed_( false ),
+        visitor_( NULL ) {
+            if(!cluster_p)
+                throw InvalidArgument(nullptr);
+            // builder of the command may be reused right after the call
+            memcpy( reserveCommand( cmd.size() ), cmd.data(), cmd.size() );
+        }
+        
+        AsyncHiredisCommand( typename Cluster::ptr_t cluster_p,
+            const string &key,
+            const ScatterCommand &cmd,
+            const RedisCallback& redisCallback = RedisCallback()) :
+        cluster_p_( cluster_p ),
+        redisCallback_( redisCallback ),
+        userErrorCb_( NULL ),
+        errorCodeCb_( NULL ),
+        finishCb_( NULL ),
+        finishData_( NULL ),
+        succeeded_( false ),
+        idempotent_( false ),
+        error_( SUCCESS ),
+        con_( {"", NULL} ),
+        node_( NULL ),
+        slot_( SlotHash::SlotByKey( key.c_str(), key.length() ) ),
+        cmd_( nullptr ),
+        len_( 0 ),
+        type_( SCATTERED ),
+        scatter_( &cmd ),
+        askingFailed_( false ),
+        visitor_( NULL ) {
+            if(!cluster_p)
+                throw InvalidArgument(nullptr);
+            // hiredis parses all arguments of subscribe commands from the command buffer
+            if( isSubscribe( cmd.name() ) )
+            {
+                char *p = reserveCommand( cmd.size() );
+                for( size_t i = 0; i < cmd.count(); ++i )
+                {
+                    memcpy( p, cmd.iov()[i].iov_base, cmd.iov()[i].iov_len );
+                    p += cmd.iov()[i].iov_len;
+                }
+                scatter_ = nullptr;
+            }
         }
         
         ~AsyncHiredisCommand()
         {
+            // redirection connection is shared with other commands
             if( con_.second != NULL )
             {
-                redisAsyncDisconnect( con_.second );
+                cluster_p_->releaseConnection( con_ );
             }
+            
+            // commands waiting for the finished ones are sent right now
+            if( node_ != NULL )
+                node_->owner->release( *node_, size() );
+            
+            if( type_ == SDS )
+                redisFreeSdsCommand( cmd_ );
+            else if( type_ == FORMATTED_STRING )
+                redisFreeCommand( cmd_ );
+            else if( type_ == COPIED )
+                free( cmd_ );
+            
+            if( finishCb_ != NULL )
+                finishCb_( finishData_, succeeded_ );
+        }
+        
+        // Commands are created and deleted for every call, so their memory is kept
+        // in the free list of the event loop thread instead of going back to malloc
+        static void* operator new( size_t size )
+        {
+            return BlockPool<sizeof(AsyncHiredisCommand)>::allocate( size );
+        }
+        
+        static void operator delete( void *p, size_t size ) noexcept
+        {
+            BlockPool<sizeof(AsyncHiredisCommand)>::release( p, size );
+        }
+        
+        // buffer for a command copied into the command object, short commands
+        // are kept inline
+        char* reserveCommand( size_t size )
+        {
+            if( size <= ShortCommandSize )
+            {
+                cmd_ = shortCmd_;
+                type_ = SHORT;
+            }
+            else
+            {
+                cmd_ = static_cast<char*>( malloc( size ) );
+                if( cmd_ == nullptr )
+                    throw std::bad_alloc();
+                type_ = COPIED;
+            }
+            len_ = static_cast<int>( size );
+            return cmd_;
         }
         
         static void clusterDestructCB(void *data) {
@@ -221,61 +671,220 @@ namespace RedisCluster
             redisAsyncDisconnect( ac );
         }
         
-        inline int process()
+        static ConnectContext& connectContext( typename Cluster::ptr_t cluster_p )
+        {
+            if( cluster_p == NULL || cluster_p->container().data_ == NULL )
+                throw InvalidArgument(nullptr);
+            return *static_cast<ConnectContext*>( cluster_p->container().data_ );
+        }
+        
+        // flow control of connections opened by connect, or NULL for connections of others
+        static FlowNode* flowNode( Connection *con )
+        {
+            if( con->onDisconnect != disconnectCb )
+                return NULL;
+            return static_cast<FlowNode*>( con->data );
+        }
+        
+        inline ErrorCode process()
+        {
+            typename Cluster::SlotConnection con;
+            ErrorCode code = cluster_p_->findConnection( slot_, con );
+            if( code == NODE_NOT_FOUND )
+                return hold();
+            if( code != SUCCESS )
+                return code;
+            return send( con.second );
+        }
+        
+        // slot of a node being reconnected is not in the container,
+        // the command waits for the node
+        ErrorCode hold()
+        {
+            ConnectContext *context = static_cast<ConnectContext*>( cluster_p_->container().data_ );
+            if( context == NULL || context->down.empty() )
+                return NODE_NOT_FOUND;
+            typename DownNodes::iterator found = DefaultContainer<Connection>::findBySlots( slot_, context->down );
+            if( found == context->down.end() )
+                return NODE_NOT_FOUND;
+            
+            Reconnect *r = found->second;
+            FlowNode *node = r->node;
+            if( r->timer == NULL && r->con == NULL && Clock::now() >= r->retryAt )
+                reconnectNow( r );
+            if( context->admit( *node, this, size() ) != FlowControl<AsyncHiredisCommand>::WAIT )
+                return DISCONNECTED;
+            return SUCCESS;
+        }
+        
+        // sends the command to the node or queues it by the flow limits, the command stays
+        // accounted on this node until it is finished, redirected or not
+        ErrorCode send( Connection *con )
+        {
+            FlowNode *node = flowNode( con );
+            if( node != NULL )
+            {
+                switch( node->owner->admit( *node, this, size() ) )
+                {
+                    case FlowControl<AsyncHiredisCommand>::WAIT:
+                        return SUCCESS;
+                    case FlowControl<AsyncHiredisCommand>::REJECT:
+                        return node->suspended ? DISCONNECTED : OVERLOADED;
+                    default:
+                        node_ = node;
+                }
+            }
+            return processHiredisCommand( con ) == REDIS_OK ? SUCCESS : DISCONNECTED;
+        }
+        
+        // queued command admitted by finished ones
+        static void sendQueued( AsyncHiredisCommand<Cluster> *c, FlowNode *node )
+        {
+            c->node_ = node;
+            if( c->processHiredisCommand( static_cast<Connection*>( node->target ) ) != REDIS_OK )
+            {
+                c->handleError( DISCONNECTED, HiredisProcess::FAILED );
+                delete c;
+            }
+        }
+        
+        // queued command of a closed connection
+        static void failQueued( AsyncHiredisCommand<Cluster> *c )
+        {
+            c->handleError( DISCONNECTED, HiredisProcess::FAILED );
+            delete c;
+        }
+        
+        // Idempotent command in flight on a dropped node connection goes back to the queue of
+        // the node. Pending callbacks are called before the disconnect callback, so the node
+        // is suspended here and is reconnected by the disconnect callback
+        bool replay( Connection *con )
+        {
+            if( !idempotent_ || node_ == NULL || node_->closed || node_->target != con || con->c.err == 0 ||
+               ( con->c.flags & REDIS_SUBSCRIBED ) )
+                return false;
+            ConnectContext *context = static_cast<ConnectContext*>( node_->owner );
+            if( !context->reconnect.enabled || !context->reconnect.replayIdempotent )
+                return false;
+            
+            FlowNode *node = node_;
+            node_ = NULL;
+            askingFailed_ = false;
+            context->suspend( *node, context->reconnect.queueLimit );
+            context->requeue( *node, this, size() );
+            return true;
+        }
+        
+        static Result<AsyncHiredisCommand<Cluster>*> start( AsyncHiredisCommand<Cluster> *c ) noexcept
         {
-            typename Cluster::SlotConnection con = cluster_p_->getConnection( key_ );
-            return processHiredisCommand( con.second );
+            ErrorCode code = c->process();
+            if( code != SUCCESS )
+            {
+                delete c;
+                return code;
+            }
+            return c;
         }
         
         inline int processHiredisCommand( Connection* con )
         {
+            if( scatter_ != nullptr )
+                return appendScattered( con );
             return redisAsyncFormattedCommand( con, processCommandReply,
-                static_cast<void*>( this ), cmd_.data(), cmd_.size() );
+                static_cast<void*>( this ), cmd_, len_ );
+        }
+        
+        // hiredis async API takes the command in one buffer, so the first part (with the command
+        // name) is passed to hiredis and the rest is appended to the output buffer directly.
+        // Room for the whole command is reserved first, so appending can't fail after the
+        // callback is registered
+        int appendScattered( Connection* con )
+        {
+            sds obuf = sdsMakeRoomFor( con->c.obuf, scatter_->size() );
+            if( obuf == NULL )
+                return REDIS_ERR;
+            con->c.obuf = obuf;
+            
+            const struct iovec *iov = scatter_->iov();
+            if( redisAsyncFormattedCommand( con, processCommandReply, static_cast<void*>( this ),
+                                           static_cast<const char*>( iov[0].iov_base ), iov[0].iov_len ) != REDIS_OK )
+                return REDIS_ERR;
+            for( size_t i = 1; i < scatter_->count(); ++i )
+                con->c.obuf = sdscatlen( con->c.obuf, iov[i].iov_base, iov[i].iov_len );
+            return REDIS_OK;
+        }
+        
+        // bytes the command takes in the output buffer
+        inline size_t size() const
+        {
+            return scatter_ != nullptr ? scatter_->size() : len_;
         }
         
-        static void runRedisCallback( Connection* con, void *r, void *data )
+        static bool isSubscribe( const StringRef &name )
+        {
+            static const char* const commands[] = {
+                "subscribe", "psubscribe", "ssubscribe", "unsubscribe", "punsubscribe", "sunsubscribe", "monitor"
+            };
+            for( size_t i = 0; i < sizeof( commands ) / sizeof( commands[0] ); ++i )
+            {
+                if( name.size() == strlen( commands[i] ) && strncasecmp( name.data(), commands[i], name.size() ) == 0 )
+                    return true;
+            }
+            return false;
+        }
+        
+        // reply to ASKING sent right before the command, the command itself
+        // is finished in processCommandReply
+        static void askingReply( Connection*, void *r, void *data )
         {
             redisReply *reply = static_cast<redisReply*>(r);
             AsyncHiredisCommand<Cluster>* that = static_cast<AsyncHiredisCommand<Cluster>*>( data );
-            Action commandState = ASK;
-
-            try
+            
+            if( reply == NULL || reply->type != REDIS_REPLY_STATUS || reply->len != 2 ||
+                memcmp( reply->str, "OK", 2 ) != 0 )
             {
-                HiredisProcess::checkCritical(reply, false, false);
-                if( reply->type == REDIS_REPLY_STATUS && string(reply->str) == "OK" )
-                {
-                    if( that->processHiredisCommand( that->con_.second ) != REDIS_OK )
-                    {
-                        throw AskingFailedException(nullptr);
-                    }
-                }
-                else
-                {
-                    throw AskingFailedException(nullptr);
-                }
+                that->askingFailed_ = true;
             }
-            catch ( const ClusterException &ce )
+        }
+        
+        // sends the command to the redirection node, ASKING and the command go in one
+        // write, reply to ASKING is checked by askingReply before the reply to the command comes
+        ErrorCode redirect( string &host, string &port, bool asking )
+        {
+            if( con_.second == NULL )
             {
-                if ( that->userErrorCb_ != NULL && that->userErrorCb_( *that, ce, HiredisProcess::ASK ) == RETRY )
-                {
-                    commandState = RETRY;
-                }
-                else
-                {
-                    commandState = FINISH;
-                }
+                ErrorCode code = cluster_p_->findRedirection( host, port, con_ );
+                if( code != SUCCESS )
+                    return code;
             }
             
-            if( commandState == RETRY )
+            if( asking )
             {
-                retry( con, r, data );
+                if( redisAsyncCommand( con_.second, askingReply, this, "ASKING" ) != REDIS_OK ||
+                    processHiredisCommand( con_.second ) != REDIS_OK )
+                    return ASKING_FAILED;
             }
-            else if( commandState == FINISH )
+            else if( processHiredisCommand( con_.second ) != REDIS_OK )
             {
-                that->runRedisCallback( *reply );
-                if( !( con->c.flags & ( REDIS_SUBSCRIBED ) ) )
-                    delete that;
+                return MOVED_FAILED;
             }
+            return SUCCESS;
+        }
+        
+        // passes the error to the error code callback or to the user error callback,
+        // exception object is created only for the user error callback and is never thrown
+        Action handleError( ErrorCode code, HiredisProcess::processState state )
+        {
+            error_ = code;
+            if( errorCodeCb_ != NULL )
+                return errorCodeCb_( *this, code, state );
+            if( userErrorCb_ != NULL )
+            {
+                return ErrorCodes::withException( code, [&]( const ClusterException &e ) {
+                    return userErrorCb_( *this, e, state );
+                } );
+            }
+            return FINISH;
         }
         
         static void processCommandReply( Connection* con, void *r, void *data )
@@ -284,44 +893,59 @@ namespace RedisCluster
             AsyncHiredisCommand<Cluster>* that = static_cast<AsyncHiredisCommand<Cluster>*>( data );
             Action commandState = FINISH;
             HiredisProcess::processState state = HiredisProcess::FAILED;
+            ErrorCode code = SUCCESS;
             string host, port;
             
-            try {
-                HiredisProcess::checkCritical( reply, false, false );
-                state = HiredisProcess::processResult( reply, host, port);
+            if( reply == NULL && that->replay( con ) )
+                return;
+            
+            if( that->askingFailed_ )
+            {
+                that->askingFailed_ = false;
+                state = HiredisProcess::ASK;
+                code = ASKING_FAILED;
+            }
+            else
+            {
+                code = HiredisProcess::checkReply( reply );
+            }
+            
+            if( code == SUCCESS )
+            {
+                state = HiredisProcess::redirection( reply, host, port );
                 switch (state) {
                     case HiredisProcess::ASK:
-                        if( that->con_.second == NULL )
-                            that->con_ = that->cluster_p_->createNewConnection( host, port );
-                        if ( redisAsyncCommand( that->con_.second, runRedisCallback, that, "ASKING" ) == REDIS_OK )
+                        code = that->redirect( host, port, true );
+                        if( code == SUCCESS )
                             commandState = ASK;
-                        else
-                            throw AskingFailedException(nullptr);
                         break;
                     case HiredisProcess::MOVED:
-                        that->cluster_p_->moved();
-                        if( that->con_.second == NULL )
-                            that->con_ = that->cluster_p_->createNewConnection( host, port );
-                        if( that->processHiredisCommand( that->con_.second ) == REDIS_OK )
+                        try
+                        {
+                            // moved callback may throw to abort the redirection
+                            that->cluster_p_->moved();
+                            code = that->redirect( host, port, false );
+                        }
+                        catch( const ClusterException &ce )
+                        {
+                            code = ErrorCodes::fromException( ce );
+                        }
+                        if( code == SUCCESS )
                             commandState = REDIRECT;
-                        else
-                            throw MovedFailedException(nullptr);
                         break;
                     case HiredisProcess::READY:
                         break;
                     case HiredisProcess::CLUSTERDOWN:
-                        throw ClusterDownException(nullptr);
-
+                        code = CLUSTER_DOWN;
+                        break;
                     default:
-                        throw LogicError(nullptr);
+                        code = LOGIC_ERROR;
                 }
             }
-            catch ( const ClusterException &ce )
+            
+            if( code != SUCCESS && that->handleError( code, state ) == RETRY )
             {
-                if ( that->userErrorCb_ != NULL && that->userErrorCb_( *that, ce, state ) == RETRY )
-                {
-                    commandState = RETRY;
-                }
+                commandState = RETRY;
             }
             
             if( commandState == RETRY )
@@ -330,7 +954,13 @@ namespace RedisCluster
             }
             else if( commandState == FINISH )
             {
-                that->runRedisCallback( *reply );
+                if( reply != NULL && that->visitor_ != NULL && reply->type == REDIS_REPLY_ERROR )
+                    that->visitor_->onError( StringRef( reply->str, reply->len ) );
+                if( reply != NULL )
+                {
+                    that->succeeded_ = code == SUCCESS && reply->type != REDIS_REPLY_ERROR;
+                    that->runRedisCallback( *reply );
+                }
                 if( !( con->c.flags & ( REDIS_SUBSCRIBED ) ) )
                     delete that;
             }
@@ -342,19 +972,150 @@ namespace RedisCluster
             
             if( that->processHiredisCommand( con ) != REDIS_OK )
             {
-                // XXX check NULL
-                that->userErrorCb_( *that, DisconnectedException(), HiredisProcess::FAILED );
-                assert(r);
-                redisReply *reply = static_cast< redisReply* >(r);
-                that->runRedisCallback( *reply );
+                that->handleError( DISCONNECTED, HiredisProcess::FAILED );
+                if( r != NULL )
+                    that->runRedisCallback( *static_cast< redisReply* >(r) );
                 delete that;
             }
         }
         
         static void disconnectCb(const struct redisAsyncContext*ctx, int status) {
-            ConnectContext *context = static_cast<ConnectContext*>(ctx->data);
+            connectionClosed( ctx, status );
+        }
+        
+        // connections failed to connect are freed without disconnect callback
+        static void connectCb(const struct redisAsyncContext*ctx, int status) {
+            if( status != REDIS_OK )
+            {
+                connectionClosed( ctx, status );
+                return;
+            }
+            
+            FlowNode *node = static_cast<FlowNode*>(ctx->data);
+            ConnectContext *context = static_cast<ConnectContext*>(node->owner);
+            Reconnect *r = context->reconnecting( node );
+            if( r != NULL && r->con == ctx )
+                reconnected( r );
+        }
+        
+        // Pending callbacks of the connection are called already, so only queued commands are
+        // left on its node. Node connections dropped with an error are restored by the
+        // reconnect policy, closed and redirection connections are just forgotten
+        static void connectionClosed( const redisAsyncContext *ctx, int status )
+        {
+            FlowNode *node = static_cast<FlowNode*>(ctx->data);
+            ConnectContext *context = static_cast<ConnectContext*>(node->owner);
             context->lifetime--;
+            
+            Reconnect *r = context->reconnecting( node );
+            if( r != NULL )
+            {
+                r->con = NULL;
+                scheduleReconnect( r );
+                return;
+            }
+            
+            typename Cluster::SlotRange range;
+            bool restore = status != REDIS_OK && context->reconnect.enabled &&
+                ctx->c.connection_type == REDIS_CONN_TCP && ctx->c.tcp.host != NULL &&
+                context->pcluster->container().findSlots( ctx, range );
             context->pcluster->deleteConnection(ctx);
+            if( !restore || !startReconnect( context, node, range, ctx->c.tcp.host, ctx->c.tcp.port ) )
+                context->closeNode(node);
+        }
+        
+        static bool startReconnect( ConnectContext *context, FlowNode *node,
+                                   const typename Cluster::SlotRange &range, const char *host, int port )
+        {
+            Reconnect *r = nullptr;
+            try
+            {
+                r = new Reconnect;
+                r->context = context;
+                r->node = node;
+                r->range = range;
+                r->host = host;
+                r->port = port;
+                r->attempt = 0;
+                r->timer = NULL;
+                r->con = NULL;
+                context->down.insert( typename DownNodes::value_type( range, r ) );
+            }
+            catch( ... )
+            {
+                delete r;
+                return false;
+            }
+            context->suspend( *node, context->reconnect.queueLimit );
+            scheduleReconnect( r );
+            return true;
+        }
+        
+        static void scheduleReconnect( Reconnect *r )
+        {
+            ConnectContext *context = r->context;
+            const ReconnectPolicy &policy = context->reconnect;
+            if( !policy.enabled || ( policy.maxAttempts != 0 && r->attempt >= policy.maxAttempts ) )
+            {
+                giveUp( r );
+                return;
+            }
+            
+            std::chrono::milliseconds delay = policy.delay( r->attempt++, context->random );
+            r->timer = context->adapter->startTimer( static_cast<long>( delay.count() ), reconnectTimer, r );
+            if( r->timer == NULL )
+                r->retryAt = Clock::now() + delay;
+        }
+        
+        static void reconnectTimer( void *data )
+        {
+            Reconnect *r = static_cast<Reconnect*>( data );
+            r->timer = NULL;
+            reconnectNow( r );
+        }
+        
+        static void reconnectNow( Reconnect *r )
+        {
+            try
+            {
+                r->con = open( r->host.c_str(), r->port, r->context, r->node );
+            }
+            catch( ... )
+            {
+                scheduleReconnect( r );
+            }
+        }
+        
+        // the node serves its slots again, held commands are sent
+        static void reconnected( Reconnect *r )
+        {
+            ConnectContext *context = r->context;
+            Connection *con = r->con;
+            try
+            {
+                context->pcluster->container().insert( r->range, con );
+            }
+            catch( ... )
+            {
+                // reconnected once more by the disconnect callback
+                redisAsyncDisconnect( con );
+                return;
+            }
+            
+            FlowNode *node = r->node;
+            context->down.erase( r->range );
+            delete r;
+            context->resume( *node, con );
+        }
+        
+        // held commands of the node fail, its slots are not served any more
+        static void giveUp( Reconnect *r )
+        {
+            ConnectContext *context = r->context;
+            FlowNode *node = r->node;
+            context->down.erase( r->range );
+            delete r;
+            context->closeNode( node );
         }
         
         static Connection* connect( const char* host, int port, void *data )
@@ -362,18 +1123,271 @@ namespace RedisCluster
             ConnectContext *context = static_cast<ConnectContext*>(data);
             if ( context == NULL || context->adapter == NULL )
                 throw ConnectionFailedException(nullptr);
-
+            return open( host, port, context, NULL );
+        }
+        
+        // connection with a new flow node, or with the node of a reconnected one
+        static Connection* open( const char* host, int port, ConnectContext *context, FlowNode *node )
+        {
             Connection *con = redisAsyncConnect( host, port );
             if( con == NULL || con->err != 0 ||
                 context->adapter->attachContext( *con ) != REDIS_OK )
+            {
+                if( con != NULL )
+                    redisAsyncFree( con );
                 throw ConnectionFailedException(nullptr);
+            }
 
             context->lifetime++;
-            con->data = static_cast<void*>(context);
+            con->data = static_cast<void*>( node != NULL ? node : context->openNode( con ) );
+            // every reply tree is allocated from its own arena freed by hiredis after callback,
+            // replies to streamed commands are passed to visitors
+            con->c.reader->fn = streamFunctions();
+            con->c.reader->privdata = con;
+            redisAsyncSetConnectCallback(con, connectCb);
             redisAsyncSetDisconnectCallback(con, disconnectCb);
             return con;
         }
 
+        // Reader functions of async connections. Reader privdata is the connection, so the
+        // command waiting for the reply being parsed is the head of the callback list
+        static redisReplyObjectFunctions* streamFunctions()
+        {
+            static redisReplyObjectFunctions fn = {
+                streamString,
+                streamArray,
+                streamInteger,
+#if HIREDIS_MAJOR >= 1
+                streamDouble,
+#endif
+                streamNil,
+#if HIREDIS_MAJOR >= 1
+                streamBool,
+#endif
+                ReplyArena::ownedFunctions()->freeObject
+            };
+            return &fn;
+        }
+        
+        // visitor of the reply being parsed, or NULL if the reply tree must be built
+        static ReplyVisitor* visitorOf( const redisReadTask *task )
+        {
+            Connection *ac = static_cast<Connection*>( task->privdata );
+            if( ac == NULL || ( ac->c.flags & REDIS_SUBSCRIBED ) ||
+                ac->replies.head == NULL || ac->replies.head->fn != processCommandReply )
+                return NULL;
+            
+            const redisReadTask *root = task;
+            while( root->parent != NULL )
+                root = root->parent;
+            // top-level errors are processed as usual for redirections
+            if( root->type == REDIS_REPLY_ERROR )
+                return NULL;
+#ifdef REDIS_REPLY_PUSH
+            if( root->type == REDIS_REPLY_PUSH )
+                return NULL;
+#endif
+            return static_cast<AsyncHiredisCommand<Cluster>*>( ac->replies.head->privdata )->visitor_;
+        }
+        
+        // Elements of a top-level array already received completely are parsed by RespParser
+        // into the arena of the array. Their data in the reader buffer is replaced with
+        // one empty status ("+\r\n", shorter than any element) per element, so hiredis
+        // only passes over the placeholders and prebuilt returns the parsed elements
+        static void prebuild( const redisReadTask *task, redisReply *r )
+        {
+            Connection *ac = static_cast<Connection*>( task->privdata );
+            if( ac == NULL )
+                return;
+            redisReader *reader = ac->c.reader;
+            try
+            {
+                RespParser parser;
+                const char *data = reader->buf + reader->pos;
+                size_t len = reader->len - reader->pos;
+                long used = parser.scanElements( data, len, r->elements );
+                if( used <= 0 )
+                    return;
+                parser.buildElements( data, used, r->element, r->elements, *ReplyArena::ownerOf( r ) );
+                
+                size_t placeholders = reader->pos + used - 3 * r->elements;
+                for( size_t i = 0; i < r->elements; ++i )
+                    memcpy( reader->buf + placeholders + 3 * i, "+\r\n", 3 );
+                reader->pos = placeholders;
+            }
+            catch( const std::bad_alloc & )
+            {
+                // elements are parsed by hiredis then
+                memset( r->element, 0, r->elements * sizeof( redisReply* ) );
+            }
+        }
+        
+        // parsed element of a top-level array for its placeholder, or NULL
+        static redisReply* prebuilt( const redisReadTask *task )
+        {
+            if( task->parent == NULL || task->parent->parent != NULL || task->type != REDIS_REPLY_STATUS )
+                return NULL;
+            redisReply *parent = static_cast<redisReply*>( task->parent->obj );
+            return parent->element[task->idx];
+        }
+        
+        // top-level reply is an empty object of its type freed by hiredis,
+        // elements are not allocated at all
+        static void* placeholder( const redisReadTask *task )
+        {
+            static char element;
+            if( task->parent != NULL )
+                return &element;
+            return ReplyArena::ownedFunctions()->createArray( task, 0 );
+        }
+        
+        // element is complete, so are the arrays it is the last element of
+        static void* complete( ReplyVisitor &visitor, const redisReadTask *task )
+        {
+            void *obj = placeholder( task );
+            while( task->parent != NULL && task->idx == task->parent->elements - 1 )
+            {
+                visitor.onArrayEnd();
+                task = task->parent;
+            }
+            return obj;
+        }
+        
+        // visitors must not throw into the C parser, exception is reported
+        // to hiredis as NULL object and the connection fails
+        static void* streamString( const redisReadTask *task, char *str, size_t len )
+        {
+            ReplyVisitor *visitor = visitorOf( task );
+            if( visitor == NULL )
+            {
+                if( redisReply *element = prebuilt( task ) )
+                    return element;
+                return ReplyArena::ownedFunctions()->createString( task, str, len );
+            }
+            try
+            {
+                switch( task->type )
+                {
+                    case REDIS_REPLY_ERROR:
+                        visitor->onError( StringRef( str, len ) );
+                        break;
+                    case REDIS_REPLY_STATUS:
+#ifdef REDIS_REPLY_BIGNUM
+                    case REDIS_REPLY_BIGNUM:
+#endif
+                        visitor->onStatus( StringRef( str, len ) );
+                        break;
+                    default:
+#ifdef REDIS_REPLY_VERB
+                        // format prefix of verbatim strings is dropped as in hiredis replies
+                        if( task->type == REDIS_REPLY_VERB && len >= 4 )
+                        {
+                            str += 4;
+                            len -= 4;
+                        }
+#endif
+                        visitor->onBulkBegin( len );
+                        visitor->onBulkChunk( StringRef( str, len ) );
+                        visitor->onBulkEnd();
+                }
+                return complete( *visitor, task );
+            }
+            catch( ... )
+            {
+                return NULL;
+            }
+        }
+        
+        static void* streamArray( const redisReadTask *task, ReplyArena::ArrayLength elements )
+        {
+            ReplyVisitor *visitor = visitorOf( task );
+            if( visitor == NULL )
+            {
+                redisReply *r = static_cast<redisReply*>( ReplyArena::ownedFunctions()->createArray( task, elements ) );
+                if( r != NULL && task->parent == NULL && elements > 0 && RespParser::enabled() )
+                    prebuild( task, r );
+                return r;
+            }
+            try
+            {
+                visitor->onArray( elements );
+                if( elements > 0 )
+                    return placeholder( task );
+                visitor->onArrayEnd();
+                return complete( *visitor, task );
+            }
+            catch( ... )
+            {
+                return NULL;
+            }
+        }
+        
+        static void* streamInteger( const redisReadTask *task, long long value )
+        {
+            ReplyVisitor *visitor = visitorOf( task );
+            if( visitor == NULL )
+                return ReplyArena::ownedFunctions()->createInteger( task, value );
+            try
+            {
+                visitor->onInteger( value );
+                return complete( *visitor, task );
+            }
+            catch( ... )
+            {
+                return NULL;
+            }
+        }
+        
+#if HIREDIS_MAJOR >= 1
+        static void* streamDouble( const redisReadTask *task, double value, char *str, size_t len )
+        {
+            ReplyVisitor *visitor = visitorOf( task );
+            if( visitor == NULL )
+                return ReplyArena::ownedFunctions()->createDouble( task, value, str, len );
+            try
+            {
+                visitor->onStatus( StringRef( str, len ) );
+                return complete( *visitor, task );
+            }
+            catch( ... )
+            {
+                return NULL;
+            }
+        }
+        
+        static void* streamBool( const redisReadTask *task, int value )
+        {
+            ReplyVisitor *visitor = visitorOf( task );
+            if( visitor == NULL )
+                return ReplyArena::ownedFunctions()->createBool( task, value );
+            try
+            {
+                visitor->onInteger( value != 0 );
+                return complete( *visitor, task );
+            }
+            catch( ... )
+            {
+                return NULL;
+            }
+        }
+#endif
+        
+        static void* streamNil( const redisReadTask *task )
+        {
+            ReplyVisitor *visitor = visitorOf( task );
+            if( visitor == NULL )
+                return ReplyArena::ownedFunctions()->createNil( task );
+            try
+            {
+                visitor->onNil();
+                return complete( *visitor, task );
+            }
+            catch( ... )
+            {
+                return NULL;
+            }
+        }
+
     private:
         void runRedisCallback( const redisReply& reply ) const
         {
@@ -389,13 +1403,34 @@ namespace RedisCluster
         RedisCallback redisCallback_;
         // user error handler
         userErrorCallbackFn *userErrorCb_;
+        // user error handler of the non-throwing API
+        errorCodeCallbackFn *errorCodeCb_;
+        // completion handler of batches
+        finishCallbackFn *finishCb_;
+        void *finishData_;
+        bool succeeded_;
+        // command may be sent again after reconnect
+        bool idempotent_;
+        ErrorCode error_;
         
-        // pointer to async context ( in case of redirection class creates new connection )
+        // connection to the redirection target taken from the cluster, or NULL
         typename Cluster::HostConnection con_;
+        // node the command is accounted on while in flight, or NULL
+        FlowNode *node_;
 
-        // key of redis command to find proper cluster node
-        string key_;
-        string cmd_;
+        // slot of the command key to find proper cluster node
+        typename Cluster::SlotIndex slot_;
+        // formatted command, owned according to its type
+        char *cmd_;
+        int len_;
+        CommandType type_;
+        char shortCmd_[ShortCommandSize];
+        // command with parts in the caller's memory, or nullptr if cmd_ is used
+        const ScatterCommand *scatter_;
+        // set when ASKING sent before the command is not acknowledged
+        bool askingFailed_;
+        // receiver of the streamed reply, or NULL if the reply tree is built
+        ReplyVisitor *visitor_;
     };
 }
 
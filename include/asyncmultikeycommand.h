@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__asyncmultikeycommand__
+#define __libredisCluster__asyncmultikeycommand__
+
+#include <map>
+#include <utility>
+#include <vector>
+#include <string.h>
+
+#include "asyncbatch.h"
+#include "asynchirediscommand.h"
+#include "replyarena.h"
+#include "respcommand.h"
+
+namespace RedisCluster
+{
+    using std::string;
+
+    // Asynchronous multi-key commands (MGET, MSET, DEL, EXISTS, UNLINK) with keys in different slots.
+    // Keys are split by slot, as cluster nodes refuse multi-key commands across slots, and the
+    // sub-commands of one node are sent in one write. Every sub-command follows redirections
+    // on its own. The callback gets one reply merged in the order of input keys, or the first
+    // error reply of sub-commands. Sub-commands finished without a reply make an error reply
+    // with the message of their error code
+    //
+    //   AsyncMultiKeyCommand<>::MGet( cluster_p, keys, []( const redisReply &reply ) { ... } );
+    template < typename Cluster = Cluster<redisAsyncContext> >
+    class AsyncMultiKeyCommand
+    {
+        typedef typename Cluster::SlotIndex SlotIndex;
+        typedef AsyncHiredisCommand<Cluster> Command;
+
+        enum MergeType
+        {
+            MERGE_ARRAY,
+            MERGE_SUM,
+            MERGE_STATUS
+        };
+
+        struct State;
+
+    public:
+        // reply is valid only during the call, must not throw
+        typedef SmallFunction<void (const redisReply &reply)> Callback;
+
+    private:
+        // keys of one slot sent as one sub-command
+        struct Part
+        {
+            Part() : state( nullptr ), command( nullptr ), reply( nullptr ), arena( nullptr ), error( SUCCESS ) {}
+
+            State *state;
+            // positions of keys in the input
+            std::vector<size_t> positions;
+            Command *command;
+            // reply kept after the callback of the sub-command with its arena
+            redisReply *reply;
+            ReplyArena *arena;
+            ErrorCode error;
+        };
+
+        typedef std::map<SlotIndex, Part> Parts;
+
+        struct State
+        {
+            State( const char *n, MergeType m, size_t keys ) :
+            name( n ), merge( m ), keyCount( keys ), pending( 0 ) {}
+
+            ~State()
+            {
+                for( typename Parts::iterator it = parts.begin(); it != parts.end(); ++it )
+                    delete it->second.arena;
+            }
+
+            const char *name;
+            Callback callback;
+            MergeType merge;
+            size_t keyCount;
+            Parts parts;
+            // unfinished sub-commands and one more for the sending
+            size_t pending;
+            // merged reply and error replies
+            ReplyArena arena;
+        };
+
+        AsyncMultiKeyCommand() = delete;
+
+    public:
+        // Commands return the first error of sending. The callback is called in any case,
+        // for a command failed completely it is called before return. Only invalid
+        // arguments are returned without the callback
+
+        // array reply with values in the order of keys
+        static ErrorCode MGet( typename Cluster::ptr_t cluster_p,
+                              const std::vector<string> &keys,
+                              const Callback &callback )
+        {
+            return start( cluster_p, "MGET", MERGE_ARRAY, keys, callback );
+        }
+
+        // status reply, or the first error reply of sub-commands
+        static ErrorCode MSet( typename Cluster::ptr_t cluster_p,
+                              const std::vector< std::pair<string, string> > &keyValues,
+                              const Callback &callback )
+        {
+            if( keyValues.empty() )
+                return INVALID_ARGUMENT;
+            std::vector<const string*> args;
+            args.reserve( keyValues.size() * 2 );
+            for( size_t i = 0; i < keyValues.size(); ++i )
+            {
+                args.push_back( &keyValues[i].first );
+                args.push_back( &keyValues[i].second );
+            }
+            return start( cluster_p, "MSET", MERGE_STATUS, args, 2, callback );
+        }
+
+        // integer reply with the number of deleted keys
+        static ErrorCode Del( typename Cluster::ptr_t cluster_p,
+                             const std::vector<string> &keys,
+                             const Callback &callback )
+        {
+            return start( cluster_p, "DEL", MERGE_SUM, keys, callback );
+        }
+
+        // integer reply with the number of existing keys
+        static ErrorCode Exists( typename Cluster::ptr_t cluster_p,
+                                const std::vector<string> &keys,
+                                const Callback &callback )
+        {
+            return start( cluster_p, "EXISTS", MERGE_SUM, keys, callback );
+        }
+
+        // integer reply with the number of unlinked keys
+        static ErrorCode Unlink( typename Cluster::ptr_t cluster_p,
+                                const std::vector<string> &keys,
+                                const Callback &callback )
+        {
+            return start( cluster_p, "UNLINK", MERGE_SUM, keys, callback );
+        }
+
+    protected:
+
+        static ErrorCode start( typename Cluster::ptr_t cluster_p, const char *name, MergeType merge,
+                               const std::vector<string> &keys, const Callback &callback )
+        {
+            if( keys.empty() )
+                return INVALID_ARGUMENT;
+            std::vector<const string*> args;
+            args.reserve( keys.size() );
+            for( size_t i = 0; i < keys.size(); ++i )
+                args.push_back( &keys[i] );
+            return start( cluster_p, name, merge, args, 1, callback );
+        }
+
+        // keys (or keys and values) are copied into the sub-commands, so they
+        // may be freed right after the call
+        static ErrorCode start( typename Cluster::ptr_t cluster_p, const char *name, MergeType merge,
+                               const std::vector<const string*> &args, size_t argsPerKey,
+                               const Callback &callback )
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+
+            State *state = nullptr;
+            std::vector<Command*> commands;
+            try
+            {
+                state = new State( name, merge, args.size() / argsPerKey );
+                state->callback = callback;
+                split( *state, args, argsPerKey );
+                commands.reserve( state->parts.size() );
+
+                RespCommand cmd;
+                std::vector<const char*> argv;
+                std::vector<size_t> argvlen;
+                for( typename Parts::iterator it = state->parts.begin(); it != state->parts.end(); ++it )
+                {
+                    Part &part = it->second;
+                    part.state = state;
+                    argv.assign( 1, name );
+                    argvlen.assign( 1, strlen( name ) );
+                    for( size_t i = 0; i < part.positions.size(); ++i )
+                    {
+                        for( size_t j = 0; j < argsPerKey; ++j )
+                        {
+                            const string *arg = args[ part.positions[i] * argsPerKey + j ];
+                            argv.push_back( arg->data() );
+                            argvlen.push_back( arg->length() );
+                        }
+                    }
+                    cmd.formatArgv( (int)argv.size(), argv.data(), argvlen.data() );
+
+                    Part *p = &part;
+                    part.command = new Command( cluster_p, *args[ part.positions[0] * argsPerKey ], cmd,
+                                               [p]( const redisReply &reply ) { keep( *p, reply ); } );
+                    commands.push_back( part.command );
+                }
+            }
+            catch( ... )
+            {
+                for( size_t i = 0; i < commands.size(); ++i )
+                    delete commands[i];
+                delete state;
+                return ErrorCodes::current();
+            }
+
+            state->pending = commands.size() + 1;
+            for( typename Parts::iterator it = state->parts.begin(); it != state->parts.end(); ++it )
+                it->second.command->setFinishCb( finished, &it->second );
+
+            ErrorCode result = AsyncBatch<Cluster>::submit( cluster_p, commands );
+            done( state );
+            return result;
+        }
+
+        static void split( State &state, const std::vector<const string*> &args, size_t argsPerKey )
+        {
+            for( size_t i = 0; i < state.keyCount; ++i )
+            {
+                const string &key = *args[ i * argsPerKey ];
+                state.parts[ SlotHash::SlotByKey( key.data(), (int)key.length() ) ].positions.push_back( i );
+            }
+        }
+
+        // replies of async commands are freed by hiredis after the callback,
+        // so the reply is taken with its arena
+        static void keep( Part &part, const redisReply &reply )
+        {
+            part.arena = ReplyArena::detach( &reply );
+            part.reply = const_cast<redisReply*>( &reply );
+        }
+
+        static void finished( void *data, bool )
+        {
+            Part *part = static_cast<Part*>( data );
+            if( part->reply == nullptr )
+                part->error = part->command->error() != SUCCESS ? part->command->error() : DISCONNECTED;
+            part->command = nullptr;
+            done( part->state, part );
+        }
+
+        // the part finished last may have the reply hiredis is about to free, its arena
+        // goes back to the reply instead of being freed with the state
+        static void done( State *state, Part *last = nullptr )
+        {
+            if( --state->pending != 0 )
+                return;
+            const redisReply *reply = merge( *state );
+            if( state->callback )
+                state->callback( *reply );
+            if( last != nullptr && last->arena != nullptr )
+            {
+                ReplyArena::attach( last->reply, last->arena );
+                last->arena = nullptr;
+            }
+            delete state;
+        }
+
+        static redisReply* merge( State &state )
+        {
+            typename Parts::iterator it;
+            // the first error of sub-commands is the reply to the whole command
+            for( it = state.parts.begin(); it != state.parts.end(); ++it )
+            {
+                if( it->second.reply == nullptr )
+                    return errorReply( state, errorMessage( it->second.error ) );
+                if( it->second.reply->type == REDIS_REPLY_ERROR )
+                    return it->second.reply;
+            }
+
+            if( state.merge == MERGE_STATUS )
+                return state.parts.begin()->second.reply;
+
+            try
+            {
+                if( state.merge == MERGE_SUM )
+                {
+                    redisReply *result = state.arena.createReply( REDIS_REPLY_INTEGER );
+                    for( it = state.parts.begin(); it != state.parts.end(); ++it )
+                    {
+                        if( it->second.reply->type != REDIS_REPLY_INTEGER )
+                            return errorReply( state, "unexpected reply type of multi-key command" );
+                        result->integer += it->second.reply->integer;
+                    }
+                    return result;
+                }
+
+                redisReply *result = state.arena.createReply( REDIS_REPLY_ARRAY );
+                result->element = static_cast<redisReply**>( state.arena.allocate( state.keyCount * sizeof(redisReply*) ) );
+                result->elements = state.keyCount;
+                for( it = state.parts.begin(); it != state.parts.end(); ++it )
+                {
+                    Part &part = it->second;
+                    if( part.reply->type != REDIS_REPLY_ARRAY || part.reply->elements != part.positions.size() )
+                        return errorReply( state, "unexpected reply type of multi-key command" );
+                    // elements stay in the arenas of replies of sub-commands
+                    for( size_t i = 0; i < part.positions.size(); ++i )
+                        result->element[ part.positions[i] ] = part.reply->element[i];
+                }
+                return result;
+            }
+            catch( const std::bad_alloc & )
+            {
+                return errorReply( state, errorMessage( OUT_OF_MEMORY ) );
+            }
+        }
+
+        // error reply allocated statically if the arena is out of memory
+        static redisReply* errorReply( State &state, const char *message )
+        {
+            static char outOfMemory[] = "out of memory";
+            static redisReply failed;
+            try
+            {
+                size_t len = strlen( message );
+                redisReply *r = state.arena.createReply( REDIS_REPLY_ERROR );
+                r->str = static_cast<char*>( state.arena.allocate( len + 1 ) );
+                memcpy( r->str, message, len + 1 );
+                r->len = len;
+                return r;
+            }
+            catch( const std::bad_alloc & )
+            {
+                failed.type = REDIS_REPLY_ERROR;
+                failed.str = outOfMemory;
+                failed.len = sizeof( outOfMemory ) - 1;
+                return &failed;
+            }
+        }
+    };
+}
+
+#endif /* defined(__libredisCluster__asyncmultikeycommand__) */
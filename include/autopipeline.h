@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __libredisCluster__autopipeline__
+#define __libredisCluster__autopipeline__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdarg.h>
+#include <stdlib.h>
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+#include "cluster.h"
+#include "hiredisio.h"
+#include "hiredisprocess.h"
+#include "respcommand.h"
+
+namespace RedisCluster
+{
+    using std::string;
+
+    // Synchronous commands of many threads sharing one connection per node. Commands issued
+    // to a node while another thread waits for replies are queued, and the next thread doing
+    // I/O on the node writes all queued commands at once and reads the replies in order.
+    // Every caller is woken up when its reply is read, the I/O is then handed to a thread
+    // still waiting for a reply. So concurrent commands to a node share writes and round trips
+    // without more connections.
+    //
+    // The pipeline takes connections of nodes from the cluster and uses them exclusively,
+    // so the cluster (DefaultContainer) must not be used by other commands at the same time.
+    // Commands waiting on a failed connection get DisconnectedException, and the next command
+    // to the node takes a new connection from the cluster.
+    // Replies are freed by the caller with freeReplyObject
+    //
+    //   AutoPipeline<> pipeline( cluster_p );
+    //   // in any thread
+    //   redisReply *reply = static_cast<redisReply*>( pipeline.Command( "FOO", "GET %s", "FOO" ) );
+    template < typename Cluster = Cluster<redisContext> >
+    class AutoPipeline
+    {
+        typedef typename Cluster::SlotIndex SlotIndex;
+        typedef typename Cluster::SlotConnection SlotConnection;
+        typedef typename Cluster::HostConnection HostConnection;
+
+        static const SlotIndex SlotCount = 16384;
+
+        // command of one caller waiting in the queue of a node
+        struct Request
+        {
+            Request( const char *c, size_t l ) :
+            cmd( c ), len( l ), reply( nullptr ), done( false ), failed( false ) {}
+
+            const char *cmd;
+            size_t len;
+            redisReply *reply;
+            bool done;
+            bool failed;
+            std::condition_variable cv;
+        };
+
+        // shared connection of a node with commands queued for writing
+        // and commands written and waiting for replies
+        class Channel
+        {
+            Channel(const Channel&) = delete;
+            Channel& operator=(const Channel&) = delete;
+
+        public:
+            explicit Channel( redisContext *con ) :
+            con_( con ),
+            busy_( false ),
+            failed_( false ),
+            commands_( 0 ),
+            writes_( 0 )
+            {
+            }
+
+            // returns when the reply to the request is read or the connection failed
+            void run( Request &req )
+            {
+                std::unique_lock<std::mutex> locker( lock_ );
+                if( failed_ )
+                {
+                    req.failed = true;
+                    return;
+                }
+                queued_.push_back( &req );
+
+                while( !req.done )
+                {
+                    if( busy_ )
+                    {
+                        req.cv.wait( locker );
+                        continue;
+                    }
+                    busy_ = true;
+
+                    // all queued commands are appended and written together
+                    size_t batch = 0;
+                    while( !queued_.empty() )
+                    {
+                        Request *r = queued_.front();
+                        queued_.pop_front();
+                        redisAppendFormattedCommand( con_, r->cmd, r->len );
+                        inflight_.push_back( r );
+                        ++batch;
+                    }
+                    size_t expected = inflight_.size();
+                    commands_ += batch;
+                    if( batch > 0 )
+                        ++writes_;
+                    locker.unlock();
+
+                    std::vector<redisReply*> &replies = replies_;
+                    int status = read( expected, batch > 0, replies );
+
+                    locker.lock();
+                    for( size_t i = 0; i < replies.size(); ++i )
+                    {
+                        Request *r = inflight_.front();
+                        inflight_.pop_front();
+                        r->reply = replies[i];
+                        r->done = true;
+                        r->cv.notify_one();
+                    }
+                    replies.clear();
+                    if( status != REDIS_OK )
+                        fail();
+                    busy_ = false;
+                }
+
+                // I/O is handed over to the next thread waiting for a reply
+                Request *next = !inflight_.empty() ? inflight_.front() :
+                    ( !queued_.empty() ? queued_.front() : nullptr );
+                if( next != nullptr )
+                    next->cv.notify_one();
+            }
+
+            inline size_t commands() const { return commands_; }
+            inline size_t writes() const { return writes_; }
+            inline redisContext* connection() const { return con_; }
+
+        private:
+            // writes the output buffer and reads the first reply and all other
+            // replies that are already received, without lock
+            int read( size_t expected, bool write, std::vector<redisReply*> &replies )
+            {
+                if( write && HiredisIO::flush( con_ ) != REDIS_OK )
+                    return REDIS_ERR;
+
+                void *reply = nullptr;
+                if( redisGetReply( con_, &reply ) != REDIS_OK )
+                    return REDIS_ERR;
+                replies.push_back( static_cast<redisReply*>( reply ) );
+
+                while( replies.size() < expected )
+                {
+                    reply = nullptr;
+                    if( redisGetReplyFromReader( con_, &reply ) != REDIS_OK )
+                        return REDIS_ERR;
+                    if( reply == nullptr )
+                        break;
+                    replies.push_back( static_cast<redisReply*>( reply ) );
+                }
+                return REDIS_OK;
+            }
+
+            // connection is broken, all waiting callers get the error
+            void fail()
+            {
+                failed_ = true;
+                while( !inflight_.empty() )
+                {
+                    finishFailed( inflight_.front() );
+                    inflight_.pop_front();
+                }
+                while( !queued_.empty() )
+                {
+                    finishFailed( queued_.front() );
+                    queued_.pop_front();
+                }
+            }
+
+            static void finishFailed( Request *r )
+            {
+                r->failed = true;
+                r->done = true;
+                r->cv.notify_one();
+            }
+
+            redisContext *con_;
+            std::mutex lock_;
+            std::deque<Request*> queued_;
+            std::deque<Request*> inflight_;
+            // replies read by the thread doing I/O, reused between batches
+            std::vector<redisReply*> replies_;
+            bool busy_;
+            bool failed_;
+            std::atomic<size_t> commands_;
+            std::atomic<size_t> writes_;
+        };
+
+        AutoPipeline(const AutoPipeline&) = delete;
+        AutoPipeline& operator=(const AutoPipeline&) = delete;
+
+    public:
+
+        explicit AutoPipeline( typename Cluster::ptr_t cluster_p ) :
+        cluster_p_( cluster_p ),
+        slots_( new std::atomic<Channel*>[SlotCount]() )
+        {
+            if( cluster_p == NULL )
+                throw InvalidArgument(nullptr);
+        }
+
+        // all commands must be completed before the pipeline is destroyed,
+        // connections stay in the cluster
+        ~AutoPipeline()
+        {
+            typename Channels::iterator it( channels_.begin() ), end( channels_.end() );
+            for( ; it != end; ++it )
+                delete it->second;
+            for( size_t i = 0; i < failed_.size(); ++i )
+                delete failed_[i];
+        }
+
+        void* Command( string key, const char *format, ... )
+        {
+            va_list ap;
+            va_start( ap, format );
+            char *cmd = nullptr;
+            int len = redisvFormatCommand( &cmd, format, ap );
+            va_end( ap );
+            if( len < 0 )
+                throw InvalidArgument(nullptr);
+
+            std::unique_ptr<char, void(*)(void*)> holder( cmd, free );
+            return execute( key, cmd, len );
+        }
+
+        void* Command( string key, int argc, const char ** argv, const size_t *argvlen )
+        {
+            RespCommand cmd;
+            cmd.formatArgv( argc, argv, argvlen );
+            return execute( key, cmd.data(), cmd.size() );
+        }
+
+        void* Command( string key, const RespCommand &cmd )
+        {
+            return execute( key, cmd.data(), cmd.size() );
+        }
+
+        // number of commands sent and of writes they took, the ratio shows
+        // how many commands share a write
+        size_t commands()
+        {
+            return sum( &Channel::commands );
+        }
+
+        size_t writes()
+        {
+            return sum( &Channel::writes );
+        }
+
+    protected:
+
+        typedef std::map<redisContext*, Channel*> Channels;
+
+        void* execute( const string &key, const char *cmd, size_t len )
+        {
+            SlotIndex slot = SlotHash::SlotByKey( key.c_str(), (int)key.length() );
+            Request req( cmd, len );
+            Channel &ch = channel( slot );
+            ch.run( req );
+            if( req.failed )
+            {
+                drop( ch );
+                throw DisconnectedException();
+            }
+
+            redisReply *reply = req.reply;
+            HiredisProcess::checkCritical( reply, false );
+
+            string host, port;
+            HiredisProcess::processState state = HiredisProcess::processResult( reply, host, port );
+            if( state == HiredisProcess::ASK || state == HiredisProcess::MOVED )
+            {
+                freeReplyObject( reply );
+                reply = redirect( state, host, port, cmd, len );
+            }
+            return reply;
+        }
+
+        // redirected commands are rare, they are sent one by one over connections
+        // created by the cluster and are serialized by the lock. The cluster itself
+        // is used under the cluster lock only, like by channel
+        redisReply* redirect( HiredisProcess::processState state, string &host, string &port,
+                             const char *cmd, size_t len )
+        {
+            std::lock_guard<std::mutex> locker( redirectLock_ );
+            HostConnection hcon;
+            {
+                std::lock_guard<std::mutex> clusterLocker( clusterLock_ );
+                hcon = cluster_p_->createNewConnection( host, port );
+                if( hcon.second == NULL || hcon.second->err != 0 )
+                {
+                    cluster_p_->releaseConnection( hcon );
+                    throw LogicError(nullptr, "Can't connect while resolving redirection");
+                }
+                if( state == HiredisProcess::MOVED )
+                {
+                    // moved callback may throw to abort the redirection
+                    try
+                    {
+                        cluster_p_->moved();
+                    }
+                    catch( ... )
+                    {
+                        cluster_p_->releaseConnection( hcon );
+                        throw;
+                    }
+                }
+            }
+
+            redisReply *reply = nullptr;
+            try
+            {
+                reply = sendRedirected( hcon.second, state, cmd, len );
+            }
+            catch( ... )
+            {
+                // broken connection is closed by the container when released
+                std::lock_guard<std::mutex> clusterLocker( clusterLock_ );
+                cluster_p_->releaseConnection( hcon );
+                throw;
+            }
+            std::lock_guard<std::mutex> clusterLocker( clusterLock_ );
+            cluster_p_->releaseConnection( hcon );
+            return reply;
+        }
+
+        redisReply* sendRedirected( redisContext *con, HiredisProcess::processState state,
+                                   const char *cmd, size_t len )
+        {
+            redisReply *asking = nullptr;
+            redisReply *reply = nullptr;
+            if( state == HiredisProcess::ASK )
+            {
+                // ASKING is written together with the command
+                redisAppendCommand( con, "ASKING" );
+                redisAppendFormattedCommand( con, cmd, len );
+                if( redisGetReply( con, (void**)&asking ) != REDIS_OK )
+                    throw DisconnectedException();
+            }
+            else
+            {
+                redisAppendFormattedCommand( con, cmd, len );
+            }
+
+            if( redisGetReply( con, (void**)&reply ) != REDIS_OK || reply == nullptr )
+            {
+                if( asking != nullptr )
+                    freeReplyObject( asking );
+                throw DisconnectedException();
+            }
+            if( asking != nullptr )
+            {
+                if( asking->type == REDIS_REPLY_ERROR )
+                {
+                    freeReplyObject( reply );
+                    HiredisProcess::checkCritical( asking, true, true, "asking error", con );
+                }
+                freeReplyObject( asking );
+            }
+            HiredisProcess::checkCritical( reply, false, true, "", con );
+            return reply;
+        }
+
+        // channels are found by slot without locking, channel of a node is created
+        // on the first command to any of its slots
+        Channel& channel( SlotIndex slot )
+        {
+            Channel *ch = slots_[slot].load( std::memory_order_acquire );
+            if( ch != nullptr )
+                return *ch;
+
+            std::lock_guard<std::mutex> locker( clusterLock_ );
+            ch = slots_[slot].load( std::memory_order_relaxed );
+            if( ch != nullptr )
+                return *ch;
+
+            SlotConnection con = cluster_p_->getConnection( slot );
+            Channel *&found = channels_[ con.second ];
+            if( found == nullptr )
+                found = new Channel( con.second );
+            for( SlotIndex i = con.first.first; i <= con.first.second && i < SlotCount; ++i )
+                slots_[i].store( found, std::memory_order_release );
+            return *found;
+        }
+
+        // Failed channel is taken out of the slots, so the next command to the node creates
+        // a new one. The container reopens the broken connection when it is taken again.
+        // Other threads may still hold the channel, it fails their commands until
+        // the pipeline is destroyed
+        void drop( Channel &ch )
+        {
+            std::lock_guard<std::mutex> locker( clusterLock_ );
+            typename Channels::iterator found = channels_.find( ch.connection() );
+            if( found == channels_.end() || found->second != &ch )
+                return;
+            channels_.erase( found );
+            failed_.push_back( &ch );
+            for( SlotIndex i = 0; i < SlotCount; ++i )
+            {
+                if( slots_[i].load( std::memory_order_relaxed ) == &ch )
+                    slots_[i].store( nullptr, std::memory_order_release );
+            }
+        }
+
+        size_t sum( size_t (Channel::*counter)() const )
+        {
+            std::lock_guard<std::mutex> locker( clusterLock_ );
+            size_t total = 0;
+            typename Channels::iterator it( channels_.begin() ), end( channels_.end() );
+            for( ; it != end; ++it )
+                total += ( it->second->*counter )();
+            for( size_t i = 0; i < failed_.size(); ++i )
+                total += ( failed_[i]->*counter )();
+            return total;
+        }
+
+        typename Cluster::ptr_t cluster_p_;
+        std::unique_ptr< std::atomic<Channel*>[] > slots_;
+        Channels channels_;
+        // channels of failed connections, still referenced by the threads that loaded them
+        std::vector<Channel*> failed_;
+        // guards every use of the cluster, which is not thread safe, and the channels
+        std::mutex clusterLock_;
+        // serializes redirected commands on the shared redirection connections
+        std::mutex redirectLock_;
+    };
+}
+
+#endif /* defined(__libredisCluster__autopipeline__) */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__blockpool__
+#define __libredisCluster__blockpool__
+
+#include <new>
+#include <stddef.h>
+
+namespace RedisCluster
+{
+    // Free list of memory blocks of one size for objects created and destroyed at a high rate,
+    // like async commands. Every thread has its own list, so blocks are taken and returned
+    // without locking. A block may be returned by another thread than the one which took it,
+    // blocks are plain heap blocks and just move to the list of that thread then.
+    // Not more than MaxFree blocks are kept by a thread, the rest are freed
+    template<size_t BlockSize, size_t MaxFree = 1024>
+    class BlockPool
+    {
+        struct Node
+        {
+            Node *next;
+        };
+
+        static_assert( BlockSize >= sizeof(Node), "block is too small" );
+
+        struct FreeList
+        {
+            FreeList() : head( nullptr ), count( 0 ), closed( false )
+            {
+            }
+
+            ~FreeList()
+            {
+                while( head != nullptr )
+                {
+                    Node *next = head->next;
+                    ::operator delete( head );
+                    head = next;
+                }
+                // blocks returned by destructors of other thread local objects are freed
+                closed = true;
+            }
+
+            Node *head;
+            size_t count;
+            bool closed;
+        };
+
+        static FreeList& freeList()
+        {
+            static thread_local FreeList list;
+            return list;
+        }
+
+    public:
+
+        static void* allocate( size_t size )
+        {
+            if( size > BlockSize )
+                return ::operator new( size );
+
+            FreeList &list = freeList();
+            if( list.head == nullptr )
+                return ::operator new( BlockSize );
+            Node *node = list.head;
+            list.head = node->next;
+            --list.count;
+            return node;
+        }
+
+        static void release( void *p, size_t size ) noexcept
+        {
+            if( p == nullptr )
+                return;
+            FreeList &list = freeList();
+            if( size > BlockSize || list.closed || list.count >= MaxFree )
+            {
+                ::operator delete( p );
+                return;
+            }
+            Node *node = static_cast<Node*>( p );
+            node->next = list.head;
+            list.head = node;
+            ++list.count;
+        }
+
+        // number of free blocks kept by the calling thread
+        static size_t freeBlocks()
+        {
+            return freeList().count;
+        }
+    };
+}
+
+#endif /* defined(__libredisCluster__blockpool__) */
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __libredisCluster__boundedqueue__
+#define __libredisCluster__boundedqueue__
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace RedisCluster {
+
+    // Bounded lock-free multi-producer multi-consumer queue (D. Vyukov's algorithm).
+    // Every cell has a sequence number telling whether the cell is ready for push or for pop,
+    // so producers and consumers only compete on the head and tail counters
+    template<typename T>
+    class BoundedQueue
+    {
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+        
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+        
+        static const size_t CacheLine = 64;
+        
+    public:
+        // capacity is rounded up to the power of two
+        explicit BoundedQueue( size_t capacity ) :
+        cells_( roundUp( capacity ) ),
+        mask_( cells_.size() - 1 ),
+        tail_( 0 ),
+        head_( 0 )
+        {
+            for( size_t i = 0; i < cells_.size(); ++i )
+                cells_[i].sequence.store( i, std::memory_order_relaxed );
+        }
+        
+        inline size_t capacity() const
+        {
+            return cells_.size();
+        }
+        
+        // returns false if the queue is full
+        bool push( const T &value )
+        {
+            size_t pos = tail_.load( std::memory_order_relaxed );
+            Cell *cell;
+            while( true )
+            {
+                cell = &cells_[pos & mask_];
+                size_t seq = cell->sequence.load( std::memory_order_acquire );
+                intptr_t diff = static_cast<intptr_t>( seq ) - static_cast<intptr_t>( pos );
+                if( diff == 0 )
+                {
+                    if( tail_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                        break;
+                }
+                else if( diff < 0 )
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = tail_.load( std::memory_order_relaxed );
+                }
+            }
+            cell->value = value;
+            cell->sequence.store( pos + 1, std::memory_order_release );
+            return true;
+        }
+        
+        // returns false if the queue is empty
+        bool pop( T &value )
+        {
+            size_t pos = head_.load( std::memory_order_relaxed );
+            Cell *cell;
+            while( true )
+            {
+                cell = &cells_[pos & mask_];
+                size_t seq = cell->sequence.load( std::memory_order_acquire );
+                intptr_t diff = static_cast<intptr_t>( seq ) - static_cast<intptr_t>( pos + 1 );
+                if( diff == 0 )
+                {
+                    if( head_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) )
+                        break;
+                }
+                else if( diff < 0 )
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = head_.load( std::memory_order_relaxed );
+                }
+            }
+            value = cell->value;
+            cell->sequence.store( pos + mask_ + 1, std::memory_order_release );
+            return true;
+        }
+        
+        // approximate number of elements
+        inline size_t size() const
+        {
+            size_t tail = tail_.load( std::memory_order_relaxed );
+            size_t head = head_.load( std::memory_order_relaxed );
+            return tail > head ? tail - head : 0;
+        }
+        
+    private:
+        static size_t roundUp( size_t capacity )
+        {
+            size_t size = 2;
+            while( size < capacity )
+                size *= 2;
+            return size;
+        }
+        
+        std::vector<Cell> cells_;
+        const size_t mask_;
+        // counters are kept on different cache lines by padding, as over-aligned
+        // members would need aligned new, which C++11 doesn't have
+        char padTail_[CacheLine];
+        std::atomic<size_t> tail_;
+        char padHead_[CacheLine - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> head_;
+        char padEnd_[CacheLine - sizeof(std::atomic<size_t>)];
+    };
+}
+
+#endif /* defined(__libredisCluster__boundedqueue__) */
@@ -39,6 +39,8 @@ extern "C"
 #include "slothash.h"
 #include "clusterexception.h"
 #include "container.h"
+#include "deadline.h"
+#include "result.h"
 
 namespace RedisCluster
 {
@@ -95,14 +97,24 @@ namespace RedisCluster
             if( connect == NULL || disconnect == NULL )
                 throw InvalidArgument(reply);
             // init function will parse redisReply structure
-            init(reply);
+            try
+            {
+                init(reply);
+            }
+            catch( ... )
+            {
+                // container may own resources like threads, so it is not leaked
+                delete connections_;
+                throw;
+            }
         }
         
         ~Cluster()
         {
+            // disconnect callbacks of connections may still use the destruct data
+            delete connections_;
             if(destructCallback_)
                 destructCallback_(destructData);
-            delete connections_;
         }
         
         // disconnect function applicable when we want to close all async connections from callback
@@ -126,6 +138,84 @@ namespace RedisCluster
             int slot = SlotHash::SlotByKey( key.c_str(), key.length() );
             return connections_->getConnection( slot );
         }
+
+        // function gets a connection from container by already calculated slot number
+        SlotConnection getConnection ( SlotIndex slot )
+        {
+            if( !readytouse_ )
+            {
+                throw NotInitializedException();
+            }
+
+            return connections_->getConnection( slot );
+        }
+        
+        // functions get a connection waiting for it not longer than the deadline, containers
+        // that may wait for connections can have getConnection( SlotIndex, const Deadline& )
+        SlotConnection getConnection ( std::string key, const Deadline &deadline )
+        {
+            return getConnection( SlotHash::SlotByKey( key.c_str(), key.length() ), deadline );
+        }
+        
+        SlotConnection getConnection ( SlotIndex slot, const Deadline &deadline )
+        {
+            if( !readytouse_ )
+            {
+                throw NotInitializedException();
+            }
+            if( deadline.expired() )
+            {
+                throw TimeoutException();
+            }
+            
+            return connectionBySlot( *connections_, slot, deadline, 0 );
+        }
+        
+        // non-throwing versions of getConnection and createNewConnection for the error code API.
+        // Containers can have findConnection( SlotIndex, SlotConnection& ) returning false if
+        // node is not found, exceptions of other containers are converted to error codes
+        ErrorCode findConnection( const std::string &key, SlotConnection &conn,
+                                 const Deadline &deadline = Deadline() ) noexcept
+        {
+            return findConnection( SlotHash::SlotByKey( key.c_str(), key.length() ), conn, deadline );
+        }
+        
+        ErrorCode findConnection( SlotIndex slot, SlotConnection &conn,
+                                 const Deadline &deadline = Deadline() ) noexcept
+        {
+            if( !readytouse_ )
+                return NOT_INITIALIZED;
+            if( deadline.expired() )
+                return TIMEOUT;
+            
+            try
+            {
+                return findBySlot( *connections_, slot, conn, deadline, 0 );
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+        }
+        
+        ErrorCode findRedirection( string host, string port, HostConnection &conn,
+                                  const Deadline &deadline = Deadline() ) noexcept
+        {
+            if( !readytouse_ )
+                return NOT_INITIALIZED;
+            if( deadline.expired() )
+                return TIMEOUT;
+            
+            try
+            {
+                conn = connectionByHost( *connections_, host, port, deadline, 0 );
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+            return conn.second != NULL ? SUCCESS : REDIRECT_FAILED;
+        }
         
         // moved method set cluster to moved state
         // if cluster is in moved state, then you need to reinitialise it once a time
@@ -153,11 +243,20 @@ namespace RedisCluster
             userMovedFn_ = fn;
         }
         // creates new connection when HiredisCommand or AsyncHiredisCommand needs a
-        // connection for follow the redirection
+        // connection for follow the redirection, the connection is returned by releaseConnection
         inline HostConnection createNewConnection( string host, string port )
         {
             return connections_->insert(host, port);
         }
+        // same with the deadline, containers can have insert( string, string, const Deadline& )
+        inline HostConnection createNewConnection( string host, string port, const Deadline &deadline )
+        {
+            if( deadline.expired() )
+            {
+                throw TimeoutException();
+            }
+            return connectionByHost( *connections_, host, port, deadline, 0 );
+        }
         // if we want to cluster throw NotInitializedException (i.e. in other threads)
         // we can use this function
         inline void stop()
@@ -177,6 +276,12 @@ namespace RedisCluster
             connections_->releaseConnection( conn );
         }
         
+        // access to the connection container, i.e. for setting container options
+        inline ConnectionContainer& container()
+        {
+            return *connections_;
+        }
+        
         // TODO: сделать удаление соединения извне
         void deleteConnection(const redisConnection* con) {
             connections_->deleteConnection(con);
@@ -220,6 +325,47 @@ namespace RedisCluster
             readytouse_ = true;
         }
 
+        // deadline is passed to the container if it supports deadlines
+        template<typename Container>
+        static auto connectionBySlot( Container &container, SlotIndex slot, const Deadline &deadline, int )
+        -> decltype( container.getConnection( slot, deadline ) )
+        {
+            return container.getConnection( slot, deadline );
+        }
+        
+        template<typename Container>
+        static SlotConnection connectionBySlot( Container &container, SlotIndex slot, const Deadline &, long )
+        {
+            return container.getConnection( slot );
+        }
+        
+        template<typename Container>
+        static auto findBySlot( Container &container, SlotIndex slot, SlotConnection &conn, const Deadline &, int )
+        -> decltype( container.findConnection( slot, conn ), ErrorCode() )
+        {
+            return container.findConnection( slot, conn ) ? SUCCESS : NODE_NOT_FOUND;
+        }
+        
+        template<typename Container>
+        static ErrorCode findBySlot( Container &container, SlotIndex slot, SlotConnection &conn, const Deadline &deadline, long )
+        {
+            conn = connectionBySlot( container, slot, deadline, 0 );
+            return SUCCESS;
+        }
+        
+        template<typename Container>
+        static auto connectionByHost( Container &container, string &host, string &port, const Deadline &deadline, int )
+        -> decltype( container.insert( host, port, deadline ) )
+        {
+            return container.insert( host, port, deadline );
+        }
+        
+        template<typename Container>
+        static HostConnection connectionByHost( Container &container, string &host, string &port, const Deadline &, long )
+        {
+            return container.insert( host, port );
+        }
+
         ConnectionContainer *connections_;
         DestructCb destructCallback_ = nullptr;
         void* destructData = nullptr;
@@ -112,6 +112,28 @@ namespace RedisCluster {
         LogicError(redisReply *reply, string reason) : BadStateException(reply, reason) {}
     };
 
+    // exception meaning that connection container can't open one more connection
+    // because the limit of connections is reached
+    class ConnectionLimitException : public ClusterException {
+    public:
+        ConnectionLimitException() : ClusterException(nullptr, std::string("cluster connection limit reached")) {}
+    };
+
+    // exception meaning that command is not sent because too many commands
+    // are in flight to the node or to the cluster
+    class OverloadedException : public ClusterException {
+    public:
+        OverloadedException() : ClusterException(nullptr, std::string("cluster node overloaded")) {}
+    };
+
+    // exception meaning that operation was not completed in time
+    class TimeoutException : public ClusterException {
+    public:
+        TimeoutException() : ClusterException(nullptr, std::string("cluster operation timed out")) {}
+
+        TimeoutException(const std::string &reason) : ClusterException(nullptr, reason) {}
+    };
+
     // exception meaning that you had not properly passed arguments cluster or command invocation
     class InvalidArgument : public ClusterException {
     public:
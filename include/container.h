@@ -29,6 +29,11 @@
 #ifndef __libredisCluster__container__
 #define __libredisCluster__container__
 
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+
 #include "cluster.h"
 
 namespace RedisCluster {
@@ -37,16 +42,30 @@ namespace RedisCluster {
     class Cluster;
     
     // Container for redis connections. Simple container defined here, it's not thread safe
-    // but can be replaced by user defined container as Cluster template class
+    // but can be replaced by user defined container as Cluster template class.
+    // Connections to redirection targets are shared by the commands: every insert( host, port )
+    // takes a reference released by releaseConnection, and connections are closed when they
+    // stay unreferenced for the redirect idle timeout, or when they are disconnected
     template<typename redisConnection>
     class DefaultContainer
     {
         typedef Cluster<redisConnection, DefaultContainer> RCluster;
         typedef typename RCluster::SlotRange SlotRange;
         typedef typename RCluster::Host Host;
+        typedef std::chrono::steady_clock Clock;
+        
+        struct Redirect
+        {
+            redisConnection *con;
+            // commands holding the connection
+            size_t refs;
+            // time the last reference was released
+            Clock::time_point released;
+        };
         
         typedef std::map <SlotRange, redisConnection*, typename RCluster::SlotComparator> ClusterNodes;
-        typedef std::map <Host, redisConnection*> RedirectConnections;
+        typedef std::map <Host, Redirect> RedirectConnections;
+        typedef std::map <SlotRange, std::pair<std::string, int>, typename RCluster::SlotComparator> NodeAddresses;
         
     public:
         
@@ -55,7 +74,9 @@ namespace RedisCluster {
                          void* userData ) :
         data_( userData ),
         connect_(conn),
-        disconnect_(disconn)
+        disconnect_(disconn),
+        redirectIdleTimeout_( std::chrono::milliseconds( 60000 ) ),
+        lastSweep_( Clock::now() )
         {
         }
         
@@ -77,70 +98,167 @@ namespace RedisCluster {
             }
             
             nodes_.insert( typename ClusterNodes::value_type(slots, conn) );
+            addresses_[slots] = std::make_pair( std::string( host ), port );
         }
         
+        // connection opened outside of the container, i.e. a node connection restored after
+        // it was dropped and deleted
         inline
-        typename RCluster::HostConnection insert( string host, string port )
+        void insert( typename RCluster::SlotRange slots, redisConnection* conn )
         {
-            string key( host + ":" + port );
-            try
+            nodes_[slots] = conn;
+        }
+        
+        // slot range served by the connection, false for redirection connections
+        bool findSlots( const redisConnection* con, typename RCluster::SlotRange &slots ) const
+        {
+            for( typename ClusterNodes::const_iterator it = nodes_.begin(); it != nodes_.end(); ++it )
             {
-                return typename RCluster::HostConnection( key, connections_.at( key ) );
+                if( it->second == con )
+                {
+                    slots = it->first;
+                    return true;
+                }
             }
-            catch( const std::out_of_range &oor )
+            return false;
+        }
+        
+        inline
+        typename RCluster::HostConnection insert( string host, string port )
+        {
+            string key( host + ":" + port );
+            typename RedirectConnections::iterator found = connections_.find( key );
+            if( found != connections_.end() )
             {
+                ++found->second.refs;
+                return typename RCluster::HostConnection( key, found->second.con );
             }
             
             typename RCluster::HostConnection conn( key, connect_( host.c_str(), std::stoi(port), data_ ) );
             if( conn.second != NULL && conn.second->err == 0 )
             {
-                connections_.insert( conn );
+                Redirect redirect = { conn.second, 1, Clock::time_point() };
+                connections_.insert( typename RedirectConnections::value_type( key, redirect ) );
             }
             return conn;
         }
         
+        // returns storage.end() if no slot range contains the index
         template<typename Storage>
-        inline static typename Storage::iterator searchBySlots( typename RCluster::SlotIndex index, Storage &storage )
+        inline static typename Storage::iterator findBySlots( typename RCluster::SlotIndex index, Storage &storage )
         {
             typename RCluster::SlotRange range = { index + 1, 0 };
             typename Storage::iterator node = storage.lower_bound( range );
             // as with lower bound we find greater (next) slotrange, so now decrement
-            if( node != storage.begin() )
-                --node;
+            if( node == storage.begin() )
+                return storage.end();
+            --node;
             
-            if ( node != storage.end() )
-            {
-                range = node->first;
-                if ( range.first > index || range.second < index )
-                {
-                    throw NodeSearchException();
-                }
-                else
-                {
-                    return node;
-                }
-            }
-            else
+            range = node->first;
+            if ( range.first > index || range.second < index )
+                return storage.end();
+            return node;
+        }
+        
+        template<typename Storage>
+        inline static typename Storage::iterator searchBySlots( typename RCluster::SlotIndex index, Storage &storage )
+        {
+            typename Storage::iterator node = findBySlots( index, storage );
+            if( node == storage.end() )
             {
                 throw NodeSearchException();
             }
+            return node;
         }
         
         inline
         typename RCluster::SlotConnection getConnection( typename RCluster::SlotIndex index )
         {
-            return *searchBySlots(index, nodes_);
+            typename ClusterNodes::iterator node = searchBySlots(index, nodes_);
+            if( broken( node->second ) )
+                reopen( node );
+            return *node;
+        }
+        
+        // same as getConnection, but returns false instead of throwing if node is not found
+        inline
+        bool findConnection( typename RCluster::SlotIndex index, typename RCluster::SlotConnection &conn )
+        {
+            typename ClusterNodes::iterator node = findBySlots( index, nodes_ );
+            if( node == nodes_.end() )
+                return false;
+            if( broken( node->second ) )
+                reopen( node );
+            conn = *node;
+            return true;
         }
         
-        // for a not multithreaded container this functions are dummy
+        // for a not multithreaded container this function is dummy
         inline void releaseConnection( typename RCluster::SlotConnection ) {}
-        inline void releaseConnection( typename RCluster::HostConnection ) {}
         
-        template<typename Cons>
-        void deleteConnection(Cons connections, const redisConnection* con) {
-            for (auto it = connections.begin(); it != connections.end();) {
+        // drops the reference taken by insert( host, port ). Connection is matched by the pointer
+        // too, as the target could be reconnected while the command held the old connection
+        void releaseConnection( typename RCluster::HostConnection conn )
+        {
+            typename RedirectConnections::iterator found = connections_.find( conn.first );
+            if( found == connections_.end() || found->second.con != conn.second || found->second.refs == 0 )
+                return;
+            
+            if( --found->second.refs == 0 )
+            {
+                found->second.released = Clock::now();
+                // broken synchronous connections are not reused
+                if( conn.second->err != 0 )
+                    closeRedirection( found );
+                else if( redirectIdleTimeout_.count() > 0 &&
+                        found->second.released - lastSweep_ >= redirectIdleTimeout_ )
+                    closeIdleRedirections();
+            }
+        }
+        
+        // redirection connections unreferenced for longer than the timeout are closed
+        // when a reference is released, zero timeout keeps them open
+        inline void setRedirectIdleTimeout( std::chrono::milliseconds timeout )
+        {
+            redirectIdleTimeout_ = timeout;
+        }
+        
+        // closes redirection connections unreferenced for the idle timeout,
+        // can also be called periodically from the event loop
+        void closeIdleRedirections()
+        {
+            Clock::time_point now = Clock::now();
+            lastSweep_ = now;
+            typename RedirectConnections::iterator it = connections_.begin();
+            while( it != connections_.end() )
+            {
+                typename RedirectConnections::iterator next = it;
+                ++next;
+                if( it->second.refs == 0 && now - it->second.released >= redirectIdleTimeout_ )
+                    closeRedirection( it );
+                it = next;
+            }
+        }
+        
+        inline size_t redirections() const
+        {
+            return connections_.size();
+        }
+        
+        // forgets a connection closed outside of the container (i.e. by disconnect callback
+        // of async connection), commands holding it release it without effect
+        void deleteConnection(const redisConnection* con) {
+            for (auto it = connections_.begin(); it != connections_.end();) {
+                if (it->second.con == con) {
+                    it = connections_.erase(it);
+                }
+                else {
+                    ++it;
+                }
+            }
+            for (auto it = nodes_.begin(); it != nodes_.end();) {
                 if (it->second == con) {
-                    it = connections.erase(it);
+                    it = nodes_.erase(it);
                 }
                 else {
                     ++it;
@@ -148,40 +266,75 @@ namespace RedisCluster {
             }
         }
         
-        
-        void deleteConnection(const redisConnection* con) {
-            deleteConnection(connections_, con);
-            deleteConnection(nodes_, con);
-        }
-        
         inline
         void disconnect()
         {
-            disconnect<ClusterNodes>( nodes_ );
-            disconnect<RedirectConnections>( connections_ );
-        }
-        
-        template <typename T>
-        inline void disconnect(T &cons)
-        {
+            // disconnect functions of async connections call deleteConnection,
+            // so connections are taken out of the container first
+            ClusterNodes nodes;
+            nodes.swap( nodes_ );
+            RedirectConnections connections;
+            connections.swap( connections_ );
             if( disconnect_ != NULL )
             {
-                typename T::iterator it(cons.begin()), end(cons.end());
-                while ( it != end )
-                {
+                for( typename ClusterNodes::iterator it = nodes.begin(); it != nodes.end(); ++it )
                     disconnect_( it->second );
-                    ++it;
-                }
+                for( typename RedirectConnections::iterator it = connections.begin(); it != connections.end(); ++it )
+                    disconnect_( it->second.con );
             }
-            cons.clear();
         }
         
         void* data_;
     private:
+        // synchronous connections failed by an error or an expired deadline can't be used
+        // anymore, async ones are forgotten by their disconnect callbacks instead
+        static inline bool broken( const redisContext *con )
+        {
+            return con->err != 0;
+        }
+        
+        template<typename Connection>
+        static inline bool broken( const Connection * )
+        {
+            return false;
+        }
+        
+        // broken node connection is replaced when a command needs the node next time,
+        // it is kept if the node can't be connected, so the next command tries again
+        void reopen( typename ClusterNodes::iterator node )
+        {
+            typename NodeAddresses::iterator address = addresses_.find( node->first );
+            if( address == addresses_.end() )
+                return;
+            
+            redisConnection *conn = connect_( address->second.first.c_str(), address->second.second, data_ );
+            if( conn == NULL || conn->err )
+            {
+                if( conn != NULL && disconnect_ != NULL )
+                    disconnect_( conn );
+                throw ConnectionFailedException(nullptr);
+            }
+            if( disconnect_ != NULL )
+                disconnect_( node->second );
+            node->second = conn;
+        }
+        
+        void closeRedirection( typename RedirectConnections::iterator it )
+        {
+            redisConnection *con = it->second.con;
+            connections_.erase( it );
+            if( disconnect_ != NULL )
+                disconnect_( con );
+        }
+        
         typename RCluster::pt2RedisConnectFunc connect_;
         typename RCluster::pt2RedisFreeFunc disconnect_;
         RedirectConnections connections_;
         ClusterNodes nodes_;
+        // addresses of node connections opened by the container
+        NodeAddresses addresses_;
+        std::chrono::milliseconds redirectIdleTimeout_;
+        Clock::time_point lastSweep_;
     };
     
 }
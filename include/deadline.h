@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __libredisCluster__deadline__
+#define __libredisCluster__deadline__
+
+#include <chrono>
+
+namespace RedisCluster
+{
+    // Point in time by which an operation must complete. Default constructed deadline
+    // never expires, so commands without deadline don't query the clock
+    //
+    //   HiredisCommand<>::Command( cluster_p, key, Deadline( std::chrono::milliseconds( 50 ) ), "GET %s", key );
+    class Deadline
+    {
+    public:
+        typedef std::chrono::steady_clock Clock;
+        
+        Deadline() : at_( Clock::time_point::max() ) {}
+        
+        // deadline after the timeout from now
+        template<typename Rep, typename Period>
+        explicit Deadline( const std::chrono::duration<Rep, Period> &timeout ) :
+        at_( Clock::now() + std::chrono::duration_cast<Clock::duration>( timeout ) )
+        {
+        }
+        
+        static inline Deadline at( Clock::time_point time )
+        {
+            Deadline deadline;
+            deadline.at_ = time;
+            return deadline;
+        }
+        
+        inline bool infinite() const
+        {
+            return at_ == Clock::time_point::max();
+        }
+        
+        inline bool expired() const
+        {
+            return !infinite() && Clock::now() >= at_;
+        }
+        
+        inline Clock::time_point time() const
+        {
+            return at_;
+        }
+        
+        // the earlier of the deadline and the timeout from now
+        template<typename Rep, typename Period>
+        inline Clock::time_point timeAfter( const std::chrono::duration<Rep, Period> &timeout ) const
+        {
+            Clock::time_point time = Clock::now() + std::chrono::duration_cast<Clock::duration>( timeout );
+            return time < at_ ? time : at_;
+        }
+        
+        // timeout for poll() in milliseconds rounded up, -1 if there is no deadline
+        int pollTimeout() const
+        {
+            if( infinite() )
+                return -1;
+            
+            Clock::duration left = at_ - Clock::now();
+            if( left <= Clock::duration::zero() )
+                return 0;
+            
+            long long ms = std::chrono::duration_cast<std::chrono::milliseconds>( left + std::chrono::milliseconds( 1 ) - Clock::duration( 1 ) ).count();
+            return ms > 0x7fffffff ? 0x7fffffff : static_cast<int>( ms );
+        }
+        
+    private:
+        Clock::time_point at_;
+    };
+}
+
+#endif /* defined(__libredisCluster__deadline__) */
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__flowcontrol__
+#define __libredisCluster__flowcontrol__
+
+#include <algorithm>
+#include <deque>
+#include <stddef.h>
+#include <vector>
+
+namespace RedisCluster
+{
+    // what happens to a command over the in-flight limits
+    enum OverloadPolicy
+    {
+        // command fails with OVERLOADED error
+        OVERLOAD_REJECT,
+        // command waits in the queue of its node until commands in flight are finished,
+        // it fails if the queues of the cluster are full
+        OVERLOAD_QUEUE,
+        // command is sent, the overload callback tells the producer to slow down
+        OVERLOAD_SIGNAL
+    };
+
+    // limits of commands sent and not finished yet, zero is no limit
+    struct FlowLimits
+    {
+        FlowLimits() :
+        nodeCommands( 0 ),
+        nodeBytes( 0 ),
+        clusterCommands( 0 ),
+        clusterBytes( 0 ),
+        policy( OVERLOAD_REJECT ),
+        queueLimit( 0 )
+        {
+        }
+
+        size_t nodeCommands;
+        size_t nodeBytes;
+        size_t clusterCommands;
+        size_t clusterBytes;
+        OverloadPolicy policy;
+        // commands queued in the whole cluster with OVERLOAD_QUEUE
+        size_t queueLimit;
+    };
+
+    struct FlowStats
+    {
+        size_t commands;
+        size_t bytes;
+        size_t queued;
+        size_t rejected;
+        bool overloaded;
+    };
+
+    // Accounting of commands in flight per node and per cluster. A command is admitted
+    // before it is sent and released when it is finished. Queued commands are sent by
+    // send function as soon as commands of their node and of the cluster are finished.
+    // Not thread safe, like the async commands using it
+    template<typename Item>
+    class FlowControl
+    {
+        FlowControl(const FlowControl&) = delete;
+        FlowControl& operator=(const FlowControl&) = delete;
+
+    public:
+        typedef void (overloadCallbackFn)( void *data, bool overloaded );
+
+        enum Admission
+        {
+            SEND,
+            WAIT,
+            REJECT
+        };
+
+        struct Counter
+        {
+            Counter() : commands( 0 ), bytes( 0 ) {}
+
+            // a command always fits when nothing is in flight, so one big command can't block
+            inline bool fits( size_t maxCommands, size_t maxBytes, size_t size ) const
+            {
+                return commands == 0 ||
+                    ( ( maxCommands == 0 || commands < maxCommands ) &&
+                      ( maxBytes == 0 || bytes + size <= maxBytes ) );
+            }
+
+            // overloaded state is left at the half of the limits
+            inline bool below( size_t maxCommands, size_t maxBytes ) const
+            {
+                return commands <= maxCommands / 2 && bytes <= maxBytes / 2;
+            }
+
+            size_t commands;
+            size_t bytes;
+        };
+
+        // accounting of a node connection, lives while the connection is open
+        // or while commands admitted on it are in flight
+        struct Node
+        {
+            Node( FlowControl &flow, void *connection ) :
+            owner( &flow ), target( connection ), holdLimit( 0 ), requeued( 0 ),
+            overloaded( false ), suspended( false ), closed( false ) {}
+
+            FlowControl *owner;
+            // connection queued commands are sent to
+            void *target;
+            Counter inFlight;
+            // waiting commands with their sizes
+            std::deque<std::pair<Item*, size_t> > queue;
+            // commands held by a suspended node, zero is no limit
+            size_t holdLimit;
+            // commands put back to the head of the queue since the node was suspended
+            size_t requeued;
+            bool overloaded;
+            bool suspended;
+            bool closed;
+        };
+
+        // send sends an admitted command or finishes it on error,
+        // fail finishes a queued command which will never be sent
+        typedef void (sendFn)( Item*, Node* );
+        typedef void (failFn)( Item* );
+
+        FlowControl( sendFn *send, failFn *fail ) :
+        send_( send ),
+        fail_( fail ),
+        queued_( 0 ),
+        rejected_( 0 ),
+        overloadedNodes_( 0 ),
+        overloaded_( false ),
+        draining_( false ),
+        overloadCb_( nullptr ),
+        overloadData_( nullptr )
+        {
+        }
+
+        ~FlowControl()
+        {
+            while( !nodes_.empty() )
+                closeNode( nodes_.back() );
+        }
+
+        void setLimits( const FlowLimits &limits, overloadCallbackFn *overloadCb, void *data )
+        {
+            limits_ = limits;
+            overloadCb_ = overloadCb;
+            overloadData_ = data;
+            drain();
+        }
+
+        inline const FlowLimits& limits() const
+        {
+            return limits_;
+        }
+
+        FlowStats stats() const
+        {
+            FlowStats stats = { inFlight_.commands, inFlight_.bytes, queued_, rejected_, overloaded_ };
+            return stats;
+        }
+
+        Node* openNode( void *target )
+        {
+            Node *node = new Node( *this, target );
+            try
+            {
+                nodes_.push_back( node );
+            }
+            catch( ... )
+            {
+                delete node;
+                throw;
+            }
+            return node;
+        }
+
+        // queued commands of a closed node fail, the node is freed when
+        // its commands in flight are released
+        void closeNode( Node *node )
+        {
+            nodes_.erase( std::remove( nodes_.begin(), nodes_.end(), node ), nodes_.end() );
+            node->closed = true;
+            while( !node->queue.empty() )
+            {
+                Item *item = node->queue.front().first;
+                node->queue.pop_front();
+                --queued_;
+                fail_( item );
+            }
+            if( node->inFlight.commands == 0 )
+                free( node );
+        }
+
+        // Commands of a suspended node (i.e. while its connection is restored) are held in its
+        // queue regardless of the limits and the policy, up to the hold limit
+        void suspend( Node &node, size_t holdLimit )
+        {
+            node.suspended = true;
+            node.holdLimit = holdLimit;
+        }
+
+        // held commands go to the new connection of the node
+        void resume( Node &node, void *target )
+        {
+            node.suspended = false;
+            node.target = target;
+            node.requeued = 0;
+            drain();
+        }
+
+        // command in flight on a suspended node goes back to the queue before the commands
+        // held, to be sent again when the node is resumed
+        void requeue( Node &node, Item *item, size_t size )
+        {
+            node.queue.insert( node.queue.begin() + node.requeued, std::make_pair( item, size ) );
+            ++node.requeued;
+            ++queued_;
+            release( node, size );
+        }
+
+        // decides if a command of the size can be sent to the node now. Sent commands are
+        // accounted and must be released, waiting ones are sent by the send function later
+        Admission admit( Node &node, Item *item, size_t size )
+        {
+            if( node.suspended )
+            {
+                if( node.holdLimit != 0 && node.queue.size() >= node.holdLimit )
+                {
+                    ++rejected_;
+                    return REJECT;
+                }
+                node.queue.push_back( std::make_pair( item, size ) );
+                ++queued_;
+                return WAIT;
+            }
+            bool fits = node.queue.empty() &&
+                node.inFlight.fits( limits_.nodeCommands, limits_.nodeBytes, size ) &&
+                inFlight_.fits( limits_.clusterCommands, limits_.clusterBytes, size );
+            if( fits || limits_.policy == OVERLOAD_SIGNAL )
+            {
+                account( node, size );
+                return SEND;
+            }
+            if( limits_.policy == OVERLOAD_QUEUE && ( limits_.queueLimit == 0 || queued_ < limits_.queueLimit ) )
+            {
+                node.queue.push_back( std::make_pair( item, size ) );
+                ++queued_;
+                return WAIT;
+            }
+            ++rejected_;
+            return REJECT;
+        }
+
+        void release( Node &node, size_t size )
+        {
+            node.inFlight.commands--;
+            node.inFlight.bytes -= size;
+            inFlight_.commands--;
+            inFlight_.bytes -= size;
+            if( node.closed )
+            {
+                if( node.inFlight.commands == 0 )
+                    free( &node );
+            }
+            else
+            {
+                updateNode( node );
+            }
+            updateCluster();
+            drain();
+        }
+
+    private:
+        void account( Node &node, size_t size )
+        {
+            node.inFlight.commands++;
+            node.inFlight.bytes += size;
+            inFlight_.commands++;
+            inFlight_.bytes += size;
+            updateNode( node );
+            updateCluster();
+        }
+
+        // sends queued commands while they fit, commands finished by send
+        // functions release their accounting without draining again
+        void drain()
+        {
+            if( queued_ == 0 || draining_ )
+                return;
+            draining_ = true;
+            for( size_t i = 0; i < nodes_.size() && queued_ > 0; ++i )
+            {
+                Node *node = nodes_[i];
+                while( !node->queue.empty() && !node->suspended )
+                {
+                    // commands held by a resumed node are over the limits with the signal policy
+                    size_t size = node->queue.front().second;
+                    if( limits_.policy != OVERLOAD_SIGNAL &&
+                       ( !node->inFlight.fits( limits_.nodeCommands, limits_.nodeBytes, size ) ||
+                         !inFlight_.fits( limits_.clusterCommands, limits_.clusterBytes, size ) ) )
+                        break;
+                    Item *item = node->queue.front().first;
+                    node->queue.pop_front();
+                    --queued_;
+                    account( *node, size );
+                    send_( item, node );
+                    // send may finish commands and close nodes
+                    if( i >= nodes_.size() || nodes_[i] != node )
+                        break;
+                }
+            }
+            draining_ = false;
+        }
+
+        void free( Node *node )
+        {
+            if( node->overloaded )
+            {
+                node->overloaded = false;
+                --overloadedNodes_;
+            }
+            delete node;
+            updateCluster();
+        }
+
+        void updateNode( Node &node )
+        {
+            if( !node.overloaded && !node.inFlight.fits( limits_.nodeCommands, limits_.nodeBytes, 0 ) )
+            {
+                node.overloaded = true;
+                ++overloadedNodes_;
+            }
+            else if( node.overloaded && node.inFlight.below( limits_.nodeCommands, limits_.nodeBytes ) )
+            {
+                node.overloaded = false;
+                --overloadedNodes_;
+            }
+        }
+
+        // producer is told about changes of the overloaded state of the whole cluster
+        void updateCluster()
+        {
+            bool overloaded;
+            if( overloadedNodes_ > 0 || !inFlight_.fits( limits_.clusterCommands, limits_.clusterBytes, 0 ) )
+                overloaded = true;
+            else if( overloaded_ )
+                overloaded = !inFlight_.below( limits_.clusterCommands, limits_.clusterBytes );
+            else
+                overloaded = false;
+
+            if( overloaded != overloaded_ )
+            {
+                overloaded_ = overloaded;
+                if( overloadCb_ != nullptr )
+                    overloadCb_( overloadData_, overloaded );
+            }
+        }
+
+        sendFn *send_;
+        failFn *fail_;
+        FlowLimits limits_;
+        Counter inFlight_;
+        std::vector<Node*> nodes_;
+        size_t queued_;
+        size_t rejected_;
+        size_t overloadedNodes_;
+        bool overloaded_;
+        bool draining_;
+        overloadCallbackFn *overloadCb_;
+        void *overloadData_;
+    };
+}
+
+#endif /* defined(__libredisCluster__flowcontrol__) */
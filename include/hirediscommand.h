@@ -31,7 +31,14 @@
 
 #include <iostream>
 #include "cluster.h"
+#include "deadline.h"
+#include "hiredisio.h"
 #include "hiredisprocess.h"
+#include "replyarena.h"
+#include "replydecoder.h"
+#include "replystream.h"
+#include "respcommand.h"
+#include "result.h"
 #include <memory>
 
 extern "C"
@@ -43,6 +50,7 @@ namespace RedisCluster
 {
     using std::string;
 
+    // reply returned by AltCommand, it owns the arena the whole reply tree is allocated from
     typedef std::shared_ptr<redisReply> Reply;
     template < typename Cluster = Cluster<redisContext> >
     class HiredisCommand
@@ -51,7 +59,9 @@ namespace RedisCluster
         enum CommandType
         {
             SDS,
-            FORMATTED_STRING
+            FORMATTED_STRING,
+            PREFORMATTED,
+            SCATTERED
         };
         
         HiredisCommand(const HiredisCommand&) = delete;
@@ -93,7 +103,8 @@ namespace RedisCluster
                                     const char ** argv,
                                     const size_t *argvlen )
         {
-            return Reply(HiredisCommand( cluster_p, key, argc, argv, argvlen ).process(), deleteReply);
+            HiredisCommand command( cluster_p, key, argc, argv, argvlen );
+            return command.processReply();
         }
         
         static inline Reply AltCommand( typename Cluster::ptr_t cluster_p,
@@ -102,15 +113,63 @@ namespace RedisCluster
         {
             va_list ap;
             va_start( ap, format );
-            return Reply(HiredisCommand( cluster_p, key, format, ap ).process(), deleteReply);
+            HiredisCommand command( cluster_p, key, format, ap );
             va_end(ap);
+            return command.processReply();
         }
         
         static inline Reply AltCommand( typename Cluster::ptr_t cluster_p,
                                     string key,
                                     const char *format, va_list ap)
         {
-            return Reply(HiredisCommand( cluster_p, key, format, ap ).process(), deleteReply);
+            HiredisCommand command( cluster_p, key, format, ap );
+            return command.processReply();
+        }
+        
+        static inline Reply AltCommand( typename Cluster::ptr_t cluster_p,
+                                    string key,
+                                    const RespCommand &cmd )
+        {
+            HiredisCommand command( cluster_p, key, cmd );
+            return command.processReply();
+        }
+        
+        // commands with deadline. The deadline covers getting a connection, redirections and
+        // reading of replies. When it expires TimeoutException is thrown and the connection
+        // in use is marked as failed
+        static inline Reply AltCommand( typename Cluster::ptr_t cluster_p,
+                                    string key,
+                                    const Deadline &deadline,
+                                    int argc,
+                                    const char ** argv,
+                                    const size_t *argvlen )
+        {
+            HiredisCommand command( cluster_p, key, argc, argv, argvlen );
+            command.deadline_ = deadline;
+            return command.processReply();
+        }
+        
+        static inline Reply AltCommand( typename Cluster::ptr_t cluster_p,
+                                    string key,
+                                    const Deadline &deadline,
+                                    const char *format, ...)
+        {
+            va_list ap;
+            va_start( ap, format );
+            HiredisCommand command( cluster_p, key, format, ap );
+            va_end(ap);
+            command.deadline_ = deadline;
+            return command.processReply();
+        }
+        
+        static inline Reply AltCommand( typename Cluster::ptr_t cluster_p,
+                                    string key,
+                                    const Deadline &deadline,
+                                    const RespCommand &cmd )
+        {
+            HiredisCommand command( cluster_p, key, cmd );
+            command.deadline_ = deadline;
+            return command.processReply();
         }
         
         static inline void* Command( typename Cluster::ptr_t cluster_p,
@@ -139,6 +198,307 @@ namespace RedisCluster
             return HiredisCommand( cluster_p, key, format, ap ).process();
         }
         
+        // command is already encoded by RespCommand builder and is sent without copying
+        static inline void* Command( typename Cluster::ptr_t cluster_p,
+                                    string key,
+                                    const RespCommand &cmd )
+        {
+            return HiredisCommand( cluster_p, key, cmd ).process();
+        }
+        
+        static inline void* Command( typename Cluster::ptr_t cluster_p,
+                                   string key,
+                                   const Deadline &deadline,
+                                   int argc,
+                                   const char ** argv,
+                                   const size_t *argvlen )
+        {
+            HiredisCommand command( cluster_p, key, argc, argv, argvlen );
+            command.deadline_ = deadline;
+            return command.process();
+        }
+        
+        static inline void* Command( typename Cluster::ptr_t cluster_p,
+                                   string key,
+                                   const Deadline &deadline,
+                                   const char *format, ...)
+        {
+            va_list ap;
+            va_start( ap, format );
+            HiredisCommand command( cluster_p, key, format, ap );
+            va_end(ap);
+            command.deadline_ = deadline;
+            return command.process();
+        }
+        
+        static inline void* Command( typename Cluster::ptr_t cluster_p,
+                                   string key,
+                                   const Deadline &deadline,
+                                   const RespCommand &cmd )
+        {
+            HiredisCommand command( cluster_p, key, cmd );
+            command.deadline_ = deadline;
+            return command.process();
+        }
+        
+        // large arguments of the command are written from the caller's memory with writev
+        static inline void* Command( typename Cluster::ptr_t cluster_p,
+                                    string key,
+                                    const ScatterCommand &cmd )
+        {
+            return HiredisCommand( cluster_p, key, cmd ).process();
+        }
+        
+        static inline void* Command( typename Cluster::ptr_t cluster_p,
+                                   string key,
+                                   const Deadline &deadline,
+                                   const ScatterCommand &cmd )
+        {
+            HiredisCommand command( cluster_p, key, cmd );
+            command.deadline_ = deadline;
+            return command.process();
+        }
+        
+        // reply is passed to the visitor while it is read from the socket, so replies of any size
+        // are consumed with a fixed size buffer. Bulk strings come in chunks as they arrive
+        static inline void Command( typename Cluster::ptr_t cluster_p,
+                                   string key,
+                                   const RespCommand &cmd,
+                                   ReplyVisitor &visitor )
+        {
+            Command( cluster_p, key, Deadline(), cmd, visitor );
+        }
+        
+        static inline void Command( typename Cluster::ptr_t cluster_p,
+                                   string key,
+                                   const Deadline &deadline,
+                                   const RespCommand &cmd,
+                                   ReplyVisitor &visitor )
+        {
+            ReplyArena arena;
+            HiredisCommand command( cluster_p, key, cmd );
+            command.arena_ = &arena;
+            command.visitor_ = &visitor;
+            command.deadline_ = deadline;
+            command.finishStream( command.process() );
+        }
+        
+        // reply is allocated from the arena and stays valid until the arena is reset
+        // or destroyed, so replies of a batch of commands are freed in one step
+        static inline redisReply* Command( typename Cluster::ptr_t cluster_p,
+                                         string key,
+                                         int argc,
+                                         const char ** argv,
+                                         const size_t *argvlen,
+                                         ReplyArena &arena )
+        {
+            HiredisCommand command( cluster_p, key, argc, argv, argvlen );
+            command.arena_ = &arena;
+            return command.process();
+        }
+        
+        static inline redisReply* Command( typename Cluster::ptr_t cluster_p,
+                                         string key,
+                                         const Deadline &deadline,
+                                         int argc,
+                                         const char ** argv,
+                                         const size_t *argvlen,
+                                         ReplyArena &arena )
+        {
+            HiredisCommand command( cluster_p, key, argc, argv, argvlen );
+            command.arena_ = &arena;
+            command.deadline_ = deadline;
+            return command.process();
+        }
+        
+        static inline redisReply* Command( typename Cluster::ptr_t cluster_p,
+                                         string key,
+                                         const RespCommand &cmd,
+                                         ReplyArena &arena )
+        {
+            HiredisCommand command( cluster_p, key, cmd );
+            command.arena_ = &arena;
+            return command.process();
+        }
+        
+        // Non-throwing versions of the commands. Cluster errors are returned in Result
+        // instead of exceptions, so failovers don't cost stack unwinding in every thread.
+        // Redis error replies other than redirections and CLUSTERDOWN are returned as replies
+        static inline Result<redisReply*> TryCommand( typename Cluster::ptr_t cluster_p,
+                                                     string key,
+                                                     int argc,
+                                                     const char ** argv,
+                                                     const size_t *argvlen ) noexcept
+        {
+            return TryCommand( cluster_p, key, Deadline(), argc, argv, argvlen );
+        }
+        
+        static inline Result<redisReply*> TryCommand( typename Cluster::ptr_t cluster_p,
+                                                     string key,
+                                                     const Deadline &deadline,
+                                                     int argc,
+                                                     const char ** argv,
+                                                     const size_t *argvlen ) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            try
+            {
+                HiredisCommand command( cluster_p, key, argc, argv, argvlen );
+                command.deadline_ = deadline;
+                return command.tryProcess();
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+        }
+        
+        static inline Result<redisReply*> TryCommand( typename Cluster::ptr_t cluster_p,
+                                                     string key,
+                                                     const char *format, ...) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            va_list ap;
+            va_start( ap, format );
+            try
+            {
+                HiredisCommand command( cluster_p, key, format, ap );
+                va_end( ap );
+                return command.tryProcess();
+            }
+            catch( ... )
+            {
+                va_end( ap );
+                return ErrorCodes::current();
+            }
+        }
+        
+        static inline Result<redisReply*> TryCommand( typename Cluster::ptr_t cluster_p,
+                                                     string key,
+                                                     const RespCommand &cmd ) noexcept
+        {
+            return TryCommand( cluster_p, key, Deadline(), cmd );
+        }
+        
+        static inline Result<redisReply*> TryCommand( typename Cluster::ptr_t cluster_p,
+                                                     string key,
+                                                     const Deadline &deadline,
+                                                     const RespCommand &cmd ) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            try
+            {
+                HiredisCommand command( cluster_p, key, cmd );
+                command.deadline_ = deadline;
+                return command.tryProcess();
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+        }
+        
+        static inline Result<redisReply*> TryCommand( typename Cluster::ptr_t cluster_p,
+                                                     string key,
+                                                     const ScatterCommand &cmd ) noexcept
+        {
+            return TryCommand( cluster_p, key, Deadline(), cmd );
+        }
+        
+        static inline Result<redisReply*> TryCommand( typename Cluster::ptr_t cluster_p,
+                                                     string key,
+                                                     const Deadline &deadline,
+                                                     const ScatterCommand &cmd ) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            try
+            {
+                HiredisCommand command( cluster_p, key, cmd );
+                command.deadline_ = deadline;
+                return command.tryProcess();
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+        }
+        
+        static inline ErrorCode TryCommand( typename Cluster::ptr_t cluster_p,
+                                           string key,
+                                           const Deadline &deadline,
+                                           const RespCommand &cmd,
+                                           ReplyVisitor &visitor ) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            try
+            {
+                ReplyArena arena;
+                HiredisCommand command( cluster_p, key, cmd );
+                command.arena_ = &arena;
+                command.visitor_ = &visitor;
+                command.deadline_ = deadline;
+                redisReply *reply = nullptr;
+                ErrorCode code = command.execute( reply );
+                if( code == SUCCESS )
+                    command.finishStream( reply );
+                return code;
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+        }
+        
+        static inline Result<Reply> TryAltCommand( typename Cluster::ptr_t cluster_p,
+                                                  string key,
+                                                  int argc,
+                                                  const char ** argv,
+                                                  const size_t *argvlen ) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            try
+            {
+                HiredisCommand command( cluster_p, key, argc, argv, argvlen );
+                return command.tryProcessReply();
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+        }
+        
+        static inline Result<Reply> TryAltCommand( typename Cluster::ptr_t cluster_p,
+                                                  string key,
+                                                  const RespCommand &cmd ) noexcept
+        {
+            return TryAltCommand( cluster_p, key, Deadline(), cmd );
+        }
+        
+        static inline Result<Reply> TryAltCommand( typename Cluster::ptr_t cluster_p,
+                                                  string key,
+                                                  const Deadline &deadline,
+                                                  const RespCommand &cmd ) noexcept
+        {
+            if( cluster_p == NULL )
+                return INVALID_ARGUMENT;
+            try
+            {
+                HiredisCommand command( cluster_p, key, cmd );
+                command.deadline_ = deadline;
+                return command.tryProcessReply();
+            }
+            catch( ... )
+            {
+                return ErrorCodes::current();
+            }
+        }
+        
     protected:
         
         HiredisCommand( typename Cluster::ptr_t cluster_p,
@@ -148,7 +508,10 @@ namespace RedisCluster
                        const size_t *argvlen ) :
         cluster_p_( cluster_p ),
         key_( key ),
-        type_( SDS )
+        type_( SDS ),
+        scatter_( nullptr ),
+        arena_( nullptr ),
+        visitor_( nullptr )
         {
             if( cluster_p == NULL )
                 throw InvalidArgument(nullptr);
@@ -161,7 +524,10 @@ namespace RedisCluster
                        const char *format, va_list ap ) :
         cluster_p_( cluster_p ),
         key_( key ),
-        type_( FORMATTED_STRING )
+        type_( FORMATTED_STRING ),
+        scatter_( nullptr ),
+        arena_( nullptr ),
+        visitor_( nullptr )
         {
             if( cluster_p == NULL )
                 throw InvalidArgument(nullptr);
@@ -169,84 +535,235 @@ namespace RedisCluster
             len_ = redisvFormatCommand(&cmd_, format, ap);
         }
         
+        HiredisCommand( typename Cluster::ptr_t cluster_p,
+                       string key,
+                       const RespCommand &cmd ) :
+        cluster_p_( cluster_p ),
+        key_( key ),
+        cmd_( const_cast<char*>( cmd.data() ) ),
+        len_( (int)cmd.size() ),
+        type_( PREFORMATTED ),
+        scatter_( nullptr ),
+        arena_( nullptr ),
+        visitor_( nullptr )
+        {
+            if( cluster_p == NULL )
+                throw InvalidArgument(nullptr);
+        }
+        
+        HiredisCommand( typename Cluster::ptr_t cluster_p,
+                       string key,
+                       const ScatterCommand &cmd ) :
+        cluster_p_( cluster_p ),
+        key_( key ),
+        cmd_( nullptr ),
+        len_( (int)cmd.size() ),
+        type_( SCATTERED ),
+        scatter_( &cmd ),
+        arena_( nullptr ),
+        visitor_( nullptr )
+        {
+            if( cluster_p == NULL )
+                throw InvalidArgument(nullptr);
+        }
+        
         ~HiredisCommand()
         {
             if( type_ == SDS )
             {
                 sdsfree( (sds)cmd_ );
             }
-            else
+            else if( type_ == FORMATTED_STRING )
             {
                 free( cmd_ );
             }
         }
         
-        redisReply* processHiredisCommand( Connection *con ) {
-            redisReply* reply;
-            redisAppendFormattedCommand( con, cmd_, len_ );
-            redisGetReply( con, (void**)&reply );
+        // sends the command (after ASKING if asking is set) and reads the reply.
+        // Reply to the command is read even if ASKING failed, so the connection
+        // stays in sync, and the redirection takes one round trip
+        ErrorCode send( Connection *con, bool asking, redisReply *&reply )
+        {
+            redisReply* askingReply = nullptr;
+            if( asking )
+                redisAppendCommand( con, "ASKING" );
+            
+            // scattered command is written right away after the output buffer
+            if( scatter_ != nullptr )
+            {
+                if( HiredisIO::writev( con, scatter_->iov(), scatter_->count(), deadline_ ) != REDIS_OK )
+                    return HiredisProcess::checkReply( nullptr, con );
+            }
+            else
+            {
+                redisAppendFormattedCommand( con, cmd_, len_ );
+            }
+            
+            if( asking )
+            {
+                HiredisIO::getReply( con, (void**)&askingReply, deadline_ );
+                if( askingReply == nullptr )
+                    return HiredisProcess::checkReply( nullptr, con );
+            }
+            
+            reply = visitor_ != nullptr ? streamReply( con ) : readReply( con );
+            ErrorCode code = HiredisProcess::checkReply( reply, con );
+            if( askingReply != nullptr )
+            {
+                if( code == SUCCESS && askingReply->type == REDIS_REPLY_ERROR )
+                    code = ASKING_FAILED;
+                freeReplyObject( askingReply );
+            }
+            if( code != SUCCESS && reply != nullptr )
+            {
+                freeReply( reply );
+                reply = nullptr;
+            }
+            return code;
+        }
+        
+        redisReply* readReply( Connection *con ) {
+            redisReply* reply = nullptr;
+            if( arena_ != nullptr )
+            {
+                HiredisIO::getReply( con, *arena_, (void**)&reply, deadline_ );
+            }
+            else
+            {
+                HiredisIO::getReply( con, (void**)&reply, deadline_ );
+            }
+            return reply;
+        }
+        
+        // streamed reply is passed to the visitor, only its kind is returned: an error reply
+        // (for redirections) or an empty status reply. Connection is marked as failed when
+        // the visitor throws, because the rest of the reply can't be skipped
+        redisReply* streamReply( Connection *con ) {
+            ReplyStreamParser parser( *visitor_ );
+            try
+            {
+                if( HiredisIO::readStream( con, parser, deadline_ ) != REDIS_OK )
+                    return nullptr;
+            }
+            catch( ... )
+            {
+                HiredisIO::failed( con, REDIS_ERR_OTHER, "reply stream aborted" );
+                throw;
+            }
+            
+            if( !parser.isError() )
+                return arena_->createReply( REDIS_REPLY_STATUS );
+            
+            redisReply *reply = arena_->createReply( REDIS_REPLY_ERROR );
+            char *str = static_cast<char*>( arena_->allocate( parser.error().size() + 1 ) );
+            memcpy( str, parser.error().c_str(), parser.error().size() + 1 );
+            reply->str = str;
+            reply->len = parser.error().size();
             return reply;
         }
         
-        redisReply* asking( Connection *con  ) {
-            return static_cast<redisReply*>( redisCommand( con, "ASKING" ) );
+        // error reply is the last part of a streamed reply
+        void finishStream( redisReply *reply ) {
+            if( reply->type == REDIS_REPLY_ERROR )
+                visitor_->onError( StringRef( reply->str, reply->len ) );
+        }
+        
+        // replies allocated from an arena are freed together with the arena
+        inline void freeReply( redisReply *reply ) {
+            if( arena_ == nullptr )
+                freeReplyObject( reply );
+        }
+        
+        // reply tree is allocated from an arena owned by the returned Reply,
+        // so the Reply needs one allocation for the arena and its control block
+        Reply processReply()
+        {
+            std::shared_ptr<ReplyArena> arena = std::make_shared<ReplyArena>();
+            arena_ = arena.get();
+            return Reply( arena, process() );
+        }
+        
+        Result<Reply> tryProcessReply()
+        {
+            std::shared_ptr<ReplyArena> arena = std::make_shared<ReplyArena>();
+            arena_ = arena.get();
+            redisReply *reply = nullptr;
+            ErrorCode code = execute( reply );
+            if( code != SUCCESS )
+                return code;
+            return Reply( arena, reply );
         }
         
         redisReply* process()
         {
             redisReply *reply = nullptr;
-            typename Cluster::SlotConnection con = cluster_p_->getConnection( key_ );
-            typename Cluster::HostConnection hcon = { "", NULL };
-            string host, port;
-
-            reply = processHiredisCommand( con.second );
-            HiredisProcess::checkCritical(reply, false, "", con.second);
+            ErrorCode code = execute( reply );
+            if( code == ASKING_FAILED )
+                throw LogicError( nullptr, "asking error" );
+            ErrorCodes::raise( code );
+            return reply;
+        }
+        
+        Result<redisReply*> tryProcess()
+        {
+            redisReply *reply = nullptr;
+            ErrorCode code = execute( reply );
+            if( code != SUCCESS )
+                return code;
+            return reply;
+        }
+        
+        // runs the command following ASK and MOVED redirections. Cluster errors are returned
+        // as error codes, on error reply is nullptr and connections are already released
+        ErrorCode execute( redisReply *&reply )
+        {
+            reply = nullptr;
+            typename Cluster::SlotConnection con;
+            ErrorCode code = cluster_p_->findConnection( key_, con, deadline_ );
+            if( code != SUCCESS )
+                return code;
+            
+            code = send( con.second, false, reply );
             cluster_p_->releaseConnection( con );
-
-            HiredisProcess::processState state = HiredisProcess::processResult( reply, host, port);
+            if( code != SUCCESS )
+                return code;
+            
+            string host, port;
+            HiredisProcess::processState state = HiredisProcess::redirection( reply, host, port );
+            if( state == HiredisProcess::READY )
+                return SUCCESS;
+            
+            freeReply( reply );
+            reply = nullptr;
+            if( state != HiredisProcess::ASK && state != HiredisProcess::MOVED )
+                return LOGIC_ERROR;
             
-            switch ( state ) {
-                case HiredisProcess::ASK:
-                    freeReplyObject( reply );
-                    hcon = cluster_p_->createNewConnection( host, port );
-                    
-                    if (hcon.second != NULL && hcon.second->err == 0) {
-                        reply = asking( hcon.second );
-                        HiredisProcess::checkCritical(reply, true, "asking error");
-                    
-                        freeReplyObject( reply );
-                        reply = processHiredisCommand(hcon.second);
-                        HiredisProcess::checkCritical(reply, false);
-                    
-                        cluster_p_->releaseConnection( hcon );
-                    }
-                    else if( hcon.second == NULL )
-                        throw LogicError(nullptr, "Can't connect while resolving asking state");
-                    else {
-                        cluster_p_->releaseConnection( hcon );
-                        throw LogicError(nullptr, hcon.second->errstr);
-                    }
-                    break;
-                case HiredisProcess::MOVED:
-                    freeReplyObject( reply );
-                    hcon = cluster_p_->createNewConnection( host, port );
-                    if( hcon.second != NULL && hcon.second->err == 0 ) {
-                        reply = processHiredisCommand( hcon.second );
-                        cluster_p_->moved();
-                    }
-                    else if( hcon.second == NULL )
-                        throw LogicError(nullptr, "Can't connect while resolving asking state");
-                    else
-                        throw LogicError(nullptr, hcon.second->errstr );
-                    cluster_p_->releaseConnection( hcon );
-                    
-                    break;
-                case HiredisProcess::READY:
-                    break;
-                default:
-                    throw LogicError(reply, "error in state processing" );
+            typename Cluster::HostConnection hcon;
+            code = cluster_p_->findRedirection( host, port, hcon, deadline_ );
+            if( code != SUCCESS )
+                return code;
+            if( hcon.second->err != 0 )
+            {
+                cluster_p_->releaseConnection( hcon );
+                return REDIRECT_FAILED;
             }
-            return reply;
+            
+            code = send( hcon.second, state == HiredisProcess::ASK, reply );
+            cluster_p_->releaseConnection( hcon );
+            if( code == SUCCESS && state == HiredisProcess::MOVED )
+            {
+                // moved callback may throw to abort the redirection
+                try
+                {
+                    cluster_p_->moved();
+                }
+                catch( ... )
+                {
+                    freeReply( reply );
+                    throw;
+                }
+            }
+            return code;
         }
         
         static Connection* connectFunction( const char* host, int port, void * )
@@ -264,6 +781,14 @@ namespace RedisCluster
         char *cmd_;
         int len_;
         CommandType type_;
+        // command with parts in the caller's memory, or nullptr
+        const ScatterCommand *scatter_;
+        // arena for the reply, or nullptr if reply is allocated by hiredis
+        ReplyArena *arena_;
+        // receiver of the streamed reply, or nullptr if the reply tree is built
+        ReplyVisitor *visitor_;
+        // deadline of the whole command including redirections
+        Deadline deadline_;
     };
 }
 
@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__hiredisio__
+#define __libredisCluster__hiredisio__
+
+#include <vector>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+#include "deadline.h"
+#include "replyarena.h"
+#include "replystream.h"
+#include "respparser.h"
+
+namespace RedisCluster
+{
+    // Helpers for driving several synchronous hiredis connections at once.
+    // All output buffers are written first and replies are then collected with
+    // poll(), so requests to different nodes are in flight at the same time.
+    // With a deadline sockets are written and read only when poll() reports them
+    // ready, and writes to blocking sockets are bounded by the send timeout of the
+    // socket, which is set to the time left. When the deadline expires, connections with unfinished requests are
+    // marked as failed (their replies can't be matched to requests anymore)
+    // and REDIS_ERR is returned, expired() tells timeouts from other errors
+    class HiredisIO
+    {
+    public:
+        // replies expected on one connection and the replies read so far
+        struct Pending
+        {
+            redisContext *con;
+            size_t expected;
+            std::vector<redisReply*> replies;
+        };
+
+        // writes the whole output buffer of the connection
+        static int flush( redisContext *con, const Deadline &deadline = Deadline() )
+        {
+            SendTimeout timeout( con, deadline );
+            int done = 0;
+            do
+            {
+                if( !deadline.infinite() && ( !wait( con, POLLOUT, deadline ) || !timeout.update( deadline ) ) )
+                    return REDIS_ERR;
+                if( redisBufferWrite( con, &done ) != REDIS_OK )
+                {
+                    // the send timeout expired in the middle of the write
+                    if( deadline.expired() )
+                        expire( con );
+                    return REDIS_ERR;
+                }
+            } while( !done );
+            return REDIS_OK;
+        }
+
+        // writes parts of a command from the caller's memory with writev after the output
+        // buffer, so commands appended before (i.e. ASKING) are sent first. The connection
+        // is marked as failed on errors, as hiredis does
+        static int writev( redisContext *con, const struct iovec *iov, size_t count,
+                          const Deadline &deadline = Deadline() )
+        {
+            if( flush( con, deadline ) != REDIS_OK )
+                return REDIS_ERR;
+
+            SendTimeout timeout( con, deadline );
+            size_t index = 0, offset = 0;
+            while( true )
+            {
+                // empty parts and parts already written are skipped
+                while( index < count && iov[index].iov_len == offset )
+                {
+                    ++index;
+                    offset = 0;
+                }
+                if( index == count )
+                    return REDIS_OK;
+
+                struct iovec window[WritevWindow];
+                size_t n = 0;
+                for( size_t i = index; i < count && n < WritevWindow; ++i, ++n )
+                    window[n] = iov[i];
+                window[0].iov_base = static_cast<char*>( window[0].iov_base ) + offset;
+                window[0].iov_len -= offset;
+
+                if( !deadline.infinite() && ( !wait( con, POLLOUT, deadline ) || !timeout.update( deadline ) ) )
+                    return REDIS_ERR;
+
+                ssize_t written = ::writev( con->fd, window, (int)n );
+                if( written < 0 )
+                {
+                    if( errno == EINTR )
+                        continue;
+                    // blocking socket gets EAGAIN when its send timeout expires
+                    if( ( errno == EAGAIN || errno == EWOULDBLOCK ) &&
+                       ( !( con->flags & REDIS_BLOCK ) || !deadline.infinite() ) )
+                    {
+                        if( !wait( con, POLLOUT, deadline ) )
+                            return REDIS_ERR;
+                        continue;
+                    }
+                    return failed( con, REDIS_ERR_IO, strerror( errno ) );
+                }
+
+                size_t left = static_cast<size_t>( written );
+                while( left > 0 )
+                {
+                    size_t available = iov[index].iov_len - offset;
+                    if( left < available )
+                    {
+                        offset += left;
+                        break;
+                    }
+                    left -= available;
+                    ++index;
+                    offset = 0;
+                }
+            }
+        }
+
+        // same as redisGetReply, but bounded by the deadline
+        static int getReply( redisContext *con, void **reply, const Deadline &deadline = Deadline() )
+        {
+            if( deadline.infinite() )
+                return redisGetReply( con, reply );
+
+            if( flush( con, deadline ) != REDIS_OK )
+                return REDIS_ERR;
+            while( true )
+            {
+                if( redisGetReplyFromReader( con, reply ) != REDIS_OK )
+                    return REDIS_ERR;
+                if( *reply != nullptr )
+                    return REDIS_OK;
+                if( !wait( con, POLLIN, deadline ) || redisBufferRead( con ) != REDIS_OK )
+                    return REDIS_ERR;
+            }
+        }
+
+        // same as getReply, but the reply is parsed by RespParser and allocated from the arena
+        static int getReply( redisContext *con, ReplyArena &arena, void **reply, const Deadline &deadline = Deadline() )
+        {
+            if( flush( con, deadline ) != REDIS_OK )
+                return REDIS_ERR;
+            
+            RespParser parser;
+            while( true )
+            {
+                if( takeReply( con, parser, arena, reply ) != REDIS_OK )
+                    return REDIS_ERR;
+                if( *reply != nullptr )
+                    return REDIS_OK;
+                if( !deadline.infinite() && !wait( con, POLLIN, deadline ) )
+                    return REDIS_ERR;
+                if( redisBufferRead( con ) != REDIS_OK )
+                    return REDIS_ERR;
+            }
+        }
+        
+        // Moves one complete reply from the reader buffer without touching the socket, *reply is
+        // NULL if the reply isn't complete yet. The parser keeps the scanned part of an incomplete
+        // reply, so it must be given again until the reply is taken. Replies partially parsed by
+        // the hiredis reader (or all replies if RespParser is disabled) are left to the reader
+        static int takeReply( redisContext *con, RespParser &parser, ReplyArena &arena, void **reply )
+        {
+            *reply = nullptr;
+            redisReader *reader = con->reader;
+            if( reader->ridx != -1 || !RespParser::enabled() )
+            {
+                ReplyArena::ReaderScope scope( reader, arena );
+                return redisGetReplyFromReader( con, reply );
+            }
+            
+            long used = parser.scan( reader->buf + reader->pos, reader->len - reader->pos );
+            if( used < 0 )
+                return failed( con, REDIS_ERR_PROTOCOL, parser.error() );
+            if( used > 0 )
+            {
+                *reply = parser.build( reader->buf + reader->pos, used, arena );
+                reader->pos += used;
+                // the buffer is compacted as the hiredis reader does
+                if( reader->pos >= 1024 )
+                {
+                    sdsrange( reader->buf, reader->pos, -1 );
+                    reader->len -= reader->pos;
+                    reader->pos = 0;
+                }
+            }
+            return REDIS_OK;
+        }
+        
+        // reads one reply from the socket passing it to the parser, so only a buffer of
+        // StreamBuffer bytes is used for replies of any size. Data buffered by the hiredis
+        // reader is parsed first, bytes of the following replies are given back to the reader
+        static int readStream( redisContext *con, ReplyStreamParser &parser, const Deadline &deadline = Deadline() )
+        {
+            if( flush( con, deadline ) != REDIS_OK )
+                return REDIS_ERR;
+            
+            redisReader *reader = con->reader;
+            if( reader->ridx != -1 )
+                return failed( con, REDIS_ERR_OTHER, "reply is partially read by hiredis reader" );
+            if( reader->len > reader->pos )
+            {
+                long used = parser.feed( reader->buf + reader->pos, reader->len - reader->pos );
+                if( used < 0 )
+                    return failed( con, REDIS_ERR_PROTOCOL, "protocol error" );
+                reader->pos += used;
+            }
+            
+            char buf[StreamBuffer];
+            while( !parser.done() )
+            {
+                if( !deadline.infinite() && !wait( con, POLLIN, deadline ) )
+                    return REDIS_ERR;
+                
+                ssize_t n = ::read( con->fd, buf, sizeof( buf ) );
+                if( n < 0 )
+                {
+                    if( errno == EINTR )
+                        continue;
+                    if( ( errno == EAGAIN || errno == EWOULDBLOCK ) && !( con->flags & REDIS_BLOCK ) )
+                    {
+                        if( !wait( con, POLLIN, deadline ) )
+                            return REDIS_ERR;
+                        continue;
+                    }
+                    return failed( con, REDIS_ERR_IO, strerror( errno ) );
+                }
+                if( n == 0 )
+                    return failed( con, REDIS_ERR_EOF, "Server closed the connection" );
+                
+                long used = parser.feed( buf, n );
+                if( used < 0 )
+                    return failed( con, REDIS_ERR_PROTOCOL, "protocol error" );
+                if( used < n && redisReaderFeed( reader, buf + used, n - used ) != REDIS_OK )
+                    return failed( con, REDIS_ERR_OOM, "Out of memory" );
+            }
+            return REDIS_OK;
+        }
+        
+        // sets the error of the connection as hiredis does
+        static int failed( redisContext *con, int err, const char *errstr )
+        {
+            con->err = err;
+            snprintf( con->errstr, sizeof( con->errstr ), "%s", errstr );
+            return REDIS_ERR;
+        }
+
+        // marks the connection as unusable after an expired deadline
+        static void expire( redisContext *con )
+        {
+#ifdef REDIS_ERR_TIMEOUT
+            con->err = REDIS_ERR_TIMEOUT;
+#else
+            con->err = REDIS_ERR_IO;
+#endif
+            snprintf( con->errstr, sizeof( con->errstr ), "%s", expiredError() );
+        }
+
+        // true if the connection failed because of an expired deadline
+        static bool expired( const redisContext *con )
+        {
+            return con->err != 0 && strcmp( con->errstr, expiredError() ) == 0;
+        }
+
+        // Marks connections with requests not answered yet as failed, so they are not reused
+        // with stale replies in their sockets. Connections failed already keep their errors
+        static void abandon( std::vector<Pending> &pending )
+        {
+            for( size_t i = 0; i < pending.size(); ++i )
+            {
+                redisContext *con = pending[i].con;
+                if( con->err == 0 && pending[i].replies.size() < pending[i].expected )
+                    failed( con, REDIS_ERR_OTHER, abandonedError() );
+            }
+        }
+
+        // reads the expected number of replies from every connection, reading
+        // only from sockets that poll() reports as ready. On error (or timeout) the
+        // replies that were already read are left in pending for the caller to free.
+        // If arena is given, all replies are allocated from it
+        static int readReplies( std::vector<Pending> &pending, ReplyArena *arena = nullptr,
+                               const Deadline &deadline = Deadline() )
+        {
+            if( arena == nullptr )
+                return pollReplies( pending, deadline );
+            
+            if( RespParser::enabled() )
+            {
+                std::vector<RespParser> parsers( pending.size() );
+                return pollReplies( pending, deadline, arena, parsers.data() );
+            }
+
+            std::vector<redisReplyObjectFunctions*> fn( pending.size() );
+            std::vector<void*> privdata( pending.size() );
+            for( size_t i = 0; i < pending.size(); ++i )
+            {
+                redisReader *reader = pending[i].con->reader;
+                fn[i] = reader->fn;
+                privdata[i] = reader->privdata;
+                reader->fn = ReplyArena::functions();
+                reader->privdata = arena;
+            }
+
+            int result = pollReplies( pending, deadline );
+            restore( pending, fn, privdata );
+            return result;
+        }
+
+    protected:
+        // parts passed to one writev call, far below IOV_MAX
+        static const size_t WritevWindow = 64;
+        // socket reads of streamed replies
+        static const size_t StreamBuffer = 16 * 1024;
+
+        static inline const char* expiredError()
+        {
+            return "command deadline expired";
+        }
+
+        static inline const char* abandonedError()
+        {
+            return "replies of a failed request are pending";
+        }
+
+        // Send timeout of a blocking socket written with a deadline, the previous
+        // timeout is restored when the write is done
+        class SendTimeout
+        {
+            SendTimeout(const SendTimeout&) = delete;
+            SendTimeout& operator=(const SendTimeout&) = delete;
+            
+        public:
+            SendTimeout( redisContext *con, const Deadline &deadline ) : con_( nullptr )
+            {
+                if( deadline.infinite() || !( con->flags & REDIS_BLOCK ) )
+                    return;
+                socklen_t len = sizeof( saved_ );
+                if( getsockopt( con->fd, SOL_SOCKET, SO_SNDTIMEO, &saved_, &len ) == 0 )
+                    con_ = con;
+            }
+            
+            ~SendTimeout()
+            {
+                if( con_ != nullptr )
+                    setsockopt( con_->fd, SOL_SOCKET, SO_SNDTIMEO, &saved_, sizeof( saved_ ) );
+            }
+            
+            // sets the timeout to the time left before the next write, false if the
+            // deadline expired (zero timeout would block forever)
+            bool update( const Deadline &deadline )
+            {
+                if( con_ == nullptr )
+                    return true;
+                int ms = deadline.pollTimeout();
+                if( ms == 0 )
+                {
+                    expire( con_ );
+                    return false;
+                }
+                struct timeval tv;
+                tv.tv_sec = ms / 1000;
+                tv.tv_usec = ( ms % 1000 ) * 1000;
+                setsockopt( con_->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof( tv ) );
+                return true;
+            }
+            
+        private:
+            redisContext *con_;
+            struct timeval saved_;
+        };
+        
+        static void restore( std::vector<Pending> &pending,
+                            const std::vector<redisReplyObjectFunctions*> &fn,
+                            const std::vector<void*> &privdata )
+        {
+            for( size_t i = 0; i < pending.size(); ++i )
+            {
+                pending[i].con->reader->fn = fn[i];
+                pending[i].con->reader->privdata = privdata[i];
+            }
+        }
+
+        // waits until the socket is ready, returns false on socket errors and timeout
+        static bool wait( redisContext *con, short events, const Deadline &deadline )
+        {
+            struct pollfd pfd = { con->fd, events, 0 };
+            while( true )
+            {
+                int ready = poll( &pfd, 1, deadline.pollTimeout() );
+                if( ready > 0 )
+                    return true;
+                if( ready == 0 )
+                {
+                    expire( con );
+                    return false;
+                }
+                // the request may be half written or read, so the connection is not reused
+                if( errno != EINTR )
+                {
+                    failed( con, REDIS_ERR_IO, strerror( errno ) );
+                    return false;
+                }
+            }
+        }
+
+        // on any error the other connections are abandoned too
+        static int pollReplies( std::vector<Pending> &pending, const Deadline &deadline,
+                               ReplyArena *arena = nullptr, RespParser *parsers = nullptr )
+        {
+            int result = pollAll( pending, deadline, arena, parsers );
+            if( result != REDIS_OK )
+                abandon( pending );
+            return result;
+        }
+
+        static int pollAll( std::vector<Pending> &pending, const Deadline &deadline,
+                           ReplyArena *arena, RespParser *parsers )
+        {
+            std::vector<struct pollfd> fds;
+            std::vector<size_t> index;
+            fds.reserve( pending.size() );
+            index.reserve( pending.size() );
+
+            while( true )
+            {
+                fds.clear();
+                index.clear();
+
+                for( size_t i = 0; i < pending.size(); ++i )
+                {
+                    if( takeReplies( pending[i], arena, parsers ? &parsers[i] : nullptr ) != REDIS_OK )
+                        return REDIS_ERR;
+
+                    if( pending[i].replies.size() < pending[i].expected )
+                    {
+                        struct pollfd pfd = { pending[i].con->fd, POLLIN, 0 };
+                        fds.push_back( pfd );
+                        index.push_back( i );
+                    }
+                }
+
+                if( fds.empty() )
+                    return REDIS_OK;
+
+                int ready = poll( fds.data(), fds.size(), deadline.pollTimeout() );
+                if( ready < 0 )
+                {
+                    if( errno == EINTR )
+                        continue;
+                    return failed( pending[index[0]].con, REDIS_ERR_IO, strerror( errno ) );
+                }
+                if( ready == 0 )
+                {
+                    for( size_t i = 0; i < index.size(); ++i )
+                        expire( pending[index[i]].con );
+                    return REDIS_ERR;
+                }
+
+                for( size_t i = 0; i < fds.size(); ++i )
+                {
+                    if( fds[i].revents != 0 && redisBufferRead( pending[index[i]].con ) != REDIS_OK )
+                        return REDIS_ERR;
+                }
+            }
+        }
+
+        // moves complete replies from the connection reader without touching the socket,
+        // with a parser replies are parsed by it into the arena
+        static int takeReplies( Pending &pending, ReplyArena *arena = nullptr, RespParser *parser = nullptr )
+        {
+            while( pending.replies.size() < pending.expected )
+            {
+                void *reply = nullptr;
+                int result = parser != nullptr ? takeReply( pending.con, *parser, *arena, &reply ) :
+                    redisGetReplyFromReader( pending.con, &reply );
+                if( result != REDIS_OK )
+                    return REDIS_ERR;
+                if( reply == nullptr )
+                    break;
+                pending.replies.push_back( static_cast<redisReply*>( reply ) );
+            }
+            return REDIS_OK;
+        }
+    };
+}
+
+#endif /* defined(__libredisCluster__hiredisio__) */
@@ -30,7 +30,10 @@
 #define __libredisCluster__hiredisprocess__
 
 #include <string>
+#include <string.h>
 #include "cluster.h"
+#include "hiredisio.h"
+#include "result.h"
 
 extern "C"
 {
@@ -55,48 +58,75 @@ namespace RedisCluster
         
         static void parsehostport( string error, string &host, string &port )
         {
-            size_t hostPotision = error.find( " ", error.find( " " ) + 1) + 1;
-            size_t portPosition = error.find( ":", hostPotision ) + 1;
-            
-            if( hostPotision != string::npos && portPosition != string::npos )
-            {
-                host = error.substr( hostPotision, portPosition - hostPotision - 1 );
-                port = error.substr( portPosition );
-            }
-            else
+            if( !parseHostPort( error.data(), error.size(), host, port ) )
             {
                 throw LogicError(nullptr, "error while parsing host port in redis redirection reply");
             }
         }
         
+        // parses "<ASK|MOVED> <slot> <host>:<port>", returns false on malformed reply
+        static bool parseHostPort( const char *error, size_t len, string &host, string &port )
+        {
+            const char *end = error + len;
+            const char *slot = static_cast<const char*>( memchr( error, ' ', len ) );
+            if( slot == nullptr )
+                return false;
+            const char *hostPosition = static_cast<const char*>( memchr( slot + 1, ' ', end - slot - 1 ) );
+            if( hostPosition == nullptr )
+                return false;
+            ++hostPosition;
+            const char *portPosition = static_cast<const char*>( memchr( hostPosition, ':', end - hostPosition ) );
+            if( portPosition == nullptr )
+                return false;
+            
+            host.assign( hostPosition, portPosition );
+            port.assign( portPosition + 1, end );
+            return true;
+        }
+        
         static processState processResult( redisReply* reply, string &result_host, string &result_port )
         {
-            processState state = READY;
-            if ( reply->type == REDIS_REPLY_ERROR )
+            processState state = redirection( reply, result_host, result_port );
+            if( state == FAILED )
             {
-                string error ( reply->str, reply->len );
-                
-                if( error.find( "ASK" ) == 0 )
-                {
-                    parsehostport( error, result_host, result_port );
-                    state = ASK;
-                }
-                else if ( error.find( "MOVED" ) == 0  )
-                {
-                    parsehostport( error , result_host, result_port );
-                    state = MOVED;
-                }
-                else if ( error.find( "CLUSTERDOWN" ) == 0 )
-                {
-                    state = CLUSTERDOWN;
-                }
-                else
-                {
-                }
+                throw LogicError(nullptr, "error while parsing host port in redis redirection reply");
             }
             return state;
         }
-
+        
+        // same as processResult, but returns FAILED instead of throwing on malformed redirection
+        static processState redirection( const redisReply* reply, string &result_host, string &result_port )
+        {
+            if( reply->type != REDIS_REPLY_ERROR )
+                return READY;
+            
+            if( startsWith( reply, "ASK" ) )
+            {
+                return parseHostPort( reply->str, reply->len, result_host, result_port ) ? ASK : FAILED;
+            }
+            else if( startsWith( reply, "MOVED" ) )
+            {
+                return parseHostPort( reply->str, reply->len, result_host, result_port ) ? MOVED : FAILED;
+            }
+            else if( startsWith( reply, "CLUSTERDOWN" ) )
+            {
+                return CLUSTERDOWN;
+            }
+            return READY;
+        }
+        
+        // error code version of checkCritical, reply is never freed
+        static ErrorCode checkReply( const redisReply *reply, const redisContext *con = nullptr )
+        {
+            if( con != nullptr && con->err != 0 )
+                return HiredisIO::expired( con ) ? TIMEOUT : DISCONNECTED;
+            if( reply == nullptr )
+                return DISCONNECTED;
+            if( reply->type == REDIS_REPLY_ERROR && strstr( reply->str, "CLUSTERDOWN" ) != nullptr )
+                return CLUSTER_DOWN;
+            return SUCCESS;
+        }
+        
         static void checkCritical( redisReply *reply, bool errorcritical, bool free_reply_obj = true,
                                    string error = "", redisContext *con = nullptr ) {
             if(con!= NULL && con->err !=0) {
@@ -114,6 +144,13 @@ namespace RedisCluster
                 }
             }
         }
+    
+    private:
+        template<size_t N>
+        static inline bool startsWith( const redisReply *reply, const char (&prefix)[N] )
+        {
+            return reply->len >= N - 1 && memcmp( reply->str, prefix, N - 1 ) == 0;
+        }
     };
 }
 
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__loopqueue__
+#define __libredisCluster__loopqueue__
+
+#include <atomic>
+#include <utility>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "adapters/adapter.h"
+#include "clusterexception.h"
+
+namespace RedisCluster
+{
+    // Tasks posted by any thread and run by one thread. Posting is lock-free: a task is pushed
+    // to the head of a list with one compare-and-swap, and the consumer takes the whole list
+    // with one exchange, so a busy consumer runs many tasks per wakeup. The consumer is woken
+    // through a descriptor (eventfd on Linux, a pipe elsewhere) only when a task comes to an
+    // empty queue. The descriptor is watched by the adapter of an event loop, or waited for
+    // by a thread without a loop
+    template<typename Task>
+    class LoopQueue
+    {
+        LoopQueue(const LoopQueue&) = delete;
+        LoopQueue& operator=(const LoopQueue&) = delete;
+
+        struct Node
+        {
+            explicit Node( Task &&t ) : next( nullptr ), task( std::move( t ) ) {}
+
+            Node *next;
+            Task task;
+        };
+
+    public:
+        // tasks are run by the event loop of the adapter, which must be able to watch descriptors
+        explicit LoopQueue( Adapter &adapter ) :
+        adapter_( &adapter ),
+        watch_( NULL ),
+        head_( nullptr )
+        {
+            openFds();
+            watch_ = adapter.watchFd( fds_[0], wake, this );
+            if( watch_ == NULL )
+            {
+                closeFds();
+                throw InvalidArgument( nullptr );
+            }
+        }
+
+        // tasks are run by the thread calling wait or drain
+        LoopQueue() :
+        adapter_( NULL ),
+        watch_( NULL ),
+        head_( nullptr )
+        {
+            openFds();
+        }
+
+        // tasks still queued are run, so they don't leak what they carry,
+        // the loop must not run anymore
+        ~LoopQueue()
+        {
+            close();
+            drain();
+            closeFds();
+        }
+
+        // called by any thread
+        void post( Task &&task )
+        {
+            Node *node = new Node( std::move( task ) );
+            Node *head = head_.load( std::memory_order_relaxed );
+            do
+            {
+                node->next = head;
+            }
+            while( !head_.compare_exchange_weak( head, node, std::memory_order_release,
+                                                std::memory_order_relaxed ) );
+            if( head == nullptr )
+                signal();
+        }
+
+        // runs the tasks posted so far in the order of posting, called by the consumer thread
+        size_t drain()
+        {
+            Node *node = head_.exchange( nullptr, std::memory_order_acquire );
+            if( node == nullptr )
+                return 0;
+
+            // list is taken newest first
+            Node *batch = nullptr;
+            while( node != nullptr )
+            {
+                Node *next = node->next;
+                node->next = batch;
+                batch = node;
+                node = next;
+            }
+
+            size_t count = 0;
+            while( batch != nullptr )
+            {
+                Node *next = batch->next;
+                batch->task();
+                delete batch;
+                batch = next;
+                ++count;
+            }
+            return count;
+        }
+
+        // Waits for tasks up to the timeout (negative waits forever) and runs them, for queues
+        // of threads without event loops. Returns the number of tasks run
+        size_t wait( int milliseconds )
+        {
+            struct pollfd pfd;
+            pfd.fd = fds_[0];
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if( head_.load( std::memory_order_relaxed ) == nullptr &&
+                poll( &pfd, 1, milliseconds ) <= 0 )
+                return 0;
+            clear();
+            return drain();
+        }
+
+        // descriptor readable when tasks are posted, for threads waiting for it themselves
+        inline int fd() const
+        {
+            return fds_[0];
+        }
+
+        // stops watching the descriptor, so the loop may run out of events and return,
+        // called on the loop thread. Tasks posted later are left for drain
+        void close()
+        {
+            if( watch_ != NULL )
+                adapter_->unwatchFd( watch_ );
+            watch_ = NULL;
+        }
+
+    private:
+        void openFds()
+        {
+            fds_[0] = fds_[1] = -1;
+#ifdef __linux__
+            fds_[0] = fds_[1] = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+            if( fds_[0] < 0 )
+                throw ConnectionFailedException( nullptr );
+#else
+            if( pipe( fds_ ) != 0 )
+                throw ConnectionFailedException( nullptr );
+            for( int i = 0; i < 2; ++i )
+            {
+                fcntl( fds_[i], F_SETFL, fcntl( fds_[i], F_GETFL ) | O_NONBLOCK );
+                fcntl( fds_[i], F_SETFD, FD_CLOEXEC );
+            }
+#endif
+        }
+
+        void signal()
+        {
+#ifdef __linux__
+            uint64_t one = 1;
+            ssize_t written = write( fds_[1], &one, sizeof(one) );
+#else
+            char one = 1;
+            ssize_t written = write( fds_[1], &one, sizeof(one) );
+#endif
+            // a full pipe or counter already wakes the loop
+            (void)written;
+        }
+
+        // wakeup is cleared before the queue is taken, so tasks posted meanwhile wake the loop again
+        void clear()
+        {
+            char buf[64];
+            while( read( fds_[0], buf, sizeof(buf) ) > 0 )
+                ;
+        }
+
+        static void wake( void *data )
+        {
+            LoopQueue *that = static_cast<LoopQueue*>( data );
+            that->clear();
+            that->drain();
+        }
+
+        void closeFds()
+        {
+            if( fds_[0] >= 0 )
+                ::close( fds_[0] );
+            if( fds_[1] >= 0 && fds_[1] != fds_[0] )
+                ::close( fds_[1] );
+            fds_[0] = fds_[1] = -1;
+        }
+
+        Adapter *adapter_;
+        void *watch_;
+        int fds_[2];
+        // newest task first
+        std::atomic<Node*> head_;
+    };
+}
+
+#endif /* defined(__libredisCluster__loopqueue__) */
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__multikeycommand__
+#define __libredisCluster__multikeycommand__
+
+#include <map>
+#include <new>
+#include <utility>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cluster.h"
+#include "deadline.h"
+#include "hirediscommand.h"
+#include "hiredisio.h"
+#include "hiredisprocess.h"
+#include "replyarena.h"
+#include "respcommand.h"
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+namespace RedisCluster
+{
+    using std::string;
+
+    // Synchronous multi-key commands (MGET, MSET, DEL, EXISTS, UNLINK) with keys in different slots.
+    // Keys are split by slot and one sub-command per slot is pipelined to the node owning the slot.
+    // Requests to all involved nodes are written before any reply is read, so the whole command
+    // takes about one round trip to the slowest node. Replies are merged in the order of input keys.
+    // Replies of all sub-commands and the merged reply are allocated from one arena owned by the Reply.
+    // Optional deadline bounds the whole command, TimeoutException is thrown when it expires
+    template < typename Cluster = Cluster<redisContext> >
+    class MultiKeyCommand
+    {
+        typedef typename Cluster::SlotIndex SlotIndex;
+        typedef typename Cluster::SlotConnection SlotConnection;
+
+        // how replies of sub-commands are merged into one reply
+        enum MergeType
+        {
+            MERGE_ARRAY,
+            MERGE_SUM,
+            MERGE_STATUS
+        };
+
+        // keys of one slot sent as one sub-command
+        struct SlotBatch
+        {
+            SlotBatch() : reply( nullptr ) {}
+
+            // positions of keys in the input
+            std::vector<size_t> positions;
+            std::vector<const char*> argv;
+            std::vector<size_t> argvlen;
+            redisReply *reply;
+        };
+
+        typedef std::map<SlotIndex, SlotBatch> SlotBatches;
+
+        MultiKeyCommand(const MultiKeyCommand&) = delete;
+        MultiKeyCommand& operator=(const MultiKeyCommand&) = delete;
+
+    public:
+
+        // returns an array reply with values in the order of keys
+        static inline Reply MGet( typename Cluster::ptr_t cluster_p,
+                                 const std::vector<string> &keys,
+                                 const Deadline &deadline = Deadline() )
+        {
+            return MultiKeyCommand( cluster_p, "MGET", MERGE_ARRAY, keys, deadline ).process();
+        }
+
+        // returns a status reply, or the first error reply of sub-commands
+        static inline Reply MSet( typename Cluster::ptr_t cluster_p,
+                                 const std::vector< std::pair<string, string> > &keyValues,
+                                 const Deadline &deadline = Deadline() )
+        {
+            return MultiKeyCommand( cluster_p, "MSET", MERGE_STATUS, keyValues, deadline ).process();
+        }
+
+        // returns an integer reply with the number of deleted keys
+        static inline Reply Del( typename Cluster::ptr_t cluster_p,
+                                const std::vector<string> &keys,
+                                const Deadline &deadline = Deadline() )
+        {
+            return MultiKeyCommand( cluster_p, "DEL", MERGE_SUM, keys, deadline ).process();
+        }
+
+        // returns an integer reply with the number of existing keys
+        static inline Reply Exists( typename Cluster::ptr_t cluster_p,
+                                   const std::vector<string> &keys,
+                                   const Deadline &deadline = Deadline() )
+        {
+            return MultiKeyCommand( cluster_p, "EXISTS", MERGE_SUM, keys, deadline ).process();
+        }
+
+        // returns an integer reply with the number of unlinked keys
+        static inline Reply Unlink( typename Cluster::ptr_t cluster_p,
+                                   const std::vector<string> &keys,
+                                   const Deadline &deadline = Deadline() )
+        {
+            return MultiKeyCommand( cluster_p, "UNLINK", MERGE_SUM, keys, deadline ).process();
+        }
+
+    protected:
+
+        MultiKeyCommand( typename Cluster::ptr_t cluster_p,
+                        const char *name,
+                        MergeType merge,
+                        const std::vector<string> &keys,
+                        const Deadline &deadline ) :
+        cluster_p_( cluster_p ),
+        name_( name ),
+        merge_( merge ),
+        argsPerKey_( 1 ),
+        keyCount_( keys.size() ),
+        deadline_( deadline ),
+        arena_( std::make_shared<ReplyArena>() )
+        {
+            if( cluster_p == NULL || keys.empty() )
+                throw InvalidArgument(nullptr);
+
+            args_.reserve( keys.size() );
+            for( size_t i = 0; i < keys.size(); ++i )
+                args_.push_back( &keys[i] );
+        }
+
+        MultiKeyCommand( typename Cluster::ptr_t cluster_p,
+                        const char *name,
+                        MergeType merge,
+                        const std::vector< std::pair<string, string> > &keyValues,
+                        const Deadline &deadline ) :
+        cluster_p_( cluster_p ),
+        name_( name ),
+        merge_( merge ),
+        argsPerKey_( 2 ),
+        keyCount_( keyValues.size() ),
+        deadline_( deadline ),
+        arena_( std::make_shared<ReplyArena>() )
+        {
+            if( cluster_p == NULL || keyValues.empty() )
+                throw InvalidArgument(nullptr);
+
+            args_.reserve( keyValues.size() * 2 );
+            for( size_t i = 0; i < keyValues.size(); ++i )
+            {
+                args_.push_back( &keyValues[i].first );
+                args_.push_back( &keyValues[i].second );
+            }
+        }
+
+        // replies are freed with the arena
+        ~MultiKeyCommand()
+        {
+            releaseConnections();
+        }
+
+        Reply process()
+        {
+            split();
+            send();
+            receive();
+            followRedirections();
+            return Reply( arena_, merge() );
+        }
+
+        inline const string& key( size_t position ) const
+        {
+            return *args_[ position * argsPerKey_ ];
+        }
+
+        // groups keys by slot and prepares argv of every sub-command
+        void split()
+        {
+            for( size_t i = 0; i < keyCount_; ++i )
+            {
+                SlotIndex slot = SlotHash::SlotByKey( key(i).data(), (int)key(i).length() );
+                batches_[slot].positions.push_back( i );
+            }
+
+            for( typename SlotBatches::iterator it = batches_.begin(); it != batches_.end(); ++it )
+            {
+                SlotBatch &batch = it->second;
+                size_t argc = 1 + batch.positions.size() * argsPerKey_;
+                batch.argv.reserve( argc );
+                batch.argvlen.reserve( argc );
+
+                batch.argv.push_back( name_ );
+                batch.argvlen.push_back( strlen( name_ ) );
+                for( size_t i = 0; i < batch.positions.size(); ++i )
+                {
+                    for( size_t j = 0; j < argsPerKey_; ++j )
+                    {
+                        const string *arg = args_[ batch.positions[i] * argsPerKey_ + j ];
+                        batch.argv.push_back( arg->data() );
+                        batch.argvlen.push_back( arg->length() );
+                    }
+                }
+            }
+        }
+
+        // finds already taken connection of the node serving the slot
+        // or takes a new one from the cluster
+        size_t nodeBySlot( SlotIndex slot )
+        {
+            for( size_t i = 0; i < nodes_.size(); ++i )
+            {
+                if( nodes_[i].first.first <= slot && slot <= nodes_[i].first.second )
+                    return i;
+            }
+
+            nodes_.push_back( cluster_p_->getConnection( slot, deadline_ ) );
+            HiredisIO::Pending pending = { nodes_.back().second, 0, std::vector<redisReply*>() };
+            pending_.push_back( pending );
+            order_.push_back( std::vector<SlotBatch*>() );
+            return nodes_.size() - 1;
+        }
+
+        // appends sub-commands to connections of their nodes and writes
+        // output buffers of all nodes before reading any reply
+        void send()
+        {
+            try
+            {
+                append();
+            }
+            catch( ... )
+            {
+                // sub-commands appended to other connections are never read
+                HiredisIO::abandon( pending_ );
+                throw;
+            }
+
+            for( size_t i = 0; i < nodes_.size(); ++i )
+            {
+                if( HiredisIO::flush( nodes_[i].second, deadline_ ) != REDIS_OK )
+                {
+                    HiredisIO::abandon( pending_ );
+                    ioFailed();
+                }
+            }
+        }
+
+        void append()
+        {
+            for( typename SlotBatches::iterator it = batches_.begin(); it != batches_.end(); ++it )
+            {
+                size_t node = nodeBySlot( it->first );
+                SlotBatch &batch = it->second;
+
+                cmd_.formatArgv( (int)batch.argv.size(), batch.argv.data(), batch.argvlen.data() );
+                if( redisAppendFormattedCommand( nodes_[node].second, cmd_.data(), cmd_.size() ) != REDIS_OK )
+                {
+                    throw DisconnectedException();
+                }
+                order_[node].push_back( &batch );
+                ++pending_[node].expected;
+            }
+        }
+
+        void receive()
+        {
+            if( HiredisIO::readReplies( pending_, arena_.get(), deadline_ ) != REDIS_OK )
+                ioFailed();
+
+            // replies of one node come in the order sub-commands were appended
+            for( size_t i = 0; i < pending_.size(); ++i )
+            {
+                for( size_t j = 0; j < pending_[i].replies.size(); ++j )
+                    order_[i][j]->reply = pending_[i].replies[j];
+                pending_[i].replies.clear();
+            }
+            releaseConnections();
+        }
+
+        void ioFailed()
+        {
+            for( size_t i = 0; i < nodes_.size(); ++i )
+            {
+                if( HiredisIO::expired( nodes_[i].second ) )
+                    throw TimeoutException();
+            }
+            throw DisconnectedException();
+        }
+
+        // sub-commands hit by resharding are sent again one by one through
+        // HiredisCommand, which follows ASK and MOVED redirections
+        void followRedirections()
+        {
+            string host, port;
+            for( typename SlotBatches::iterator it = batches_.begin(); it != batches_.end(); ++it )
+            {
+                SlotBatch &batch = it->second;
+                HiredisProcess::checkCritical( batch.reply, false, false );
+
+                HiredisProcess::processState state = HiredisProcess::processResult( batch.reply, host, port );
+                if( state == HiredisProcess::ASK || state == HiredisProcess::MOVED )
+                {
+                    batch.reply = HiredisCommand<Cluster>::Command( cluster_p_,
+                                                                   key( batch.positions[0] ),
+                                                                   deadline_,
+                                                                   (int)batch.argv.size(),
+                                                                   batch.argv.data(),
+                                                                   batch.argvlen.data(),
+                                                                   *arena_ );
+                }
+            }
+        }
+
+        redisReply* merge()
+        {
+            typename SlotBatches::iterator it;
+            // the first error reply of sub-commands is the reply to the whole command
+            for( it = batches_.begin(); it != batches_.end(); ++it )
+            {
+                if( it->second.reply->type == REDIS_REPLY_ERROR )
+                    return take( it->second );
+            }
+
+            if( merge_ == MERGE_STATUS )
+            {
+                return take( batches_.begin()->second );
+            }
+
+            if( merge_ == MERGE_SUM )
+            {
+                redisReply *result = arena_->createReply( REDIS_REPLY_INTEGER );
+                for( it = batches_.begin(); it != batches_.end(); ++it )
+                {
+                    if( it->second.reply->type != REDIS_REPLY_INTEGER )
+                        throw LogicError(nullptr, "unexpected reply type of multi-key command");
+                    result->integer += it->second.reply->integer;
+                }
+                return result;
+            }
+
+            redisReply *result = arena_->createReply( REDIS_REPLY_ARRAY );
+            result->element = static_cast<redisReply**>( arena_->allocate( keyCount_ * sizeof(redisReply*) ) );
+            result->elements = keyCount_;
+
+            for( it = batches_.begin(); it != batches_.end(); ++it )
+            {
+                SlotBatch &batch = it->second;
+                if( batch.reply->type != REDIS_REPLY_ARRAY || batch.reply->elements != batch.positions.size() )
+                    throw LogicError(nullptr, "unexpected reply type of multi-key command");
+                // elements are shared with replies of sub-commands, so they are not copied
+                for( size_t i = 0; i < batch.positions.size(); ++i )
+                    result->element[ batch.positions[i] ] = batch.reply->element[i];
+            }
+            return result;
+        }
+
+        static inline redisReply* take( SlotBatch &batch )
+        {
+            redisReply *reply = batch.reply;
+            batch.reply = nullptr;
+            return reply;
+        }
+
+        void releaseConnections()
+        {
+            for( size_t i = 0; i < nodes_.size(); ++i )
+                cluster_p_->releaseConnection( nodes_[i] );
+            nodes_.clear();
+        }
+
+        typename Cluster::ptr_t cluster_p_;
+        const char *name_;
+        MergeType merge_;
+        // keys (or keys and values) of the command in input order
+        std::vector<const string*> args_;
+        size_t argsPerKey_;
+        size_t keyCount_;
+        // deadline of the whole command, it bounds redirections too
+        Deadline deadline_;
+
+        SlotBatches batches_;
+        // reusable buffer for encoding of sub-commands
+        RespCommand cmd_;
+        // connections taken from the cluster, replies expected on them
+        // and sub-commands in the order they were sent to every node
+        std::vector<SlotConnection> nodes_;
+        std::vector<HiredisIO::Pending> pending_;
+        std::vector< std::vector<SlotBatch*> > order_;
+        // arena of all replies, owned by the returned Reply
+        std::shared_ptr<ReplyArena> arena_;
+    };
+}
+
+#endif /* defined(__libredisCluster__multikeycommand__) */
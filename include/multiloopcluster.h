@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__multiloopcluster__
+#define __libredisCluster__multiloopcluster__
+
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "adapters/adapter.h"
+#include "asynccommandqueue.h"
+#include "asynchirediscommand.h"
+#include "slothash.h"
+
+namespace RedisCluster
+{
+    using std::string;
+
+    // Async cluster served by several event loop threads. Every node of the cluster is owned
+    // by one loop, which has the only connections to it, and commands are sent by the loop
+    // owning the slot of their key. Loops have their own clusters made of one CLUSTER SLOTS
+    // reply, so they share one topology and never lock each other. Commands and tasks may
+    // come from any thread, they are handed over to the loop threads through their command
+    // queues. Callbacks are called on the loop threads, or on the submitting threads
+    // through their reply queues
+    //
+    //   event_base *bases[4]; LibeventAdapter *adapters[4]; ...
+    //   MultiLoopCluster<> cluster( "127.0.0.1", 7000, std::vector<Adapter*>( adapters, adapters + 4 ) );
+    //   cluster.Command( "FOO", cmd.format( "GET", "FOO" ), []( const redisReply &reply ) { ... } );
+    template < typename Cluster = Cluster<redisAsyncContext> >
+    class MultiLoopCluster
+    {
+        typedef AsyncHiredisCommand<Cluster> AsyncCommand;
+        typedef AsyncCommandQueue<Cluster> CommandQueue;
+        typedef typename Cluster::SlotIndex SlotIndex;
+
+        MultiLoopCluster(const MultiLoopCluster&) = delete;
+        MultiLoopCluster& operator=(const MultiLoopCluster&) = delete;
+
+    public:
+        typedef typename AsyncCommand::RedisCallback RedisCallback;
+        typedef typename AsyncCommand::errorCodeCallbackFn errorCodeCallbackFn;
+        // task run by a loop with the cluster of the loop, must not throw
+        typedef typename CommandQueue::Task Task;
+        typedef typename CommandQueue::ReplyQueue ReplyQueue;
+
+        // Adapters (one per loop thread) are owned by the caller, they must be able to run their
+        // loops and to watch descriptors. Loop threads are started by the constructor
+        MultiLoopCluster( const char *host,
+                         int port,
+                         const std::vector<Adapter*> &adapters,
+                         const struct timeval &timeout = { 3, 0 } ) :
+        slotLoops_( SlotCount, 0 )
+        {
+            if( adapters.empty() || adapters.size() > MaxLoops )
+                throw InvalidArgument( nullptr );
+
+            redisContext *con = redisConnectWithTimeout( host, port, timeout );
+            if( con == NULL || con->err )
+            {
+                if( con != NULL )
+                    redisFree( con );
+                throw ConnectionFailedException( nullptr );
+            }
+            redisReply *reply = static_cast<redisReply*>( redisCommand( con, Cluster::CmdInit() ) );
+            redisFree( con );
+            if( reply == NULL )
+                throw ConnectionFailedException( nullptr );
+
+            try
+            {
+                // the reply is freed here, not by the exception
+                HiredisProcess::checkCritical( reply, true, false );
+                init( reply, adapters );
+            }
+            catch( ... )
+            {
+                freeReplyObject( reply );
+                shutdown();
+                throw;
+            }
+            freeReplyObject( reply );
+        }
+
+        // Clusters are disconnected like single loop ones, loops are joined when they run out
+        // of events, so replies to commands in flight still come. Commands posted meanwhile fail
+        ~MultiLoopCluster()
+        {
+            shutdown();
+        }
+
+        inline size_t loops() const
+        {
+            return loops_.size();
+        }
+
+        inline size_t loopOf( const string &key ) const
+        {
+            return slotLoops_[ SlotHash::SlotByKey( key.c_str(), key.length() ) ];
+        }
+
+        inline size_t loopOfSlot( SlotIndex slot ) const
+        {
+            return slotLoops_[ slot ];
+        }
+
+        // cluster of a loop, may be used only by tasks of the loop,
+        // i.e. for setting flow limits and reconnect policies
+        inline typename Cluster::ptr_t cluster( size_t loop ) const
+        {
+            return loops_[ loop ]->cluster;
+        }
+
+        // runs the task on the loop thread, called by any thread
+        void post( size_t loop, const Task &task )
+        {
+            loops_[ loop ]->commands->post( task );
+        }
+
+        // runs the task on the loop owning the slot of the key
+        void post( const string &key, const Task &task )
+        {
+            post( loopOf( key ), task );
+        }
+
+        // Sends the command from the loop owning the slot of the key. The command is formatted
+        // by the calling thread, the callback is called on the loop thread or on the thread of
+        // the reply queue. Errors of sending and redirections go to the error code callback
+        void Command( const string &key,
+                     const RespCommand &cmd,
+                     const RedisCallback &redisCallback = RedisCallback(),
+                     errorCodeCallbackFn *errorCb = NULL,
+                     ReplyQueue *replyTo = NULL )
+        {
+            loops_[ loopOf( key ) ]->commands->Command( key, cmd, redisCallback, errorCb, replyTo );
+        }
+
+        void Command( const string &key,
+                     int argc,
+                     const char **argv,
+                     const size_t *argvlen,
+                     const RedisCallback &redisCallback = RedisCallback(),
+                     errorCodeCallbackFn *errorCb = NULL,
+                     ReplyQueue *replyTo = NULL )
+        {
+            loops_[ loopOf( key ) ]->commands->Command( key, argc, argv, argvlen,
+                                                     redisCallback, errorCb, replyTo );
+        }
+
+        // Same with a future, which is ready when the command is finished on the loop
+        AsyncFuture FutureCommand( const string &key, const RespCommand &cmd )
+        {
+            return loops_[ loopOf( key ) ]->commands->FutureCommand( key, cmd );
+        }
+
+        AsyncFuture FutureCommand( const string &key,
+                                  int argc,
+                                  const char **argv,
+                                  const size_t *argvlen )
+        {
+            return loops_[ loopOf( key ) ]->commands->FutureCommand( key, argc, argv, argvlen );
+        }
+
+    private:
+        static const SlotIndex SlotCount = 16384;
+        static const size_t MaxLoops = 256;
+
+        struct Loop
+        {
+            explicit Loop( Adapter &a ) : adapter( a ), cluster( NULL ), commands( NULL ) {}
+
+            ~Loop()
+            {
+                delete commands;
+                delete cluster;
+            }
+
+            Adapter &adapter;
+            typename Cluster::ptr_t cluster;
+            CommandQueue *commands;
+            std::thread thread;
+        };
+
+        // range of CLUSTER SLOTS reply in the format parsed by Cluster
+        static bool isRange( const redisReply *r )
+        {
+            return r->type == REDIS_REPLY_ARRAY && r->elements >= 3 &&
+                r->element[0]->type == REDIS_REPLY_INTEGER &&
+                r->element[1]->type == REDIS_REPLY_INTEGER &&
+                r->element[2]->type == REDIS_REPLY_ARRAY && r->element[2]->elements >= 2 &&
+                r->element[2]->element[0]->type == REDIS_REPLY_STRING &&
+                r->element[2]->element[1]->type == REDIS_REPLY_INTEGER;
+        }
+
+        // nodes are given to loops in turn, every loop gets a cluster made of the
+        // ranges of its nodes, the reply itself is shared
+        void init( redisReply *reply, const std::vector<Adapter*> &adapters )
+        {
+            size_t count = adapters.size();
+            std::map<string, size_t> nodeLoops;
+            std::vector< std::vector<redisReply*> > ranges( count );
+            for( size_t i = 0; i < reply->elements; ++i )
+            {
+                redisReply *r = reply->element[i];
+                if( !isRange( r ) )
+                    throw ConnectionFailedException( nullptr );
+                string node = string( r->element[2]->element[0]->str ) + ":" +
+                    std::to_string( r->element[2]->element[1]->integer );
+                std::map<string, size_t>::iterator found = nodeLoops.find( node );
+                if( found == nodeLoops.end() )
+                    found = nodeLoops.insert( std::make_pair( node, nodeLoops.size() % count ) ).first;
+                ranges[ found->second ].push_back( r );
+                for( long long slot = r->element[0]->integer;
+                    slot <= r->element[1]->integer && slot < (long long)slotLoops_.size(); ++slot )
+                    slotLoops_[ slot ] = static_cast<unsigned char>( found->second );
+            }
+
+            loops_.reserve( count );
+            for( size_t i = 0; i < count; ++i )
+            {
+                loops_.push_back( nullptr );
+                loops_.back() = new Loop( *adapters[i] );
+                redisReply view = *reply;
+                view.element = ranges[i].empty() ? NULL : &ranges[i][0];
+                view.elements = ranges[i].size();
+                loops_.back()->cluster = AsyncCommand::createCluster( &view, *adapters[i] );
+                loops_.back()->commands = new CommandQueue( loops_.back()->cluster, *adapters[i] );
+            }
+
+            for( size_t i = 0; i < count; ++i )
+            {
+                Adapter *adapter = &loops_[i]->adapter;
+                loops_[i]->thread = std::thread( [adapter]() { adapter->run(); } );
+            }
+        }
+
+        // Every loop disconnects its cluster and stops watching its queue, so it returns when
+        // the connections are closed. Tasks posted meanwhile are run here, so commands don't leak
+        void shutdown()
+        {
+            for( size_t i = 0; i < loops_.size(); ++i )
+            {
+                Loop *l = loops_[i];
+                if( l != nullptr && l->thread.joinable() )
+                    l->commands->post( Task( [l]( typename Cluster::ptr_t ) { close( l ); } ) );
+            }
+            for( size_t i = 0; i < loops_.size(); ++i )
+            {
+                Loop *l = loops_[i];
+                if( l != nullptr && l->thread.joinable() )
+                    l->thread.join();
+            }
+            for( size_t i = 0; i < loops_.size(); ++i )
+            {
+                Loop *l = loops_[i];
+                if( l == nullptr )
+                    continue;
+                if( l->commands != NULL )
+                    l->commands->drain();
+                delete l;
+            }
+            loops_.clear();
+        }
+
+        // stopped cluster doesn't open connections for redirections of the commands in flight,
+        // they would keep the loop running
+        static void close( Loop *l )
+        {
+            l->cluster->stop();
+            l->cluster->disconnect();
+            l->commands->close();
+        }
+
+        std::vector<Loop*> loops_;
+        // loop of every slot, read by all threads
+        std::vector<unsigned char> slotLoops_;
+    };
+}
+
+#endif /* defined(__libredisCluster__multiloopcluster__) */
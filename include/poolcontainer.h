@@ -0,0 +1,745 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __libredisCluster__poolcontainer__
+#define __libredisCluster__poolcontainer__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cluster.h"
+#include "boundedqueue.h"
+
+namespace RedisCluster {
+
+    // Thread safe container with a pool of connections for every cluster node.
+    // Free connections are kept in lock-free lists, a thread takes the mutex of a node pool
+    // only when the pool is exhausted and it has to wait. Waiting threads are served in FIFO
+    // order and the wait is bounded by acquireTimeout (or the command deadline if it is earlier),
+    // TimeoutException is thrown when it expires. Broken connections are closed when released.
+    //
+    // Pools are elastic. A maintenance thread of the container keeps minConnections open,
+    // opens new connections (up to maxConnections per node) for waiting threads, so a burst
+    // of requests does not wait for connects one by one, and closes connections that were
+    // not needed during idleTimeout. Pool options must be set before the cluster is shared
+    // between threads, configure throws LogicError while connections are in use
+    //
+    //   typedef Cluster<redisContext, PoolContainer<redisContext> > PoolCluster;
+    //   PoolCluster::ptr_t cluster_p = HiredisCommand<PoolCluster>::createCluster( "127.0.0.1", 7000 );
+    //   PoolContainer<redisContext>::Options options;
+    //   options.maxConnections = 32;
+    //   cluster_p->container().configure( options );
+    template<typename redisConnection>
+    class PoolContainer
+    {
+        typedef Cluster<redisConnection, PoolContainer> RCluster;
+        typedef typename RCluster::SlotRange SlotRange;
+        typedef typename RCluster::SlotIndex SlotIndex;
+        typedef typename RCluster::Host Host;
+        typedef std::chrono::steady_clock Clock;
+        
+    public:
+        struct Options
+        {
+            Options() :
+            minConnections( 1 ),
+            maxConnections( 10 ),
+            acquireTimeout( std::chrono::milliseconds( 1000 ) ),
+            idleTimeout( std::chrono::milliseconds( 60000 ) ),
+            maintenanceInterval( std::chrono::milliseconds( 1000 ) )
+            {
+            }
+            
+            // connections per node kept open and the limit of connections per node
+            size_t minConnections;
+            size_t maxConnections;
+            // longest wait for a free connection
+            std::chrono::milliseconds acquireTimeout;
+            // connections above minConnections that were not needed during this time
+            // are closed, zero disables closing
+            std::chrono::milliseconds idleTimeout;
+            // period of checking pools by the maintenance thread
+            std::chrono::milliseconds maintenanceInterval;
+        };
+        
+        // counters of a pool, summed up for all pools by stats()
+        struct Stats
+        {
+            Stats() :
+            size( 0 ), inUse( 0 ), acquired( 0 ), waits( 0 ),
+            timeouts( 0 ), waitTime( 0 ), maxWaitTime( 0 ),
+            created( 0 ), discarded( 0 ), reaped( 0 )
+            {
+            }
+            
+            // opened connections and connections taken by threads
+            size_t size;
+            size_t inUse;
+            // taken connections and how many times threads had to wait for them
+            size_t acquired;
+            size_t waits;
+            size_t timeouts;
+            std::chrono::microseconds waitTime;
+            std::chrono::microseconds maxWaitTime;
+            // opened, closed because of errors and closed as idle
+            size_t created;
+            size_t discarded;
+            size_t reaped;
+        };
+        
+    private:
+        
+        // pool of connections to one node
+        class NodePool
+        {
+            NodePool(const NodePool&) = delete;
+            NodePool& operator=(const NodePool&) = delete;
+            
+            // thread waiting for a connection, it has own condition variable
+            // so the connection is handed exactly to the first waiter
+            struct Waiter
+            {
+                Waiter() : con( nullptr ), done( false ), failed( false ) {}
+                
+                std::condition_variable cv;
+                redisConnection *con;
+                bool done;
+                bool failed;
+            };
+            
+        public:
+            NodePool( PoolContainer &owner, const char *host, int port, const Options &options ) :
+            owner_( owner ),
+            host_( host ),
+            port_( port ),
+            options_( options ),
+            free_( options.maxConnections ),
+            size_( 0 ),
+            inUse_( 0 ),
+            waiting_( 0 ),
+            minFree_( 0 ),
+            closed_( false ),
+            acquired_( 0 ), waits_( 0 ), timeouts_( 0 ), waitTime_( 0 ), maxWaitTime_( 0 ),
+            created_( 0 ), discarded_( 0 ), reaped_( 0 )
+            {
+            }
+            
+            ~NodePool()
+            {
+                close();
+            }
+            
+            redisConnection* acquire( const Deadline &deadline )
+            {
+                Clock::time_point start = Clock::now();
+                redisConnection *con = nullptr;
+                
+                if( closed_ )
+                    throw NotInitializedException();
+                
+                // connections are taken without locking only if nobody waits,
+                // otherwise they are handed to waiters in order of arrival
+                if( waiting_ == 0 && free_.pop( con ) )
+                {
+                    updateMinFree();
+                }
+                else
+                {
+                    con = wait( deadline.timeAfter( options_.acquireTimeout ) );
+                    ++waits_;
+                    addWaitTime( start );
+                }
+                
+                ++inUse_;
+                ++acquired_;
+                return con;
+            }
+            
+            void release( redisConnection *con )
+            {
+                --inUse_;
+                if( con->err || closed_ )
+                {
+                    discard( con );
+                    return;
+                }
+                put( con );
+            }
+            
+            // closes free connections, connections in use are closed when released
+            void close()
+            {
+                closed_ = true;
+                redisConnection *con;
+                while( free_.pop( con ) )
+                    discard( con );
+                
+                std::lock_guard<std::mutex> locker( lock_ );
+                while( !waiters_.empty() )
+                    wake( nullptr );
+            }
+            
+            // called by the maintenance thread: opens connections for waiting threads
+            // and up to minConnections
+            void grow()
+            {
+                while( !closed_ && ( waiting_ > 0 || size_ < options_.minConnections ) && reserve() )
+                {
+                    redisConnection *con;
+                    try
+                    {
+                        con = open();
+                    }
+                    catch( const ConnectionFailedException & )
+                    {
+                        // node is not available, waiting threads get the error now
+                        std::lock_guard<std::mutex> locker( lock_ );
+                        while( !waiters_.empty() )
+                            wake( nullptr, true );
+                        return;
+                    }
+                    put( con );
+                }
+            }
+            
+            // called by the maintenance thread once per idle timeout: closes connections
+            // that stayed free the whole time since the previous call
+            void reap()
+            {
+                size_t surplus = minFree_;
+                redisConnection *con;
+                while( surplus > 0 && size_ > options_.minConnections && free_.pop( con ) )
+                {
+                    owner_.disconnect_( con );
+                    --size_;
+                    ++reaped_;
+                    --surplus;
+                }
+                minFree_ = free_.size();
+            }
+            
+            Stats stats() const
+            {
+                Stats stats;
+                stats.size = size_;
+                stats.inUse = inUse_;
+                stats.acquired = acquired_;
+                stats.waits = waits_;
+                stats.timeouts = timeouts_;
+                stats.waitTime = std::chrono::microseconds( waitTime_ );
+                stats.maxWaitTime = std::chrono::microseconds( maxWaitTime_ );
+                stats.created = created_;
+                stats.discarded = discarded_;
+                stats.reaped = reaped_;
+                return stats;
+            }
+            
+            // moves free connections to another pool, used on reconfiguration
+            void moveTo( NodePool &pool )
+            {
+                redisConnection *con;
+                while( free_.pop( con ) )
+                {
+                    --size_;
+                    if( pool.reserve() )
+                        pool.free_.push( con );
+                    else
+                        owner_.disconnect_( con );
+                }
+                pool.minFree_ = pool.free_.size();
+            }
+            
+            // opens a connection to the node and puts it to the free list
+            void warm()
+            {
+                if( reserve() )
+                    put( open() );
+            }
+            
+            inline const Host& host() const { return host_; }
+            inline int port() const { return port_; }
+            
+            // connections are taken or threads wait for them
+            inline bool busy() const { return inUse_ > 0 || waiting_ > 0; }
+            
+        private:
+            redisConnection* wait( Clock::time_point deadline )
+            {
+                std::unique_lock<std::mutex> locker( lock_ );
+                
+                if( closed_ )
+                    throw NotInitializedException();
+                
+                ++waiting_;
+                // pairs with the fence in put, so either the releasing thread sees
+                // the waiter or the connection is seen here
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+                redisConnection *con;
+                if( waiters_.empty() && free_.pop( con ) )
+                {
+                    --waiting_;
+                    updateMinFree();
+                    return con;
+                }
+                
+                Waiter waiter;
+                waiters_.push_back( &waiter );
+                // new connections are opened by the maintenance thread
+                if( size_ < options_.maxConnections )
+                    owner_.requestGrowth();
+                
+                while( !waiter.done )
+                {
+                    if( waiter.cv.wait_until( locker, deadline ) == std::cv_status::timeout && !waiter.done )
+                    {
+                        waiters_.erase( std::find( waiters_.begin(), waiters_.end(), &waiter ) );
+                        --waiting_;
+                        ++timeouts_;
+                        throw TimeoutException( "timeout while waiting for a pool connection" );
+                    }
+                }
+                
+                if( waiter.failed )
+                    throw ConnectionFailedException(nullptr);
+                if( waiter.con == nullptr )
+                    throw NotInitializedException();
+                minFree_ = 0;
+                return waiter.con;
+            }
+            
+            // returns a connection to the free list or hands it to the first waiter
+            void put( redisConnection *con )
+            {
+                free_.push( con );
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+                if( waiting_ > 0 )
+                {
+                    std::lock_guard<std::mutex> locker( lock_ );
+                    while( !waiters_.empty() && free_.pop( con ) )
+                        wake( con );
+                }
+            }
+            
+            bool reserve()
+            {
+                size_t size = size_;
+                while( size < options_.maxConnections )
+                {
+                    if( size_.compare_exchange_weak( size, size + 1 ) )
+                        return true;
+                }
+                return false;
+            }
+            
+            // connects slot reserved by reserve()
+            redisConnection* open()
+            {
+                redisConnection *con = owner_.connect_( host_.c_str(), port_, owner_.data_ );
+                if( con == NULL || con->err )
+                {
+                    if( con != NULL )
+                        owner_.disconnect_( con );
+                    --size_;
+                    throw ConnectionFailedException(nullptr);
+                }
+                ++created_;
+                return con;
+            }
+            
+            // closes a broken connection, replacement is opened for waiting threads
+            void discard( redisConnection *con )
+            {
+                owner_.disconnect_( con );
+                ++discarded_;
+                --size_;
+                std::atomic_thread_fence( std::memory_order_seq_cst );
+                if( waiting_ > 0 && !closed_ )
+                    owner_.requestGrowth();
+            }
+            
+            // must be called under lock_
+            void wake( redisConnection *con, bool failed = false )
+            {
+                Waiter *waiter = waiters_.front();
+                waiters_.pop_front();
+                --waiting_;
+                waiter->con = con;
+                waiter->failed = failed;
+                waiter->done = true;
+                waiter->cv.notify_one();
+            }
+            
+            // lowest number of free connections since the last reap, these connections
+            // were not needed and can be closed
+            inline void updateMinFree()
+            {
+                size_t free = free_.size();
+                size_t min = minFree_.load( std::memory_order_relaxed );
+                while( free < min && !minFree_.compare_exchange_weak( min, free ) ) {}
+            }
+            
+            void addWaitTime( Clock::time_point start )
+            {
+                size_t us = std::chrono::duration_cast<std::chrono::microseconds>( Clock::now() - start ).count();
+                waitTime_ += us;
+                size_t max = maxWaitTime_;
+                while( us > max && !maxWaitTime_.compare_exchange_weak( max, us ) ) {}
+            }
+            
+            PoolContainer &owner_;
+            Host host_;
+            int port_;
+            Options options_;
+            BoundedQueue<redisConnection*> free_;
+            std::atomic<size_t> size_;
+            std::atomic<size_t> inUse_;
+            std::atomic<size_t> waiting_;
+            std::atomic<size_t> minFree_;
+            std::atomic<bool> closed_;
+            std::mutex lock_;
+            std::deque<Waiter*> waiters_;
+            
+            std::atomic<size_t> acquired_;
+            std::atomic<size_t> waits_;
+            std::atomic<size_t> timeouts_;
+            std::atomic<size_t> waitTime_;
+            std::atomic<size_t> maxWaitTime_;
+            std::atomic<size_t> created_;
+            std::atomic<size_t> discarded_;
+            std::atomic<size_t> reaped_;
+        };
+        
+        typedef std::map <SlotRange, NodePool*, typename RCluster::SlotComparator> ClusterNodes;
+        typedef std::map <Host, NodePool*> NodePools;
+        
+    public:
+        
+        PoolContainer( typename RCluster::pt2RedisConnectFunc conn,
+                      typename RCluster::pt2RedisFreeFunc disconn,
+                      void* userData ) :
+        data_( userData ),
+        connect_( conn ),
+        disconnect_( disconn ),
+        stop_( false ),
+        growthRequested_( false )
+        {
+        }
+        
+        // all connections must be released before the container is destroyed
+        ~PoolContainer()
+        {
+            stopMaintenance();
+            disconnect();
+            for( typename NodePools::iterator it = pools_.begin(); it != pools_.end(); ++it )
+                delete it->second;
+            for( typename NodePools::iterator it = redirects_.begin(); it != redirects_.end(); ++it )
+                delete it->second;
+            for( size_t i = 0; i < retired_.size(); ++i )
+                delete retired_[i];
+        }
+        
+        // Replaces pools of the cluster with pools having new options, free connections are kept.
+        // Must be called before the cluster is shared between threads, LogicError is thrown if
+        // a connection is in use. Replaced pools are closed and kept until the container is
+        // destroyed, so a command racing with configure fails instead of using a freed pool
+        void configure( const Options &options )
+        {
+            std::lock_guard<std::mutex> maintenance( maintenanceLock_ );
+            std::lock_guard<std::mutex> redirects( redirectsLock_ );
+            if( busy( pools_ ) || busy( redirects_ ) )
+                throw LogicError( nullptr, "pool is reconfigured while connections are in use" );
+            {
+                std::lock_guard<std::mutex> locker( signalLock_ );
+                options_ = options;
+            }
+            std::map<NodePool*, NodePool*> replaced;
+            reconfigure( pools_, replaced );
+            reconfigure( redirects_, replaced );
+            for( typename ClusterNodes::iterator it = nodes_.begin(); it != nodes_.end(); ++it )
+                it->second = replaced[it->second];
+            for( typename std::map<NodePool*, NodePool*>::iterator it = replaced.begin(); it != replaced.end(); ++it )
+            {
+                it->first->close();
+                retired_.push_back( it->first );
+            }
+            requestGrowth();
+        }
+        
+        inline const Options& options() const
+        {
+            return options_;
+        }
+        
+        // counters summed up for all node pools
+        Stats stats()
+        {
+            Stats total;
+            std::lock_guard<std::mutex> locker( redirectsLock_ );
+            add( total, pools_ );
+            add( total, redirects_ );
+            return total;
+        }
+        
+        // counters of the pool of the node given as "host:port"
+        Stats stats( const Host &node )
+        {
+            std::lock_guard<std::mutex> locker( redirectsLock_ );
+            typename NodePools::iterator found = pools_.find( node );
+            if( found != pools_.end() )
+                return found->second->stats();
+            found = redirects_.find( node );
+            if( found != redirects_.end() )
+                return found->second->stats();
+            return Stats();
+        }
+        
+        // pools are created at cluster initialization with one connection checking node
+        // availability, other connections are opened by the maintenance thread
+        inline
+        void insert( typename RCluster::SlotRange slots, const char* host, int port )
+        {
+            NodePool *&pool = pools_[ key( host, port ) ];
+            if( pool == nullptr )
+            {
+                pool = new NodePool( *this, host, port, options_ );
+                pool->warm();
+            }
+            nodes_.insert( typename ClusterNodes::value_type( slots, pool ) );
+            startMaintenance();
+        }
+        
+        inline
+        typename RCluster::HostConnection insert( string host, string port, const Deadline &deadline = Deadline() )
+        {
+            string name( host + ":" + port );
+            NodePool *pool;
+            {
+                std::lock_guard<std::mutex> locker( redirectsLock_ );
+                NodePool *&found = redirects_[name];
+                if( found == nullptr )
+                    found = new NodePool( *this, host.c_str(), std::stoi( port ), options_ );
+                pool = found;
+            }
+            return typename RCluster::HostConnection( name, pool->acquire( deadline ) );
+        }
+        
+        // waits for a free connection until acquireTimeout or the deadline expires
+        inline
+        typename RCluster::SlotConnection getConnection( SlotIndex index, const Deadline &deadline = Deadline() )
+        {
+            typename ClusterNodes::iterator node = DefaultContainer<redisConnection>::searchBySlots( index, nodes_ );
+            return typename RCluster::SlotConnection( node->first, node->second->acquire( deadline ) );
+        }
+        
+        inline void releaseConnection( typename RCluster::SlotConnection conn )
+        {
+            typename ClusterNodes::iterator node = nodes_.find( conn.first );
+            if( node != nodes_.end() )
+                node->second->release( conn.second );
+        }
+        
+        inline void releaseConnection( typename RCluster::HostConnection conn )
+        {
+            NodePool *pool = nullptr;
+            {
+                std::lock_guard<std::mutex> locker( redirectsLock_ );
+                typename NodePools::iterator found = redirects_.find( conn.first );
+                if( found != redirects_.end() )
+                    pool = found->second;
+            }
+            if( pool != nullptr )
+                pool->release( conn.second );
+        }
+        
+        // pooled connections are synchronous and are never freed outside of the container
+        void deleteConnection( const redisConnection* ) {}
+        
+        // closes free connections without waiting for connections in use, they are closed
+        // when released. Waiting threads and new requests get NotInitializedException
+        inline
+        void disconnect()
+        {
+            for( typename NodePools::iterator it = pools_.begin(); it != pools_.end(); ++it )
+                it->second->close();
+            std::lock_guard<std::mutex> locker( redirectsLock_ );
+            for( typename NodePools::iterator it = redirects_.begin(); it != redirects_.end(); ++it )
+                it->second->close();
+        }
+        
+        void* data_;
+    private:
+        
+        static Host key( const char *host, int port )
+        {
+            return string( host ) + ":" + std::to_string( port );
+        }
+        
+        void reconfigure( NodePools &pools, std::map<NodePool*, NodePool*> &replaced )
+        {
+            for( typename NodePools::iterator it = pools.begin(); it != pools.end(); ++it )
+            {
+                NodePool *pool = new NodePool( *this, it->second->host().c_str(), it->second->port(), options_ );
+                it->second->moveTo( *pool );
+                replaced[it->second] = pool;
+                it->second = pool;
+            }
+        }
+        
+        static bool busy( const NodePools &pools )
+        {
+            for( typename NodePools::const_iterator it = pools.begin(); it != pools.end(); ++it )
+            {
+                if( it->second->busy() )
+                    return true;
+            }
+            return false;
+        }
+        
+        static void add( Stats &total, NodePools &pools )
+        {
+            for( typename NodePools::iterator it = pools.begin(); it != pools.end(); ++it )
+            {
+                Stats stats = it->second->stats();
+                total.size += stats.size;
+                total.inUse += stats.inUse;
+                total.acquired += stats.acquired;
+                total.waits += stats.waits;
+                total.timeouts += stats.timeouts;
+                total.waitTime += stats.waitTime;
+                total.maxWaitTime = std::max( total.maxWaitTime, stats.maxWaitTime );
+                total.created += stats.created;
+                total.discarded += stats.discarded;
+                total.reaped += stats.reaped;
+            }
+        }
+        
+        // wakes the maintenance thread up to open connections for waiting threads
+        void requestGrowth()
+        {
+            std::lock_guard<std::mutex> locker( signalLock_ );
+            growthRequested_ = true;
+            signal_.notify_one();
+        }
+        
+        void startMaintenance()
+        {
+            if( !maintenance_.joinable() )
+            {
+                lastReap_ = Clock::now();
+                maintenance_ = std::thread( &PoolContainer::maintenanceLoop, this );
+            }
+        }
+        
+        void stopMaintenance()
+        {
+            {
+                std::lock_guard<std::mutex> locker( signalLock_ );
+                stop_ = true;
+                signal_.notify_one();
+            }
+            if( maintenance_.joinable() )
+                maintenance_.join();
+        }
+        
+        void maintenanceLoop()
+        {
+            std::unique_lock<std::mutex> locker( signalLock_ );
+            while( !stop_ )
+            {
+                // pools are checked on growth requests and periodically to keep minimum
+                // of connections and close idle ones
+                if( !growthRequested_ )
+                    signal_.wait_for( locker, options_.maintenanceInterval );
+                if( stop_ )
+                    break;
+                growthRequested_ = false;
+                locker.unlock();
+                maintain();
+                locker.lock();
+            }
+        }
+        
+        void maintain()
+        {
+            std::lock_guard<std::mutex> maintenance( maintenanceLock_ );
+            
+            std::vector<NodePool*> pools;
+            for( typename NodePools::iterator it = pools_.begin(); it != pools_.end(); ++it )
+                pools.push_back( it->second );
+            {
+                std::lock_guard<std::mutex> locker( redirectsLock_ );
+                for( typename NodePools::iterator it = redirects_.begin(); it != redirects_.end(); ++it )
+                    pools.push_back( it->second );
+            }
+            
+            Clock::time_point now = Clock::now();
+            bool reap = options_.idleTimeout.count() > 0 && now - lastReap_ >= options_.idleTimeout;
+            if( reap )
+                lastReap_ = now;
+            
+            for( size_t i = 0; i < pools.size(); ++i )
+            {
+                pools[i]->grow();
+                if( reap )
+                    pools[i]->reap();
+            }
+        }
+        
+        typename RCluster::pt2RedisConnectFunc connect_;
+        typename RCluster::pt2RedisFreeFunc disconnect_;
+        Options options_;
+        // pools by "host:port" and slot ranges pointing to them, not changed after initialization
+        NodePools pools_;
+        ClusterNodes nodes_;
+        // pools of redirection targets are created while cluster is used
+        NodePools redirects_;
+        std::mutex redirectsLock_;
+        // pools replaced by configure
+        std::vector<NodePool*> retired_;
+        
+        // maintenance thread, maintenanceLock_ keeps pools from being replaced while it works
+        std::thread maintenance_;
+        std::mutex maintenanceLock_;
+        std::mutex signalLock_;
+        std::condition_variable signal_;
+        bool stop_;
+        bool growthRequested_;
+        Clock::time_point lastReap_;
+    };
+    
+}
+
+#endif /* defined(__libredisCluster__poolcontainer__) */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__reconnect__
+#define __libredisCluster__reconnect__
+
+#include <chrono>
+#include <random>
+#include <stddef.h>
+
+namespace RedisCluster
+{
+    // How async connections to cluster nodes are restored after they drop. Commands for the
+    // slots of a dropped node are held until it is reconnected, attempts are delayed
+    // exponentially with jitter, so clients don't reconnect to a restarted node all at once
+    //
+    //   ReconnectPolicy policy;
+    //   policy.maxDelay = std::chrono::milliseconds( 5000 );
+    //   AsyncHiredisCommand<>::setReconnectPolicy( cluster_p, policy );
+    struct ReconnectPolicy
+    {
+        typedef std::minstd_rand Random;
+
+        ReconnectPolicy() :
+        enabled( true ),
+        initialDelay( 100 ),
+        maxDelay( 10000 ),
+        maxAttempts( 0 ),
+        queueLimit( 1024 ),
+        replayIdempotent( true )
+        {
+        }
+
+        // policy of clusters which don't reconnect, dropped connections fail their commands
+        static ReconnectPolicy disabled()
+        {
+            ReconnectPolicy policy;
+            policy.enabled = false;
+            return policy;
+        }
+
+        // delay before the attempt, from half to the whole of the exponential delay
+        std::chrono::milliseconds delay( unsigned attempt, Random &random ) const
+        {
+            long long ms = initialDelay.count();
+            for( unsigned i = 0; i < attempt && ms < maxDelay.count(); ++i )
+                ms *= 2;
+            if( ms > maxDelay.count() )
+                ms = maxDelay.count();
+            if( ms <= 1 )
+                return std::chrono::milliseconds( ms );
+            std::uniform_int_distribution<long long> jitter( 0, ms / 2 );
+            return std::chrono::milliseconds( ms - ms / 2 + jitter( random ) );
+        }
+
+        bool enabled;
+        std::chrono::milliseconds initialDelay;
+        std::chrono::milliseconds maxDelay;
+        // failed attempts before the node is given up and its commands fail, zero is no limit
+        unsigned maxAttempts;
+        // commands held per node while it is reconnected, zero is no limit
+        size_t queueLimit;
+        // commands marked idempotent are sent again if their connection drops before the reply
+        bool replayIdempotent;
+    };
+}
+
+#endif /* defined(__libredisCluster__reconnect__) */
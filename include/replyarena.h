@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__replyarena__
+#define __libredisCluster__replyarena__
+
+#include <new>
+#include <type_traits>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+namespace RedisCluster
+{
+    // Bump allocator for redisReply trees. All objects of a reply (or of all replies of
+    // a pipeline) are allocated from a few memory blocks and are freed at once with the arena.
+    // First block is a part of the arena object itself, so small replies need no allocation
+    // except the arena. Replies from an arena must never be freed by freeReplyObject
+    class ReplyArena
+    {
+        static const size_t InlineSize = 1024;
+        static const size_t MinBlockSize = 4096;
+        static const size_t MaxBlockSize = 64 * 1024;
+        static const size_t Alignment = 2 * sizeof(void*);
+
+        // header of blocks allocated after the inline block is exhausted
+        struct Block
+        {
+            Block *next;
+        };
+
+        ReplyArena(const ReplyArena&) = delete;
+        ReplyArena& operator=(const ReplyArena&) = delete;
+
+    public:
+
+#if HIREDIS_MAJOR >= 1
+        typedef size_t ArrayLength;
+#else
+        typedef int ArrayLength;
+#endif
+
+        ReplyArena() :
+        pos_( inlineBlock() ),
+        end_( inlineBlock() + InlineSize ),
+        blocks_( nullptr ),
+        nextBlockSize_( MinBlockSize )
+        {
+        }
+
+        ~ReplyArena()
+        {
+            releaseBlocks();
+        }
+
+        inline void* allocate( size_t size )
+        {
+            size = ( size + Alignment - 1 ) & ~( Alignment - 1 );
+            if( size > static_cast<size_t>( end_ - pos_ ) )
+                grow( size );
+
+            void *p = pos_;
+            pos_ += size;
+            return p;
+        }
+
+        // frees all objects allocated from the arena, arena can be reused after reset
+        void reset()
+        {
+            releaseBlocks();
+            pos_ = inlineBlock();
+            end_ = inlineBlock() + InlineSize;
+            nextBlockSize_ = MinBlockSize;
+        }
+
+        // Reply functions taking the arena from redisReader::privdata. Use ReaderScope
+        // to install them, replies are freed together with the arena
+        static redisReplyObjectFunctions* functions()
+        {
+            static redisReplyObjectFunctions fn = {
+                createString<false>,
+                createArray<false>,
+                createInteger<false>,
+#if HIREDIS_MAJOR >= 1
+                createDouble<false>,
+#endif
+                createNil<false>,
+#if HIREDIS_MAJOR >= 1
+                createBool<false>,
+#endif
+                freeNothing
+            };
+            return &fn;
+        }
+
+        // Reply functions creating an arena for every top-level reply. The arena is freed
+        // by freeObject of the reader, so these functions can be installed permanently
+        // on async connections, where hiredis frees replies after callbacks
+        static redisReplyObjectFunctions* ownedFunctions()
+        {
+            static redisReplyObjectFunctions fn = {
+                createString<true>,
+                createArray<true>,
+                createInteger<true>,
+#if HIREDIS_MAJOR >= 1
+                createDouble<true>,
+#endif
+                createNil<true>,
+#if HIREDIS_MAJOR >= 1
+                createBool<true>,
+#endif
+                freeOwned
+            };
+            return &fn;
+        }
+
+        // arena of a top-level reply created by ownedFunctions
+        static ReplyArena* ownerOf( const redisReply *reply )
+        {
+            return *( reinterpret_cast<ReplyArena* const*>( reply ) - 1 );
+        }
+
+        // takes the arena of a top-level reply created by ownedFunctions from the reply, so the
+        // reply outlives the callback it is passed to. Freeing the reply does nothing then,
+        // the reply is freed with the returned arena
+        static ReplyArena* detach( const redisReply *reply )
+        {
+            ReplyArena **owner = const_cast<ReplyArena**>( reinterpret_cast<ReplyArena* const*>( reply ) - 1 );
+            ReplyArena *arena = *owner;
+            *owner = nullptr;
+            return arena;
+        }
+
+        // gives the arena taken by detach back to its reply, i.e. when the reply is being
+        // freed by hiredis, as the owner pointer lives in the arena itself
+        static void attach( const redisReply *reply, ReplyArena *arena )
+        {
+            *const_cast<ReplyArena**>( reinterpret_cast<ReplyArena* const*>( reply ) - 1 ) = arena;
+        }
+
+        // installs arena reply functions to the reader while in scope
+        class ReaderScope
+        {
+            ReaderScope(const ReaderScope&) = delete;
+            ReaderScope& operator=(const ReaderScope&) = delete;
+
+        public:
+            ReaderScope( redisReader *reader, ReplyArena &arena ) :
+            reader_( reader ),
+            fn_( reader->fn ),
+            privdata_( reader->privdata )
+            {
+                reader->fn = functions();
+                reader->privdata = &arena;
+            }
+
+            ~ReaderScope()
+            {
+                reader_->fn = fn_;
+                reader_->privdata = privdata_;
+            }
+
+        private:
+            redisReader *reader_;
+            redisReplyObjectFunctions *fn_;
+            void *privdata_;
+        };
+
+        // allocates an empty reply object from the arena
+        redisReply* createReply( int type )
+        {
+            redisReply *r = static_cast<redisReply*>( allocate( sizeof(redisReply) ) );
+            memset( r, 0, sizeof(redisReply) );
+            r->type = type;
+            return r;
+        }
+
+        // deep copy of a reply tree into the arena, for replies which outlive
+        // the reader, i.e. replies handed over to other threads
+        redisReply* copyReply( const redisReply &reply )
+        {
+            redisReply *r = static_cast<redisReply*>( allocate( sizeof(redisReply) ) );
+            memcpy( r, &reply, sizeof(redisReply) );
+            if( reply.str != nullptr )
+            {
+                r->str = static_cast<char*>( allocate( reply.len + 1 ) );
+                memcpy( r->str, reply.str, reply.len );
+                r->str[reply.len] = '\0';
+            }
+            if( reply.element != nullptr )
+            {
+                r->element = static_cast<redisReply**>( allocate( reply.elements * sizeof(redisReply*) ) );
+                for( size_t i = 0; i < reply.elements; ++i )
+                    r->element[i] = reply.element[i] != nullptr ? copyReply( *reply.element[i] ) : nullptr;
+            }
+            return r;
+        }
+
+    protected:
+
+        inline char* inlineBlock()
+        {
+            return reinterpret_cast<char*>( &inline_ );
+        }
+
+        void grow( size_t size )
+        {
+            size_t blockSize = nextBlockSize_;
+            while( blockSize < size + Alignment )
+                blockSize *= 2;
+            if( nextBlockSize_ < MaxBlockSize )
+                nextBlockSize_ *= 2;
+
+            Block *block = static_cast<Block*>( malloc( blockSize ) );
+            if( block == nullptr )
+                throw std::bad_alloc();
+            block->next = blocks_;
+            blocks_ = block;
+
+            // data starts after the aligned block header
+            pos_ = reinterpret_cast<char*>( block ) + Alignment;
+            end_ = reinterpret_cast<char*>( block ) + blockSize;
+        }
+
+        void releaseBlocks()
+        {
+            while( blocks_ != nullptr )
+            {
+                Block *next = blocks_->next;
+                free( blocks_ );
+                blocks_ = next;
+            }
+        }
+
+        // finds the arena of the reply being parsed
+        template<bool Owned>
+        static ReplyArena* arenaOf( const redisReadTask *task )
+        {
+            if( !Owned )
+                return static_cast<ReplyArena*>( task->privdata );
+
+            while( task->parent != nullptr )
+                task = task->parent;
+            // owned arena pointer is stored before the top-level object
+            return *( reinterpret_cast<ReplyArena**>( task->obj ) - 1 );
+        }
+
+        template<bool Owned>
+        static redisReply* createObject( const redisReadTask *task, int type )
+        {
+            redisReply *r;
+            if( Owned && task->parent == nullptr )
+            {
+                ReplyArena *arena = new (std::nothrow) ReplyArena();
+                if( arena == nullptr )
+                    return nullptr;
+                ReplyArena **owner = static_cast<ReplyArena**>(
+                    arena->allocate( sizeof(ReplyArena*) + sizeof(redisReply) ) );
+                *owner = arena;
+                r = reinterpret_cast<redisReply*>( owner + 1 );
+                memset( r, 0, sizeof(redisReply) );
+                r->type = type;
+            }
+            else
+            {
+                r = arenaOf<Owned>( task )->createReply( type );
+            }
+
+            if( task->parent != nullptr )
+            {
+                redisReply *parent = static_cast<redisReply*>( task->parent->obj );
+                parent->element[task->idx] = r;
+            }
+            return r;
+        }
+
+        // reply functions must not throw into the C parser, allocation
+        // failure is reported to hiredis as NULL object
+        template<bool Owned>
+        static void* createString( const redisReadTask *task, char *str, size_t len )
+        {
+            try
+            {
+                redisReply *r = createObject<Owned>( task, task->type );
+                if( r == nullptr )
+                    return nullptr;
+#ifdef REDIS_REPLY_VERB
+                if( task->type == REDIS_REPLY_VERB && len >= 4 )
+                {
+                    memcpy( r->vtype, str, 3 );
+                    r->vtype[3] = '\0';
+                    str += 4;
+                    len -= 4;
+                }
+#endif
+                char *buf = static_cast<char*>( arenaOfObject<Owned>( task, r )->allocate( len + 1 ) );
+                memcpy( buf, str, len );
+                buf[len] = '\0';
+                r->str = buf;
+                r->len = len;
+                return r;
+            }
+            catch( const std::bad_alloc & )
+            {
+                return nullptr;
+            }
+        }
+
+        template<bool Owned>
+        static void* createArray( const redisReadTask *task, ArrayLength elements )
+        {
+            try
+            {
+                redisReply *r = createObject<Owned>( task, task->type );
+                if( r == nullptr )
+                    return nullptr;
+                if( elements > 0 )
+                {
+                    r->element = static_cast<redisReply**>(
+                        arenaOfObject<Owned>( task, r )->allocate( elements * sizeof(redisReply*) ) );
+                    memset( r->element, 0, elements * sizeof(redisReply*) );
+                }
+                r->elements = elements;
+                return r;
+            }
+            catch( const std::bad_alloc & )
+            {
+                return nullptr;
+            }
+        }
+
+        template<bool Owned>
+        static void* createInteger( const redisReadTask *task, long long value )
+        {
+            try
+            {
+                redisReply *r = createObject<Owned>( task, REDIS_REPLY_INTEGER );
+                if( r != nullptr )
+                    r->integer = value;
+                return r;
+            }
+            catch( const std::bad_alloc & )
+            {
+                return nullptr;
+            }
+        }
+
+#if HIREDIS_MAJOR >= 1
+        template<bool Owned>
+        static void* createDouble( const redisReadTask *task, double value, char *str, size_t len )
+        {
+            redisReply *r = static_cast<redisReply*>( createString<Owned>( task, str, len ) );
+            if( r != nullptr )
+            {
+                r->type = REDIS_REPLY_DOUBLE;
+                r->dval = value;
+            }
+            return r;
+        }
+
+        template<bool Owned>
+        static void* createBool( const redisReadTask *task, int value )
+        {
+            try
+            {
+                redisReply *r = createObject<Owned>( task, REDIS_REPLY_BOOL );
+                if( r != nullptr )
+                    r->integer = value != 0;
+                return r;
+            }
+            catch( const std::bad_alloc & )
+            {
+                return nullptr;
+            }
+        }
+#endif
+
+        template<bool Owned>
+        static void* createNil( const redisReadTask *task )
+        {
+            try
+            {
+                return createObject<Owned>( task, REDIS_REPLY_NIL );
+            }
+            catch( const std::bad_alloc & )
+            {
+                return nullptr;
+            }
+        }
+
+        // for the top-level object of an owned reply the task has no object yet
+        template<bool Owned>
+        static ReplyArena* arenaOfObject( const redisReadTask *task, redisReply *r )
+        {
+            if( Owned && task->parent == nullptr )
+                return *( reinterpret_cast<ReplyArena**>( r ) - 1 );
+            return arenaOf<Owned>( task );
+        }
+
+        static void freeNothing( void * )
+        {
+        }
+
+        static void freeOwned( void *reply )
+        {
+            if( reply != nullptr )
+                delete *( reinterpret_cast<ReplyArena**>( reply ) - 1 );
+        }
+
+        typename std::aligned_storage<InlineSize, Alignment>::type inline_;
+        char *pos_;
+        char *end_;
+        Block *blocks_;
+        size_t nextBlockSize_;
+    };
+}
+
+#endif /* defined(__libredisCluster__replyarena__) */
@@ -0,0 +1,709 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__replydecoder__
+#define __libredisCluster__replydecoder__
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdlib.h>
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+#include "clusterexception.h"
+#include "replystream.h"
+#include "stringref.h"
+
+namespace RedisCluster
+{
+    using std::string;
+    
+    template<typename T, typename Enable = void>
+    struct ReplyDecoder;
+    
+    // Non-owning view of a reply. Strings are StringRef views of the reply buffers, arrays
+    // are indexed in place, so the reply must stay valid while the view is used.
+    // Works with replies of sync commands and with replies in async callbacks
+    //
+    //   ReplyView view( *reply );
+    //   for( ReplyView::iterator it = view.begin(); it != view.end(); ++it )
+    //       cout << (*it).str().str() << endl;
+    //   long long counter = view[0].as<long long>();
+    class ReplyView
+    {
+    public:
+        class iterator
+        {
+        public:
+            typedef std::random_access_iterator_tag iterator_category;
+            typedef ReplyView value_type;
+            typedef ptrdiff_t difference_type;
+            typedef void pointer;
+            typedef ReplyView reference;
+            
+            iterator() : element_( nullptr ) {}
+            explicit iterator( redisReply **element ) : element_( element ) {}
+            
+            inline ReplyView operator*() const;
+            inline iterator& operator++() { ++element_; return *this; }
+            inline iterator operator++( int ) { iterator it( *this ); ++element_; return it; }
+            inline iterator operator+( ptrdiff_t n ) const { return iterator( element_ + n ); }
+            inline ptrdiff_t operator-( const iterator &other ) const { return element_ - other.element_; }
+            inline bool operator==( const iterator &other ) const { return element_ == other.element_; }
+            inline bool operator!=( const iterator &other ) const { return element_ != other.element_; }
+            
+        private:
+            redisReply **element_;
+        };
+        
+        ReplyView() : reply_( nullptr ) {}
+        ReplyView( const redisReply &reply ) : reply_( &reply ) {}
+        explicit ReplyView( const redisReply *reply ) : reply_( reply ) {}
+        
+        inline const redisReply* get() const { return reply_; }
+        inline int type() const { return reply_ ? reply_->type : REDIS_REPLY_NIL; }
+        
+        inline bool isNil() const { return type() == REDIS_REPLY_NIL; }
+        inline bool isError() const { return type() == REDIS_REPLY_ERROR; }
+        inline bool isInteger() const
+        {
+#ifdef REDIS_REPLY_BOOL
+            if( type() == REDIS_REPLY_BOOL )
+                return true;
+#endif
+            return type() == REDIS_REPLY_INTEGER;
+        }
+        
+        // strings, statuses, errors and RESP3 textual replies
+        inline bool isString() const
+        {
+            switch( type() )
+            {
+                case REDIS_REPLY_STRING:
+                case REDIS_REPLY_STATUS:
+                case REDIS_REPLY_ERROR:
+#ifdef REDIS_REPLY_VERB
+                case REDIS_REPLY_VERB:
+#endif
+#ifdef REDIS_REPLY_DOUBLE
+                case REDIS_REPLY_DOUBLE:
+#endif
+#ifdef REDIS_REPLY_BIGNUM
+                case REDIS_REPLY_BIGNUM:
+#endif
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        
+        // arrays and RESP3 maps, sets and pushes, maps have keys and values as elements
+        inline bool isArray() const
+        {
+            switch( type() )
+            {
+                case REDIS_REPLY_ARRAY:
+#ifdef REDIS_REPLY_MAP
+                case REDIS_REPLY_MAP:
+#endif
+#ifdef REDIS_REPLY_SET
+                case REDIS_REPLY_SET:
+#endif
+#ifdef REDIS_REPLY_PUSH
+                case REDIS_REPLY_PUSH:
+#endif
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        
+        inline StringRef str() const { return isString() ? StringRef( reply_->str, reply_->len ) : StringRef(); }
+        inline long long integer() const { return isInteger() ? reply_->integer : 0; }
+        
+        inline size_t size() const { return isArray() ? reply_->elements : 0; }
+        inline bool empty() const { return size() == 0; }
+        inline ReplyView operator[]( size_t i ) const { return ReplyView( reply_->element[i] ); }
+        inline iterator begin() const { return iterator( isArray() ? reply_->element : nullptr ); }
+        inline iterator end() const { return begin() + size(); }
+        
+        // decodes the reply to value, returns false if the reply doesn't match the type
+        template<typename T>
+        inline bool decode( T &value ) const
+        {
+            return reply_ != nullptr && ReplyDecoder<T>::decode( *reply_, value );
+        }
+        
+        // decoded value, LogicError is thrown if the reply doesn't match the type
+        template<typename T>
+        T as() const
+        {
+            T value;
+            if( !decode( value ) )
+                throw LogicError( nullptr, "unexpected reply type" );
+            return value;
+        }
+        
+    private:
+        const redisReply *reply_;
+    };
+    
+    inline ReplyView ReplyView::iterator::operator*() const
+    {
+        return ReplyView( *element_ );
+    }
+    
+    // value which may be nil (i.e. elements of MGET reply)
+    template<typename T>
+    struct Nullable
+    {
+        Nullable() : nil( true ), value() {}
+        
+        bool nil;
+        T value;
+    };
+    
+    // Conversions of scalar replies. Strings are parsed to numbers and numbers are formatted
+    // to strings, so replies are decoded regardless of the protocol version
+    template<typename T, typename Enable = void>
+    struct ScalarDecoder;
+    
+    template<>
+    struct ScalarDecoder<string>
+    {
+        static bool fromString( string &value, const StringRef &str ) { value.assign( str.data(), str.size() ); return true; }
+        static bool fromInteger( string &value, long long integer ) { value = std::to_string( integer ); return true; }
+        static bool fromNil( string & ) { return false; }
+    };
+    
+    // view of the reply buffer, can't be decoded from integers
+    template<>
+    struct ScalarDecoder<StringRef>
+    {
+        static bool fromString( StringRef &value, const StringRef &str ) { value = str; return true; }
+        static bool fromInteger( StringRef &, long long ) { return false; }
+        static bool fromNil( StringRef & ) { return false; }
+    };
+    
+    template<>
+    struct ScalarDecoder<bool>
+    {
+        static bool fromString( bool &value, const StringRef &str )
+        {
+            if( str == StringRef( "1" ) || str == StringRef( "OK" ) )
+                value = true;
+            else if( str == StringRef( "0" ) )
+                value = false;
+            else
+                return false;
+            return true;
+        }
+        static bool fromInteger( bool &value, long long integer ) { value = integer != 0; return true; }
+        static bool fromNil( bool &value ) { value = false; return true; }
+    };
+    
+    template<typename T>
+    struct ScalarDecoder<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+    {
+        static bool fromString( T &value, const StringRef &str )
+        {
+            size_t i = 0;
+            bool negative = str.size() > 0 && str[0] == '-';
+            if( negative )
+            {
+                if( !std::is_signed<T>::value )
+                    return false;
+                ++i;
+            }
+            if( i == str.size() )
+                return false;
+            
+            unsigned long long result = 0;
+            for( ; i < str.size(); ++i )
+            {
+                if( str[i] < '0' || str[i] > '9' )
+                    return false;
+                result = result * 10 + ( str[i] - '0' );
+            }
+            value = negative ? static_cast<T>( 0 - result ) : static_cast<T>( result );
+            return true;
+        }
+        static bool fromInteger( T &value, long long integer ) { value = static_cast<T>( integer ); return true; }
+        static bool fromNil( T & ) { return false; }
+    };
+    
+    template<typename T>
+    struct ScalarDecoder<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+    {
+        static bool fromString( T &value, const StringRef &str )
+        {
+            // numbers are short, so they are parsed from a terminated copy on the stack
+            char buf[64];
+            if( str.size() == 0 || str.size() >= sizeof( buf ) )
+                return false;
+            memcpy( buf, str.data(), str.size() );
+            buf[str.size()] = '\0';
+            char *end = nullptr;
+            value = static_cast<T>( strtod( buf, &end ) );
+            return end == buf + str.size();
+        }
+        static bool fromInteger( T &value, long long integer ) { value = static_cast<T>( integer ); return true; }
+        static bool fromNil( T & ) { return false; }
+    };
+    
+    template<typename T>
+    struct ScalarDecoder< Nullable<T> >
+    {
+        static bool fromString( Nullable<T> &value, const StringRef &str )
+        {
+            value.nil = false;
+            return ScalarDecoder<T>::fromString( value.value, str );
+        }
+        static bool fromInteger( Nullable<T> &value, long long integer )
+        {
+            value.nil = false;
+            return ScalarDecoder<T>::fromInteger( value.value, integer );
+        }
+        static bool fromNil( Nullable<T> &value ) { value.nil = true; return true; }
+    };
+    
+    // Decoding of replies to values. Scalars, containers, pairs and tuples are decoded here,
+    // decoding of user types is added by specializations, i.e. with decodeFields:
+    //
+    //   namespace RedisCluster {
+    //   template<> struct ReplyDecoder<User> {
+    //       static bool decode( const redisReply &reply, User &user ) {
+    //           return decodeFields( reply, user.name, user.age );
+    //       }
+    //   }; }
+    template<typename T, typename Enable>
+    struct ReplyDecoder
+    {
+        static bool decode( const redisReply &reply, T &value )
+        {
+            ReplyView view( reply );
+            if( view.isNil() )
+                return ScalarDecoder<T>::fromNil( value );
+            if( view.isInteger() )
+                return ScalarDecoder<T>::fromInteger( value, view.integer() );
+            if( view.isString() && !view.isError() )
+                return ScalarDecoder<T>::fromString( value, view.str() );
+            return false;
+        }
+    };
+    
+    template<>
+    struct ReplyDecoder<ReplyView>
+    {
+        static bool decode( const redisReply &reply, ReplyView &value )
+        {
+            value = ReplyView( reply );
+            return true;
+        }
+    };
+    
+    template<typename T>
+    struct ReplyDecoder< Nullable<T> >
+    {
+        static bool decode( const redisReply &reply, Nullable<T> &value )
+        {
+            value.nil = reply.type == REDIS_REPLY_NIL;
+            return value.nil || ReplyDecoder<T>::decode( reply, value.value );
+        }
+    };
+    
+    template<typename T, typename Allocator>
+    struct ReplyDecoder< std::vector<T, Allocator> >
+    {
+        static bool decode( const redisReply &reply, std::vector<T, Allocator> &value )
+        {
+            ReplyView view( reply );
+            if( !view.isArray() )
+                return false;
+            value.resize( view.size() );
+            for( size_t i = 0; i < view.size(); ++i )
+            {
+                if( !ReplyDecoder<T>::decode( *reply.element[i], value[i] ) )
+                    return false;
+            }
+            return true;
+        }
+    };
+    
+    // maps are decoded from RESP3 maps and from flat arrays of keys and values (HGETALL)
+    template<typename Map>
+    struct MapDecoder
+    {
+        static bool decode( const redisReply &reply, Map &value )
+        {
+            ReplyView view( reply );
+            if( !view.isArray() || view.size() % 2 != 0 )
+                return false;
+            value.clear();
+            for( size_t i = 0; i < view.size(); i += 2 )
+            {
+                typename Map::key_type key;
+                if( !ReplyDecoder<typename Map::key_type>::decode( *reply.element[i], key ) ||
+                    !ReplyDecoder<typename Map::mapped_type>::decode( *reply.element[i + 1], value[key] ) )
+                    return false;
+            }
+            return true;
+        }
+    };
+    
+    template<typename K, typename V, typename Compare, typename Allocator>
+    struct ReplyDecoder< std::map<K, V, Compare, Allocator> > :
+        MapDecoder< std::map<K, V, Compare, Allocator> > {};
+    
+    template<typename K, typename V, typename Hash, typename Equal, typename Allocator>
+    struct ReplyDecoder< std::unordered_map<K, V, Hash, Equal, Allocator> > :
+        MapDecoder< std::unordered_map<K, V, Hash, Equal, Allocator> > {};
+    
+    inline bool decodeElements( const redisReply &, size_t )
+    {
+        return true;
+    }
+    
+    template<typename First, typename... Rest>
+    inline bool decodeElements( const redisReply &reply, size_t index, First &first, Rest&... rest )
+    {
+        return ReplyDecoder<First>::decode( *reply.element[index], first ) &&
+            decodeElements( reply, index + 1, rest... );
+    }
+    
+    // decodes elements of an array reply to fields, the number of elements must match
+    template<typename... Fields>
+    inline bool decodeFields( const redisReply &reply, Fields&... fields )
+    {
+        return ReplyView( reply ).isArray() && reply.elements == sizeof...(Fields) &&
+            decodeElements( reply, 0, fields... );
+    }
+    
+    template<typename A, typename B>
+    struct ReplyDecoder< std::pair<A, B> >
+    {
+        static bool decode( const redisReply &reply, std::pair<A, B> &value )
+        {
+            return decodeFields( reply, value.first, value.second );
+        }
+    };
+    
+    template<typename... Types>
+    struct ReplyDecoder< std::tuple<Types...> >
+    {
+        static bool decode( const redisReply &reply, std::tuple<Types...> &value )
+        {
+            return ReplyView( reply ).isArray() && reply.elements == sizeof...(Types) &&
+                decodeTuple<0>( reply, value );
+        }
+        
+    private:
+        template<size_t I>
+        static typename std::enable_if<I == sizeof...(Types), bool>::type
+        decodeTuple( const redisReply &, std::tuple<Types...> & )
+        {
+            return true;
+        }
+        
+        template<size_t I>
+        static typename std::enable_if<I < sizeof...(Types), bool>::type
+        decodeTuple( const redisReply &reply, std::tuple<Types...> &value )
+        {
+            typedef typename std::tuple_element<I, std::tuple<Types...> >::type Element;
+            return ReplyDecoder<Element>::decode( *reply.element[I], std::get<I>( value ) ) &&
+                decodeTuple<I + 1>( reply, value );
+        }
+    };
+    
+    // target of a scalar element of a streamed reply
+    class ScalarTarget
+    {
+    public:
+        ScalarTarget() : object_( nullptr ), string_( nullptr ), fromString_( nullptr ),
+            fromInteger_( nullptr ), fromNil_( nullptr ) {}
+        
+        template<typename T>
+        static ScalarTarget of( T &value )
+        {
+            ScalarTarget target;
+            target.object_ = &value;
+            target.string_ = stringOf( value );
+            target.fromString_ = &fromString<T>;
+            target.fromInteger_ = &fromInteger<T>;
+            target.fromNil_ = &fromNil<T>;
+            return target;
+        }
+        
+        inline bool valid() const { return object_ != nullptr; }
+        // string the bulk chunks are appended to directly, or NULL if the value is parsed
+        inline string* directString() const { return string_; }
+        
+        inline bool setString( const StringRef &str ) const { return fromString_( object_, str ); }
+        inline bool setInteger( long long integer ) const { return fromInteger_( object_, integer ); }
+        inline bool setNil() const { return fromNil_( object_ ); }
+        
+    private:
+        static string* stringOf( string &value ) { return &value; }
+        static string* stringOf( Nullable<string> &value ) { value.nil = false; return &value.value; }
+        template<typename T>
+        static string* stringOf( T & ) { return nullptr; }
+        
+        template<typename T>
+        static bool fromString( void *object, const StringRef &str )
+        {
+            return ScalarDecoder<T>::fromString( *static_cast<T*>( object ), str );
+        }
+        template<typename T>
+        static bool fromInteger( void *object, long long integer )
+        {
+            return ScalarDecoder<T>::fromInteger( *static_cast<T*>( object ), integer );
+        }
+        template<typename T>
+        static bool fromNil( void *object )
+        {
+            return ScalarDecoder<T>::fromNil( *static_cast<T*>( object ) );
+        }
+        
+        void *object_;
+        string *string_;
+        bool (*fromString_)( void*, const StringRef& );
+        bool (*fromInteger_)( void*, long long );
+        bool (*fromNil_)( void* );
+    };
+    
+    // Element storage of streamed replies. Scalars take a single value,
+    // vectors and maps take the elements of a flat array (or a RESP3 map)
+    template<typename T>
+    struct StreamSink
+    {
+        static const bool Container = false;
+        
+        void reserve( T &, size_t ) {}
+        bool complete( size_t count ) const { return count == 1; }
+        ScalarTarget next( T &value, size_t index )
+        {
+            return index == 0 ? ScalarTarget::of( value ) : ScalarTarget();
+        }
+    };
+    
+    template<typename T, typename Allocator>
+    struct StreamSink< std::vector<T, Allocator> >
+    {
+        static const bool Container = true;
+        
+        void reserve( std::vector<T, Allocator> &value, size_t size ) { value.clear(); value.reserve( size ); }
+        bool complete( size_t ) const { return true; }
+        ScalarTarget next( std::vector<T, Allocator> &value, size_t )
+        {
+            value.push_back( T() );
+            return ScalarTarget::of( value.back() );
+        }
+    };
+    
+    template<typename Map>
+    struct MapSink
+    {
+        static const bool Container = true;
+        
+        void reserve( Map &value, size_t ) { value.clear(); }
+        bool complete( size_t count ) const { return count % 2 == 0; }
+        // keys are decoded to a temporary, values directly to the map
+        ScalarTarget next( Map &value, size_t index )
+        {
+            if( index % 2 == 0 )
+            {
+                key_ = typename Map::key_type();
+                return ScalarTarget::of( key_ );
+            }
+            return ScalarTarget::of( value[key_] );
+        }
+        
+        typename Map::key_type key_;
+    };
+    
+    template<typename K, typename V, typename Compare, typename Allocator>
+    struct StreamSink< std::map<K, V, Compare, Allocator> > :
+        MapSink< std::map<K, V, Compare, Allocator> > {};
+    
+    template<typename K, typename V, typename Hash, typename Equal, typename Allocator>
+    struct StreamSink< std::unordered_map<K, V, Hash, Equal, Allocator> > :
+        MapSink< std::unordered_map<K, V, Hash, Equal, Allocator> > {};
+    
+    // Decodes a streamed reply directly to value, so no reply objects are built at all.
+    // Scalars and flat arrays of scalars (LRANGE, HGETALL, MGET to vector of Nullable)
+    // are supported, any other reply shape fails decoding. Use with sync or async
+    // commands taking a ReplyVisitor:
+    //
+    //   std::vector<string> list;
+    //   DecodingVisitor< std::vector<string> > decoder( list );
+    //   HiredisCommand<>::Command( cluster, "list", RespCommand().format( "LRANGE", "list", 0, -1 ), decoder );
+    //   if( !decoder.ok() ) ...
+    template<typename T>
+    class DecodingVisitor : public ReplyVisitor
+    {
+        static_assert( !std::is_same<T, StringRef>::value, "streamed strings can't be referenced" );
+        
+    public:
+        explicit DecodingVisitor( T &value ) :
+        value_( value ),
+        depth_( 0 ),
+        index_( 0 ),
+        started_( false ),
+        failed_( false )
+        {
+        }
+        
+        // true if the reply matched the value type
+        inline bool ok() const { return !failed_ && started_ && sink_.complete( index_ ); }
+        
+        // prepares the visitor to decode the next reply
+        void reset()
+        {
+            depth_ = 0;
+            index_ = 0;
+            started_ = false;
+            failed_ = false;
+        }
+        
+        void onArray( size_t size ) override
+        {
+            if( !StreamSink<T>::Container || started_ )
+                failed_ = true;
+            else
+                sink_.reserve( value_, size );
+            started_ = true;
+            ++depth_;
+        }
+        
+        void onArrayEnd() override
+        {
+            --depth_;
+        }
+        
+        void onBulkBegin( size_t size ) override
+        {
+            buffer_.clear();
+            target_ = nextTarget();
+            if( !target_.valid() )
+                return;
+            if( string *str = target_.directString() )
+            {
+                str->clear();
+                str->reserve( size );
+            }
+        }
+        
+        void onBulkChunk( const StringRef &chunk ) override
+        {
+            if( !target_.valid() )
+                return;
+            if( string *str = target_.directString() )
+                str->append( chunk.data(), chunk.size() );
+            else
+                buffer_.append( chunk.data(), chunk.size() );
+        }
+        
+        void onBulkEnd() override
+        {
+            if( target_.valid() && target_.directString() == nullptr && !target_.setString( buffer_ ) )
+                failed_ = true;
+            target_ = ScalarTarget();
+        }
+        
+        void onStatus( const StringRef &status ) override
+        {
+            ScalarTarget target = nextTarget();
+            if( target.valid() && !target.setString( status ) )
+                failed_ = true;
+        }
+        
+        void onError( const StringRef & ) override
+        {
+            failed_ = true;
+        }
+        
+        void onInteger( long long integer ) override
+        {
+            ScalarTarget target = nextTarget();
+            if( target.valid() && !target.setInteger( integer ) )
+                failed_ = true;
+        }
+        
+        void onNil() override
+        {
+            ScalarTarget target = nextTarget();
+            if( target.valid() && !target.setNil() )
+                failed_ = true;
+        }
+        
+    protected:
+        
+        // scalars are accepted at the top level of scalar values and
+        // in the top-level array of containers only
+        ScalarTarget nextTarget()
+        {
+            if( !StreamSink<T>::Container )
+                started_ = true;
+            if( failed_ || depth_ != ( StreamSink<T>::Container ? 1 : 0 ) )
+            {
+                failed_ = true;
+                return ScalarTarget();
+            }
+            ScalarTarget target = sink_.next( value_, index_++ );
+            if( !target.valid() )
+                failed_ = true;
+            return target;
+        }
+        
+        T &value_;
+        StreamSink<T> sink_;
+        ScalarTarget target_;
+        string buffer_;
+        int depth_;
+        size_t index_;
+        bool started_;
+        bool failed_;
+    };
+    
+    // decodes the reply to value, returns false if the reply doesn't match the type
+    template<typename T>
+    inline bool decode( const redisReply &reply, T &value )
+    {
+        return ReplyDecoder<T>::decode( reply, value );
+    }
+}
+
+#endif /* defined(__libredisCluster__replydecoder__) */
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__replystream__
+#define __libredisCluster__replystream__
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#include "stringref.h"
+
+namespace RedisCluster
+{
+    // Receiver of a reply consumed in streaming mode. Parts of the reply are passed to the
+    // visitor as they are parsed, so the reply tree is never built. Maps report the number
+    // of keys and values as hiredis does. RESP3 doubles and big numbers come as status
+    // strings, booleans as integers, verbatim strings as bulk strings without the format
+    // prefix like in hiredis replies
+    class ReplyVisitor
+    {
+    public:
+        virtual ~ReplyVisitor() {}
+        
+        // array (set, push, map) with the number of elements, onArrayEnd follows the last element
+        virtual void onArray( size_t ) {}
+        virtual void onArrayEnd() {}
+        // bulk string of the given length, its data comes in one or more chunks
+        virtual void onBulkBegin( size_t ) {}
+        virtual void onBulkChunk( const StringRef & ) {}
+        virtual void onBulkEnd() {}
+        virtual void onStatus( const StringRef & ) {}
+        virtual void onError( const StringRef & ) {}
+        virtual void onInteger( long long ) {}
+        // nil bulk strings and nil arrays
+        virtual void onNil() {}
+    };
+    
+    // Incremental RESP parser passing one reply to a visitor. Data of bulk strings is passed
+    // without copying in chunks of the fed buffers, only the header lines are buffered when
+    // they are split between buffers. Top-level error replies are not passed to the visitor,
+    // they are kept for processing of cluster redirections
+    class ReplyStreamParser
+    {
+        // longest header line, longer lines are protocol errors
+        static const size_t MaxLine = 64 * 1024;
+        
+        ReplyStreamParser(const ReplyStreamParser&) = delete;
+        ReplyStreamParser& operator=(const ReplyStreamParser&) = delete;
+        
+    public:
+        explicit ReplyStreamParser( ReplyVisitor &visitor ) :
+        visitor_( visitor ),
+        prefixLeft_( 0 ),
+        bulkLeft_( 0 ),
+        crlfLeft_( 0 ),
+        done_( false ),
+        isError_( false )
+        {
+        }
+        
+        // parses data until the reply is complete, returns the number of bytes consumed
+        // or -1 on protocol errors. Bytes after the reply are not consumed
+        long feed( const char *data, size_t len )
+        {
+            const char *p = data, *end = data + len;
+            while( p < end && !done_ )
+            {
+                if( prefixLeft_ > 0 )
+                {
+                    size_t chunk = std::min( prefixLeft_, static_cast<size_t>( end - p ) );
+                    p += chunk;
+                    prefixLeft_ -= chunk;
+                    continue;
+                }
+                if( bulkLeft_ > 0 )
+                {
+                    size_t chunk = std::min( bulkLeft_, static_cast<size_t>( end - p ) );
+                    visitor_.onBulkChunk( StringRef( p, chunk ) );
+                    p += chunk;
+                    bulkLeft_ -= chunk;
+                    continue;
+                }
+                if( crlfLeft_ > 0 )
+                {
+                    size_t chunk = std::min( crlfLeft_, static_cast<size_t>( end - p ) );
+                    p += chunk;
+                    crlfLeft_ -= chunk;
+                    if( crlfLeft_ == 0 )
+                    {
+                        visitor_.onBulkEnd();
+                        complete();
+                    }
+                    continue;
+                }
+                
+                const char *eol = static_cast<const char*>( memchr( p, '\n', end - p ) );
+                if( eol == nullptr )
+                {
+                    line_.append( p, end - p );
+                    if( line_.size() > MaxLine )
+                        return -1;
+                    p = end;
+                    break;
+                }
+                
+                const char *line = p;
+                size_t lineLen = eol - p;
+                if( !line_.empty() )
+                {
+                    line_.append( p, eol - p );
+                    line = line_.data();
+                    lineLen = line_.size();
+                }
+                p = eol + 1;
+                
+                if( lineLen < 2 || line[lineLen - 1] != '\r' || !processLine( line[0], line + 1, lineLen - 2 ) )
+                    return -1;
+                line_.clear();
+            }
+            return p - data;
+        }
+        
+        inline bool done() const { return done_; }
+        // top-level error reply, the visitor is not called for it
+        inline bool isError() const { return isError_; }
+        inline const std::string& error() const { return error_; }
+        
+    protected:
+        bool processLine( char type, const char *text, size_t len )
+        {
+            long long value = 0;
+            switch( type )
+            {
+                case '+':
+                case ',':
+                case '(':
+                    visitor_.onStatus( StringRef( text, len ) );
+                    break;
+                case '-':
+                    if( stack_.empty() )
+                    {
+                        error_.assign( text, len );
+                        isError_ = true;
+                    }
+                    else
+                    {
+                        visitor_.onError( StringRef( text, len ) );
+                    }
+                    break;
+                case ':':
+                    if( !parseInteger( text, len, value ) )
+                        return false;
+                    visitor_.onInteger( value );
+                    break;
+                case '#':
+                    if( len != 1 || ( text[0] != 't' && text[0] != 'f' ) )
+                        return false;
+                    visitor_.onInteger( text[0] == 't' );
+                    break;
+                case '_':
+                    visitor_.onNil();
+                    break;
+                case '$':
+                case '=':
+                    if( !parseInteger( text, len, value ) || value < -1 )
+                        return false;
+                    if( value == -1 )
+                    {
+                        visitor_.onNil();
+                        break;
+                    }
+                    // format of verbatim strings ("txt:") is skipped
+                    if( type == '=' )
+                    {
+                        if( value < 4 )
+                            return false;
+                        prefixLeft_ = 4;
+                        value -= 4;
+                    }
+                    visitor_.onBulkBegin( static_cast<size_t>( value ) );
+                    bulkLeft_ = static_cast<size_t>( value );
+                    crlfLeft_ = 2;
+                    return true;
+                case '*':
+                case '~':
+                case '>':
+                case '%':
+                    if( !parseInteger( text, len, value ) || value < -1 )
+                        return false;
+                    if( value == -1 )
+                    {
+                        visitor_.onNil();
+                        break;
+                    }
+                    if( type == '%' )
+                        value *= 2;
+                    visitor_.onArray( static_cast<size_t>( value ) );
+                    if( value == 0 )
+                    {
+                        visitor_.onArrayEnd();
+                        break;
+                    }
+                    stack_.push_back( static_cast<size_t>( value ) );
+                    return true;
+                default:
+                    return false;
+            }
+            complete();
+            return true;
+        }
+        
+        // element is complete, so are the arrays it is the last element of
+        void complete()
+        {
+            while( !stack_.empty() )
+            {
+                if( --stack_.back() > 0 )
+                    return;
+                stack_.pop_back();
+                visitor_.onArrayEnd();
+            }
+            done_ = true;
+        }
+        
+        static bool parseInteger( const char *text, size_t len, long long &value )
+        {
+            size_t i = 0;
+            bool negative = len > 0 && text[0] == '-';
+            if( negative )
+                ++i;
+            if( i == len )
+                return false;
+            unsigned long long result = 0;
+            for( ; i < len; ++i )
+            {
+                if( text[i] < '0' || text[i] > '9' )
+                    return false;
+                result = result * 10 + ( text[i] - '0' );
+            }
+            value = static_cast<long long>( negative ? 0 - result : result );
+            return true;
+        }
+        
+        ReplyVisitor &visitor_;
+        // elements left in arrays being parsed
+        std::vector<size_t> stack_;
+        // header line split between buffers
+        std::string line_;
+        size_t prefixLeft_;
+        size_t bulkLeft_;
+        size_t crlfLeft_;
+        bool done_;
+        bool isError_;
+        std::string error_;
+    };
+}
+
+#endif /* defined(__libredisCluster__replystream__) */
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__respcommand__
+#define __libredisCluster__respcommand__
+
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "stringref.h"
+
+namespace RedisCluster
+{
+    using std::string;
+
+    // Encoding of command arguments in RESP ("*<argc>\r\n" followed by "$<len>\r\n<arg>\r\n"
+    // for every argument). Length of the whole command is calculated first, so the command
+    // is written in one pass without printf like format parsing or temporary buffers
+    class RespWriter
+    {
+        // integral types except characters and bool
+        template<typename T>
+        struct IsInteger
+        {
+            static const bool value = std::is_integral<T>::value &&
+                !std::is_same<T, bool>::value &&
+                !std::is_same<T, char>::value &&
+                !std::is_same<T, signed char>::value &&
+                !std::is_same<T, unsigned char>::value;
+        };
+
+    public:
+        static inline size_t decimalLength( unsigned long long value )
+        {
+            size_t len = 1;
+            while( value >= 10 )
+            {
+                value /= 10;
+                ++len;
+            }
+            return len;
+        }
+
+        static inline char* writeDecimal( char *p, unsigned long long value, size_t len )
+        {
+            char *end = p + len;
+            do
+            {
+                *--end = static_cast<char>( '0' + value % 10 );
+                value /= 10;
+            } while( value != 0 );
+            return p + len;
+        }
+
+        static inline size_t headerLength( size_t argc )
+        {
+            return 1 + decimalLength( argc ) + 2;
+        }
+
+        static inline char* writeHeader( char *p, size_t argc )
+        {
+            *p++ = '*';
+            p = writeDecimal( p, argc, decimalLength( argc ) );
+            *p++ = '\r';
+            *p++ = '\n';
+            return p;
+        }
+
+        static inline size_t bulkLength( size_t len )
+        {
+            return 1 + decimalLength( len ) + 2 + len + 2;
+        }
+
+        static inline char* writeBulk( char *p, const char *data, size_t len )
+        {
+            *p++ = '$';
+            p = writeDecimal( p, len, decimalLength( len ) );
+            *p++ = '\r';
+            *p++ = '\n';
+            memcpy( p, data, len );
+            p += len;
+            *p++ = '\r';
+            *p++ = '\n';
+            return p;
+        }
+
+        // string arguments
+
+        static inline size_t argumentLength( const StringRef &arg )
+        {
+            return bulkLength( arg.size() );
+        }
+
+        static inline char* writeArgument( char *p, const StringRef &arg )
+        {
+            return writeBulk( p, arg.data(), arg.size() );
+        }
+
+        static inline size_t argumentLength( const string &arg )
+        {
+            return bulkLength( arg.size() );
+        }
+
+        static inline char* writeArgument( char *p, const string &arg )
+        {
+            return writeBulk( p, arg.data(), arg.size() );
+        }
+
+        static inline size_t argumentLength( const char *arg )
+        {
+            return bulkLength( strlen( arg ) );
+        }
+
+        static inline char* writeArgument( char *p, const char *arg )
+        {
+            return writeBulk( p, arg, strlen( arg ) );
+        }
+
+        // integer arguments are sent as their decimal representation
+
+        template<typename T>
+        static inline typename std::enable_if<IsInteger<T>::value, size_t>::type
+        argumentLength( T arg )
+        {
+            return bulkLength( integerLength( arg ) );
+        }
+
+        template<typename T>
+        static inline typename std::enable_if<IsInteger<T>::value, char*>::type
+        writeArgument( char *p, T arg )
+        {
+            size_t len = integerLength( arg );
+            *p++ = '$';
+            p = writeDecimal( p, len, decimalLength( len ) );
+            *p++ = '\r';
+            *p++ = '\n';
+            if( isNegative( arg ) )
+            {
+                *p++ = '-';
+                p = writeDecimal( p, magnitude( arg ), len - 1 );
+            }
+            else
+            {
+                p = writeDecimal( p, magnitude( arg ), len );
+            }
+            *p++ = '\r';
+            *p++ = '\n';
+            return p;
+        }
+
+        // lengths and writing of argument lists
+
+        static inline size_t argumentsLength()
+        {
+            return 0;
+        }
+
+        template<typename First, typename... Rest>
+        static inline size_t argumentsLength( const First &first, const Rest&... rest )
+        {
+            return argumentLength( first ) + argumentsLength( rest... );
+        }
+
+        static inline char* writeArguments( char *p )
+        {
+            return p;
+        }
+
+        template<typename First, typename... Rest>
+        static inline char* writeArguments( char *p, const First &first, const Rest&... rest )
+        {
+            return writeArguments( writeArgument( p, first ), rest... );
+        }
+
+    private:
+        template<typename T>
+        static inline bool isNegative( T value )
+        {
+            return std::is_signed<T>::value && value < T(0);
+        }
+
+        template<typename T>
+        static inline unsigned long long magnitude( T value )
+        {
+            return isNegative( value ) ? 0ULL - static_cast<unsigned long long>( value )
+                                       : static_cast<unsigned long long>( value );
+        }
+
+        template<typename T>
+        static inline size_t integerLength( T value )
+        {
+            return decimalLength( magnitude( value ) ) + ( isNegative( value ) ? 1 : 0 );
+        }
+    };
+
+    // Typed command builder. The command is written in RESP to a buffer that is reused
+    // by the next format() call, so building commands of similar size does not allocate.
+    // Arguments may be strings (std::string, C strings, StringRef) and integers
+    //
+    //   RespCommand cmd;
+    //   HiredisCommand<>::Command( cluster_p, key, cmd.format( "SET", key, value ) );
+    //   HiredisCommand<>::Command( cluster_p, key, cmd.format( "EXPIRE", key, 60 ) );
+    class RespCommand
+    {
+        RespCommand(const RespCommand&) = delete;
+        RespCommand& operator=(const RespCommand&) = delete;
+
+    public:
+        RespCommand() : buf_( nullptr ), size_( 0 ), capacity_( 0 ) {}
+
+        ~RespCommand()
+        {
+            free( buf_ );
+        }
+
+        template<typename... Args>
+        RespCommand& format( const Args&... args )
+        {
+            static_assert( sizeof...(Args) > 0, "command must have at least one argument" );
+            size_t len = RespWriter::headerLength( sizeof...(Args) ) +
+                RespWriter::argumentsLength( args... );
+            char *p = reserve( len );
+            p = RespWriter::writeHeader( p, sizeof...(Args) );
+            RespWriter::writeArguments( p, args... );
+            size_ = len;
+            return *this;
+        }
+
+        // same as redisFormatCommandArgv, but writes to the reusable buffer
+        RespCommand& formatArgv( int argc, const char **argv, const size_t *argvlen )
+        {
+            size_t len = RespWriter::headerLength( argc );
+            for( int i = 0; i < argc; ++i )
+                len += RespWriter::bulkLength( argvlen ? argvlen[i] : strlen( argv[i] ) );
+
+            char *p = reserve( len );
+            p = RespWriter::writeHeader( p, argc );
+            for( int i = 0; i < argc; ++i )
+                p = RespWriter::writeBulk( p, argv[i], argvlen ? argvlen[i] : strlen( argv[i] ) );
+            size_ = len;
+            return *this;
+        }
+
+        inline const char* data() const { return buf_; }
+        inline size_t size() const { return size_; }
+
+    protected:
+        char* reserve( size_t len )
+        {
+            if( len > capacity_ )
+            {
+                size_t capacity = capacity_ ? capacity_ : 64;
+                while( capacity < len )
+                    capacity *= 2;
+
+                char *buf = static_cast<char*>( realloc( buf_, capacity ) );
+                if( buf == nullptr )
+                    throw std::bad_alloc();
+                buf_ = buf;
+                capacity_ = capacity;
+            }
+            return buf_;
+        }
+
+        char *buf_;
+        size_t size_;
+        size_t capacity_;
+    };
+
+    // Command with leading arguments (command name, subcommand, constant options) encoded
+    // once at construction. format() writes only the array header, copies the encoded prefix
+    // and encodes the arguments that change between calls
+    //
+    //   PreparedCommand hset( "HSET" );
+    //   HiredisCommand<>::Command( cluster_p, key, hset.format( key, field, value ) );
+    class PreparedCommand : public RespCommand
+    {
+    public:
+        template<typename First, typename... Rest>
+        explicit PreparedCommand( const First &first, const Rest&... rest ) :
+        prefixArgc_( 1 + sizeof...(Rest) )
+        {
+            prefix_.resize( RespWriter::argumentsLength( first, rest... ) );
+            RespWriter::writeArguments( &prefix_[0], first, rest... );
+        }
+
+        template<typename... Args>
+        PreparedCommand& format( const Args&... args )
+        {
+            size_t argc = prefixArgc_ + sizeof...(Args);
+            size_t len = RespWriter::headerLength( argc ) + prefix_.size() +
+                RespWriter::argumentsLength( args... );
+            char *p = reserve( len );
+            p = RespWriter::writeHeader( p, argc );
+            memcpy( p, prefix_.data(), prefix_.size() );
+            RespWriter::writeArguments( p + prefix_.size(), args... );
+            size_ = len;
+            return *this;
+        }
+
+    private:
+        string prefix_;
+        size_t prefixArgc_;
+    };
+
+    // Command with large arguments referenced instead of copied. RESP headers and small
+    // arguments are written to the command buffer, arguments not shorter than the threshold
+    // are sent from the caller's memory (i.e. an mmapped file) with writev. Referenced memory
+    // must stay valid until the command is completed. First argument is always copied
+    //
+    //   ScatterCommand cmd;
+    //   HiredisCommand<>::Command( cluster_p, key, cmd.format( "SET", key, StringRef( blob, size ) ) );
+    class ScatterCommand
+    {
+        // part of the command, data is nullptr for parts of the command buffer
+        struct Segment
+        {
+            const char *data;
+            size_t offset;
+            size_t len;
+        };
+
+        ScatterCommand(const ScatterCommand&) = delete;
+        ScatterCommand& operator=(const ScatterCommand&) = delete;
+
+    public:
+        static const size_t DefaultThreshold = 16 * 1024;
+
+        explicit ScatterCommand( size_t threshold = DefaultThreshold ) :
+        threshold_( threshold ),
+        size_( 0 ),
+        nameOffset_( 0 ),
+        nameSize_( 0 )
+        {
+        }
+
+        template<typename... Args>
+        ScatterCommand& format( const Args&... args )
+        {
+            static_assert( sizeof...(Args) > 0, "command must have at least one argument" );
+            clear();
+            RespWriter::writeHeader( append( RespWriter::headerLength( sizeof...(Args) ) ), sizeof...(Args) );
+            appendArguments( true, args... );
+            finish();
+            return *this;
+        }
+
+        ScatterCommand& formatArgv( int argc, const char **argv, const size_t *argvlen )
+        {
+            clear();
+            RespWriter::writeHeader( append( RespWriter::headerLength( argc ) ), argc );
+            for( int i = 0; i < argc; ++i )
+                appendString( i == 0, StringRef( argv[i], argvlen ? argvlen[i] : strlen( argv[i] ) ) );
+            finish();
+            return *this;
+        }
+
+        // parts of the command for writev, valid until the next format() call
+        inline const struct iovec* iov() const { return iov_.data(); }
+        inline size_t count() const { return iov_.size(); }
+        // size of the whole command
+        inline size_t size() const { return size_; }
+        // first argument (command name)
+        inline const StringRef& name() const { return name_; }
+
+        // whole command in one buffer for transports that can't write parts
+        void copyTo( string &cmd ) const
+        {
+            cmd.clear();
+            cmd.reserve( size_ );
+            for( size_t i = 0; i < iov_.size(); ++i )
+                cmd.append( static_cast<const char*>( iov_[i].iov_base ), iov_[i].iov_len );
+        }
+
+    protected:
+        void clear()
+        {
+            buf_.clear();
+            segments_.clear();
+            iov_.clear();
+            size_ = 0;
+            nameOffset_ = 0;
+            nameSize_ = 0;
+        }
+
+        // reserves len bytes at the end of the command buffer
+        char* append( size_t len )
+        {
+            size_t offset = buf_.size();
+            buf_.resize( offset + len );
+            if( !segments_.empty() && segments_.back().data == nullptr )
+            {
+                segments_.back().len += len;
+            }
+            else
+            {
+                Segment segment = { nullptr, offset, len };
+                segments_.push_back( segment );
+            }
+            return &buf_[offset];
+        }
+
+        void appendString( bool first, const StringRef &arg )
+        {
+            if( first || arg.size() < threshold_ )
+            {
+                char *p = RespWriter::writeBulk( append( RespWriter::bulkLength( arg.size() ) ), arg.data(), arg.size() );
+                if( first )
+                {
+                    nameOffset_ = p - 2 - arg.size() - buf_.data();
+                    nameSize_ = arg.size();
+                }
+                return;
+            }
+
+            size_t len = RespWriter::decimalLength( arg.size() );
+            char *p = append( 1 + len + 2 );
+            *p++ = '$';
+            p = RespWriter::writeDecimal( p, arg.size(), len );
+            *p++ = '\r';
+            *p++ = '\n';
+            Segment segment = { arg.data(), 0, arg.size() };
+            segments_.push_back( segment );
+            p = append( 2 );
+            *p++ = '\r';
+            *p++ = '\n';
+        }
+
+        inline void appendArgument( bool first, const StringRef &arg ) { appendString( first, arg ); }
+        inline void appendArgument( bool first, const string &arg ) { appendString( first, arg ); }
+        inline void appendArgument( bool first, const char *arg ) { appendString( first, arg ); }
+
+        template<typename T>
+        inline typename std::enable_if<std::is_integral<T>::value>::type
+        appendArgument( bool, T arg )
+        {
+            RespWriter::writeArgument( append( RespWriter::argumentLength( arg ) ), arg );
+        }
+
+        inline void appendArguments( bool )
+        {
+        }
+
+        template<typename First, typename... Rest>
+        inline void appendArguments( bool first, const First &arg, const Rest&... rest )
+        {
+            appendArgument( first, arg );
+            appendArguments( false, rest... );
+        }
+
+        // buffer doesn't move anymore, so iovecs can point to it
+        void finish()
+        {
+            iov_.resize( segments_.size() );
+            for( size_t i = 0; i < segments_.size(); ++i )
+            {
+                const char *data = segments_[i].data ? segments_[i].data : buf_.data() + segments_[i].offset;
+                iov_[i].iov_base = const_cast<char*>( data );
+                iov_[i].iov_len = segments_[i].len;
+                size_ += segments_[i].len;
+            }
+            name_ = StringRef( buf_.data() + nameOffset_, nameSize_ );
+        }
+
+        size_t threshold_;
+        string buf_;
+        std::vector<Segment> segments_;
+        std::vector<struct iovec> iov_;
+        size_t size_;
+        size_t nameOffset_;
+        size_t nameSize_;
+        StringRef name_;
+    };
+}
+
+#endif /* defined(__libredisCluster__respcommand__) */
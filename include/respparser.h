@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__respparser__
+#define __libredisCluster__respparser__
+
+#include <atomic>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+#include "replyarena.h"
+
+namespace RedisCluster
+{
+    // Finds line ends of RESP data. With SSE2 sixteen bytes are compared to '\r' at once and
+    // the mask is kept, so consecutive short lines of one block (i.e. headers of small array
+    // elements) are found without loading the data again
+    class LineFinder
+    {
+    public:
+        LineFinder() : block_( nullptr ), mask_( 0 ) {}
+        
+        // returns position of the first "\r\n" in [p, end), or NULL if there is none
+        const char* find( const char *p, const char *end )
+        {
+#if defined(__SSE2__)
+            const __m128i cr = _mm_set1_epi8( '\r' );
+            while( end - p >= 2 )
+            {
+                if( p < block_ || p >= block_ + BlockSize )
+                {
+                    if( end - p < BlockSize )
+                        break;
+                    block_ = p;
+                    mask_ = static_cast<unsigned>( _mm_movemask_epi8(
+                        _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>( p ) ), cr ) ) );
+                }
+                
+                unsigned mask = mask_ & ( ~0u << ( p - block_ ) );
+                while( mask != 0 )
+                {
+                    const char *found = block_ + __builtin_ctz( mask );
+                    if( found + 1 >= end )
+                        return nullptr;
+                    if( found[1] == '\n' )
+                        return found;
+                    mask &= mask - 1;
+                }
+                p = block_ + BlockSize;
+            }
+#endif
+            return findTail( p, end );
+        }
+        
+        // cached block must not be used with other data
+        void reset()
+        {
+            block_ = nullptr;
+            mask_ = 0;
+        }
+        
+    protected:
+        static const int BlockSize = 16;
+        
+        static const char* findTail( const char *p, const char *end )
+        {
+            while( end - p >= 2 )
+            {
+                const char *found = static_cast<const char*>( memchr( p, '\r', end - p - 1 ) );
+                if( found == nullptr )
+                    return nullptr;
+                if( found[1] == '\n' )
+                    return found;
+                p = found + 1;
+            }
+            return nullptr;
+        }
+        
+        const char *block_;
+        unsigned mask_;
+    };
+    
+    // RESP2/RESP3 reply parser building redisReply trees in a ReplyArena. Replies are equal to
+    // the replies of the hiredis reader (the same types, fields and protocol errors), but lines are
+    // found with LineFinder and no per-object allocations are done.
+    // Parsing is done in two passes: scan finds the end of a complete reply (and can be resumed
+    // when more data arrives), build creates the objects of the scanned reply
+    class RespParser
+    {
+        RespParser(const RespParser&) = delete;
+        RespParser& operator=(const RespParser&) = delete;
+        
+    public:
+        // the same limit of aggregate sizes as the default of the hiredis reader
+        static const long long MaxElements = ( 1LL << 32 ) - 1;
+        
+        RespParser() :
+        pos_( 0 ),
+        error_( nullptr )
+        {
+        }
+        
+        // parser is used for replies allocated from arenas when enabled (default),
+        // hiredis reader is used otherwise
+        static std::atomic<bool>& enabled()
+        {
+            static std::atomic<bool> value( true );
+            return value;
+        }
+        
+        // Scans data for one complete reply. Returns its length, 0 if more data is needed
+        // or -1 on protocol error. Scan is resumed by the next call with the same data
+        // followed by new bytes
+        inline long scan( const char *data, size_t len )
+        {
+            return scanElements( data, len, 1 );
+        }
+        
+        // the same as scan, but for a number of consecutive replies (elements of an array)
+        long scanElements( const char *data, size_t len, size_t count )
+        {
+            if( error_ != nullptr )
+                return -1;
+            if( pos_ == 0 && stack_.empty() )
+                stack_.push_back( count );
+            
+            finder_.reset();
+            const char *end = data + len;
+            while( pos_ < len )
+            {
+                const char *p = data + pos_;
+                // like the hiredis reader, type is checked before the line is complete
+                if( !isType( *p ) )
+                    return failType( *p );
+                const char *cr = finder_.find( p + 1, end );
+                if( cr == nullptr )
+                    return 0;
+                const char *line = p + 1;
+                size_t lineLen = cr - line;
+                size_t next = cr + 2 - data;
+                long long size;
+                
+                switch( *p )
+                {
+                    case '$':
+#if HIREDIS_MAJOR >= 1
+                    case '=':
+#endif
+                        if( !string2ll( line, lineLen, size ) )
+                            return fail( "Bad bulk string length" );
+                        if( size < -1 )
+                            return fail( "Bulk string length out of range" );
+                        if( size >= 0 )
+                        {
+                            if( len - next < static_cast<size_t>( size ) + 2 )
+                                return 0;
+                            if( *p == '=' && ( size < 4 || data[next + 3] != ':' ) )
+                                return fail( "Verbatim string 4 bytes of content type are missing or incorrectly encoded." );
+                            next += size + 2;
+                        }
+                        break;
+                        
+                    case '*':
+#if HIREDIS_MAJOR >= 1
+                    case '%':
+                    case '~':
+                    case '>':
+                    case '|':
+#endif
+                        if( !string2ll( line, lineLen, size ) )
+                            return fail( "Bad multi-bulk length" );
+                        if( size < -1 || size > MaxElements )
+                            return fail( "Multi-bulk length out of range" );
+                        if( size > 0 )
+                        {
+                            pos_ = next;
+                            stack_.push_back( *p == '%' || *p == '|' ? size * 2 : size );
+                            continue;
+                        }
+                        break;
+                        
+                    default:
+                        if( const char *message = checkLine( *p, line, lineLen ) )
+                            return fail( message );
+                }
+                
+                pos_ = next;
+                // the element is complete, so are the aggregates it is the last element of
+                while( !stack_.empty() && --stack_.back() == 0 )
+                    stack_.pop_back();
+                if( stack_.empty() )
+                {
+                    long length = static_cast<long>( pos_ );
+                    pos_ = 0;
+                    return length;
+                }
+            }
+            return 0;
+        }
+        
+        // builds the reply scanned last, data must be the same as given to scan
+        redisReply* build( const char *data, size_t len, ReplyArena &arena )
+        {
+            redisReply *reply = nullptr;
+            buildElements( data, len, &reply, 1, arena );
+            return reply;
+        }
+        
+        // builds the scanned elements to the array of element pointers
+        void buildElements( const char *data, size_t len, redisReply **elements, size_t count, ReplyArena &arena )
+        {
+            finder_.reset();
+            std::vector<Slots> &stack = slots_;
+            stack.clear();
+            Slots root = { elements, count };
+            stack.push_back( root );
+            
+            const char *p = data;
+            const char *end = data + len;
+            while( !stack.empty() )
+            {
+                if( stack.back().count == 0 )
+                {
+                    stack.pop_back();
+                    continue;
+                }
+                redisReply **slot = stack.back().next++;
+                --stack.back().count;
+                
+                const char *cr = finder_.find( p + 1, end );
+                const char *line = p + 1;
+                size_t lineLen = cr - line;
+                char type = *p;
+                p = cr + 2;
+                
+                redisReply *r;
+                long long size = 0;
+                switch( type )
+                {
+                    case '$':
+#if HIREDIS_MAJOR >= 1
+                    case '=':
+#endif
+                        string2ll( line, lineLen, size );
+                        if( size < 0 )
+                        {
+                            r = arena.createReply( REDIS_REPLY_NIL );
+                            break;
+                        }
+#if HIREDIS_MAJOR >= 1
+                        if( type == '=' )
+                        {
+                            r = arena.createReply( REDIS_REPLY_VERB );
+                            setString( r, p + 4, size - 4, arena );
+                            memcpy( r->vtype, p, 3 );
+                            r->vtype[3] = '\0';
+                            p += size + 2;
+                            break;
+                        }
+#endif
+                        r = arena.createReply( REDIS_REPLY_STRING );
+                        setString( r, p, size, arena );
+                        p += size + 2;
+                        break;
+                        
+                    case '*':
+#if HIREDIS_MAJOR >= 1
+                    case '%':
+                    case '~':
+                    case '>':
+                    case '|':
+#endif
+                    {
+                        string2ll( line, lineLen, size );
+                        if( size < 0 )
+                        {
+                            r = arena.createReply( REDIS_REPLY_NIL );
+                            break;
+                        }
+                        r = arena.createReply( aggregateType( type ) );
+                        if( type == '%' || type == '|' )
+                            size *= 2;
+                        if( size > 0 )
+                        {
+                            r->element = static_cast<redisReply**>( arena.allocate( size * sizeof(redisReply*) ) );
+                            Slots children = { r->element, static_cast<size_t>( size ) };
+                            *slot = r;
+                            r->elements = size;
+                            stack.push_back( children );
+                            continue;
+                        }
+                        break;
+                    }
+                        
+                    case ':':
+                        r = arena.createReply( REDIS_REPLY_INTEGER );
+                        string2ll( line, lineLen, r->integer );
+                        break;
+                        
+#if HIREDIS_MAJOR >= 1
+                    case '_':
+                        r = arena.createReply( REDIS_REPLY_NIL );
+                        break;
+                        
+                    case ',':
+                        r = arena.createReply( REDIS_REPLY_DOUBLE );
+                        parseDouble( line, lineLen, r->dval );
+                        setString( r, line, lineLen, arena );
+                        break;
+                        
+                    case '#':
+                        r = arena.createReply( REDIS_REPLY_BOOL );
+                        r->integer = line[0] == 't' || line[0] == 'T';
+                        break;
+                        
+                    case '(':
+                        r = arena.createReply( REDIS_REPLY_BIGNUM );
+                        setString( r, line, lineLen, arena );
+                        break;
+#endif
+                        
+                    default:
+                        r = arena.createReply( type == '+' ? REDIS_REPLY_STATUS : REDIS_REPLY_ERROR );
+                        setString( r, line, lineLen, arena );
+                }
+                *slot = r;
+            }
+        }
+        
+        // message of the protocol error, NULL if there is no error
+        inline const char* error() const { return error_; }
+        
+        // prepares the parser to scan the next reply
+        void reset()
+        {
+            pos_ = 0;
+            stack_.clear();
+            error_ = nullptr;
+        }
+        
+        // the same as string2ll of the hiredis reader: no signs except '-', no leading zeroes
+        static bool string2ll( const char *s, size_t len, long long &value )
+        {
+            if( len == 0 )
+                return false;
+            if( len == 1 && s[0] == '0' )
+            {
+                value = 0;
+                return true;
+            }
+            
+            size_t i = 0;
+            bool negative = s[0] == '-';
+            if( negative && ++i == len )
+                return false;
+            if( s[i] < '1' || s[i] > '9' )
+                return false;
+            
+            unsigned long long v = 0;
+            for( ; i < len; ++i )
+            {
+                if( s[i] < '0' || s[i] > '9' )
+                    return false;
+                unsigned digit = s[i] - '0';
+                if( v > ULLONG_MAX / 10 || v * 10 > ULLONG_MAX - digit )
+                    return false;
+                v = v * 10 + digit;
+            }
+            
+            if( negative )
+            {
+                if( v > static_cast<unsigned long long>( LLONG_MAX ) + 1 )
+                    return false;
+                value = static_cast<long long>( 0 - v );
+            }
+            else
+            {
+                if( v > static_cast<unsigned long long>( LLONG_MAX ) )
+                    return false;
+                value = static_cast<long long>( v );
+            }
+            return true;
+        }
+        
+    protected:
+        
+        struct Slots
+        {
+            redisReply **next;
+            size_t count;
+        };
+        
+        static int aggregateType( char type )
+        {
+            switch( type )
+            {
+#ifdef REDIS_REPLY_MAP
+                case '%':
+                    return REDIS_REPLY_MAP;
+#endif
+#ifdef REDIS_REPLY_SET
+                case '~':
+                    return REDIS_REPLY_SET;
+#endif
+#ifdef REDIS_REPLY_PUSH
+                case '>':
+                    return REDIS_REPLY_PUSH;
+#endif
+#ifdef REDIS_REPLY_ATTR
+                case '|':
+                    return REDIS_REPLY_ATTR;
+#endif
+                default:
+                    return REDIS_REPLY_ARRAY;
+            }
+        }
+        
+        // checks a line element the same way as the hiredis reader, returns the error message
+        static const char* checkLine( char type, const char *line, size_t len )
+        {
+            long long integer;
+            switch( type )
+            {
+                case ':':
+                    return string2ll( line, len, integer ) ? nullptr : "Bad integer value";
+                    
+                case '+':
+                case '-':
+                    for( size_t i = 0; i < len; ++i )
+                    {
+                        if( line[i] == '\r' || line[i] == '\n' )
+                            return "Bad simple string value";
+                    }
+                    return nullptr;
+                    
+#if HIREDIS_MAJOR >= 1
+                case '_':
+                    return len == 0 ? nullptr : "Bad nil value";
+                    
+                case ',':
+                {
+                    double value;
+                    if( len >= MaxDoubleLength )
+                        return "Double value is too large";
+                    return parseDouble( line, len, value ) ? nullptr : "Bad double value";
+                }
+                    
+                case '#':
+                    return len == 1 && strchr( "tTfF", line[0] ) != nullptr ? nullptr : "Bad bool value";
+                    
+                case '(':
+                    for( size_t i = 0; i < len; ++i )
+                    {
+                        if( i == 0 && line[0] == '-' )
+                            continue;
+                        if( line[i] < '0' || line[i] > '9' )
+                            return "Bad bignum value";
+                    }
+                    return nullptr;
+#endif
+                    
+                default:
+                    return nullptr;
+            }
+        }
+        
+        static bool isType( char type )
+        {
+#if HIREDIS_MAJOR >= 1
+            return type != '\0' && strchr( "$*+-:_,#(=%~>|", type ) != nullptr;
+#else
+            return type != '\0' && strchr( "$*+-:", type ) != nullptr;
+#endif
+        }
+        
+        static const size_t MaxDoubleLength = 326;
+        
+        static bool parseDouble( const char *line, size_t len, double &value )
+        {
+            char buf[MaxDoubleLength];
+            memcpy( buf, line, len );
+            buf[len] = '\0';
+            
+            if( len == 3 && strcasecmp( buf, "inf" ) == 0 )
+                value = INFINITY;
+            else if( len == 4 && strcasecmp( buf, "-inf" ) == 0 )
+                value = -INFINITY;
+            else if( ( len == 3 && strcasecmp( buf, "nan" ) == 0 ) || ( len == 4 && strcasecmp( buf, "-nan" ) == 0 ) )
+                value = NAN;
+            else
+            {
+                // only the decimal notation of RESP3, strtod also takes spaces, signs and hex
+                if( ( !isdigit( buf[0] ) && buf[0] != '-' && buf[0] != '.' ) ||
+                    strspn( buf, "0123456789.eE+-" ) != len )
+                    return false;
+                char *end;
+                value = strtod( buf, &end );
+                return buf[0] != '\0' && end == buf + len && isfinite( value );
+            }
+            return true;
+        }
+        
+        static void setString( redisReply *r, const char *str, size_t len, ReplyArena &arena )
+        {
+            char *buf = static_cast<char*>( arena.allocate( len + 1 ) );
+            memcpy( buf, str, len );
+            buf[len] = '\0';
+            r->str = buf;
+            r->len = len;
+        }
+        
+        long fail( const char *message )
+        {
+            error_ = message;
+            return -1;
+        }
+        
+        long failType( char type )
+        {
+            unsigned char c = static_cast<unsigned char>( type );
+            if( isprint( c ) && c != '"' && c != '\\' )
+                snprintf( typeError_, sizeof( typeError_ ), "Protocol error, got \"%c\" as reply type byte", c );
+            else
+                snprintf( typeError_, sizeof( typeError_ ), "Protocol error, got \"\\x%02x\" as reply type byte", c );
+            return fail( typeError_ );
+        }
+        
+        // offset of the next element and remaining elements of the open aggregates
+        size_t pos_;
+        std::vector<long long> stack_;
+        std::vector<Slots> slots_;
+        LineFinder finder_;
+        const char *error_;
+        char typeError_[64];
+    };
+}
+
+#endif /* defined(__libredisCluster__respparser__) */
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__result__
+#define __libredisCluster__result__
+
+#include <new>
+#include <utility>
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+#include "clusterexception.h"
+
+namespace RedisCluster
+{
+    // Error codes of the non-throwing API, one for every cluster exception type
+    enum ErrorCode
+    {
+        SUCCESS = 0,
+        INVALID_ARGUMENT,
+        NOT_INITIALIZED,
+        NODE_NOT_FOUND,
+        CONNECTION_FAILED,
+        CONNECTION_LIMIT,
+        DISCONNECTED,
+        CLUSTER_DOWN,
+        ASKING_FAILED,
+        MOVED_FAILED,
+        REDIRECT_FAILED,
+        TIMEOUT,
+        LOGIC_ERROR,
+        OUT_OF_MEMORY,
+        OVERLOADED
+    };
+    
+    inline const char* errorMessage( ErrorCode code )
+    {
+        switch( code )
+        {
+            case SUCCESS:           return "success";
+            case INVALID_ARGUMENT:  return "cluster invalid argument";
+            case NOT_INITIALIZED:   return "cluster have not been properly initialized";
+            case NODE_NOT_FOUND:    return "node not found in cluster";
+            case CONNECTION_FAILED: return "cluster connect failed";
+            case CONNECTION_LIMIT:  return "cluster connection limit reached";
+            case DISCONNECTED:      return "cluster host disconnected";
+            case CLUSTER_DOWN:      return "cluster is going down";
+            case ASKING_FAILED:     return "asking error";
+            case MOVED_FAILED:      return "error while processing moved redirection";
+            case REDIRECT_FAILED:   return "can't connect while resolving redirection";
+            case TIMEOUT:           return "cluster operation timed out";
+            case LOGIC_ERROR:       return "cluster logic error";
+            case OUT_OF_MEMORY:     return "out of memory";
+            case OVERLOADED:        return "cluster node overloaded";
+        }
+        return "unknown error";
+    }
+    
+    // Conversions between error codes and exceptions. Exceptions are only an opt-in
+    // wrapper of the error codes: functions returning codes never throw them
+    class ErrorCodes
+    {
+    public:
+        // error code of an exception thrown by cluster or container
+        static ErrorCode fromException( const ClusterException &e )
+        {
+            if( dynamic_cast<const TimeoutException*>( &e ) ) return TIMEOUT;
+            if( dynamic_cast<const DisconnectedException*>( &e ) ) return DISCONNECTED;
+            if( dynamic_cast<const ClusterDownException*>( &e ) ) return CLUSTER_DOWN;
+            if( dynamic_cast<const NodeSearchException*>( &e ) ) return NODE_NOT_FOUND;
+            if( dynamic_cast<const NotInitializedException*>( &e ) ) return NOT_INITIALIZED;
+            if( dynamic_cast<const ConnectionFailedException*>( &e ) ) return CONNECTION_FAILED;
+            if( dynamic_cast<const ConnectionLimitException*>( &e ) ) return CONNECTION_LIMIT;
+            if( dynamic_cast<const OverloadedException*>( &e ) ) return OVERLOADED;
+            if( dynamic_cast<const AskingFailedException*>( &e ) ) return ASKING_FAILED;
+            if( dynamic_cast<const MovedFailedException*>( &e ) ) return MOVED_FAILED;
+            if( dynamic_cast<const InvalidArgument*>( &e ) ) return INVALID_ARGUMENT;
+            return LOGIC_ERROR;
+        }
+        
+        // error code of the exception being handled, must be called from a catch block
+        static ErrorCode current() noexcept
+        {
+            try
+            {
+                throw;
+            }
+            catch( const ClusterException &e )
+            {
+                return fromException( e );
+            }
+            catch( const std::bad_alloc & )
+            {
+                return OUT_OF_MEMORY;
+            }
+            catch( ... )
+            {
+                return LOGIC_ERROR;
+            }
+        }
+        
+        // calls fn with the exception of the error code without throwing it,
+        // i.e. for error callbacks taking exceptions
+        template<typename Fn>
+        static auto withException( ErrorCode code, Fn fn ) -> decltype( fn( std::declval<const ClusterException&>() ) )
+        {
+            switch( code )
+            {
+                case INVALID_ARGUMENT:  return fn( InvalidArgument( nullptr ) );
+                case NOT_INITIALIZED:   return fn( NotInitializedException() );
+                case NODE_NOT_FOUND:    return fn( NodeSearchException() );
+                case CONNECTION_FAILED: return fn( ConnectionFailedException( nullptr ) );
+                case CONNECTION_LIMIT:  return fn( ConnectionLimitException() );
+                case DISCONNECTED:      return fn( DisconnectedException() );
+                case CLUSTER_DOWN:      return fn( ClusterDownException( nullptr ) );
+                case ASKING_FAILED:     return fn( AskingFailedException( nullptr ) );
+                case MOVED_FAILED:      return fn( MovedFailedException( nullptr ) );
+                case TIMEOUT:           return fn( TimeoutException() );
+                case OVERLOADED:        return fn( OverloadedException() );
+                case LOGIC_ERROR:       return fn( LogicError( nullptr ) );
+                default:                return fn( LogicError( nullptr, errorMessage( code ) ) );
+            }
+        }
+        
+        // throws exception of the error code, reply (if any) is freed by the exception
+        static void raise( ErrorCode code, redisReply *reply = nullptr )
+        {
+            switch( code )
+            {
+                case SUCCESS:
+                    return;
+                case INVALID_ARGUMENT:  throw InvalidArgument( reply );
+                case NOT_INITIALIZED:   throw NotInitializedException();
+                case NODE_NOT_FOUND:    throw NodeSearchException();
+                case CONNECTION_FAILED: throw ConnectionFailedException( reply );
+                case CONNECTION_LIMIT:  throw ConnectionLimitException();
+                case DISCONNECTED:      throw DisconnectedException();
+                case CLUSTER_DOWN:      throw ClusterDownException( reply );
+                case ASKING_FAILED:     throw AskingFailedException( reply );
+                case MOVED_FAILED:      throw MovedFailedException( reply );
+                case TIMEOUT:           throw TimeoutException();
+                case OVERLOADED:        throw OverloadedException();
+                case OUT_OF_MEMORY:     throw std::bad_alloc();
+                default:                throw LogicError( reply, errorMessage( code ) );
+            }
+        }
+    };
+    
+    // Value or error code returned by the non-throwing API
+    //
+    //   Result<redisReply*> result = HiredisCommand<>::TryCommand( cluster_p, "FOO", "GET %s", "FOO" );
+    //   if( result )
+    //       freeReplyObject( result.value() );
+    //   else
+    //       cerr << errorMessage( result.error() ) << endl;
+    template<typename T>
+    class Result
+    {
+    public:
+        Result( T value ) : value_( std::move( value ) ), error_( SUCCESS ) {}
+        Result( ErrorCode error ) : value_(), error_( error ) {}
+        
+        inline bool ok() const { return error_ == SUCCESS; }
+        inline explicit operator bool() const { return ok(); }
+        inline ErrorCode error() const { return error_; }
+        
+        inline T& value() { return value_; }
+        inline const T& value() const { return value_; }
+        
+        // value or the exception of the error
+        inline T& get()
+        {
+            ErrorCodes::raise( error_ );
+            return value_;
+        }
+        
+    private:
+        T value_;
+        ErrorCode error_;
+    };
+}
+
+#endif /* defined(__libredisCluster__result__) */
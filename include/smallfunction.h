@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__smallfunction__
+#define __libredisCluster__smallfunction__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace RedisCluster
+{
+    // Callable wrapper like std::function, but callables up to Size bytes (lambdas capturing
+    // a few pointers, function pointers, std::function objects) are stored inside the wrapper,
+    // so constructing and copying it allocates nothing. Bigger callables are allocated on heap
+    template<typename Signature, size_t Size = 6 * sizeof(void*)>
+    class SmallFunction;
+
+    template<typename R, typename... Args, size_t Size>
+    class SmallFunction<R (Args...), Size>
+    {
+        typedef typename std::aligned_storage<Size, sizeof(void*)>::type Storage;
+
+        // type-erased operations of the stored callable
+        struct Ops
+        {
+            R (*invoke)( const Storage&, Args... );
+            void (*copy)( Storage&, const Storage& );
+            void (*move)( Storage&, Storage& );
+            void (*destroy)( Storage& );
+        };
+
+        template<typename F>
+        struct Inline
+        {
+            static F& target( const Storage &s )
+            {
+                return *reinterpret_cast<F*>( const_cast<Storage*>( &s ) );
+            }
+            static R invoke( const Storage &s, Args... args )
+            {
+                return target( s )( std::forward<Args>( args )... );
+            }
+            static void copy( Storage &to, const Storage &from )
+            {
+                new (&to) F( target( from ) );
+            }
+            static void move( Storage &to, Storage &from )
+            {
+                new (&to) F( std::move( target( from ) ) );
+                target( from ).~F();
+            }
+            static void destroy( Storage &s )
+            {
+                target( s ).~F();
+            }
+        };
+
+        template<typename F>
+        struct Allocated
+        {
+            static F*& target( const Storage &s )
+            {
+                return *reinterpret_cast<F**>( const_cast<Storage*>( &s ) );
+            }
+            static R invoke( const Storage &s, Args... args )
+            {
+                return ( *target( s ) )( std::forward<Args>( args )... );
+            }
+            static void copy( Storage &to, const Storage &from )
+            {
+                target( to ) = new F( *target( from ) );
+            }
+            static void move( Storage &to, Storage &from )
+            {
+                target( to ) = target( from );
+            }
+            static void destroy( Storage &s )
+            {
+                delete target( s );
+            }
+        };
+
+        // callables are moved when the wrapper is moved, so only callables
+        // with non-throwing move constructors are stored inline
+        template<typename F>
+        struct Placement
+        {
+            static const bool fits = sizeof(F) <= sizeof(Storage) &&
+                std::alignment_of<Storage>::value % std::alignment_of<F>::value == 0 &&
+                std::is_nothrow_move_constructible<F>::value;
+            typedef typename std::conditional<fits, Inline<F>, Allocated<F> >::type type;
+        };
+
+        template<typename F>
+        static const Ops* opsOf()
+        {
+            typedef typename Placement<F>::type Placed;
+            static const Ops ops = { Placed::invoke, Placed::copy, Placed::move, Placed::destroy };
+            return &ops;
+        }
+
+        // empty function pointers and empty std::function objects make empty wrappers
+        template<typename T>
+        static bool isEmpty( T *f, int )
+        {
+            return f == nullptr;
+        }
+
+        template<typename F>
+        static auto isEmpty( const F &f, long ) -> decltype( static_cast<bool>( !f ) )
+        {
+            return !f;
+        }
+
+        template<typename F>
+        static bool isEmpty( const F &, ... )
+        {
+            return false;
+        }
+
+        template<typename D, typename F>
+        void store( F &&f, std::true_type )
+        {
+            new (&storage_) D( std::forward<F>( f ) );
+        }
+
+        template<typename D, typename F>
+        void store( F &&f, std::false_type )
+        {
+            Allocated<D>::target( storage_ ) = new D( std::forward<F>( f ) );
+        }
+
+    public:
+
+        SmallFunction() : ops_( nullptr )
+        {
+        }
+
+        SmallFunction( std::nullptr_t ) : ops_( nullptr )
+        {
+        }
+
+        template<typename F, typename D = typename std::decay<F>::type,
+            typename = typename std::enable_if<!std::is_same<D, SmallFunction>::value>::type,
+            typename = decltype( std::declval<D&>()( std::declval<Args>()... ) )>
+        SmallFunction( F &&f ) : ops_( nullptr )
+        {
+            if( isEmpty( f, 0 ) )
+                return;
+            store<D>( std::forward<F>( f ), std::integral_constant<bool, Placement<D>::fits>() );
+            ops_ = opsOf<D>();
+        }
+
+        SmallFunction( const SmallFunction &other ) : ops_( nullptr )
+        {
+            if( other.ops_ != nullptr )
+            {
+                other.ops_->copy( storage_, other.storage_ );
+                ops_ = other.ops_;
+            }
+        }
+
+        SmallFunction( SmallFunction &&other ) noexcept : ops_( other.ops_ )
+        {
+            if( ops_ != nullptr )
+            {
+                ops_->move( storage_, other.storage_ );
+                other.ops_ = nullptr;
+            }
+        }
+
+        ~SmallFunction()
+        {
+            reset();
+        }
+
+        SmallFunction& operator=( const SmallFunction &other )
+        {
+            if( this != &other )
+            {
+                SmallFunction copy( other );
+                *this = std::move( copy );
+            }
+            return *this;
+        }
+
+        SmallFunction& operator=( SmallFunction &&other ) noexcept
+        {
+            if( this != &other )
+            {
+                reset();
+                if( other.ops_ != nullptr )
+                {
+                    other.ops_->move( storage_, other.storage_ );
+                    ops_ = other.ops_;
+                    other.ops_ = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        SmallFunction& operator=( std::nullptr_t )
+        {
+            reset();
+            return *this;
+        }
+
+        explicit operator bool() const
+        {
+            return ops_ != nullptr;
+        }
+
+        // calling an empty wrapper is undefined, check it with operator bool
+        R operator()( Args... args ) const
+        {
+            return ops_->invoke( storage_, std::forward<Args>( args )... );
+        }
+
+        void reset()
+        {
+            if( ops_ != nullptr )
+            {
+                ops_->destroy( storage_ );
+                ops_ = nullptr;
+            }
+        }
+
+    private:
+        Storage storage_;
+        const Ops *ops_;
+    };
+}
+
+#endif /* defined(__libredisCluster__smallfunction__) */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __libredisCluster__stringref__
+#define __libredisCluster__stringref__
+
+#include <string>
+#include <string.h>
+
+namespace RedisCluster
+{
+    // Non-owning reference to a binary safe string. The referenced memory
+    // must stay valid while the reference is used
+    class StringRef
+    {
+    public:
+        StringRef() : data_( nullptr ), size_( 0 ) {}
+        StringRef( const char *data, size_t size ) : data_( data ), size_( size ) {}
+        StringRef( const char *str ) : data_( str ), size_( strlen( str ) ) {}
+        StringRef( const std::string &str ) : data_( str.data() ), size_( str.size() ) {}
+
+        inline const char* data() const { return data_; }
+        inline size_t size() const { return size_; }
+        inline bool empty() const { return size_ == 0; }
+
+        inline const char* begin() const { return data_; }
+        inline const char* end() const { return data_ + size_; }
+        inline char operator[]( size_t i ) const { return data_[i]; }
+
+        inline std::string str() const { return std::string( data_, size_ ); }
+
+        inline bool operator==( const StringRef &other ) const
+        {
+            return size_ == other.size_ && ( size_ == 0 || memcmp( data_, other.data_, size_ ) == 0 );
+        }
+        inline bool operator!=( const StringRef &other ) const
+        {
+            return !( *this == other );
+        }
+
+    private:
+        const char *data_;
+        size_t size_;
+    };
+}
+
+#endif /* defined(__libredisCluster__stringref__) */
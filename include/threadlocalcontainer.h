@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2015, Dmitrii Shinkevich <shinmail at gmail dot com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __libredisCluster__threadlocalcontainer__
+#define __libredisCluster__threadlocalcontainer__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "cluster.h"
+
+namespace RedisCluster {
+
+    // Thread affine container for redis connections. Every thread gets its own connection
+    // to every node, created lazily on the first command to that node and cached in thread
+    // local storage, so getting and releasing connections takes no locks. Connections are
+    // closed when their thread exits or when the container is destroyed (then connections of
+    // still running threads are closed too, so destroy the cluster only after threads stop
+    // using it). Disconnect doesn't touch connections of other threads, it makes every thread
+    // replace its connections on the next command to their nodes. Total number of connections of all threads can be limited with
+    // setMaxConnections, ConnectionLimitException is thrown when the limit is reached
+    //
+    //   typedef Cluster<redisContext, ThreadLocalContainer<redisContext> > ThreadedCluster;
+    //   ThreadedCluster::ptr_t cluster_p = HiredisCommand<ThreadedCluster>::createCluster( "127.0.0.1", 7000 );
+    //   cluster_p->container().setMaxConnections( 64 );
+    template<typename redisConnection>
+    class ThreadLocalContainer
+    {
+        typedef Cluster<redisConnection, ThreadLocalContainer> RCluster;
+        typedef typename RCluster::SlotRange SlotRange;
+        typedef typename RCluster::SlotIndex SlotIndex;
+        typedef typename RCluster::Host Host;
+        
+        // slot ranges of the cluster mapped to node indexes, filled once at cluster initialization
+        typedef std::map <SlotRange, size_t, typename RCluster::SlotComparator> ClusterNodes;
+        typedef std::map <Host, redisConnection*> RedirectConnections;
+        
+        struct Node
+        {
+            Host host;
+            int port;
+        };
+        
+        // connections of one thread for one container, with disconnect generations
+        // they were opened in
+        struct ThreadCache
+        {
+            ThreadCache() : redirectsGeneration( 0 ) {}
+            
+            std::vector<redisConnection*> nodes;
+            std::vector<unsigned> nodesGeneration;
+            RedirectConnections redirects;
+            unsigned redirectsGeneration;
+        };
+        
+        // state shared by the container and thread caches, it outlives the container
+        // while threads that used the container are running
+        struct Shared
+        {
+            Shared( typename RCluster::pt2RedisFreeFunc disconn ) :
+            disconnect_( disconn ),
+            alive( true ),
+            connections( 0 ),
+            maxConnections( 0 ),
+            generation( 0 )
+            {
+            }
+            
+            void close( ThreadCache &cache )
+            {
+                for( size_t i = 0; i < cache.nodes.size(); ++i )
+                {
+                    if( cache.nodes[i] != nullptr )
+                    {
+                        disconnect_( cache.nodes[i] );
+                        cache.nodes[i] = nullptr;
+                        --connections;
+                    }
+                }
+                closeRedirects( cache );
+            }
+            
+            void closeRedirects( ThreadCache &cache )
+            {
+                typename RedirectConnections::iterator it( cache.redirects.begin() ), end( cache.redirects.end() );
+                for( ; it != end; ++it )
+                {
+                    disconnect_( it->second );
+                    --connections;
+                }
+                cache.redirects.clear();
+            }
+            
+            typename RCluster::pt2RedisFreeFunc disconnect_;
+            // protects caches set and closing connections of other threads, which happens
+            // only when a thread exits or the container is destroyed
+            std::mutex lock;
+            std::set<ThreadCache*> caches;
+            std::atomic<bool> alive;
+            std::atomic<size_t> connections;
+            std::atomic<size_t> maxConnections;
+            // incremented by disconnect, connections opened before are replaced by their threads
+            std::atomic<unsigned> generation;
+        };
+        
+        // caches of all containers used by the current thread, connections are returned
+        // when the thread exits
+        struct ThreadCaches
+        {
+            typedef std::pair< std::shared_ptr<Shared>, ThreadCache* > Entry;
+            
+            ~ThreadCaches()
+            {
+                for( size_t i = 0; i < entries.size(); ++i )
+                    release( entries[i] );
+            }
+            
+            static void release( Entry &entry )
+            {
+                {
+                    std::lock_guard<std::mutex> locker( entry.first->lock );
+                    if( entry.first->alive )
+                    {
+                        entry.first->close( *entry.second );
+                        entry.first->caches.erase( entry.second );
+                    }
+                }
+                delete entry.second;
+            }
+            
+            std::vector<Entry> entries;
+        };
+        
+    public:
+        
+        ThreadLocalContainer( typename RCluster::pt2RedisConnectFunc conn,
+                             typename RCluster::pt2RedisFreeFunc disconn,
+                             void* userData ) :
+        data_( userData ),
+        connect_( conn ),
+        shared_( std::make_shared<Shared>( disconn ) )
+        {
+        }
+        
+        ~ThreadLocalContainer()
+        {
+            std::lock_guard<std::mutex> locker( shared_->lock );
+            closeAll();
+            shared_->caches.clear();
+            shared_->alive = false;
+        }
+        
+        // limit of connections opened by all threads, 0 means no limit
+        inline void setMaxConnections( size_t max )
+        {
+            shared_->maxConnections = max;
+        }
+        
+        inline size_t connections() const
+        {
+            return shared_->connections;
+        }
+        
+        // nodes are registered while the cluster is initialized, the connection of
+        // the initializing thread is opened here to make sure that the node is available
+        inline
+        void insert( typename RCluster::SlotRange slots, const char* host, int port )
+        {
+            Node node = { host, port };
+            size_t index = addresses_.size();
+            addresses_.push_back( node );
+            nodes_.insert( typename ClusterNodes::value_type( slots, index ) );
+            
+            ThreadCache &cache = localCache();
+            if( cache.nodes.size() <= index )
+                resize( cache, index + 1 );
+            cache.nodes[index] = open( host, port );
+            cache.nodesGeneration[index] = shared_->generation;
+        }
+        
+        inline
+        typename RCluster::HostConnection insert( string host, string port )
+        {
+            string key( host + ":" + port );
+            ThreadCache &cache = localCache();
+            
+            // redirection connections are held by one command at a time, so all of them
+            // can be replaced after disconnect
+            unsigned generation = shared_->generation;
+            if( cache.redirectsGeneration != generation )
+            {
+                shared_->closeRedirects( cache );
+                cache.redirectsGeneration = generation;
+            }
+            
+            typename RedirectConnections::iterator found = cache.redirects.find( key );
+            if( found != cache.redirects.end() )
+            {
+                if( found->second->err == 0 )
+                    return typename RCluster::HostConnection( key, found->second );
+                
+                shared_->disconnect_( found->second );
+                --shared_->connections;
+                cache.redirects.erase( found );
+            }
+            
+            typename RCluster::HostConnection conn( key, open( host.c_str(), std::stoi( port ) ) );
+            cache.redirects.insert( conn );
+            return conn;
+        }
+        
+        inline
+        typename RCluster::SlotConnection getConnection( SlotIndex index )
+        {
+            typename ClusterNodes::iterator node = DefaultContainer<redisConnection>::searchBySlots( index, nodes_ );
+            ThreadCache &cache = localCache();
+            
+            size_t nodeIndex = node->second;
+            if( cache.nodes.size() <= nodeIndex )
+                resize( cache, addresses_.size() );
+            
+            redisConnection *&con = cache.nodes[nodeIndex];
+            unsigned generation = shared_->generation;
+            if( con == nullptr || con->err || cache.nodesGeneration[nodeIndex] != generation )
+            {
+                // broken connections and connections opened before disconnect are replaced
+                // when the thread needs the node next time
+                if( con != nullptr )
+                {
+                    shared_->disconnect_( con );
+                    --shared_->connections;
+                    con = nullptr;
+                }
+                con = open( addresses_[nodeIndex].host.c_str(), addresses_[nodeIndex].port );
+                cache.nodesGeneration[nodeIndex] = generation;
+            }
+            return typename RCluster::SlotConnection( node->first, con );
+        }
+        
+        // connections stay with the thread, so releasing is not needed
+        inline void releaseConnection( typename RCluster::SlotConnection ) {}
+        inline void releaseConnection( typename RCluster::HostConnection ) {}
+        
+        // forgets connection of the current thread that is freed by the caller
+        void deleteConnection( const redisConnection* con )
+        {
+            ThreadCache &cache = localCache();
+            for( size_t i = 0; i < cache.nodes.size(); ++i )
+            {
+                if( cache.nodes[i] == con )
+                {
+                    cache.nodes[i] = nullptr;
+                    --shared_->connections;
+                }
+            }
+            for( typename RedirectConnections::iterator it = cache.redirects.begin(); it != cache.redirects.end(); )
+            {
+                if( it->second == con )
+                {
+                    it = cache.redirects.erase( it );
+                    --shared_->connections;
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        
+        // connections of all threads are closed and opened again by their threads on the next
+        // command to their nodes, so disconnect may be called while other threads send commands
+        inline
+        void disconnect()
+        {
+            ++shared_->generation;
+        }
+        
+        void* data_;
+    private:
+        
+        static void resize( ThreadCache &cache, size_t size )
+        {
+            cache.nodes.resize( size, nullptr );
+            cache.nodesGeneration.resize( size, 0 );
+        }
+        
+        void closeAll()
+        {
+            typename std::set<ThreadCache*>::iterator it( shared_->caches.begin() ), end( shared_->caches.end() );
+            for( ; it != end; ++it )
+                shared_->close( **it );
+        }
+        
+        redisConnection* open( const char* host, int port )
+        {
+            size_t max = shared_->maxConnections;
+            if( shared_->connections.fetch_add( 1 ) >= max && max != 0 )
+            {
+                --shared_->connections;
+                throw ConnectionLimitException();
+            }
+            
+            redisConnection* conn = connect_( host, port, data_ );
+            if( conn == NULL || conn->err )
+            {
+                if( conn != NULL )
+                    shared_->disconnect_( conn );
+                --shared_->connections;
+                throw ConnectionFailedException(nullptr);
+            }
+            return conn;
+        }
+        
+        static ThreadCaches& threadCaches()
+        {
+            static thread_local ThreadCaches caches;
+            return caches;
+        }
+        
+        // cache of the current thread, threads usually work with one or a few clusters
+        // so linear search is the fastest here
+        inline ThreadCache& localCache()
+        {
+            ThreadCaches &local = threadCaches();
+            for( size_t i = 0; i < local.entries.size(); ++i )
+            {
+                if( local.entries[i].first.get() == shared_.get() )
+                    return *local.entries[i].second;
+            }
+            return registerCache( local );
+        }
+        
+        ThreadCache& registerCache( ThreadCaches &local )
+        {
+            // drop caches of destroyed containers
+            for( size_t i = 0; i < local.entries.size(); )
+            {
+                if( !local.entries[i].first->alive )
+                {
+                    ThreadCaches::release( local.entries[i] );
+                    local.entries.erase( local.entries.begin() + i );
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+            
+            std::unique_ptr<ThreadCache> cache( new ThreadCache() );
+            resize( *cache, addresses_.size() );
+            cache->redirectsGeneration = shared_->generation;
+            local.entries.reserve( local.entries.size() + 1 );
+            {
+                std::lock_guard<std::mutex> locker( shared_->lock );
+                shared_->caches.insert( cache.get() );
+            }
+            local.entries.push_back( typename ThreadCaches::Entry( shared_, cache.get() ) );
+            return *cache.release();
+        }
+        
+        typename RCluster::pt2RedisConnectFunc connect_;
+        std::shared_ptr<Shared> shared_;
+        std::vector<Node> addresses_;
+        ClusterNodes nodes_;
+    };
+    
+}
+
+#endif /* defined(__libredisCluster__threadlocalcontainer__) */
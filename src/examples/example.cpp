@@ -11,6 +11,15 @@ using std::cout;
 using std::cerr;
 using std::endl;
 
+// counts bytes of a streamed reply without keeping it in memory
+class ByteCounter : public ReplyVisitor
+{
+public:
+    ByteCounter() : bytes( 0 ) {}
+    void onBulkChunk( const StringRef &chunk ) { bytes += chunk.size(); }
+    size_t bytes;
+};
+
 void processClusterCommand()
 {
     Cluster<redisContext>::ptr_t cluster_p;
@@ -24,6 +33,64 @@ void processClusterCommand()
         cout << " Reply to SET FOO BAR " << endl;
         cout << reply->str << endl;
     }
+    
+    // typed command builder writes RESP without format string parsing,
+    // its buffer is reused by next commands
+    RespCommand cmd;
+    reply = HiredisCommand<>::AltCommand( cluster_p, "FOO", cmd.format( "EXPIRE", "FOO", 60 ) );
+    cout << " Reply to EXPIRE FOO 60 " << reply->integer << endl;
+    
+    // prepared command encodes constant arguments once
+    PreparedCommand incrby( "INCRBY" );
+    for( int i = 0; i < 3; ++i )
+    {
+        reply = HiredisCommand<>::AltCommand( cluster_p, "COUNTER", incrby.format( "COUNTER", i ) );
+        cout << " Reply to INCRBY COUNTER " << i << " " << reply->integer << endl;
+    }
+    
+    // large value is written to the socket from its own memory, only RESP headers are formatted
+    string blob( 1024 * 1024, 'x' );
+    ScatterCommand scatter;
+    redisReply *blobReply = static_cast<redisReply*>( HiredisCommand<>::Command( cluster_p, "BLOB", scatter.format( "SET", "BLOB", StringRef( blob ) ) ) );
+    cout << " Reply to SET BLOB " << blobReply->str << endl;
+    freeReplyObject( blobReply );
+    
+    // big reply is passed to the visitor as it is read from the socket
+    ByteCounter counter;
+    HiredisCommand<>::Command( cluster_p, "BLOB", cmd.format( "GET", "BLOB" ), counter );
+    cout << " GET BLOB read " << counter.bytes << " bytes" << endl;
+    
+    // replies are decoded to typed values without copying strings into intermediate objects
+    reply = HiredisCommand<>::AltCommand( cluster_p, "COUNTER", cmd.format( "GET", "COUNTER" ) );
+    long long counterValue = 0;
+    if( decode( *reply, counterValue ) )
+        cout << " COUNTER is " << counterValue << endl;
+    
+    // list is streamed directly into the vector, no reply objects are created
+    std::vector<string> list;
+    DecodingVisitor< std::vector<string> > listDecoder( list );
+    HiredisCommand<>::Command( cluster_p, "LIST", cmd.format( "LRANGE", "LIST", 0, -1 ), listDecoder );
+    if( listDecoder.ok() )
+        cout << " LIST has " << list.size() << " elements" << endl;
+    
+    // the whole command including redirections must complete in 100 milliseconds,
+    // otherwise TimeoutException is thrown
+    try
+    {
+        reply = HiredisCommand<>::AltCommand( cluster_p, "FOO", Deadline( std::chrono::milliseconds( 100 ) ), "GET %s", "FOO" );
+        cout << " Reply to GET FOO " << reply->str << endl;
+    }
+    catch( const TimeoutException &e )
+    {
+        cout << " GET FOO timed out" << endl;
+    }
+    
+    // non-throwing version returns cluster errors as error codes
+    Result<Reply> result = HiredisCommand<>::TryAltCommand( cluster_p, "FOO", cmd.format( "GET", "FOO" ) );
+    if( result )
+        cout << " Reply to GET FOO " << result.value()->str << endl;
+    else
+        cout << " GET FOO failed: " << errorMessage( result.error() ) << endl;
     delete cluster_p;
 }
 
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <vector>
+
+#include "multikeycommand.h"
+
+using namespace RedisCluster;
+using std::string;
+using std::vector;
+using std::pair;
+using std::cout;
+using std::endl;
+
+// Example of multi-key commands with keys in different slots
+// Keys are split by slot, sub-commands are sent to all involved nodes at once
+// and replies are merged back in the order of the keys
+
+void processMultiKeyCommand()
+{
+    Cluster<redisContext>::ptr_t cluster_p;
+
+    cluster_p = HiredisCommand<>::createCluster( "127.0.0.1", 7000 );
+
+    vector< pair<string, string> > keyValues;
+    keyValues.push_back( pair<string, string>( "FOO1", "BAR1" ) );
+    keyValues.push_back( pair<string, string>( "FOO2", "BAR2" ) );
+    keyValues.push_back( pair<string, string>( "FOO3", "BAR3" ) );
+
+    Reply reply = MultiKeyCommand<>::MSet( cluster_p, keyValues );
+    cout << " Reply to MSET " << reply->str << endl;
+
+    vector<string> keys;
+    keys.push_back( "FOO1" );
+    keys.push_back( "FOO2" );
+    keys.push_back( "FOO3" );
+    keys.push_back( "NOT_EXISTING" );
+
+    reply = MultiKeyCommand<>::MGet( cluster_p, keys );
+    for( size_t i = 0; i < reply->elements; ++i )
+    {
+        redisReply *value = reply->element[i];
+        cout << keys[i] << " = " << ( value->type == REDIS_REPLY_STRING ? value->str : "(nil)" ) << endl;
+    }
+
+    reply = MultiKeyCommand<>::Del( cluster_p, keys );
+    cout << " Deleted keys " << reply->integer << endl;
+
+    delete cluster_p;
+}
+
+int main(int argc, const char * argv[])
+{
+    try
+    {
+        processMultiKeyCommand();
+    } catch ( const RedisCluster::ClusterException &e )
+    {
+        cout << "Cluster exception: " << e.what() << endl;
+    }
+    return 0;
+}
@@ -5,6 +5,8 @@
 #include <assert.h>
 
 #include "hirediscommand.h"
+#include "threadlocalcontainer.h"
+#include "autopipeline.h"
 
 using namespace RedisCluster;
 using std::string;
@@ -24,6 +26,8 @@ using std::endl;
  * The benefits of not including such class into library is that you can copy and paste threadedpool
  * or modify class without any restrictions on copyrights!
  * This demonstrates maximum flexibility of library that other libraries doesn't have at this moment
+ * For production use the library has PoolContainer (include/poolcontainer.h) with the same idea
+ * but without global lock, with bounded waiting and pool counters
  *
  * If ThreadedPool is too complicated to understand then just copy and paste this class to begin
  *
@@ -262,11 +266,95 @@ void processCommandPool()
     delete cluster_p;
 }
 
+/*
+ * The library also has ThreadLocalContainer, where every thread has own connections
+ * to the nodes it uses, so commands of different threads don't wait for each other
+ *
+ */
+typedef Cluster<redisContext, ThreadLocalContainer<redisContext> > ThreadLocalCluster;
+
+void commandThreadLocal( ThreadLocalCluster::ptr_t cluster_p )
+{
+    redisReply * reply;
+    for( int i = 0; i < 100; ++i )
+    {
+        reply = static_cast<redisReply*>( HiredisCommand<ThreadLocalCluster>::Command( cluster_p, "FOO", "SET %s %s", "FOO", "BAR1" ) );
+        assert( reply->type == REDIS_REPLY_STATUS && string(reply->str) == "OK" );
+        freeReplyObject( reply );
+    }
+    // connections of this thread are closed when the thread exits
+}
+
+void processCommandThreadLocal()
+{
+    const int threadsNum = 16;
+    
+    ThreadLocalCluster::ptr_t cluster_p;
+    cluster_p = HiredisCommand<ThreadLocalCluster>::createCluster( "127.0.0.1", 7000 );
+    // limit connections of all threads
+    cluster_p->container().setMaxConnections( 256 );
+    
+    std::thread thr[threadsNum];
+    for( int i = 0; i < threadsNum; ++i )
+    {
+        thr[i] = std::thread( commandThreadLocal, cluster_p );
+    }
+    
+    for( int i = 0; i < threadsNum; ++i )
+    {
+        thr[i].join();
+    }
+    
+    cout << "connections left: " << cluster_p->container().connections() << endl;
+    delete cluster_p;
+}
+
+/*
+ * AutoPipeline shares one connection per node between all threads, commands of
+ * threads waiting at the same time are written to the node together
+ *
+ */
+void commandThreadPipelined( AutoPipeline<> *pipeline )
+{
+    for( int i = 0; i < 100; ++i )
+    {
+        redisReply *reply = static_cast<redisReply*>( pipeline->Command( "FOO", "SET %s %s", "FOO", "BAR1" ) );
+        assert( reply->type == REDIS_REPLY_STATUS && string(reply->str) == "OK" );
+        freeReplyObject( reply );
+    }
+}
+
+void processCommandPipelined()
+{
+    const int threadsNum = 16;
+    
+    Cluster<redisContext>::ptr_t cluster_p = HiredisCommand<>::createCluster( "127.0.0.1", 7000 );
+    {
+        AutoPipeline<> pipeline( cluster_p );
+        
+        std::thread thr[threadsNum];
+        for( int i = 0; i < threadsNum; ++i )
+        {
+            thr[i] = std::thread( commandThreadPipelined, &pipeline );
+        }
+        
+        for( int i = 0; i < threadsNum; ++i )
+        {
+            thr[i].join();
+        }
+        
+        cout << pipeline.commands() << " commands sent in " << pipeline.writes() << " writes" << endl;
+    }
+    delete cluster_p;
+}
+
 int main(int argc, const char * argv[])
 {
     try
     {
         processCommandPool();
+        processCommandThreadLocal();
+        processCommandPipelined();
     } catch ( const RedisCluster::ClusterException &e )
     {
         cout << "Cluster exception: " << e.what() << endl;
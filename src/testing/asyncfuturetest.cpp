@@ -0,0 +1,170 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asynccommandqueue.h"
+#include "adapters/libeventadapter.h"
+#include "fakenode.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Multi-threaded test of AsyncFuture groups: worker threads send commands through the queue
+// of a loop running against an in-process cluster and join their futures with whenAll. Futures
+// and groups are dropped before, during and after completion in turn, so the shared states are
+// freed by the loop or by the workers, whichever is the last
+
+typedef Cluster<redisAsyncContext>::ptr_t ClusterPtr;
+typedef AsyncCommandQueue<> CommandQueue;
+
+static const size_t nodes = 3;
+
+static void checkReply( const AsyncFuture &future, const string &expected )
+{
+    const redisReply *reply = future.get();
+    assert( reply != nullptr && reply->type == REDIS_REPLY_STRING );
+    assert( string( reply->str, reply->len ) == expected );
+}
+
+static string keyOf( int thread, int round, int command )
+{
+    return "future" + to_string( thread ) + ":" + to_string( round ) + ":" + to_string( command );
+}
+
+// futures of ECHO commands, the replies are the keys
+static vector<AsyncFuture> send( CommandQueue &commands, int thread, int round, int count )
+{
+    RespCommand cmd;
+    vector<AsyncFuture> futures;
+    for( int i = 0; i < count; ++i )
+    {
+        string key = keyOf( thread, round, i );
+        futures.push_back( commands.FutureCommand( key, cmd.format( "ECHO", key ) ) );
+    }
+    return futures;
+}
+
+static void worker( CommandQueue &commands, int thread, int rounds, int count )
+{
+    for( int round = 0; round < rounds; ++round )
+    {
+        vector<AsyncFuture> futures = send( commands, thread, round, count );
+        switch( round % 5 )
+        {
+        case 0:
+        {
+            // the group is ready after every future
+            AsyncFuture all = AsyncFuture::whenAll( futures );
+            all.wait();
+            assert( all.ready() && all.get() == nullptr );
+            for( int i = 0; i < count; ++i )
+            {
+                assert( futures[i].ready() );
+                checkReply( futures[i], keyOf( thread, round, i ) );
+            }
+            break;
+        }
+        case 1:
+        {
+            // futures dropped while the group waits for them
+            AsyncFuture all = AsyncFuture::whenAll( futures );
+            futures.clear();
+            assert( all.waitFor( chrono::milliseconds( 5000 ) ) );
+            break;
+        }
+        case 2:
+        {
+            // group dropped at once, the futures are still completed
+            AsyncFuture::whenAll( futures );
+            for( int i = 0; i < count; ++i )
+                checkReply( futures[i], keyOf( thread, round, i ) );
+            break;
+        }
+        case 3:
+        {
+            // some futures are ready before the group is made
+            for( int i = 0; i < count / 2; ++i )
+                futures[i].wait();
+            futures.push_back( AsyncFuture() );
+            AsyncFuture all = AsyncFuture::whenAll( futures );
+            checkReply( futures[count - 1], keyOf( thread, round, count - 1 ) );
+            all.wait();
+            break;
+        }
+        default:
+        {
+            // everything dropped without waiting
+            AsyncFuture all = AsyncFuture::whenAll( futures );
+            break;
+        }
+        }
+    }
+}
+
+static void checkGroups( int threads, int rounds, int count )
+{
+    FakeRedisCluster fake( nodes );
+    event_base *base = event_base_new();
+    LibeventAdapter adapter( *base );
+    ClusterPtr cluster_p = AsyncHiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ), adapter );
+    CommandQueue *commands = new CommandQueue( cluster_p, adapter );
+    thread loop( [base] { event_base_dispatch( base ); } );
+
+    vector<thread> workers;
+    for( int i = 0; i < threads; ++i )
+        workers.push_back( thread( worker, ref( *commands ), i, rounds, count ) );
+    for( size_t i = 0; i < workers.size(); ++i )
+        workers[i].join();
+
+    // a future is in one group only, a group of no futures is ready at once
+    {
+        vector<AsyncFuture> futures = send( *commands, threads, 0, 2 );
+        AsyncFuture all = AsyncFuture::whenAll( futures );
+        bool thrown = false;
+        try
+        {
+            AsyncFuture::whenAll( futures );
+        }
+        catch( const LogicError& )
+        {
+            thrown = true;
+        }
+        assert( thrown );
+        all.wait();
+        assert( AsyncFuture::whenAll( vector<AsyncFuture>() ).ready() );
+    }
+
+    // the loop is stopped, futures of the commands left in the queue get errors
+    commands->post( [commands, base]( ClusterPtr )
+    {
+        commands->close();
+        event_base_loopbreak( base );
+    } );
+    loop.join();
+    vector<AsyncFuture> futures = send( *commands, threads, 1, 10 );
+    AsyncFuture all = AsyncFuture::whenAll( futures );
+    assert( !all.ready() );
+    commands->drain();
+    assert( all.ready() );
+    for( size_t i = 0; i < futures.size(); ++i )
+        assert( futures[i].get() == nullptr && futures[i].error() == DISCONNECTED );
+
+    delete commands;
+    delete cluster_p;
+    event_base_free( base );
+}
+
+int main( int argc, const char * argv[] )
+{
+    int threads = argc > 1 ? atoi( argv[1] ) : 8;
+    int rounds = argc > 2 ? atoi( argv[2] ) : 200;
+
+    checkGroups( threads, rounds, 20 );
+
+    cout << "future groups are ok" << endl;
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "asyncmultikeycommand.h"
+#include "adapters/libeventadapter.h"
+#include "fakenode.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Checks the merged replies of AsyncMultiKeyCommand against an in-process cluster: values
+// in the order of input keys, sums of counting commands, keys of moved slots and
+// sub-commands failed without a reply
+
+typedef Cluster<redisAsyncContext>::ptr_t ClusterPtr;
+typedef AsyncMultiKeyCommand<> MultiKey;
+
+static const size_t nodes = 3;
+
+// runs the loop until the condition is true, false on timeout
+static bool runUntil( event_base &base, const function<bool ()> &done, int milliseconds = 5000 )
+{
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds( milliseconds );
+    while( !done() )
+    {
+        if( chrono::steady_clock::now() > deadline )
+            return false;
+        event_base_loop( &base, EVLOOP_ONCE | EVLOOP_NONBLOCK );
+    }
+    return true;
+}
+
+static string valueOf( const string &key, int round )
+{
+    return "value of " + key + " in round " + to_string( round );
+}
+
+// keys in many slots, keys with the same hash tag and a repeated key
+static vector<string> makeKeys( int count )
+{
+    vector<string> keys;
+    for( int i = 0; i < count; ++i )
+        keys.push_back( "key" + to_string( rand() ) + ":" + to_string( i ) );
+    keys.push_back( "{tag}a" );
+    keys.push_back( "{tag}b" );
+    keys.push_back( "{tag}c" );
+    keys.push_back( keys[0] );
+    return keys;
+}
+
+static long long sum( event_base &base, ClusterPtr cluster_p,
+                     ErrorCode (*command)( ClusterPtr, const vector<string>&, const MultiKey::Callback& ),
+                     const vector<string> &keys )
+{
+    long long result = -1;
+    bool done = false;
+    ErrorCode code = command( cluster_p, keys, [&]( const redisReply &reply )
+    {
+        assert( reply.type == REDIS_REPLY_INTEGER );
+        result = reply.integer;
+        done = true;
+    } );
+    assert( code == SUCCESS );
+    assert( runUntil( base, [&] { return done; } ) );
+    return result;
+}
+
+// MSET of every second key, then MGET of all keys gives values and nils in their places
+static void checkRound( event_base &base, ClusterPtr cluster_p, const vector<string> &keys, int round )
+{
+    // the repeated key is the last one and is set with the first one
+    size_t distinct = keys.size() - 1;
+    size_t set = 0;
+    {
+        vector< pair<string, string> > keyValues;
+        for( size_t i = 0; i < distinct; i += 2 )
+        {
+            keyValues.push_back( make_pair( keys[i], valueOf( keys[i], round ) ) );
+            ++set;
+        }
+        bool done = false;
+        ErrorCode code = MultiKey::MSet( cluster_p, keyValues, [&]( const redisReply &reply )
+        {
+            assert( reply.type == REDIS_REPLY_STATUS && string( reply.str ) == "OK" );
+            done = true;
+        } );
+        assert( code == SUCCESS );
+        // the arguments are copied into the sub-commands
+        keyValues.clear();
+        assert( runUntil( base, [&] { return done; } ) );
+    }
+
+    bool done = false;
+    ErrorCode code = MultiKey::MGet( cluster_p, keys, [&]( const redisReply &reply )
+    {
+        assert( reply.type == REDIS_REPLY_ARRAY && reply.elements == keys.size() );
+        for( size_t i = 0; i < keys.size(); ++i )
+        {
+            const redisReply *element = reply.element[i];
+            if( i % 2 == 0 || i == distinct )
+                assert( element->type == REDIS_REPLY_STRING && string( element->str, element->len ) == valueOf( keys[i], round ) );
+            else
+                assert( element->type == REDIS_REPLY_NIL );
+        }
+        done = true;
+    } );
+    assert( code == SUCCESS );
+    assert( runUntil( base, [&] { return done; } ) );
+
+    // sums over slots, the repeated key is counted twice
+    assert( sum( base, cluster_p, &MultiKey::Exists, keys ) == (long long)set + 1 );
+    assert( sum( base, cluster_p, &MultiKey::Del, keys ) == (long long)set );
+    assert( sum( base, cluster_p, &MultiKey::Exists, keys ) == 0 );
+    assert( sum( base, cluster_p, &MultiKey::Unlink, keys ) == 0 );
+}
+
+static size_t commands( FakeRedisCluster &fake )
+{
+    size_t count = 0;
+    for( size_t i = 0; i < nodes; ++i )
+        count += fake.commands( i );
+    return count;
+}
+
+static void checkMerge( int count )
+{
+    FakeRedisCluster fake( nodes );
+    event_base *base = event_base_new();
+    LibeventAdapter adapter( *base );
+    ClusterPtr cluster_p = AsyncHiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ), adapter );
+    vector<string> keys = makeKeys( count );
+
+    // keys are grouped by slot, commands send one sub-command per slot, MSET has every second key
+    set<unsigned> slots, setSlots;
+    for( size_t i = 0; i < keys.size(); ++i )
+    {
+        unsigned slot = SlotHash::SlotByKey( keys[i].c_str(), (int)keys[i].size() );
+        slots.insert( slot );
+        if( i % 2 == 0 && i + 1 < keys.size() )
+            setSlots.insert( slot );
+    }
+    size_t before = commands( fake );
+    checkRound( *base, cluster_p, keys, 0 );
+    assert( commands( fake ) - before == setSlots.size() + 5 * slots.size() );
+
+    // every third key is served by another node, its sub-command is redirected
+    size_t redirections = cluster_p->container().redirections();
+    for( size_t i = 0; i < keys.size(); i += 3 )
+    {
+        unsigned slot = SlotHash::SlotByKey( keys[i].c_str(), (int)keys[i].size() );
+        fake.move( slot, ( slot * nodes / 16384 + 1 ) % nodes );
+    }
+    checkRound( *base, cluster_p, keys, 1 );
+    assert( cluster_p->container().redirections() > redirections );
+
+    // invalid arguments are refused without the callback
+    vector<string> none;
+    assert( MultiKey::MGet( cluster_p, none, []( const redisReply& ) { abort(); } ) == INVALID_ARGUMENT );
+    vector< pair<string, string> > noValues;
+    assert( MultiKey::MSet( cluster_p, noValues, []( const redisReply& ) { abort(); } ) == INVALID_ARGUMENT );
+    assert( MultiKey::Del( nullptr, keys, []( const redisReply& ) { abort(); } ) == INVALID_ARGUMENT );
+
+    delete cluster_p;
+    event_base_free( base );
+}
+
+// sub-commands finished without a reply make an error reply
+static void checkDisconnected( int count )
+{
+    event_base *base = event_base_new();
+    LibeventAdapter adapter( *base );
+    ClusterPtr cluster_p = nullptr;
+    vector<string> keys = makeKeys( count );
+    bool done = false;
+    string error;
+    {
+        FakeRedisCluster fake( nodes );
+        cluster_p = AsyncHiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ), adapter );
+        AsyncHiredisCommand<>::setReconnectPolicy( cluster_p, ReconnectPolicy::disabled() );
+        ErrorCode code = MultiKey::MGet( cluster_p, keys, [&]( const redisReply &reply )
+        {
+            assert( reply.type == REDIS_REPLY_ERROR );
+            error.assign( reply.str, reply.len );
+            done = true;
+        } );
+        assert( code == SUCCESS );
+    }
+    // nodes are gone before the commands are written
+    assert( runUntil( *base, [&] { return done; } ) );
+    assert( !error.empty() );
+    delete cluster_p;
+    event_base_free( base );
+}
+
+int main( int argc, const char * argv[] )
+{
+    srand( argc > 1 ? atoi( argv[1] ) : 1 );
+    int count = argc > 2 ? atoi( argv[2] ) : 200;
+
+    checkMerge( count );
+    checkDisconnected( count );
+
+    cout << "async multi-key commands are ok" << endl;
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hirediscommand.h"
+#include "autopipeline.h"
+#include "fakenode.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Multi-threaded test of AutoPipeline against an in-process cluster: threads sharing
+// connections get replies to their own commands while the I/O is handed from thread
+// to thread, redirected commands are answered, and commands fail and recover when
+// nodes drop their connections
+
+static const size_t nodes = 3;
+
+static string valueOf( const string &key, int version )
+{
+    return key + "=" + to_string( version );
+}
+
+// SET and GET of the key through the pipeline, false if a connection failed
+static bool setAndGet( AutoPipeline<> &pipeline, const string &key, int version )
+{
+    string value = valueOf( key, version );
+    try
+    {
+        redisReply *reply = static_cast<redisReply*>( pipeline.Command( key, "SET %s %s", key.c_str(), value.c_str() ) );
+        assert( reply->type == REDIS_REPLY_STATUS && string( "OK" ) == reply->str );
+        freeReplyObject( reply );
+
+        reply = static_cast<redisReply*>( pipeline.Command( key, "GET %s", key.c_str() ) );
+        assert( reply->type == REDIS_REPLY_STRING && value == reply->str );
+        freeReplyObject( reply );
+    }
+    catch( const DisconnectedException& )
+    {
+        return false;
+    }
+    return true;
+}
+
+static void checkHandOff( FakeRedisCluster &fake, int threads, int commands )
+{
+    Cluster<redisContext>::ptr_t cluster_p = HiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ) );
+    size_t reads = 0;
+    for( size_t i = 0; i < nodes; ++i )
+        reads += fake.reads( i );
+
+    {
+        AutoPipeline<> pipeline( cluster_p );
+        vector<thread> workers;
+        for( int i = 0; i < threads; ++i )
+        {
+            workers.push_back( thread( [&, i]
+            {
+                for( int k = 0; k < commands; ++k )
+                    assert( setAndGet( pipeline, "handoff" + to_string( i ) + ":" + to_string( k % 10 ), k ) );
+            } ) );
+        }
+        for( size_t i = 0; i < workers.size(); ++i )
+            workers[i].join();
+
+        size_t total = size_t( threads ) * commands * 2;
+        assert( pipeline.commands() == total );
+        // concurrent commands share writes
+        assert( pipeline.writes() < total );
+
+        size_t readsNow = 0;
+        for( size_t i = 0; i < nodes; ++i )
+            readsNow += fake.reads( i );
+        cout << total << " commands in " << pipeline.writes() << " writes, "
+             << readsNow - reads << " reads by nodes" << endl;
+    }
+    delete cluster_p;
+}
+
+// keys of moved slots are redirected over separate connections
+static void checkRedirects( FakeRedisCluster &fake, int threads, int commands )
+{
+    Cluster<redisContext>::ptr_t cluster_p = HiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ) );
+    vector<string> moved;
+    for( int i = 0; i < threads; ++i )
+    {
+        string key = "moved" + to_string( i );
+        unsigned slot = SlotHash::SlotByKey( key.c_str(), key.size() );
+        fake.move( slot, ( slot * nodes / 16384 + 1 ) % nodes );
+        moved.push_back( key );
+    }
+
+    {
+        AutoPipeline<> pipeline( cluster_p );
+        vector<thread> workers;
+        for( int i = 0; i < threads; ++i )
+        {
+            workers.push_back( thread( [&, i]
+            {
+                for( int k = 0; k < commands; ++k )
+                {
+                    assert( setAndGet( pipeline, moved[i], k ) );
+                    assert( setAndGet( pipeline, "stays" + to_string( i ), k ) );
+                }
+            } ) );
+        }
+        for( size_t i = 0; i < workers.size(); ++i )
+            workers[i].join();
+    }
+    delete cluster_p;
+
+    for( size_t i = 0; i < moved.size(); ++i )
+    {
+        unsigned slot = SlotHash::SlotByKey( moved[i].c_str(), moved[i].size() );
+        fake.move( slot, slot * nodes / 16384 );
+    }
+}
+
+// commands fail while nodes drop connections and succeed on new connections afterwards
+static void checkDroppedConnections( FakeRedisCluster &fake, int threads, int drops )
+{
+    Cluster<redisContext>::ptr_t cluster_p = HiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ) );
+    {
+        AutoPipeline<> pipeline( cluster_p );
+        atomic<bool> stop( false );
+        atomic<long> succeeded( 0 ), failed( 0 );
+        vector<thread> workers;
+        for( int i = 0; i < threads; ++i )
+        {
+            workers.push_back( thread( [&, i]
+            {
+                for( int k = 0; !stop; ++k )
+                {
+                    if( setAndGet( pipeline, "drop" + to_string( i ) + ":" + to_string( k % 10 ), k ) )
+                        ++succeeded;
+                    else
+                        ++failed;
+                }
+            } ) );
+        }
+        for( int i = 0; i < drops; ++i )
+        {
+            this_thread::sleep_for( chrono::milliseconds( 2 ) );
+            fake.dropClients( i % nodes );
+        }
+        stop = true;
+        for( size_t i = 0; i < workers.size(); ++i )
+            workers[i].join();
+
+        // every node is available again
+        for( int i = 0; i < 100; ++i )
+            assert( setAndGet( pipeline, "after" + to_string( i ), i ) );
+        cout << succeeded << " commands succeeded and " << failed << " failed during "
+             << drops << " drops" << endl;
+    }
+    delete cluster_p;
+}
+
+int main( int argc, const char * argv[] )
+{
+    int threads = argc > 1 ? atoi( argv[1] ) : 16;
+    int commands = argc > 2 ? atoi( argv[2] ) : 2000;
+
+    FakeRedisCluster fake( nodes );
+    checkHandOff( fake, threads, commands );
+    checkRedirects( fake, threads, commands / 10 );
+    checkDroppedConnections( fake, threads, 30 );
+
+    cout << "auto pipeline is ok" << endl;
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "blockpool.h"
+#include "smallfunction.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Tests of BlockPool with blocks freed by other threads and after the free list of
+// the thread is destroyed, and of SmallFunction copies, moves and cross-thread calls
+
+typedef BlockPool<64, 8> Pool;
+
+// blocks and functions passed from producer threads to consumer threads
+template<typename T>
+class Channel
+{
+public:
+    Channel() : closed_( false ) {}
+
+    void push( T value )
+    {
+        lock_guard<mutex> locker( lock_ );
+        queue_.push_back( std::move( value ) );
+        cv_.notify_one();
+    }
+
+    bool pop( T &value )
+    {
+        unique_lock<mutex> locker( lock_ );
+        cv_.wait( locker, [this] { return !queue_.empty() || closed_; } );
+        if( queue_.empty() )
+            return false;
+        value = std::move( queue_.front() );
+        queue_.pop_front();
+        return true;
+    }
+
+    void close()
+    {
+        lock_guard<mutex> locker( lock_ );
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+private:
+    mutex lock_;
+    condition_variable cv_;
+    deque<T> queue_;
+    bool closed_;
+};
+
+static void checkPool()
+{
+    void *a = Pool::allocate( 64 );
+    void *b = Pool::allocate( 10 );
+    assert( Pool::freeBlocks() == 0 );
+    Pool::release( a, 64 );
+    Pool::release( b, 10 );
+    assert( Pool::freeBlocks() == 2 );
+    // the last released block is taken first
+    assert( Pool::allocate( 64 ) == b );
+    assert( Pool::allocate( 1 ) == a );
+    assert( Pool::freeBlocks() == 0 );
+
+    // big blocks bypass the pool
+    void *big = Pool::allocate( 1000 );
+    memset( big, 0, 1000 );
+    Pool::release( big, 1000 );
+    assert( Pool::freeBlocks() == 0 );
+
+    // not more than MaxFree blocks are kept
+    vector<void*> blocks;
+    for( int i = 0; i < 20; ++i )
+        blocks.push_back( Pool::allocate( 64 ) );
+    blocks.push_back( a );
+    blocks.push_back( b );
+    for( size_t i = 0; i < blocks.size(); ++i )
+        Pool::release( blocks[i], 64 );
+    assert( Pool::freeBlocks() == 8 );
+    Pool::release( nullptr, 64 );
+}
+
+// producers take blocks, consumers check and free them, so blocks move between
+// free lists of threads
+static void checkCrossThreadFrees( int pairs, int blocks )
+{
+    Channel<unsigned char*> channel;
+    atomic<long> freed( 0 );
+    vector<thread> threads;
+    for( int i = 0; i < pairs; ++i )
+    {
+        threads.push_back( thread( [&, i]
+        {
+            for( int k = 0; k < blocks; ++k )
+            {
+                unsigned char *block = static_cast<unsigned char*>( Pool::allocate( 64 ) );
+                memset( block, ( i + k ) & 0xff, 64 );
+                block[0] = (unsigned char)( k & 0xff );
+                block[1] = (unsigned char)( ( i + k ) & 0xff );
+                channel.push( block );
+            }
+        } ) );
+        threads.push_back( thread( [&]
+        {
+            unsigned char *block;
+            while( channel.pop( block ) )
+            {
+                for( int k = 2; k < 64; ++k )
+                    assert( block[k] == block[1] );
+                Pool::release( block, 64 );
+                assert( Pool::freeBlocks() <= 8 );
+                ++freed;
+            }
+        } ) );
+    }
+    for( size_t i = 0; i < threads.size(); i += 2 )
+        threads[i].join();
+    channel.close();
+    for( size_t i = 1; i < threads.size(); i += 2 )
+        threads[i].join();
+    assert( freed == long( pairs ) * blocks );
+}
+
+// block released by a thread local object destroyed after the free list of its thread
+struct LateOwner
+{
+    LateOwner() : block( nullptr ) {}
+    ~LateOwner() { Pool::release( block, 64 ); }
+
+    void *block;
+};
+
+static void checkReleaseAtExit()
+{
+    thread worker( []
+    {
+        static thread_local LateOwner owner;
+        // the free list is constructed after the owner, so it is destroyed first
+        owner.block = Pool::allocate( 64 );
+        Pool::release( Pool::allocate( 64 ), 64 );
+    } );
+    worker.join();
+}
+
+// counts live objects of the callable, so copies and moves leaking or destroying
+// callables twice are found
+struct Counted
+{
+    static atomic<int> live;
+
+    explicit Counted( int v ) : value( v ) { ++live; }
+    Counted( const Counted &other ) : value( other.value ) { ++live; }
+    Counted( Counted &&other ) noexcept : value( other.value ) { ++live; }
+    ~Counted() { --live; }
+
+    int operator()( int x ) const { return value + x; }
+
+    int value;
+};
+
+atomic<int> Counted::live( 0 );
+
+// too big to be stored inline
+struct Big : Counted
+{
+    explicit Big( int v ) : Counted( v ) { memset( padding, v, sizeof( padding ) ); }
+
+    int operator()( int x ) const { return value + x + padding[99] - (unsigned char)value; }
+
+    unsigned char padding[100];
+};
+
+// callables with throwing moves are allocated, so moving the wrapper can't throw
+struct ThrowingMove : Counted
+{
+    explicit ThrowingMove( int v ) : Counted( v ) {}
+    ThrowingMove( const ThrowingMove &other ) : Counted( other ) {}
+    ThrowingMove( ThrowingMove &&other ) : Counted( other ) {}
+};
+
+static int twice( int x )
+{
+    return 2 * x;
+}
+
+template<typename F>
+static void checkCopies( const F &callable, int expected )
+{
+    typedef SmallFunction<int (int)> Function;
+    int live = Counted::live;
+    {
+        Function f( callable );
+        assert( f && f( 1 ) == expected );
+        Function copy( f );
+        Function moved( std::move( f ) );
+        assert( !f && copy( 1 ) == expected && moved( 1 ) == expected );
+
+        Function assigned;
+        assigned = copy;
+        assert( assigned( 1 ) == expected );
+        assigned = std::move( moved );
+        assert( !moved && assigned( 1 ) == expected );
+        assigned = assigned;
+        assert( assigned( 1 ) == expected );
+        assigned = nullptr;
+        assert( !assigned );
+    }
+    assert( Counted::live == live );
+}
+
+static void checkFunction()
+{
+    checkCopies( Counted( 5 ), 6 );
+    checkCopies( Big( 7 ), 8 );
+    checkCopies( ThrowingMove( 9 ), 10 );
+    checkCopies( &twice, 2 );
+    checkCopies( std::function<int (int)>( Counted( 3 ) ), 4 );
+
+    int captured = 40;
+    checkCopies( [captured]( int x ) { return captured + x; }, 41 );
+
+    // empty callables make empty wrappers
+    int (*none)( int ) = nullptr;
+    assert( !SmallFunction<int (int)>( none ) );
+    assert( !SmallFunction<int (int)>( std::function<int (int)>() ) );
+    assert( !SmallFunction<int (int)>( nullptr ) );
+
+    // arguments are forwarded, move-only arguments too
+    SmallFunction<int (unique_ptr<int>)> take( []( unique_ptr<int> p ) { return *p; } );
+    assert( take( unique_ptr<int>( new int( 11 ) ) ) == 11 );
+    SmallFunction<void (int&)> increment( []( int &x ) { ++x; } );
+    int x = 1;
+    increment( x );
+    assert( x == 2 );
+}
+
+// functions are created in producer threads and called and destroyed in consumer threads
+static void checkCrossThreadCalls( int pairs, int calls )
+{
+    typedef SmallFunction<int (int)> Function;
+    Channel<Function> channel;
+    atomic<long> sum( 0 );
+    vector<thread> threads;
+    for( int i = 0; i < pairs; ++i )
+    {
+        threads.push_back( thread( [&, i]
+        {
+            for( int k = 0; k < calls; ++k )
+            {
+                if( k % 2 == 0 )
+                    channel.push( Function( Counted( 1 ) ) );
+                else
+                    channel.push( Function( Big( 1 ) ) );
+            }
+        } ) );
+        threads.push_back( thread( [&]
+        {
+            Function f;
+            while( channel.pop( f ) )
+                sum += f( 0 );
+        } ) );
+    }
+    for( size_t i = 0; i < threads.size(); i += 2 )
+        threads[i].join();
+    channel.close();
+    for( size_t i = 1; i < threads.size(); i += 2 )
+        threads[i].join();
+    assert( sum == long( pairs ) * calls );
+    assert( Counted::live == 0 );
+}
+
+int main( int argc, const char * argv[] )
+{
+    int pairs = argc > 1 ? atoi( argv[1] ) : 4;
+    int count = argc > 2 ? atoi( argv[2] ) : 50000;
+
+    checkPool();
+    checkCrossThreadFrees( pairs, count );
+    checkReleaseAtExit();
+    checkFunction();
+    checkCrossThreadCalls( pairs, count / 10 );
+
+    cout << "block pool and small function are ok" << endl;
+    return 0;
+}
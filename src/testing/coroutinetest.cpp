@@ -0,0 +1,190 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "asynccoroutine.h"
+#include "adapters/libeventadapter.h"
+#include "fakenode.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Coroutines awaiting commands, batches and delays against an in-process cluster: values
+// returned by nested tasks, detached tasks, exceptions passed to awaiting tasks and
+// commands finished without a reply. Built only by compilers with C++20 coroutines
+
+typedef Cluster<redisAsyncContext>::ptr_t ClusterPtr;
+
+static const size_t nodes = 3;
+
+// runs the loop until the condition is true, false on timeout
+static bool runUntil( event_base &base, const function<bool ()> &done, int milliseconds = 5000 )
+{
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds( milliseconds );
+    while( !done() )
+    {
+        if( chrono::steady_clock::now() > deadline )
+            return false;
+        event_base_loop( &base, EVLOOP_ONCE | EVLOOP_NONBLOCK );
+    }
+    return true;
+}
+
+static size_t commands( FakeRedisCluster &fake )
+{
+    size_t count = 0;
+    for( size_t i = 0; i < nodes; ++i )
+        count += fake.commands( i );
+    return count;
+}
+
+static AsyncTask<> set( ClusterPtr cluster_p, string key, string value )
+{
+    RespCommand cmd;
+    AsyncReply reply = co_await AsyncAwait<>::Command( cluster_p, key, cmd.format( "SET", key, value ) );
+    assert( reply && reply->type == REDIS_REPLY_STATUS );
+}
+
+static AsyncTask<string> get( ClusterPtr cluster_p, string key )
+{
+    AsyncReply reply = co_await AsyncAwait<>::Command( cluster_p, key, "GET %s", key.c_str() );
+    assert( reply && reply.error() == SUCCESS );
+    co_return reply->type == REDIS_REPLY_STRING ? string( reply->str, reply->len ) : string( "nil" );
+}
+
+// copies values from key to key, awaiting nested tasks, a batch and a delay
+static AsyncTask<int> copyChain( ClusterPtr cluster_p, Adapter &adapter, int length )
+{
+    co_await set( cluster_p, "chain0", "value" );
+    for( int i = 1; i < length; ++i )
+    {
+        string value = co_await get( cluster_p, "chain" + to_string( i - 1 ) );
+        assert( value == "value" );
+        co_await set( cluster_p, "chain" + to_string( i ), value );
+    }
+
+    AsyncBatch<> batch( cluster_p );
+    RespCommand cmd;
+    for( int i = 0; i < length; ++i )
+        batch.add( "chain" + to_string( i ), cmd.format( "GET", "chain" + to_string( i ) ) );
+    batch.add( "chain0", cmd.format( "NOSUCHCOMMAND", "chain0" ) );
+    AsyncBatchResult result = co_await AsyncAwait<>::Execute( batch );
+    assert( result.commands == size_t( length ) + 1 && result.failed == 1 && result.error == SUCCESS );
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool delayed = co_await AsyncAwait<>::Delay( adapter, 20 );
+    // libevent counts timeouts from the time cached at the start of the loop iteration
+    assert( delayed && chrono::steady_clock::now() - start >= chrono::milliseconds( 10 ) );
+    co_return length;
+}
+
+static AsyncTask<> awaitChain( ClusterPtr cluster_p, Adapter &adapter, int length, bool &done )
+{
+    int copied = co_await copyChain( cluster_p, adapter, length );
+    assert( copied == length );
+    done = true;
+}
+
+static AsyncTask<int> failing( ClusterPtr cluster_p )
+{
+    co_await AsyncAwait<>::Command( cluster_p, "fail", "GET fail" );
+    throw runtime_error( "failed" );
+}
+
+static AsyncTask<> catching( ClusterPtr cluster_p, bool &caught )
+{
+    try
+    {
+        co_await failing( cluster_p );
+    }
+    catch( const runtime_error& )
+    {
+        caught = true;
+    }
+}
+
+static AsyncTask<> lost( ClusterPtr cluster_p, ErrorCode &error, bool &done )
+{
+    AsyncReply reply = co_await AsyncAwait<>::Command( cluster_p, "lost", "GET lost" );
+    assert( !reply );
+    error = reply.error();
+    done = true;
+}
+
+static void checkTasks( int length )
+{
+    FakeRedisCluster fake( nodes );
+    event_base *base = event_base_new();
+    LibeventAdapter adapter( *base );
+    ClusterPtr cluster_p = AsyncHiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ), adapter );
+
+    bool done = false;
+    {
+        // the task runs until its first co_await and is resumed by the loop
+        AsyncTask<> task = awaitChain( cluster_p, adapter, length, done );
+        assert( !task.done() );
+        assert( runUntil( *base, [&] { return done; } ) );
+        assert( task.done() );
+    }
+
+    // dropped tasks run to the end alone, their frames are reused
+    for( int i = 0; i < 3; ++i )
+    {
+        done = false;
+        awaitChain( cluster_p, adapter, length, done );
+        assert( runUntil( *base, [&] { return done; } ) );
+    }
+
+    bool caught = false;
+    catching( cluster_p, caught );
+    assert( runUntil( *base, [&] { return caught; } ) );
+
+    // awaitables not awaited are never sent
+    size_t sent = commands( fake );
+    {
+        AsyncAwait<>::CommandAwaiter unused = AsyncAwait<>::Command( cluster_p, "unused", "GET unused" );
+    }
+    done = false;
+    awaitChain( cluster_p, adapter, 1, done );
+    assert( runUntil( *base, [&] { return done; } ) );
+    // SET, the batch of GET and the unknown command
+    assert( commands( fake ) - sent == 3 );
+
+    delete cluster_p;
+    event_base_free( base );
+}
+
+// command of a node gone before it is written resumes the task with an empty reply
+static void checkLostReply()
+{
+    event_base *base = event_base_new();
+    LibeventAdapter adapter( *base );
+    ClusterPtr cluster_p = nullptr;
+    ErrorCode error = SUCCESS;
+    bool done = false;
+    {
+        FakeRedisCluster fake( nodes );
+        cluster_p = AsyncHiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ), adapter );
+        AsyncHiredisCommand<>::setReconnectPolicy( cluster_p, ReconnectPolicy::disabled() );
+        lost( cluster_p, error, done );
+    }
+    assert( runUntil( *base, [&] { return done; } ) );
+    assert( error != SUCCESS );
+    delete cluster_p;
+    event_base_free( base );
+}
+
+int main( int argc, const char * argv[] )
+{
+    int length = argc > 1 ? atoi( argv[1] ) : 50;
+
+    checkTasks( length );
+    checkLostReply();
+
+    cout << "coroutines are ok" << endl;
+    return 0;
+}
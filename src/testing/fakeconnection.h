@@ -0,0 +1,93 @@
+#ifndef __libredisCluster__fakeconnection__
+#define __libredisCluster__fakeconnection__
+
+#include <assert.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "cluster.h"
+
+// Connection type for testing connection containers without a redis server, containers
+// use only the err field of hiredis contexts. Connections count users to check that
+// a connection is never given to two threads at once
+
+struct FakeConnection
+{
+    int err;
+    std::string host;
+    int port;
+    std::atomic<int> users;
+};
+
+static std::atomic<int> liveConnections( 0 );
+static std::atomic<int> maxLiveConnections( 0 );
+static std::atomic<int> openedConnections( 0 );
+// connecting to this port fails
+static const int fakeFailingPort = 1;
+
+inline FakeConnection* fakeConnect( const char *host, int port, void* )
+{
+    FakeConnection *con = new FakeConnection();
+    con->err = port == fakeFailingPort ? REDIS_ERR_IO : 0;
+    con->host = host;
+    con->port = port;
+    con->users = 0;
+
+    int live = ++liveConnections;
+    int max = maxLiveConnections;
+    while( live > max && !maxLiveConnections.compare_exchange_weak( max, live ) ) {}
+    ++openedConnections;
+    return con;
+}
+
+inline void fakeDisconnect( FakeConnection *con )
+{
+    assert( con->users == 0 );
+    --liveConnections;
+    delete con;
+}
+
+// marks the connection as used by the current thread for a moment
+inline void useConnection( FakeConnection *con, int expectedPort )
+{
+    assert( con != nullptr && con->err == 0 && con->port == expectedPort );
+    int users = ++con->users;
+    assert( users == 1 );
+    std::this_thread::yield();
+    --con->users;
+}
+
+// reply on CLUSTER SLOTS for nodes with ports firstPort, firstPort + 1, ... sharing slots
+// evenly, the caller frees it with freeReplyObject
+inline redisReply* clusterSlotsReply( int nodes, int firstPort )
+{
+    std::string resp = "*" + std::to_string( nodes ) + "\r\n";
+    for( int i = 0; i < nodes; ++i )
+    {
+        int first = 16384 * i / nodes, last = 16384 * ( i + 1 ) / nodes - 1;
+        resp += "*3\r\n:" + std::to_string( first ) + "\r\n:" + std::to_string( last ) + "\r\n"
+            "*2\r\n$9\r\n127.0.0.1\r\n:" + std::to_string( firstPort + i ) + "\r\n";
+    }
+
+    redisReader *reader = redisReaderCreate();
+    void *reply = nullptr;
+    redisReaderFeed( reader, resp.data(), resp.size() );
+    int status = redisReaderGetReply( reader, &reply );
+    assert( status == REDIS_OK && reply != nullptr );
+    redisReaderFree( reader );
+    return static_cast<redisReply*>( reply );
+}
+
+// port of the node serving the slot in the cluster made from clusterSlotsReply
+inline int slotPort( unsigned slot, int nodes, int firstPort )
+{
+    for( int i = 0; i < nodes; ++i )
+    {
+        if( slot <= unsigned( 16384 * ( i + 1 ) / nodes - 1 ) )
+            return firstPort + i;
+    }
+    return -1;
+}
+
+#endif /* defined(__libredisCluster__fakeconnection__) */
@@ -0,0 +1,361 @@
+#ifndef __libredisCluster__fakenode__
+#define __libredisCluster__fakenode__
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "slothash.h"
+
+// In-process redis cluster for tests without a server. Nodes listen on loopback ports
+// and are served by one thread, they know CLUSTER SLOTS, PING, ECHO, GET, SET and the
+// multi-key commands MGET, MSET, DEL, EXISTS and UNLINK. Keys of slots owned by other
+// nodes are answered with MOVED, multi-key commands across slots with CROSSSLOT
+
+class FakeRedisCluster
+{
+    FakeRedisCluster(const FakeRedisCluster&) = delete;
+    FakeRedisCluster& operator=(const FakeRedisCluster&) = delete;
+
+    struct Client
+    {
+        int fd;
+        size_t node;
+        std::string in;
+        std::string out;
+    };
+
+public:
+    explicit FakeRedisCluster( size_t nodes ) :
+    owners_( 16384 ),
+    stop_( false ),
+    dropRequest_( -1 )
+    {
+        // clients write to connections closed by dropClients
+        signal( SIGPIPE, SIG_IGN );
+        for( size_t i = 0; i < nodes; ++i )
+        {
+            int fd = socket( AF_INET, SOCK_STREAM, 0 );
+            sockaddr_in addr = sockaddr_in();
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+            socklen_t len = sizeof( addr );
+            if( fd < 0 || bind( fd, (sockaddr*)&addr, len ) != 0 || listen( fd, 128 ) != 0 ||
+               getsockname( fd, (sockaddr*)&addr, &len ) != 0 )
+            {
+                perror( "fake node" );
+                abort();
+            }
+            listeners_.push_back( fd );
+            ports_.push_back( ntohs( addr.sin_port ) );
+            accepted_.push_back( 0 );
+            reads_.push_back( 0 );
+            commands_.push_back( 0 );
+        }
+        for( size_t slot = 0; slot < owners_.size(); ++slot )
+            owners_[slot] = slot * nodes / owners_.size();
+        server_ = std::thread( &FakeRedisCluster::run, this );
+    }
+
+    ~FakeRedisCluster()
+    {
+        stop_ = true;
+        server_.join();
+        for( size_t i = 0; i < listeners_.size(); ++i )
+            close( listeners_[i] );
+    }
+
+    inline int port( size_t node ) const
+    {
+        return ports_[node];
+    }
+
+    // counters of the node: accepted connections, reads of client data and commands
+    inline size_t accepted( size_t node ) { std::lock_guard<std::mutex> locker( lock_ ); return accepted_[node]; }
+    inline size_t reads( size_t node ) { std::lock_guard<std::mutex> locker( lock_ ); return reads_[node]; }
+    inline size_t commands( size_t node ) { std::lock_guard<std::mutex> locker( lock_ ); return commands_[node]; }
+
+    // slot is served by another node, CLUSTER SLOTS still tells the initial layout
+    void move( size_t slot, size_t node )
+    {
+        std::lock_guard<std::mutex> locker( lock_ );
+        owners_[slot] = node;
+    }
+
+    // closes connections of clients of the node, returns when they are closed
+    void dropClients( size_t node )
+    {
+        dropRequest_ = int( node );
+        while( dropRequest_ != -1 )
+            std::this_thread::yield();
+    }
+
+private:
+    void run()
+    {
+        std::vector<Client> clients;
+        while( !stop_ )
+        {
+            int drop = dropRequest_;
+            if( drop != -1 )
+            {
+                for( size_t i = 0; i < clients.size(); ++i )
+                {
+                    if( clients[i].node == size_t( drop ) )
+                        disconnect( clients[i] );
+                }
+                dropRequest_ = -1;
+            }
+            removeClosed( clients );
+
+            std::vector<pollfd> fds;
+            for( size_t i = 0; i < listeners_.size(); ++i )
+            {
+                pollfd fd = { listeners_[i], POLLIN, 0 };
+                fds.push_back( fd );
+            }
+            for( size_t i = 0; i < clients.size(); ++i )
+            {
+                pollfd fd = { clients[i].fd, short( POLLIN | ( clients[i].out.empty() ? 0 : POLLOUT ) ), 0 };
+                fds.push_back( fd );
+            }
+            if( poll( fds.data(), fds.size(), 5 ) <= 0 )
+                continue;
+
+            for( size_t i = 0; i < clients.size(); ++i )
+            {
+                short events = fds[listeners_.size() + i].revents;
+                if( events & ( POLLIN | POLLHUP | POLLERR ) )
+                    read( clients[i] );
+                if( clients[i].fd >= 0 && !clients[i].out.empty() )
+                    write( clients[i] );
+            }
+            for( size_t i = 0; i < listeners_.size(); ++i )
+            {
+                if( fds[i].revents & POLLIN )
+                {
+                    Client client;
+                    client.fd = accept( listeners_[i], nullptr, nullptr );
+                    client.node = i;
+                    if( client.fd >= 0 )
+                    {
+                        fcntl( client.fd, F_SETFL, fcntl( client.fd, F_GETFL ) | O_NONBLOCK );
+                        clients.push_back( client );
+                        std::lock_guard<std::mutex> locker( lock_ );
+                        ++accepted_[i];
+                    }
+                }
+            }
+        }
+        for( size_t i = 0; i < clients.size(); ++i )
+            disconnect( clients[i] );
+    }
+
+    static void disconnect( Client &client )
+    {
+        if( client.fd >= 0 )
+            close( client.fd );
+        client.fd = -1;
+    }
+
+    static void removeClosed( std::vector<Client> &clients )
+    {
+        for( size_t i = 0; i < clients.size(); )
+        {
+            if( clients[i].fd < 0 )
+                clients.erase( clients.begin() + i );
+            else
+                ++i;
+        }
+    }
+
+    void read( Client &client )
+    {
+        char buf[16384];
+        ssize_t len = ::read( client.fd, buf, sizeof( buf ) );
+        if( len < 0 && errno == EAGAIN )
+            return;
+        if( len <= 0 )
+        {
+            disconnect( client );
+            return;
+        }
+        client.in.append( buf, len );
+        {
+            std::lock_guard<std::mutex> locker( lock_ );
+            ++reads_[client.node];
+        }
+
+        std::vector<std::string> args;
+        size_t pos = 0;
+        while( parse( client.in, pos, args ) )
+        {
+            client.out += answer( client.node, args );
+            args.clear();
+        }
+        client.in.erase( 0, pos );
+    }
+
+    void write( Client &client )
+    {
+        ssize_t len = send( client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL );
+        if( len > 0 )
+            client.out.erase( 0, len );
+        else if( len < 0 && errno != EAGAIN )
+            disconnect( client );
+    }
+
+    // parses one command at pos, pos is moved past it
+    static bool parse( const std::string &in, size_t &pos, std::vector<std::string> &args )
+    {
+        size_t at = pos;
+        if( at >= in.size() || in[at] != '*' )
+            return false;
+        size_t end = in.find( "\r\n", at );
+        if( end == std::string::npos )
+            return false;
+        long count = atol( in.c_str() + at + 1 );
+        at = end + 2;
+        for( long i = 0; i < count; ++i )
+        {
+            end = in.find( "\r\n", at );
+            if( end == std::string::npos )
+                return false;
+            size_t len = atol( in.c_str() + at + 1 );
+            at = end + 2;
+            if( at + len + 2 > in.size() )
+                return false;
+            args.push_back( in.substr( at, len ) );
+            at += len + 2;
+        }
+        pos = at;
+        return true;
+    }
+
+    static std::string bulk( const std::string &value )
+    {
+        return "$" + std::to_string( value.size() ) + "\r\n" + value + "\r\n";
+    }
+
+    static std::string integer( long long value )
+    {
+        return ":" + std::to_string( value ) + "\r\n";
+    }
+
+    static unsigned slot( const std::string &key )
+    {
+        return RedisCluster::SlotHash::SlotByKey( key.c_str(), key.size() );
+    }
+
+    std::string slots()
+    {
+        size_t nodes = ports_.size();
+        std::string reply = "*" + std::to_string( nodes ) + "\r\n";
+        for( size_t i = 0; i < nodes; ++i )
+        {
+            reply += "*3\r\n" + integer( ( i * 16384 + nodes - 1 ) / nodes ) +
+                integer( ( ( i + 1 ) * 16384 + nodes - 1 ) / nodes - 1 ) +
+                "*2\r\n" + bulk( "127.0.0.1" ) + integer( ports_[i] );
+        }
+        return reply;
+    }
+
+    std::string answer( size_t node, std::vector<std::string> &args )
+    {
+        std::lock_guard<std::mutex> locker( lock_ );
+        ++commands_[node];
+
+        std::string name = args[0];
+        for( size_t i = 0; i < name.size(); ++i )
+            name[i] = toupper( name[i] );
+
+        if( name == "CLUSTER" )
+            return slots();
+        if( name == "PING" )
+            return "+PONG\r\n";
+        if( args.size() < 2 )
+            return "-ERR wrong number of arguments\r\n";
+        if( name == "ECHO" )
+            return bulk( args[1] );
+
+        // keys are every argument or every second one for MSET
+        size_t step = name == "MSET" || name == "SET" ? 2 : 1;
+        unsigned first = slot( args[1] );
+        for( size_t i = 1 + step; i < args.size(); i += step )
+        {
+            if( name != "SET" && slot( args[i] ) != first )
+                return "-CROSSSLOT Keys in request don't hash to the same slot\r\n";
+        }
+        if( owners_[first] != node )
+            return "-MOVED " + std::to_string( first ) + " 127.0.0.1:" + std::to_string( ports_[owners_[first]] ) + "\r\n";
+
+        if( name == "GET" )
+        {
+            std::map<std::string, std::string>::iterator found = values_.find( args[1] );
+            return found == values_.end() ? "$-1\r\n" : bulk( found->second );
+        }
+        if( name == "SET" && args.size() >= 3 )
+        {
+            values_[args[1]] = args[2];
+            return "+OK\r\n";
+        }
+        if( name == "MSET" && args.size() % 2 == 1 )
+        {
+            for( size_t i = 1; i < args.size(); i += 2 )
+                values_[args[i]] = args[i + 1];
+            return "+OK\r\n";
+        }
+        if( name == "MGET" )
+        {
+            std::string reply = "*" + std::to_string( args.size() - 1 ) + "\r\n";
+            for( size_t i = 1; i < args.size(); ++i )
+            {
+                std::map<std::string, std::string>::iterator found = values_.find( args[i] );
+                reply += found == values_.end() ? "$-1\r\n" : bulk( found->second );
+            }
+            return reply;
+        }
+        if( name == "DEL" || name == "UNLINK" || name == "EXISTS" )
+        {
+            long long count = 0;
+            for( size_t i = 1; i < args.size(); ++i )
+            {
+                if( name == "EXISTS" )
+                    count += values_.count( args[i] );
+                else
+                    count += values_.erase( args[i] );
+            }
+            return integer( count );
+        }
+        return "-ERR unknown command '" + args[0] + "'\r\n";
+    }
+
+    std::vector<int> listeners_;
+    std::vector<int> ports_;
+    // protects owners, values and counters
+    std::mutex lock_;
+    std::vector<size_t> owners_;
+    std::map<std::string, std::string> values_;
+    std::vector<size_t> accepted_;
+    std::vector<size_t> reads_;
+    std::vector<size_t> commands_;
+    std::atomic<bool> stop_;
+    std::atomic<int> dropRequest_;
+    std::thread server_;
+};
+
+#endif /* defined(__libredisCluster__fakenode__) */
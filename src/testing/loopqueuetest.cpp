@@ -0,0 +1,187 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "loopqueue.h"
+#include "smallfunction.h"
+#include "adapters/libeventadapter.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Multi-threaded test of LoopQueue: tasks of many producers run in the order of posting per
+// producer, whether the consumer waits for them, drains them or runs them from an event loop.
+// Tasks carry memory of the producer which is freed by the consumer, tasks left in a
+// destroyed queue are run, and waits time out on empty queues
+
+typedef LoopQueue< SmallFunction<void ()> > Queue;
+typedef chrono::steady_clock Clock;
+
+// allocated by the producer, checked and freed by the consumer
+struct Payload
+{
+    Payload( int p, int s ) : producer( p ), sequence( s )
+    {
+        memset( data, s & 0xff, sizeof( data ) );
+    }
+
+    int producer;
+    int sequence;
+    unsigned char data[48];
+};
+
+// tasks seen by the consumer, used by the consumer thread only
+struct Consumer
+{
+    explicit Consumer( int producers ) : next( producers, 0 ), done( 0 ) {}
+
+    void run( Payload *payload )
+    {
+        assert( payload->sequence == next[payload->producer] );
+        for( size_t i = 0; i < sizeof( payload->data ); ++i )
+            assert( payload->data[i] == ( payload->sequence & 0xff ) );
+        ++next[payload->producer];
+        ++done;
+        delete payload;
+    }
+
+    vector<int> next;
+    long done;
+};
+
+static void produce( Queue &queue, Consumer &consumer, int producers, int tasks, vector<thread> &threads )
+{
+    for( int i = 0; i < producers; ++i )
+    {
+        threads.push_back( thread( [&queue, &consumer, i, tasks]
+        {
+            for( int k = 0; k < tasks; ++k )
+            {
+                Payload *payload = new Payload( i, k );
+                queue.post( SmallFunction<void ()>( [&consumer, payload] { consumer.run( payload ); } ) );
+                if( k % 1000 == 0 )
+                    this_thread::yield();
+            }
+        } ) );
+    }
+}
+
+static void join( vector<thread> &threads )
+{
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+    threads.clear();
+}
+
+// the consumer waits for tasks, every wait runs the tasks posted so far
+static void checkWait( int producers, int tasks )
+{
+    Queue queue;
+    Consumer consumer( producers );
+    long total = long( producers ) * tasks;
+    vector<thread> threads;
+    produce( queue, consumer, producers, tasks, threads );
+
+    // a wakeup of a task taken by the previous wait may find the queue empty
+    Clock::time_point deadline = Clock::now() + chrono::seconds( 60 );
+    long run = 0;
+    size_t wakeups = 0;
+    while( run < total )
+    {
+        assert( Clock::now() < deadline );
+        run += queue.wait( 1000 );
+        ++wakeups;
+    }
+    join( threads );
+    assert( run == total && consumer.done == total );
+    assert( queue.wait( 0 ) == 0 );
+    // a busy consumer runs many tasks per wakeup
+    cout << total << " tasks in " << wakeups << " waits" << endl;
+}
+
+// the consumer drains without waiting, tasks left are run by the destructor
+static void checkDrain( int producers, int tasks )
+{
+    Consumer consumer( producers );
+    long total = long( producers ) * tasks;
+    {
+        Queue queue;
+        vector<thread> threads;
+        produce( queue, consumer, producers, tasks, threads );
+        long run = 0;
+        while( run < total / 2 )
+            run += queue.drain();
+        join( threads );
+        assert( consumer.done == run );
+    }
+    assert( consumer.done == total );
+}
+
+static void checkTimeouts()
+{
+    Queue queue;
+    Clock::time_point start = Clock::now();
+    assert( queue.wait( 30 ) == 0 );
+    assert( Clock::now() - start >= chrono::milliseconds( 25 ) );
+    assert( queue.wait( 0 ) == 0 && queue.drain() == 0 );
+
+    // a task posted by another thread ends a long wait early
+    int run = 0;
+    start = Clock::now();
+    thread poster( [&queue, &run]
+    {
+        this_thread::sleep_for( chrono::milliseconds( 20 ) );
+        queue.post( SmallFunction<void ()>( [&run] { ++run; } ) );
+    } );
+    assert( queue.wait( 10000 ) == 1 && run == 1 );
+    assert( Clock::now() - start < chrono::milliseconds( 5000 ) );
+    poster.join();
+
+    // drain leaves the wakeup, the next wait clears it and finds no tasks
+    queue.post( SmallFunction<void ()>( [&run] { ++run; } ) );
+    assert( queue.drain() == 1 && run == 2 );
+    assert( queue.wait( 10 ) == 0 );
+}
+
+// tasks are run by an event loop, which returns after the queue is closed
+static void checkLoop( int producers, int tasks )
+{
+    event_base *base = event_base_new();
+    LibeventAdapter adapter( *base );
+    Queue *queue = new Queue( adapter );
+    Consumer consumer( producers );
+    long total = long( producers ) * tasks;
+
+    thread loop( [base] { event_base_dispatch( base ); } );
+    vector<thread> threads;
+    produce( *queue, consumer, producers, tasks, threads );
+    join( threads );
+    queue->post( SmallFunction<void ()>( [queue] { queue->close(); } ) );
+    loop.join();
+    assert( consumer.done == total );
+
+    // tasks posted after close are run by the destructor
+    Payload *payload = new Payload( 0, tasks );
+    queue->post( SmallFunction<void ()>( [&consumer, payload] { consumer.run( payload ); } ) );
+    delete queue;
+    assert( consumer.done == total + 1 );
+    event_base_free( base );
+}
+
+int main( int argc, const char * argv[] )
+{
+    int producers = argc > 1 ? atoi( argv[1] ) : 8;
+    int tasks = argc > 2 ? atoi( argv[2] ) : 50000;
+
+    checkWait( producers, tasks );
+    checkDrain( producers, tasks );
+    checkTimeouts();
+    checkLoop( producers, tasks );
+
+    cout << "loop queue is ok" << endl;
+    return 0;
+}
@@ -0,0 +1,343 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "poolcontainer.h"
+#include "fakeconnection.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Multi-threaded tests of BoundedQueue and PoolContainer with fake connections: values
+// pushed by many producers are popped once and in order, waiting threads get connections
+// in order of arrival or time out, and pools under contention never hand one connection
+// to two threads
+
+typedef PoolContainer<FakeConnection> Pool;
+typedef Cluster<FakeConnection, Pool> PoolCluster;
+
+static const int nodes = 3;
+static const int firstPort = 7000;
+
+static void checkQueue()
+{
+    BoundedQueue<int> queue( 5 );
+    assert( queue.capacity() == 8 );
+
+    int value;
+    assert( !queue.pop( value ) );
+    for( int i = 0; i < 8; ++i )
+        assert( queue.push( i ) );
+    assert( !queue.push( 8 ) );
+    assert( queue.size() == 8 );
+    for( int i = 0; i < 8; ++i )
+    {
+        assert( queue.pop( value ) && value == i );
+        // freed cells are reused after the queue wraps around
+        assert( queue.push( i + 8 ) );
+    }
+    for( int i = 8; i < 16; ++i )
+        assert( queue.pop( value ) && value == i );
+    assert( !queue.pop( value ) && queue.size() == 0 );
+}
+
+// every producer pushes increasing numbers, every value must be popped once and a consumer
+// must see values of one producer in increasing order
+static void checkQueueStress( int producers, int consumers, int count )
+{
+    BoundedQueue<long> queue( 64 );
+    vector< vector<char> > popped( producers, vector<char>( count, 0 ) );
+    atomic<int> done( 0 );
+    atomic<long> total( 0 );
+
+    vector<thread> threads;
+    for( int p = 0; p < producers; ++p )
+    {
+        threads.push_back( thread( [&, p]
+        {
+            for( int i = 0; i < count; ++i )
+            {
+                while( !queue.push( long( p ) * count + i ) )
+                    this_thread::yield();
+            }
+            ++done;
+        } ) );
+    }
+    for( int c = 0; c < consumers; ++c )
+    {
+        threads.push_back( thread( [&]
+        {
+            vector<int> last( producers, -1 );
+            long value;
+            while( true )
+            {
+                if( !queue.pop( value ) )
+                {
+                    if( done == producers && queue.size() == 0 )
+                        break;
+                    this_thread::yield();
+                    continue;
+                }
+                int producer = int( value / count ), i = int( value % count );
+                assert( i > last[producer] );
+                last[producer] = i;
+                assert( popped[producer][i] == 0 );
+                popped[producer][i] = 1;
+                ++total;
+            }
+        } ) );
+    }
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+
+    assert( total == long( producers ) * count );
+    cout << total << " values passed the queue" << endl;
+}
+
+static PoolCluster* createCluster( const Pool::Options &options )
+{
+    redisReply *reply = clusterSlotsReply( nodes, firstPort );
+    PoolCluster *cluster = new PoolCluster( reply, fakeConnect, fakeDisconnect, nullptr );
+    freeReplyObject( reply );
+    cluster->container().configure( options );
+    return cluster;
+}
+
+// threads waiting for the only connection get it in order of arrival
+static void checkWaitersOrder( int waiters )
+{
+    Pool::Options options;
+    options.maxConnections = 1;
+    options.acquireTimeout = chrono::milliseconds( 10000 );
+    PoolCluster *cluster = createCluster( options );
+
+    PoolCluster::SlotConnection held = cluster->getConnection( PoolCluster::SlotIndex( 0 ) );
+    mutex lock;
+    vector<int> order;
+    vector<thread> threads;
+    for( int i = 0; i < waiters; ++i )
+    {
+        threads.push_back( thread( [&, i]
+        {
+            PoolCluster::SlotConnection con = cluster->getConnection( PoolCluster::SlotIndex( 0 ) );
+            useConnection( con.second, firstPort );
+            {
+                lock_guard<mutex> locker( lock );
+                order.push_back( i );
+            }
+            cluster->releaseConnection( con );
+        } ) );
+        // the next thread comes when this one waits, there is no way to see it from outside
+        this_thread::sleep_for( chrono::milliseconds( 20 ) );
+    }
+    cluster->releaseConnection( held );
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+
+    for( int i = 0; i < waiters; ++i )
+        assert( order[i] == i );
+    Pool::Stats stats = cluster->container().stats( "127.0.0.1:7000" );
+    assert( stats.size == 1 && stats.inUse == 0 && stats.waits == size_t( waiters ) );
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+// waits are bounded by acquireTimeout and by the deadline of the command
+static void checkTimeouts()
+{
+    Pool::Options options;
+    options.maxConnections = 2;
+    options.acquireTimeout = chrono::milliseconds( 100 );
+    PoolCluster *cluster = createCluster( options );
+
+    PoolCluster::SlotConnection first = cluster->getConnection( PoolCluster::SlotIndex( 0 ) );
+    PoolCluster::SlotConnection second = cluster->getConnection( PoolCluster::SlotIndex( 0 ) );
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    try
+    {
+        cluster->getConnection( PoolCluster::SlotIndex( 0 ) );
+        assert( false );
+    }
+    catch( const TimeoutException& )
+    {
+    }
+    assert( chrono::steady_clock::now() - start >= chrono::milliseconds( 100 ) );
+
+    start = chrono::steady_clock::now();
+    try
+    {
+        cluster->getConnection( PoolCluster::SlotIndex( 0 ), Deadline( chrono::milliseconds( 10 ) ) );
+        assert( false );
+    }
+    catch( const TimeoutException& )
+    {
+    }
+    assert( chrono::steady_clock::now() - start < chrono::milliseconds( 100 ) );
+
+    // other nodes have own pools
+    PoolCluster::SlotConnection other = cluster->getConnection( PoolCluster::SlotIndex( 16000 ) );
+    useConnection( other.second, firstPort + nodes - 1 );
+    cluster->releaseConnection( other );
+
+    // timed out waiters leave the queue, so the released connection is free again
+    cluster->releaseConnection( first );
+    PoolCluster::SlotConnection again = cluster->getConnection( PoolCluster::SlotIndex( 0 ) );
+    assert( again.second == first.second );
+
+    // options can't change while connections are in use
+    bool refused = false;
+    try
+    {
+        cluster->container().configure( options );
+    }
+    catch( const LogicError& )
+    {
+        refused = true;
+    }
+    assert( refused );
+
+    cluster->releaseConnection( again );
+    cluster->releaseConnection( second );
+    Pool::Stats stats = cluster->container().stats( "127.0.0.1:7000" );
+    assert( stats.timeouts == 2 && stats.inUse == 0 );
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+// threads take connections of a small pool, some connections break and are replaced
+static void checkContention( int workers, int commands )
+{
+    Pool::Options options;
+    options.maxConnections = 4;
+    options.acquireTimeout = chrono::milliseconds( 10000 );
+    PoolCluster *cluster = createCluster( options );
+
+    vector<thread> threads;
+    for( int i = 0; i < workers; ++i )
+    {
+        threads.push_back( thread( [&, i]
+        {
+            unsigned seed = i;
+            for( int k = 0; k < commands; ++k )
+            {
+                PoolCluster::SlotIndex slot = rand_r( &seed ) % 16384;
+                PoolCluster::SlotConnection con = cluster->getConnection( slot );
+                useConnection( con.second, slotPort( slot, nodes, firstPort ) );
+                if( rand_r( &seed ) % 100 == 0 )
+                    con.second->err = REDIS_ERR_IO;
+                cluster->releaseConnection( con );
+
+                if( k % 100 == 0 )
+                {
+                    PoolCluster::HostConnection redirect = cluster->createNewConnection( "127.0.0.1", "7001" );
+                    useConnection( redirect.second, 7001 );
+                    cluster->releaseConnection( redirect );
+                }
+            }
+        } ) );
+    }
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+
+    Pool::Stats stats = cluster->container().stats();
+    assert( stats.inUse == 0 && stats.timeouts == 0 );
+    assert( stats.acquired == size_t( workers ) * ( commands + ( commands + 99 ) / 100 ) );
+    assert( stats.size <= ( nodes + 1 ) * options.maxConnections );
+    assert( liveConnections == int( stats.size ) );
+    cout << stats.acquired << " connections taken, " << stats.waits << " waits, "
+         << stats.discarded << " broken" << endl;
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+// waits until the condition holds or a few seconds pass, the maintenance thread
+// works in the background
+template<typename Condition>
+static bool eventually( Condition condition )
+{
+    chrono::steady_clock::time_point end = chrono::steady_clock::now() + chrono::seconds( 5 );
+    while( !condition() )
+    {
+        if( chrono::steady_clock::now() > end )
+            return false;
+        this_thread::sleep_for( chrono::milliseconds( 1 ) );
+    }
+    return true;
+}
+
+// pools grow to minConnections, open connections for a burst up to maxConnections
+// and close connections that stay idle
+static void checkGrowAndReap( int burst )
+{
+    Pool::Options options;
+    options.minConnections = 2;
+    options.maxConnections = burst;
+    options.acquireTimeout = chrono::milliseconds( 10000 );
+    options.idleTimeout = chrono::milliseconds( 50 );
+    options.maintenanceInterval = chrono::milliseconds( 5 );
+    PoolCluster *cluster = createCluster( options );
+    Pool &pool = cluster->container();
+
+    assert( eventually( [&] { return pool.stats().size == size_t( nodes * 2 ); } ) );
+
+    // every thread holds its connection until all threads have one
+    atomic<int> holding( 0 );
+    vector<thread> threads;
+    for( int i = 0; i < burst; ++i )
+    {
+        threads.push_back( thread( [&]
+        {
+            PoolCluster::SlotConnection con = cluster->getConnection( PoolCluster::SlotIndex( 0 ) );
+            ++holding;
+            while( holding < burst )
+                this_thread::yield();
+            useConnection( con.second, firstPort );
+            cluster->releaseConnection( con );
+        } ) );
+    }
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+
+    Pool::Stats stats = pool.stats( "127.0.0.1:7000" );
+    assert( stats.size == size_t( burst ) && stats.inUse == 0 && stats.timeouts == 0 );
+
+    // free connections above the minimum are closed after the idle timeout
+    assert( eventually( [&] { return pool.stats( "127.0.0.1:7000" ).size == 2; } ) );
+    stats = pool.stats( "127.0.0.1:7000" );
+    assert( stats.reaped == size_t( burst - 2 ) );
+    assert( liveConnections == int( pool.stats().size ) );
+
+    // waiters get the error when the maintenance thread can't connect
+    try
+    {
+        cluster->createNewConnection( "127.0.0.1", to_string( fakeFailingPort ) );
+        assert( false );
+    }
+    catch( const ConnectionFailedException& )
+    {
+    }
+
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+int main( int argc, const char * argv[] )
+{
+    int workers = argc > 1 ? atoi( argv[1] ) : 16;
+    int commands = argc > 2 ? atoi( argv[2] ) : 5000;
+
+    checkQueue();
+    checkQueueStress( 4, 4, 100000 );
+    checkWaitersOrder( 5 );
+    checkTimeouts();
+    checkContention( workers, commands );
+    checkGrowAndReap( 6 );
+
+    cout << "pool container is ok" << endl;
+    return 0;
+}
@@ -0,0 +1,270 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "replydecoder.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Decodes fixed RESP replies read by the hiredis reader with ReplyDecoder and ReplyView,
+// and the same replies streamed through DecodingVisitor, which must agree with them
+
+struct User
+{
+    string name;
+    int age;
+    Nullable<string> email;
+};
+
+namespace RedisCluster
+{
+    template<>
+    struct ReplyDecoder<User>
+    {
+        static bool decode( const redisReply &reply, User &user )
+        {
+            return decodeFields( reply, user.name, user.age, user.email );
+        }
+    };
+
+    // found by argument dependent lookup, i.e. when vectors are compared
+    template<typename T>
+    static bool operator==( const Nullable<T> &a, const Nullable<T> &b )
+    {
+        return a.nil == b.nil && ( a.nil || a.value == b.value );
+    }
+}
+
+static redisReply* readReply( const string &resp )
+{
+    redisReader *reader = redisReaderCreate();
+    void *reply = nullptr;
+    redisReaderFeed( reader, resp.data(), resp.size() );
+    int status = redisReaderGetReply( reader, &reply );
+    assert( status == REDIS_OK && reply != nullptr );
+    redisReaderFree( reader );
+    return static_cast<redisReply*>( reply );
+}
+
+// decodes the reply with ReplyDecoder, streamable types are decoded by the visitor too
+template<typename T>
+static bool decodeReply( const string &resp, T &value )
+{
+    redisReply *reply = readReply( resp );
+    bool decoded = decode( *reply, value );
+    freeReplyObject( reply );
+    return decoded;
+}
+
+template<typename T>
+static bool streamReply( const string &resp, T &value )
+{
+    DecodingVisitor<T> decoder( value );
+    ReplyStreamParser parser( decoder );
+    // header lines and bulk strings are split between feeds
+    for( size_t i = 0; i < resp.size(); i += 3 )
+    {
+        long consumed = parser.feed( resp.data() + i, std::min<size_t>( 3, resp.size() - i ) );
+        assert( consumed >= 0 );
+    }
+    assert( parser.done() );
+    return decoder.ok() && !parser.isError();
+}
+
+template<typename T>
+static void expect( const string &resp, const T &expected )
+{
+    T decoded = T(), streamed = T();
+    if( !decodeReply( resp, decoded ) || !( decoded == expected ) )
+    {
+        cerr << "reply " << resp << " is not decoded" << endl;
+        abort();
+    }
+    if( !streamReply( resp, streamed ) || !( streamed == expected ) )
+    {
+        cerr << "streamed reply " << resp << " is not decoded" << endl;
+        abort();
+    }
+}
+
+// the reply doesn't match the type
+template<typename T>
+static void refuseDecoding( const string &resp )
+{
+    T value = T();
+    if( decodeReply( resp, value ) )
+    {
+        cerr << "reply " << resp << " is decoded to a wrong type" << endl;
+        abort();
+    }
+}
+
+template<typename T>
+static void refuse( const string &resp )
+{
+    refuseDecoding<T>( resp );
+    T value = T();
+    if( streamReply( resp, value ) )
+    {
+        cerr << "streamed reply " << resp << " is decoded to a wrong type" << endl;
+        abort();
+    }
+}
+
+template<typename T>
+static Nullable<T> value( const T &v )
+{
+    Nullable<T> nullable;
+    nullable.nil = false;
+    nullable.value = v;
+    return nullable;
+}
+
+static void checkScalars()
+{
+    expect<long long>( ":-9223372036854775808\r\n", -9223372036854775807LL - 1 );
+    expect<int>( ":42\r\n", 42 );
+    expect<unsigned>( "$10\r\n4294967295\r\n", 4294967295u );
+    expect<short>( "+-17\r\n", -17 );
+    expect<string>( ":42\r\n", "42" );
+    expect<string>( "$5\r\nhello\r\n", "hello" );
+    expect<string>( "+OK\r\n", "OK" );
+    expect<double>( "$4\r\n3.25\r\n", 3.25 );
+    expect<double>( ":3\r\n", 3.0 );
+    expect<float>( "$5\r\n-1e10\r\n", -1e10f );
+    expect<bool>( ":1\r\n", true );
+    expect<bool>( "+OK\r\n", true );
+    expect<bool>( "$1\r\n0\r\n", false );
+    expect<bool>( "$-1\r\n", false );
+    expect( "$-1\r\n", Nullable<string>() );
+    expect( "$0\r\n\r\n", value( string() ) );
+    expect( ":5\r\n", value( 5 ) );
+
+    refuse<int>( "$3\r\nabc\r\n" );
+    refuse<int>( "$0\r\n\r\n" );
+    refuse<int>( "$-1\r\n" );
+    refuse<unsigned>( "$2\r\n-1\r\n" );
+    refuse<double>( "$4\r\n1.5x\r\n" );
+    refuse<bool>( "$3\r\nyes\r\n" );
+    refuse<string>( "$-1\r\n" );
+    refuse<string>( "*1\r\n:1\r\n" );
+    // errors are never values, streamed top-level errors are kept for redirections
+    refuse<string>( "-ERR failed\r\n" );
+    refuse< Nullable<string> >( "-ERR failed\r\n" );
+}
+
+static void checkContainers()
+{
+    vector<string> list;
+    list.push_back( "a" );
+    list.push_back( "" );
+    list.push_back( "12" );
+    expect( "*3\r\n$1\r\na\r\n$0\r\n\r\n:12\r\n", list );
+    expect( "*0\r\n", vector<int>() );
+
+    // MGET
+    vector< Nullable<string> > values;
+    values.push_back( value( string( "v1" ) ) );
+    values.push_back( Nullable<string>() );
+    expect( "*2\r\n$2\r\nv1\r\n$-1\r\n", values );
+
+    // HGETALL
+    map<string, int> hash;
+    hash["a"] = 1;
+    hash["b"] = -2;
+    expect( "*4\r\n$1\r\na\r\n$1\r\n1\r\n$1\r\nb\r\n$2\r\n-2\r\n", hash );
+    unordered_map<string, string> strings;
+    strings["k"] = "v";
+    expect( "*2\r\n$1\r\nk\r\n$1\r\nv\r\n", strings );
+
+    refuse< map<string, int> >( "*3\r\n$1\r\na\r\n:1\r\n$1\r\nb\r\n" );
+    refuse< vector<int> >( "*2\r\n:1\r\n$1\r\nx\r\n" );
+    refuse< vector<int> >( ":1\r\n" );
+    refuse< vector<string> >( "*2\r\n$1\r\na\r\n-ERR inner\r\n" );
+
+    // shapes that are decoded from reply objects only
+    vector< vector<int> > nested;
+    nested.push_back( vector<int>( 1, 1 ) );
+    nested.push_back( vector<int>() );
+    string nestedResp( "*2\r\n*1\r\n:1\r\n*0\r\n" );
+    vector< vector<int> > decodedNested;
+    assert( decodeReply( nestedResp, decodedNested ) && decodedNested == nested );
+    refuse< vector<string> >( nestedResp );
+
+    pair<string, long long> scan;
+    assert( decodeReply( "*2\r\n$1\r\n0\r\n:7\r\n", scan ) && scan.first == "0" && scan.second == 7 );
+    refuseDecoding< pair<string, long long> >( "*3\r\n$1\r\n0\r\n:7\r\n:8\r\n" );
+
+    tuple<string, int, double> fields;
+    assert( decodeReply( "*3\r\n$4\r\nname\r\n:3\r\n$3\r\n0.5\r\n", fields ) );
+    assert( get<0>( fields ) == "name" && get<1>( fields ) == 3 && get<2>( fields ) == 0.5 );
+
+    User user;
+    assert( decodeReply( "*3\r\n$3\r\nann\r\n:30\r\n$-1\r\n", user ) );
+    assert( user.name == "ann" && user.age == 30 && user.email.nil );
+    refuseDecoding<User>( "*2\r\n$3\r\nann\r\n:30\r\n" );
+}
+
+static void checkView()
+{
+    redisReply *reply = readReply( "*3\r\n$3\r\nabc\r\n:5\r\n*1\r\n$-1\r\n" );
+    ReplyView view( *reply );
+    assert( view.isArray() && view.size() == 3 );
+    assert( view[0].isString() && view[0].str() == StringRef( "abc" ) );
+    assert( view[1].isInteger() && view[1].integer() == 5 && view[1].as<int>() == 5 );
+    assert( view[2][0].isNil() );
+
+    size_t count = 0;
+    for( ReplyView::iterator it = view.begin(); it != view.end(); ++it )
+        ++count;
+    assert( count == 3 && view.end() - view.begin() == 3 );
+
+    // wrong types give empty values or LogicError
+    assert( view.str().size() == 0 && view.integer() == 0 && view[0].size() == 0 );
+    bool thrown = false;
+    try
+    {
+        view[0].as<int>();
+    }
+    catch( const LogicError& )
+    {
+        thrown = true;
+    }
+    assert( thrown );
+    freeReplyObject( reply );
+}
+
+static void checkResp3()
+{
+#if HIREDIS_MAJOR >= 1
+    map<string, double> scores;
+    scores["x"] = 1.5;
+    scores["y"] = -2;
+    expect( "%2\r\n$1\r\nx\r\n,1.5\r\n+y\r\n:-2\r\n", scores );
+    expect<bool>( "#t\r\n", true );
+    expect<bool>( "#f\r\n", false );
+    expect<double>( ",-0.25\r\n", -0.25 );
+    expect<string>( "(123456789012345678901234567890\r\n", "123456789012345678901234567890" );
+    expect<string>( "=8\r\ntxt:text\r\n", "text" );
+    expect( "~2\r\n:1\r\n:2\r\n", vector<int>( { 1, 2 } ) );
+    expect( "_\r\n", Nullable<int>() );
+#endif
+}
+
+int main( int argc, const char * argv[] )
+{
+    checkScalars();
+    checkContainers();
+    checkView();
+    checkResp3();
+
+    cout << "reply decoder is ok" << endl;
+    return 0;
+}
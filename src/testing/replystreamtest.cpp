@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hirediscommand.h"
+#include "replystream.h"
+#include "fakenode.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Checks the visitor callbacks of ReplyStreamParser on fixed RESP2 and RESP3 replies
+// fed whole, byte by byte and in random pieces, and streamed synchronous commands
+// against an in-process cluster
+
+// writes callbacks as text, chunks of a bulk string are joined
+class TraceVisitor : public ReplyVisitor
+{
+public:
+    TraceVisitor() : chunks( 0 ) {}
+
+    virtual void onArray( size_t size ) { trace += "[" + to_string( size ) + " "; }
+    virtual void onArrayEnd() { trace += "] "; }
+    virtual void onBulkBegin( size_t size ) { trace += "$" + to_string( size ) + ":"; }
+    virtual void onBulkChunk( const StringRef &chunk ) { trace.append( chunk.data(), chunk.size() ); ++chunks; }
+    virtual void onBulkEnd() { trace += " "; }
+    virtual void onStatus( const StringRef &status ) { trace += "+" + string( status.data(), status.size() ) + " "; }
+    virtual void onError( const StringRef &error ) { trace += "-" + string( error.data(), error.size() ) + " "; }
+    virtual void onInteger( long long value ) { trace += ":" + to_string( value ) + " "; }
+    virtual void onNil() { trace += "nil "; }
+
+    string trace;
+    size_t chunks;
+};
+
+struct Case
+{
+    const char *resp;
+    const char *trace;
+};
+
+static const Case cases[] =
+{
+    { "+OK\r\n", "+OK " },
+    { ":-42\r\n", ":-42 " },
+    { ":-9223372036854775808\r\n", ":-9223372036854775808 " },
+    { "$5\r\nhello\r\n", "$5:hello " },
+    { "$0\r\n\r\n", "$0: " },
+    { "$-1\r\n", "nil " },
+    { "*-1\r\n", "nil " },
+    { "*0\r\n", "[0 ] " },
+    { "*3\r\n$3\r\nfoo\r\n$-1\r\n:7\r\n", "[3 $3:foo nil :7 ] " },
+    { "*2\r\n*2\r\n+a\r\n-ERR inner\r\n*0\r\n", "[2 [2 +a -ERR inner ] [0 ] ] " },
+    { "*1\r\n*1\r\n*1\r\n:1\r\n", "[1 [1 [1 :1 ] ] ] " },
+    // RESP3
+    { "%2\r\n+k1\r\n:1\r\n$2\r\nk2\r\n_\r\n", "[4 +k1 :1 $2:k2 nil ] " },
+    { "~2\r\n#t\r\n#f\r\n", "[2 :1 :0 ] " },
+    { ">2\r\n+message\r\n,3.14\r\n", "[2 +message +3.14 ] " },
+    { "(12345678901234567890\r\n", "+12345678901234567890 " },
+    { "=8\r\ntxt:text\r\n", "$4:text " },
+};
+
+// feeds the reply in pieces of random size, a few bytes of the next reply follow
+static string parse( const string &resp, size_t maxPiece, bool &error, string &errorText )
+{
+    string data = resp + "*1\r\n";
+    TraceVisitor visitor;
+    ReplyStreamParser parser( visitor );
+    size_t fed = 0;
+    while( !parser.done() )
+    {
+        assert( fed < resp.size() );
+        size_t piece = 1 + rand() % maxPiece;
+        piece = std::min( piece, data.size() - fed );
+        long consumed = parser.feed( data.data() + fed, piece );
+        assert( consumed >= 0 );
+        fed += consumed;
+        // bytes are left only after the end of the reply
+        assert( size_t( consumed ) == piece || parser.done() );
+    }
+    assert( fed == resp.size() );
+    error = parser.isError();
+    errorText = parser.error();
+    return visitor.trace;
+}
+
+static void checkParser()
+{
+    for( size_t i = 0; i < sizeof( cases ) / sizeof( cases[0] ); ++i )
+    {
+        string resp( cases[i].resp ), expected( cases[i].trace );
+        size_t pieces[] = { resp.size() + 4, 1, 3, 7 };
+        for( size_t k = 0; k < sizeof( pieces ) / sizeof( pieces[0] ); ++k )
+        {
+            bool error;
+            string errorText;
+            string trace = parse( resp, pieces[k], error, errorText );
+            if( trace != expected || error )
+            {
+                cerr << "reply " << resp << " gave trace '" << trace << "' instead of '" << expected << "'" << endl;
+                abort();
+            }
+        }
+    }
+
+    // bulk strings are binary safe
+    bool error;
+    string errorText;
+    string binary( "$6\r\na\r\nb\0c\r\n", 12 );
+    assert( parse( binary, 2, error, errorText ) == string( "$6:a\r\nb\0c ", 10 ) );
+
+    // top-level errors are kept for redirections and not passed to the visitor
+    assert( parse( "-MOVED 3999 127.0.0.1:7001\r\n", 3, error, errorText ).empty() );
+    assert( error && errorText == "MOVED 3999 127.0.0.1:7001" );
+
+    // protocol errors
+    const char *broken[] = { "?\r\n", ":12a\r\n", "$-2\r\n", "*x\r\n", "#x\r\n", ":1\n", "=3\r\ntxt\r\n" };
+    for( size_t i = 0; i < sizeof( broken ) / sizeof( broken[0] ); ++i )
+    {
+        TraceVisitor visitor;
+        ReplyStreamParser parser( visitor );
+        assert( parser.feed( broken[i], strlen( broken[i] ) ) == -1 );
+    }
+    TraceVisitor visitor;
+    ReplyStreamParser parser( visitor );
+    string longLine( 100 * 1024, '1' );
+    assert( parser.feed( ":", 1 ) == 1 );
+    assert( parser.feed( longLine.data(), longLine.size() ) == -1 );
+}
+
+// large bulk strings come from the socket in several chunks
+static void checkCommands()
+{
+    FakeRedisCluster fake( 3 );
+    Cluster<redisContext>::ptr_t cluster_p = HiredisCommand<>::createCluster( "127.0.0.1", fake.port( 0 ) );
+
+    string large( 300 * 1024, 'x' );
+    for( size_t i = 0; i < large.size(); i += 1000 )
+        large[i] = char( 'a' + i % 26 );
+    RespCommand cmd;
+    Reply reply = HiredisCommand<>::AltCommand( cluster_p, "{s}large", cmd.format( "SET", "{s}large", large ) );
+    assert( reply->type == REDIS_REPLY_STATUS );
+    reply = HiredisCommand<>::AltCommand( cluster_p, "{s}small", cmd.format( "SET", "{s}small", "v" ) );
+
+    TraceVisitor visitor;
+    HiredisCommand<>::Command( cluster_p, "{s}large", cmd.format( "GET", "{s}large" ), visitor );
+    assert( visitor.trace == "$" + to_string( large.size() ) + ":" + large + " " );
+    assert( visitor.chunks > 1 );
+
+    visitor = TraceVisitor();
+    HiredisCommand<>::Command( cluster_p, "{s}large", cmd.format( "MGET", "{s}small", "{s}missing", "{s}large" ), visitor );
+    assert( visitor.trace == "[3 $1:v nil $" + to_string( large.size() ) + ":" + large + " ] " );
+
+    // the MOVED reply is not seen by the visitor
+    unsigned slot = SlotHash::SlotByKey( "{s}", 3 );
+    fake.move( slot, ( slot * 3 / 16384 + 1 ) % 3 );
+    visitor = TraceVisitor();
+    HiredisCommand<>::Command( cluster_p, "{s}small", cmd.format( "GET", "{s}small" ), visitor );
+    assert( visitor.trace == "$1:v " );
+
+    delete cluster_p;
+}
+
+int main( int argc, const char * argv[] )
+{
+    srand( argc > 1 ? atoi( argv[1] ) : 1 );
+
+    checkParser();
+    checkCommands();
+
+    cout << "reply stream is ok" << endl;
+    return 0;
+}
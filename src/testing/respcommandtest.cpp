@@ -0,0 +1,155 @@
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "respcommand.h"
+
+extern "C"
+{
+#include <hiredis/hiredis.h>
+}
+
+using namespace RedisCluster;
+using namespace std;
+
+// Compares commands encoded by RespCommand and PreparedCommand with the encoding of
+// redisFormatCommandArgv for the same arguments given as strings
+
+static unsigned long checked = 0;
+
+static void expect( const RespCommand &cmd, const vector<string> &args )
+{
+    vector<const char*> argv;
+    vector<size_t> argvlen;
+    for( size_t i = 0; i < args.size(); ++i )
+    {
+        argv.push_back( args[i].data() );
+        argvlen.push_back( args[i].size() );
+    }
+
+    char *expected = nullptr;
+    long long len = redisFormatCommandArgv( &expected, (int)args.size(), argv.data(), argvlen.data() );
+    if( len < 0 || (size_t)len != cmd.size() || memcmp( expected, cmd.data(), cmd.size() ) != 0 )
+    {
+        cerr << "different encoding of:";
+        for( size_t i = 0; i < args.size(); ++i )
+            cerr << " '" << args[i] << "'";
+        cerr << endl << "expected: " << string( expected, len > 0 ? len : 0 ) << endl
+             << "encoded:  " << string( cmd.data(), cmd.size() ) << endl;
+        abort();
+    }
+    redisFreeCommand( expected );
+    ++checked;
+}
+
+static string randomString()
+{
+    string s;
+    size_t len = rand() % 4 == 0 ? 0 : rand() % ( rand() % 10 == 0 ? 70000 : 40 );
+    for( size_t i = 0; i < len; ++i )
+        s += static_cast<char>( rand() % 256 );
+    return s;
+}
+
+static long long randomInteger()
+{
+    switch( rand() % 4 )
+    {
+        case 0:
+            return rand() % 20 - 10;
+        case 1:
+            return (long long)rand() * rand() * ( rand() % 2 ? 1 : -1 );
+        case 2:
+            return rand() % 2 ? LLONG_MAX : LLONG_MIN;
+        default:
+            return (long long)rand() << ( rand() % 32 );
+    }
+}
+
+static void checkIntegers()
+{
+    RespCommand cmd;
+    expect( cmd.format( "I", 0, -1, 1 ), { "I", "0", "-1", "1" } );
+    expect( cmd.format( "I", (short)SHRT_MIN, (unsigned short)USHRT_MAX, INT_MIN, INT_MAX ),
+           { "I", to_string( SHRT_MIN ), to_string( USHRT_MAX ), to_string( INT_MIN ), to_string( INT_MAX ) } );
+    expect( cmd.format( "I", LLONG_MIN, LLONG_MAX, ULLONG_MAX, (size_t)0 ),
+           { "I", to_string( LLONG_MIN ), to_string( LLONG_MAX ), to_string( ULLONG_MAX ), "0" } );
+    expect( cmd.format( "I", (int16_t)-128, (uint16_t)255, (int32_t)-7, 10u, 100ul, 1000ll ),
+           { "I", "-128", "255", "-7", "10", "100", "1000" } );
+    // powers of ten are where the length of the decimal changes
+    unsigned long long power = 1;
+    for( int i = 0; i < 20; ++i, power *= 10 )
+    {
+        expect( cmd.format( power - 1, power, power + 1 ),
+               { to_string( power - 1 ), to_string( power ), to_string( power + 1 ) } );
+        long long negative = -(long long)( power > (unsigned long long)LLONG_MAX ? 1 : power );
+        expect( cmd.format( negative ), { to_string( negative ) } );
+    }
+}
+
+static void checkStrings()
+{
+    RespCommand cmd;
+    string binary( "a\0b\r\nc", 6 );
+    expect( cmd.format( "SET", binary, "" ), { "SET", binary, "" } );
+    expect( cmd.format( StringRef( "GET" ), StringRef( binary.data(), 3 ) ), { "GET", string( "a\0b", 3 ) } );
+    // the buffer grows and is reused by smaller commands
+    string large( 1 << 20, 'x' );
+    expect( cmd.format( "SET", "key", large ), { "SET", "key", large } );
+    expect( cmd.format( "PING" ), { "PING" } );
+}
+
+static void checkPrepared()
+{
+    PreparedCommand hset( "HSET" );
+    expect( hset.format( "key", "field", 5 ), { "HSET", "key", "field", "5" } );
+    expect( hset.format( "k", "f", string( 5000, 'v' ) ), { "HSET", "k", "f", string( 5000, 'v' ) } );
+
+    PreparedCommand setex( "SET", "ignored", "EX", 60 );
+    expect( setex.format(), { "SET", "ignored", "EX", "60" } );
+    expect( setex.format( -1, "NX" ), { "SET", "ignored", "EX", "60", "-1", "NX" } );
+}
+
+static void checkRandom( int iterations )
+{
+    RespCommand cmd;
+    PreparedCommand prepared( "ZADD", "NX" );
+    for( int i = 0; i < iterations; ++i )
+    {
+        string key = randomString(), value = randomString();
+        long long number = randomInteger();
+
+        expect( cmd.format( "SET", key, value, "PX", number ), { "SET", key, value, "PX", to_string( number ) } );
+        expect( prepared.format( key, number, value ), { "ZADD", "NX", key, to_string( number ), value } );
+
+        vector<string> args( 1 + rand() % 20 );
+        vector<const char*> argv;
+        vector<size_t> argvlen;
+        for( size_t j = 0; j < args.size(); ++j )
+        {
+            args[j] = randomString();
+            argv.push_back( args[j].data() );
+            argvlen.push_back( args[j].size() );
+        }
+        expect( cmd.formatArgv( (int)args.size(), argv.data(), argvlen.data() ), args );
+    }
+}
+
+int main( int argc, const char * argv[] )
+{
+    unsigned seed = argc > 1 ? atoi( argv[1] ) : 1;
+    int iterations = argc > 2 ? atoi( argv[2] ) : 2000;
+    srand( seed );
+
+    checkIntegers();
+    checkStrings();
+    checkPrepared();
+    checkRandom( iterations );
+
+    cout << checked << " commands encoded as by hiredis" << endl;
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+
+#include "respparser.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Compares replies of RespParser with the replies of the hiredis reader on random
+// (and randomly damaged) RESP data fed in random pieces
+
+static string randomLine()
+{
+    static const char chars[] = "abcXYZ019 -+:$*\r\n";
+    string line;
+    int len = rand() % 8;
+    for( int i = 0; i < len; ++i )
+        line += chars[rand() % ( sizeof( chars ) - 1 )];
+    return line;
+}
+
+static string randomReply( int depth )
+{
+    int kinds = depth > 0 ? 7 : 5;
+#if HIREDIS_MAJOR >= 1
+    kinds += 6;
+#endif
+    switch( rand() % kinds )
+    {
+        case 0:
+        {
+            string value = randomLine();
+            if( rand() % 10 == 0 )
+                value = string( rand() % 40000, 'v' );
+            return "$" + to_string( value.size() ) + "\r\n" + value + "\r\n";
+        }
+        case 1:
+            return "+" + randomLine() + "\r\n";
+        case 2:
+            return "-ERR " + randomLine() + "\r\n";
+        case 3:
+            return ":" + to_string( (long long)rand() * ( rand() % 2 ? 1 : -1 ) ) + "\r\n";
+        case 4:
+            return rand() % 2 ? "$-1\r\n" : "*-1\r\n";
+#if HIREDIS_MAJOR >= 1
+        case 5:
+            return "_\r\n";
+        case 6:
+        {
+            static const char *doubles[] = { "1.5", "-0.25", "inf", "-inf", "nan", "1e10", "3" };
+            return string( "," ) + doubles[rand() % 7] + "\r\n";
+        }
+        case 7:
+            return rand() % 2 ? "#t\r\n" : "#f\r\n";
+        case 8:
+            return "(" + to_string( rand() ) + to_string( rand() ) + "\r\n";
+        case 9:
+        {
+            string value = "txt:" + randomLine();
+            return "=" + to_string( value.size() ) + "\r\n" + value + "\r\n";
+        }
+        case 10:
+            return "$0\r\n\r\n";
+#endif
+        default:
+        {
+            static const char *types = "*%~>|";
+            char type = types[0];
+#if HIREDIS_MAJOR >= 1
+            type = types[rand() % 5];
+#endif
+            int count = rand() % ( depth > 3 ? 3 : 12 );
+            string reply = type + to_string( count ) + "\r\n";
+            for( int i = 0; i < count * ( type == '%' || type == '|' ? 2 : 1 ); ++i )
+                reply += randomReply( depth - 1 );
+            return reply;
+        }
+    }
+}
+
+static void damage( string &data )
+{
+    if( data.empty() )
+        return;
+    size_t pos = rand() % data.size();
+    switch( rand() % 3 )
+    {
+        case 0:
+            data[pos] = randomLine().c_str()[0];
+            break;
+        case 1:
+            data.erase( pos, 1 );
+            break;
+        default:
+            data.insert( pos, 1, "\r\n0-$*"[rand() % 6] );
+    }
+}
+
+static bool equal( const redisReply *a, const redisReply *b )
+{
+    if( a->type != b->type )
+        return false;
+    switch( a->type )
+    {
+        case REDIS_REPLY_INTEGER:
+#ifdef REDIS_REPLY_BOOL
+        case REDIS_REPLY_BOOL:
+#endif
+            return a->integer == b->integer;
+        case REDIS_REPLY_NIL:
+            return true;
+        case REDIS_REPLY_ARRAY:
+#ifdef REDIS_REPLY_MAP
+        case REDIS_REPLY_MAP:
+        case REDIS_REPLY_SET:
+        case REDIS_REPLY_PUSH:
+#endif
+#ifdef REDIS_REPLY_ATTR
+        case REDIS_REPLY_ATTR:
+#endif
+            if( a->elements != b->elements )
+                return false;
+            for( size_t i = 0; i < a->elements; ++i )
+            {
+                if( !equal( a->element[i], b->element[i] ) )
+                    return false;
+            }
+            return true;
+        default:
+#ifdef REDIS_REPLY_DOUBLE
+            if( a->type == REDIS_REPLY_DOUBLE && !( a->dval == b->dval || ( isnan( a->dval ) && isnan( b->dval ) ) ) )
+                return false;
+            if( a->type == REDIS_REPLY_VERB && strcmp( a->vtype, b->vtype ) != 0 )
+                return false;
+#endif
+            return a->len == b->len && memcmp( a->str, b->str, a->len ) == 0 && a->str[a->len] == '\0';
+    }
+}
+
+// 0 - no reply, 1 - reply, -1 - protocol error
+static int compare( const string &data, unsigned long &replies )
+{
+    redisReader *reader = redisReaderCreate();
+    RespParser parser;
+    ReplyArena arena;
+
+    void *hiredisReply = nullptr;
+    int hiredisResult = 0;
+    long used = 0;
+    size_t fed = 0;
+    while( fed < data.size() )
+    {
+        size_t piece = 1 + rand() % ( rand() % 2 ? 8 : 20000 );
+        piece = min( piece, data.size() - fed );
+        redisReaderFeed( reader, data.data() + fed, piece );
+        fed += piece;
+
+        if( hiredisResult == 0 )
+        {
+            if( redisReaderGetReply( reader, &hiredisReply ) != REDIS_OK )
+                hiredisResult = -1;
+            else if( hiredisReply != nullptr )
+                hiredisResult = 1;
+        }
+        if( used == 0 )
+            used = parser.scan( data.data(), fed );
+    }
+
+    int result = used < 0 ? -1 : ( used > 0 ? 1 : 0 );
+    if( result != hiredisResult )
+    {
+        cerr << "hiredis result " << hiredisResult << " (" << reader->errstr << "), parser result "
+             << result << " (" << ( parser.error() ? parser.error() : "" ) << ") on:" << endl << data << endl;
+        abort();
+    }
+    if( result == 1 )
+    {
+        redisReply *reply = parser.build( data.data(), data.size(), arena );
+        if( !equal( static_cast<redisReply*>( hiredisReply ), reply ) ||
+            reader->len - reader->pos != data.size() - used )
+        {
+            cerr << "different replies on:" << endl << data << endl;
+            abort();
+        }
+        ++replies;
+    }
+
+    if( hiredisReply != nullptr )
+        freeReplyObject( hiredisReply );
+    redisReaderFree( reader );
+    return result;
+}
+
+int main( int argc, const char * argv[] )
+{
+    unsigned seed = argc > 1 ? atoi( argv[1] ) : 1;
+    int iterations = argc > 2 ? atoi( argv[2] ) : 100000;
+    srand( seed );
+
+    unsigned long replies = 0, errors = 0;
+    for( int i = 0; i < iterations; ++i )
+    {
+        string data = randomReply( 5 );
+        if( rand() % 3 == 0 )
+            damage( data );
+        if( rand() % 4 == 0 )
+            data += randomReply( 1 );
+        if( compare( data, replies ) < 0 )
+            ++errors;
+    }
+
+    cout << iterations << " inputs, " << replies << " equal replies, " << errors << " equal protocol errors" << endl;
+    return 0;
+}
@@ -7,6 +7,7 @@
 
 #include "hirediscommand.h"
 #include "asynchirediscommand.h"
+#include "poolcontainer.h"
 
 using namespace RedisCluster;
 using namespace std;
@@ -166,6 +167,74 @@ void runAskingTest()
     delete cluster_p;
 }
 
+// a command timed out by its deadline breaks its connection, the next command
+// on the node must get a new one instead of the timeout error
+void runTimeoutTest()
+{
+    Cluster<redisContext>::ptr_t cluster_p;
+    cluster_p = HiredisCommand<>::createCluster( "127.0.0.1", 7000 );
+    
+    bool timedOut = false;
+    try
+    {
+        HiredisCommand<>::AltCommand( cluster_p, "FOO", Deadline( std::chrono::milliseconds( 50 ) ), "BLPOP %s 1", "FOO" );
+    }
+    catch( const TimeoutException & )
+    {
+        timedOut = true;
+    }
+    assert( timedOut );
+    
+    Reply reply = HiredisCommand<>::AltCommand( cluster_p, "FOO", "SET %s %s", "FOO", "test" );
+    assert( REDIS_REPLY_STATUS == reply->type );
+    assert( string("OK") == reply->str );
+    
+    delete cluster_p;
+}
+
+// threads share a pool smaller than their number, every command must still get
+// its connection and the reply to its own key
+void runPoolContentionTest()
+{
+    typedef Cluster<redisContext, PoolContainer<redisContext> > PoolCluster;
+    PoolCluster::ptr_t cluster_p;
+    cluster_p = HiredisCommand<PoolCluster>::createCluster( "127.0.0.1", 7000 );
+    
+    PoolContainer<redisContext>::Options options;
+    options.maxConnections = 2;
+    options.acquireTimeout = std::chrono::milliseconds( 10000 );
+    cluster_p->container().configure( options );
+    
+    vector<thread> threads;
+    for( int i = 0; i < 16; ++i )
+    {
+        threads.push_back( thread( [cluster_p, i]
+        {
+            for( int k = 0; k < 200; ++k )
+            {
+                string key = "pool" + std::to_string( i ) + ":" + std::to_string( k % 20 );
+                string value = std::to_string( k );
+                
+                Reply reply = HiredisCommand<PoolCluster>::AltCommand( cluster_p, key, "SET %s %s", key.c_str(), value.c_str() );
+                assert( REDIS_REPLY_STATUS == reply->type );
+                
+                reply = HiredisCommand<PoolCluster>::AltCommand( cluster_p, key, "GET %s", key.c_str() );
+                assert( REDIS_REPLY_STRING == reply->type );
+                assert( value == reply->str );
+            }
+        } ) );
+    }
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+    
+    PoolContainer<redisContext>::Stats stats = cluster_p->container().stats();
+    assert( stats.inUse == 0 );
+    assert( stats.timeouts == 0 );
+    assert( stats.waits > 0 );
+    
+    delete cluster_p;
+}
+
 int main(int argc, const char * argv[])
 {
     try
@@ -173,6 +242,8 @@ int main(int argc, const char * argv[])
 //        fillClusterSLot( );
 //        processClusterKeysSubset();
         runAskingTest();
+        runTimeoutTest();
+        runPoolContentionTest();
 //        runAsyncAskingTest();
     } catch ( const RedisCluster::ClusterException &e )
     {
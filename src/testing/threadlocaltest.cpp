@@ -0,0 +1,241 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "threadlocalcontainer.h"
+#include "fakeconnection.h"
+
+using namespace RedisCluster;
+using namespace std;
+
+// Stress test of per-thread connection caches of ThreadLocalContainer with fake
+// connections: threads get connections to random slots while other threads disconnect
+// the cluster, connections are limited, threads exit and the cluster is destroyed
+
+typedef Cluster<FakeConnection, ThreadLocalContainer<FakeConnection> > ThreadedCluster;
+
+static const int nodes = 3;
+static const int firstPort = 7000;
+
+static ThreadedCluster* createCluster()
+{
+    redisReply *reply = clusterSlotsReply( nodes, firstPort );
+    ThreadedCluster *cluster = new ThreadedCluster( reply, fakeConnect, fakeDisconnect, nullptr );
+    freeReplyObject( reply );
+    return cluster;
+}
+
+static void checkThreadAffinity()
+{
+    ThreadedCluster *cluster = createCluster();
+    // the initializing thread has connections to all nodes
+    assert( cluster->container().connections() == nodes );
+
+    FakeConnection *mine = cluster->getConnection( ThreadedCluster::SlotIndex( 0 ) ).second;
+    assert( cluster->getConnection( ThreadedCluster::SlotIndex( 100 ) ).second == mine );
+    assert( cluster->getConnection( ThreadedCluster::SlotIndex( 16383 ) ).second != mine );
+
+    FakeConnection *other = nullptr;
+    thread worker( [&]
+    {
+        other = cluster->getConnection( ThreadedCluster::SlotIndex( 0 ) ).second;
+        assert( cluster->getConnection( ThreadedCluster::SlotIndex( 0 ) ).second == other );
+        assert( cluster->container().connections() == nodes + 1 );
+    } );
+    worker.join();
+    assert( other != mine );
+    // connections are closed when their thread exits
+    assert( cluster->container().connections() == nodes );
+
+    // redirections are cached per thread too
+    ThreadedCluster::HostConnection redirect = cluster->createNewConnection( "127.0.0.1", "7001" );
+    assert( redirect.second->port == 7001 );
+    cluster->releaseConnection( redirect );
+    assert( cluster->createNewConnection( "127.0.0.1", "7001" ).second == redirect.second );
+
+    // disconnect makes the thread replace its connections, the addresses may be reused
+    // by the allocator, so ports and counters are checked
+    int opened = openedConnections;
+    cluster->disconnect();
+    useConnection( cluster->getConnection( ThreadedCluster::SlotIndex( 0 ) ).second, firstPort );
+    useConnection( cluster->createNewConnection( "127.0.0.1", "7001" ).second, 7001 );
+    assert( openedConnections == opened + 2 );
+    assert( cluster->container().connections() == nodes + 1 );
+
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+// workers use connections to random slots while the cluster is disconnected
+static void checkDisconnectStorm( int workers, int disconnects )
+{
+    ThreadedCluster *cluster = createCluster();
+    atomic<bool> stop( false );
+    atomic<long> commands( 0 );
+
+    vector<thread> threads;
+    for( int i = 0; i < workers; ++i )
+    {
+        threads.push_back( thread( [&, i]
+        {
+            unsigned seed = i;
+            while( !stop )
+            {
+                ThreadedCluster::SlotIndex slot = rand_r( &seed ) % 16384;
+                ThreadedCluster::SlotConnection con = cluster->getConnection( slot );
+                useConnection( con.second, slotPort( slot, nodes, firstPort ) );
+                cluster->releaseConnection( con );
+
+                if( rand_r( &seed ) % 50 == 0 )
+                {
+                    ThreadedCluster::HostConnection redirect = cluster->createNewConnection( "127.0.0.1", "7002" );
+                    useConnection( redirect.second, 7002 );
+                    cluster->releaseConnection( redirect );
+                }
+                ++commands;
+            }
+        } ) );
+    }
+
+    for( int i = 0; i < disconnects; ++i )
+    {
+        this_thread::sleep_for( chrono::microseconds( 500 ) );
+        cluster->disconnect();
+    }
+    stop = true;
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+
+    // only connections of this thread are left
+    assert( cluster->container().connections() <= nodes + 1 );
+    assert( liveConnections == int( cluster->container().connections() ) );
+    delete cluster;
+    assert( liveConnections == 0 );
+    cout << commands << " commands with " << disconnects << " disconnects" << endl;
+}
+
+static void checkConnectionLimit( int workers )
+{
+    ThreadedCluster *cluster = createCluster();
+    size_t limit = nodes + workers / 2;
+    cluster->container().setMaxConnections( limit );
+    maxLiveConnections = 0;
+
+    atomic<int> limited( 0 ), tried( 0 );
+    mutex lock;
+    condition_variable cv;
+    bool done = false;
+
+    vector<thread> threads;
+    for( int i = 0; i < workers; ++i )
+    {
+        threads.push_back( thread( [&]
+        {
+            try
+            {
+                useConnection( cluster->getConnection( ThreadedCluster::SlotIndex( 0 ) ).second, firstPort );
+            }
+            catch( const ConnectionLimitException& )
+            {
+                ++limited;
+            }
+            ++tried;
+            // threads keep their connections until all of them tried
+            unique_lock<mutex> locker( lock );
+            cv.wait( locker, [&] { return done; } );
+        } ) );
+    }
+
+    while( tried < workers )
+        this_thread::yield();
+    {
+        lock_guard<mutex> locker( lock );
+        done = true;
+    }
+    cv.notify_all();
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+
+    assert( limited == workers - int( limit - nodes ) );
+    assert( maxLiveConnections <= int( limit ) );
+    // connections of exited threads don't count
+    useConnection( cluster->createNewConnection( "127.0.0.1", "7001" ).second, 7001 );
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+// the cluster is destroyed before threads that used it exit
+static void checkDestroyBeforeExit( int workers )
+{
+    ThreadedCluster *cluster = createCluster();
+    mutex lock;
+    condition_variable cv;
+    int ready = 0;
+    bool destroyed = false;
+
+    vector<thread> threads;
+    for( int i = 0; i < workers; ++i )
+    {
+        threads.push_back( thread( [&]
+        {
+            useConnection( cluster->getConnection( ThreadedCluster::SlotIndex( 16000 ) ).second, firstPort + nodes - 1 );
+            unique_lock<mutex> locker( lock );
+            ++ready;
+            cv.notify_all();
+            cv.wait( locker, [&] { return destroyed; } );
+        } ) );
+    }
+    {
+        unique_lock<mutex> locker( lock );
+        cv.wait( locker, [&] { return ready == workers; } );
+        delete cluster;
+        assert( liveConnections == 0 );
+        destroyed = true;
+    }
+    cv.notify_all();
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+
+    // the thread drops the cache of the destroyed container when it uses a new one
+    cluster = createCluster();
+    useConnection( cluster->getConnection( ThreadedCluster::SlotIndex( 0 ) ).second, firstPort );
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+static void checkFailedConnect()
+{
+    ThreadedCluster *cluster = createCluster();
+    size_t connections = cluster->container().connections();
+    try
+    {
+        cluster->createNewConnection( "127.0.0.1", to_string( fakeFailingPort ) );
+        assert( false );
+    }
+    catch( const ConnectionFailedException& )
+    {
+    }
+    assert( cluster->container().connections() == connections );
+    delete cluster;
+    assert( liveConnections == 0 );
+}
+
+int main( int argc, const char * argv[] )
+{
+    int workers = argc > 1 ? atoi( argv[1] ) : 8;
+    int disconnects = argc > 2 ? atoi( argv[2] ) : 200;
+
+    checkThreadAffinity();
+    checkDisconnectStorm( workers, disconnects );
+    checkConnectionLimit( workers );
+    checkDestroyBeforeExit( workers );
+    checkFailedConnect();
+
+    cout << "thread local container is ok" << endl;
+    return 0;
+}